@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <benchmark.h>
+
+void benchmark_report_init(struct benchmark_report *report, const char *name) {
+    report->name = name;
+    report->n_metrics = 0;
+}
+
+int benchmark_report_add(
+    struct benchmark_report *report,
+    const char *name,
+    const char *unit,
+    double value,
+    bool higher_is_better
+) {
+    if (report->n_metrics >= BENCHMARK_MAX_METRICS) {
+        return ENOSPC;
+    }
+
+    report->metrics[report->n_metrics++] = (struct benchmark_metric) {
+        .name = name,
+        .unit = unit,
+        .value = value,
+        .higher_is_better = higher_is_better,
+        .n_samples = 1,
+        .min = value,
+        .max = value,
+        .mean = value,
+        .stddev = 0.0,
+    };
+
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+int benchmark_report_add_samples(
+    struct benchmark_report *report,
+    const char *name,
+    const char *unit,
+    double *samples,
+    int n_samples,
+    bool higher_is_better
+) {
+    struct benchmark_metric *metric;
+    double sum, variance;
+    int ok;
+
+    if (n_samples <= 0) {
+        return EINVAL;
+    }
+
+    qsort(samples, n_samples, sizeof *samples, compare_doubles);
+
+    ok = benchmark_report_add(
+        report,
+        name,
+        unit,
+        n_samples % 2 ? samples[n_samples / 2] : (samples[n_samples / 2 - 1] + samples[n_samples / 2]) / 2.0,
+        higher_is_better
+    );
+    if (ok != 0) {
+        return ok;
+    }
+
+    sum = 0.0;
+    for (int i = 0; i < n_samples; i++) {
+        sum += samples[i];
+    }
+
+    metric = report->metrics + report->n_metrics - 1;
+    metric->n_samples = n_samples;
+    metric->min = samples[0];
+    metric->max = samples[n_samples - 1];
+    metric->mean = sum / n_samples;
+
+    variance = 0.0;
+    for (int i = 0; i < n_samples; i++) {
+        variance += (samples[i] - metric->mean) * (samples[i] - metric->mean);
+    }
+    metric->stddev = n_samples > 1 ? sqrt(variance / (n_samples - 1)) : 0.0;
+
+    return 0;
+}
+
+/// JSON has no NaN / infinity.
+static double json_number(double value) {
+    return isfinite(value) ? value : 0.0;
+}
+
+void benchmark_report_write_json(const struct benchmark_report *report, FILE *file) {
+    const struct benchmark_metric *metric;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"benchmark\": \"%s\",\n", report->name);
+    fprintf(file, "  \"metrics\": {\n");
+
+    for (int i = 0; i < report->n_metrics; i++) {
+        metric = report->metrics + i;
+
+        // always in the same order, and "value" first, so find_metric_value can read it back.
+        fprintf(
+            file,
+            "    \"%s\": { \"value\": %.6g, \"unit\": \"%s\", \"higher_is_better\": %s",
+            metric->name,
+            json_number(metric->value),
+            metric->unit,
+            metric->higher_is_better ? "true" : "false"
+        );
+        if (metric->n_samples > 1) {
+            fprintf(
+                file,
+                ", \"samples\": %d, \"min\": %.6g, \"max\": %.6g, \"mean\": %.6g, \"stddev\": %.6g",
+                metric->n_samples,
+                json_number(metric->min),
+                json_number(metric->max),
+                json_number(metric->mean),
+                json_number(metric->stddev)
+            );
+        }
+        fprintf(file, " }%s\n", i + 1 < report->n_metrics ? "," : "");
+    }
+
+    fprintf(file, "  }\n");
+    fprintf(file, "}\n");
+}
+
+int benchmark_report_save(const struct benchmark_report *report, const char *path) {
+    FILE *file;
+    int ok;
+
+    if (strcmp(path, "-") == 0) {
+        benchmark_report_write_json(report, stdout);
+        fflush(stdout);
+        return 0;
+    }
+
+    file = fopen(path, "w");
+    if (file == NULL) {
+        ok = errno;
+        fprintf(stderr, "[benchmark] Couldn't open \"%s\" for writing. fopen: %s\n", path, strerror(ok));
+        return ok;
+    }
+
+    benchmark_report_write_json(report, file);
+
+    if (fclose(file) != 0) {
+        ok = errno;
+        fprintf(stderr, "[benchmark] Couldn't write \"%s\". fclose: %s\n", path, strerror(ok));
+        return ok;
+    }
+
+    return 0;
+}
+
+static char *read_file(const char *path) {
+    FILE *file;
+    char *buffer;
+    long size;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        goto fail_close_file;
+    }
+
+    buffer = malloc(size + 1);
+    if (buffer == NULL) {
+        goto fail_close_file;
+    }
+
+    if (fread(buffer, 1, size, file) != (size_t) size) {
+        goto fail_free_buffer;
+    }
+
+    buffer[size] = '\0';
+    fclose(file);
+    return buffer;
+
+
+    fail_free_buffer:
+    free(buffer);
+
+    fail_close_file:
+    fclose(file);
+    return NULL;
+}
+
+/**
+ * @brief Find the value of metric @a name in the JSON written by @ref benchmark_report_write_json.
+ *
+ * This is not a JSON parser, it only understands the (fixed) layout we write ourselves.
+ */
+static bool find_metric_value(const char *json, const char *name, double *value_out) {
+    const char *cursor;
+    char *end;
+    char key[128];
+    double value;
+
+    cursor = strstr(json, "\"metrics\"");
+    if (cursor == NULL) {
+        return false;
+    }
+
+    snprintf(key, sizeof key, "\"%s\"", name);
+
+    cursor = strstr(cursor, key);
+    if (cursor == NULL) {
+        return false;
+    }
+
+    cursor = strstr(cursor + strlen(key), "\"value\"");
+    if (cursor == NULL) {
+        return false;
+    }
+
+    cursor = strchr(cursor, ':');
+    if (cursor == NULL) {
+        return false;
+    }
+
+    value = strtod(cursor + 1, &end);
+    if (end == cursor + 1) {
+        return false;
+    }
+
+    *value_out = value;
+    return true;
+}
+
+int benchmark_report_compare(
+    const struct benchmark_report *report,
+    const char *baseline_path,
+    double tolerance,
+    FILE *file,
+    int *n_regressions_out
+) {
+    const struct benchmark_metric *metric;
+    double baseline, change;
+    bool regressed;
+    char *json;
+    int n_regressions;
+
+    json = read_file(baseline_path);
+    if (json == NULL) {
+        fprintf(stderr, "[benchmark] Couldn't read baseline \"%s\".\n", baseline_path);
+        return EIO;
+    }
+
+    fprintf(file, "%s, compared to baseline %s:\n", report->name, baseline_path);
+
+    n_regressions = 0;
+    for (int i = 0; i < report->n_metrics; i++) {
+        metric = report->metrics + i;
+
+        if (!find_metric_value(json, metric->name, &baseline)) {
+            fprintf(file, "  %-24s %12.3f %-6s  (not in baseline)\n", metric->name, metric->value, metric->unit);
+            continue;
+        }
+
+        change = baseline != 0.0 ? (metric->value - baseline) / baseline : 0.0;
+        regressed = metric->higher_is_better ? change < -tolerance : change > tolerance;
+        if (regressed) {
+            n_regressions++;
+        }
+
+        fprintf(
+            file,
+            "  %-24s %12.3f %-6s  baseline %12.3f  %+7.1f%%%s\n",
+            metric->name,
+            metric->value,
+            metric->unit,
+            baseline,
+            change * 100.0,
+            regressed ? "  REGRESSION" : ""
+        );
+    }
+
+    free(json);
+
+    *n_regressions_out = n_regressions;
+    return 0;
+}
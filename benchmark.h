@@ -0,0 +1,103 @@
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define BENCHMARK_MAX_METRICS 16
+
+/**
+ * @brief The results of one benchmark run, as a list of named metrics.
+ *
+ * Reports are written as JSON so CI can archive them, and can be compared
+ * against a report from an earlier run (the baseline) to catch regressions.
+ */
+struct benchmark_metric {
+    const char *name;
+    const char *unit;
+    double value;
+
+    /// Whether bigger values are better (frames per second) or worse (milliseconds per frame).
+    bool higher_is_better;
+
+    /// For metrics added with @ref benchmark_report_add_samples, the number of samples
+    /// and their spread. @ref value is the median then. 1 for metrics measured once.
+    int n_samples;
+    double min, max, mean, stddev;
+};
+
+struct benchmark_report {
+    const char *name;
+
+    int n_metrics;
+    struct benchmark_metric metrics[BENCHMARK_MAX_METRICS];
+};
+
+void benchmark_report_init(
+    struct benchmark_report *report,
+    const char *name
+);
+
+/**
+ * @brief Add a metric to the report. @a name and @a unit need to stay valid
+ * as long as the report is used.
+ *
+ * @returns ENOSPC if the report already has BENCHMARK_MAX_METRICS metrics.
+ */
+int benchmark_report_add(
+    struct benchmark_report *report,
+    const char *name,
+    const char *unit,
+    double value,
+    bool higher_is_better
+);
+
+/**
+ * @brief Add a metric that was measured @a n_samples times, e.g. by repeating a
+ * microbenchmark. The median is its value, so single outliers (a context switch,
+ * a page fault) don't move it; min, max, mean and standard deviation are written
+ * to the JSON as well, to see how noisy it was.
+ *
+ * @a samples is reordered.
+ */
+int benchmark_report_add_samples(
+    struct benchmark_report *report,
+    const char *name,
+    const char *unit,
+    double *samples,
+    int n_samples,
+    bool higher_is_better
+);
+
+void benchmark_report_write_json(
+    const struct benchmark_report *report,
+    FILE *file
+);
+
+/**
+ * @brief Write the report as JSON to the file at @a path, or to stdout if @a path is "-".
+ */
+int benchmark_report_save(
+    const struct benchmark_report *report,
+    const char *path
+);
+
+/**
+ * @brief Compare the report against a baseline report written by @ref benchmark_report_save
+ * and print the difference of each metric to @a file.
+ *
+ * A metric regressed if it's worse than the baseline by more than @a tolerance
+ * (relative, so 0.1 is 10%). Metrics that are not in the baseline are skipped.
+ *
+ * @returns 0 if the baseline could be read, the number of regressed metrics is
+ * written to @a n_regressions_out.
+ */
+int benchmark_report_compare(
+    const struct benchmark_report *report,
+    const char *baseline_path,
+    double tolerance,
+    FILE *file,
+    int *n_regressions_out
+);
+
+#endif
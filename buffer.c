@@ -35,16 +35,165 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <time.h>
 
 #include "kms-quads.h"
+#include "fill.h"
+#include "shadowfb.h"
+#include "softcube.h"
+#include "timespec-util.h"
+#include "workpool.h"
 
 /*
- * Using the CPU mapping, fill the buffer with a simple pixel-by-pixel
- * checkerboard; the boundaries advance from top-left to bottom-right.
+ * Dumb buffers are filled in bands of rows this big (in bytes). Small enough
+ * that there are plenty of bands for the worker threads to balance between
+ * them, big enough that the per-band overhead doesn't matter.
+ */
+#define FILL_BAND_BYTES (256 * 1024)
+
+/* Tiles of the software cube handed to a worker thread at once. */
+#define CUBE_CHUNK_TILES 4
+
+static const struct fill_kernels *fill_kernels = NULL;
+
+/*
+ * Whether to draw the cube in software instead of the checkerboard;
+ * KMS_QUADS_SCENE=cube.
+ */
+static bool draw_cube = false;
+
+/* Worker thread callback, filling rows [begin, end) of a dumb buffer. */
+static void buffer_fill_band(void *userdata, unsigned int begin,
+			     unsigned int end)
+{
+	struct buffer *buffer = userdata;
+
+	if (buffer->dumb.from_shadow) {
+		shadowfb_fill_rows(buffer->output->shadow, fill_kernels,
+				   buffer->dumb.mem, buffer->pitches[0],
+				   begin, end);
+		return;
+	}
+
+	fill_checkerboard_rows(fill_kernels, buffer->dumb.mem,
+			       buffer->pitches[0], buffer->width, begin, end,
+			       buffer->dumb.split_x, buffer->dumb.split_y);
+}
+
+/* Worker thread callback, rendering tiles [begin, end) of the cube. */
+static void buffer_fill_cube_tiles(void *userdata, unsigned int begin,
+				   unsigned int end)
+{
+	struct buffer *buffer = userdata;
+
+	softcube_render_tiles(buffer->output->softcube, fill_kernels,
+			      buffer->dumb.mem, buffer->pitches[0],
+			      begin, end);
+}
+
+/*
+ * Draw the same spinning cube as the Vulkan renderer, using the CPU
+ * rasterizer in softcube.c. The whole buffer gets written every frame, so
+ * this doesn't go through the shadow framebuffer.
+ */
+static void buffer_fill_cube(struct buffer *buffer)
+{
+	struct output *output = buffer->output;
+	struct workpool *workpool = output->device->workpool;
+	struct softcube_shading shading = SOFTCUBE_SHADING_DEFAULT;
+	struct timespec now;
+	unsigned int n_tiles;
+	int err;
+
+	if (!output->softcube) {
+		err = softcube_new(&output->softcube, buffer->width,
+				   buffer->height, &shading);
+		if (err != 0) {
+			fprintf(stderr, "[%s] couldn't create software cube: %s\n",
+				output->name, strerror(err));
+			output->softcube = NULL;
+			return;
+		}
+	}
+
+	/*
+	 * Animate for the time the frame is predicted to be displayed, like
+	 * the checkerboard does, so it stays smooth when frames are dropped.
+	 */
+	now = output->next_frame;
+	if (timespec_to_nsec(&now) == 0)
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+	softcube_begin_frame(output->softcube, timespec_to_msec(&now));
+
+	n_tiles = softcube_get_n_tiles(output->softcube);
+	if (!workpool) {
+		buffer_fill_cube_tiles(buffer, 0, n_tiles);
+		return;
+	}
+
+	workpool_submit(workpool, buffer_fill_cube_tiles, buffer, n_tiles,
+			CUBE_CHUNK_TILES);
+}
+
+/*
+ * Prepare filling the buffer from the output's shadow framebuffer, creating
+ * the shadow if we don't have one yet. Returns false if we can't use one, in
+ * which case the whole buffer is filled directly.
+ */
+static bool buffer_begin_shadow_fill(struct buffer *buffer)
+{
+	struct output *output = buffer->output;
+	uint64_t bytes;
+	int index, err;
+
+	for (index = 0; index < BUFFER_QUEUE_DEPTH; index++) {
+		if (output->buffers[index] == buffer)
+			break;
+	}
+	if (index == BUFFER_QUEUE_DEPTH)
+		return false;
+
+	if (!output->shadow) {
+		err = shadowfb_new(&output->shadow, buffer->width,
+				   buffer->height, BUFFER_QUEUE_DEPTH);
+		if (err != 0) {
+			fprintf(stderr, "[%s] couldn't allocate shadow framebuffer: %s\n",
+				output->name, strerror(err));
+			output->shadow = NULL;
+			return false;
+		}
+	}
+
+	bytes = shadowfb_begin_fill(output->shadow, index,
+				    buffer->dumb.split_x,
+				    buffer->dumb.split_y);
+
+	debug("[%s] writing %" PRIu64 " bytes (%.1f%% of the buffer)\n",
+	      output->name, bytes,
+	      100.0 * bytes / ((uint64_t) buffer->pitches[0] * buffer->height));
+	return true;
+}
+
+/*
+ * Using the CPU mapping, fill the buffer with a simple checkerboard; the
+ * boundaries advance from top-left to bottom-right.
+ *
+ * The mapping is write-combined, so the fill kernels write whole rows with
+ * wide non-temporal stores instead of going pixel by pixel; see fill.h.
+ *
+ * Only a few rows and columns change every frame, so the checkerboard is
+ * kept in a cached shadow framebuffer, and only what changed since this
+ * buffer was last filled is copied over; see shadowfb.h.
+ *
+ * With KMS_QUADS_SCENE=cube, the Vulkan renderer's cube is drawn instead,
+ * rasterized on the CPU; see softcube.h.
  */
 void buffer_fill(struct buffer *buffer, int frame_num)
 {
 	struct output *output = buffer->output;
+	struct workpool *workpool = output->device->workpool;
+	unsigned int band_rows;
 
 	if (buffer->gbm.bo) {
 		// TODO: handle return value
@@ -53,31 +202,43 @@ void buffer_fill(struct buffer *buffer, int frame_num)
 		return;
 	}
 
-	for (unsigned int y = 0; y < buffer->height; y++) {
-		/*
-		 * We play silly games with pointer types so we advance
-		 * by (y*pitch) in bytes rather than in pixels, then cast back.
-		 */
-		uint8_t b;
-		uint32_t *pix =
-			(uint32_t *) ((uint8_t *) buffer->dumb.mem + (y * buffer->pitches[0]));
-		if (y >= (buffer->height * output->frame_num) / NUM_ANIM_FRAMES)
-			b = 0xff;
-		else
-			b = 0;
-
-		for (unsigned int x = 0; x < buffer->width; x++) {
-			uint32_t r;
-
-			if (x >= (buffer->width * output->frame_num) / NUM_ANIM_FRAMES)
-				r = 0xff;
-			else
-				r = 0;
-
-			*pix++ = (0xff << 24 /* A */) | (r << 16) | \
-				 (0x00 <<  8 /* G */) | b;
-		}
+	if (!fill_kernels) {
+		const char *scene = getenv("KMS_QUADS_SCENE");
+
+		fill_kernels = fill_get_best_kernels();
+		debug("filling dumb buffers using %s kernels\n",
+		      fill_kernels->name);
+
+		draw_cube = scene && strcmp(scene, "cube") == 0;
 	}
+
+	if (draw_cube) {
+		buffer_fill_cube(buffer);
+		return;
+	}
+
+	buffer->dumb.split_x =
+		(buffer->width * output->frame_num) / NUM_ANIM_FRAMES;
+	buffer->dumb.split_y =
+		(buffer->height * output->frame_num) / NUM_ANIM_FRAMES;
+
+	buffer->dumb.from_shadow = buffer_begin_shadow_fill(buffer);
+
+	if (!workpool) {
+		buffer_fill_band(buffer, 0, buffer->height);
+		return;
+	}
+
+	/*
+	 * The bands of all outputs go into the same pool, so one output's
+	 * bands get filled by whichever workers are done with the others.
+	 */
+	band_rows = FILL_BAND_BYTES / buffer->pitches[0];
+	if (band_rows == 0)
+		band_rows = 1;
+
+	workpool_submit(workpool, buffer_fill_band, buffer, buffer->height,
+			band_rows);
 }
 
 /*
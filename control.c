@@ -0,0 +1,489 @@
+/*
+ * Control socket, for tuning the presentation pipeline of kms-quads while
+ * it runs; see control.h for how to use it.
+ *
+ * Everything here runs on the main loop's thread: the sockets are
+ * non-blocking, and a client which doesn't read its replies fast enough
+ * gets disconnected rather than stalling our repaints.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "kms-quads.h"
+#include "control.h"
+
+struct control_client {
+	int fd;
+	char buf[CONTROL_MAX_LINE];
+	size_t len;
+};
+
+struct control {
+	struct device *device;
+	char *path;
+	int listen_fd;
+
+	struct control_client clients[CONTROL_MAX_CLIENTS];
+	int num_clients;
+
+	/*
+	 * Tunables as changed by our clients, which become the device's at
+	 * the next control_apply. Only valid while dirty is set.
+	 */
+	struct tunables pending;
+	bool dirty;
+};
+
+enum tunable {
+	TUNABLE_QUEUE_DEPTH = 0,
+	TUNABLE_REPAINT_MARGIN,
+	TUNABLE_FRAME_TIMING_TOLERANCE,
+	TUNABLE_PRESENT_MODE,
+	TUNABLE__COUNT
+};
+
+static const char *const tunable_names[TUNABLE__COUNT] = {
+	[TUNABLE_QUEUE_DEPTH] = "queue_depth",
+	[TUNABLE_REPAINT_MARGIN] = "repaint_margin_ms",
+	[TUNABLE_FRAME_TIMING_TOLERANCE] = "timing_tolerance_ms",
+	[TUNABLE_PRESENT_MODE] = "present_mode",
+};
+
+static const char *const present_mode_names[] = {
+	[PRESENT_MODE_FIFO] = "fifo",
+	[PRESENT_MODE_ASYNC] = "async",
+};
+
+static const char help_text[] =
+	"get [<name>]          print tunables\n"
+	"set <name> <value>    change a tunable, from the next frame on\n"
+	"stats                 print frame statistics of all outputs\n"
+	"help                  print this\n"
+	"\n"
+	"tunables:\n"
+	"  queue_depth          buffers per output to cycle through, 2 to "
+	"BUFFER_QUEUE_DEPTH\n"
+	"  repaint_margin_ms    start repainting this long before the predicted "
+	"flip\n"
+	"  timing_tolerance_ms  complain about flips this far off the prediction\n"
+	"  present_mode         fifo (flip at vblank) or async (flip immediately, "
+	"may tear)\n";
+
+static int find_tunable(const char *name)
+{
+	for (int i = 0; i < TUNABLE__COUNT; i++) {
+		if (strcmp(name, tunable_names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/* The tunables as they'll be after the next control_apply. */
+static struct tunables *get_tunables(struct control *control)
+{
+	if (!control->dirty)
+		return &control->device->tunables;
+	return &control->pending;
+}
+
+static void print_tunable(struct control *control, FILE *out,
+			  enum tunable tunable)
+{
+	struct tunables *tunables = get_tunables(control);
+
+	fprintf(out, "%s ", tunable_names[tunable]);
+
+	switch (tunable) {
+	case TUNABLE_QUEUE_DEPTH:
+		fprintf(out, "%u", tunables->queue_depth);
+		break;
+	case TUNABLE_REPAINT_MARGIN:
+		fprintf(out, "%.3f", tunables->repaint_margin_nsec / 1e6);
+		break;
+	case TUNABLE_FRAME_TIMING_TOLERANCE:
+		fprintf(out, "%.3f",
+			tunables->frame_timing_tolerance_nsec / 1e6);
+		break;
+	case TUNABLE_PRESENT_MODE:
+		fprintf(out, "%s", present_mode_names[tunables->present_mode]);
+		break;
+	default:
+		break;
+	}
+
+	fprintf(out, "\n");
+}
+
+/* Parse a duration in milliseconds between 0 and 1s, into nanoseconds. */
+static bool parse_msec(const char *value, int64_t *nsec_out)
+{
+	char *end;
+	double msec;
+
+	errno = 0;
+	msec = strtod(value, &end);
+	if (errno != 0 || end == value || *end != '\0' ||
+	    !(msec >= 0.0 && msec <= 1000.0))
+		return false;
+
+	*nsec_out = (int64_t) (msec * 1000000.0);
+	return true;
+}
+
+static void set_tunable(struct control *control, FILE *out,
+			enum tunable tunable, const char *value)
+{
+	struct tunables tunables = *get_tunables(control);
+	unsigned long depth;
+	char *end;
+
+	switch (tunable) {
+	case TUNABLE_QUEUE_DEPTH:
+		errno = 0;
+		depth = strtoul(value, &end, 10);
+		if (errno != 0 || end == value || *end != '\0' ||
+		    depth < 2 || depth > BUFFER_QUEUE_DEPTH) {
+			fprintf(out, "error: queue_depth must be between 2 and %d\n",
+				BUFFER_QUEUE_DEPTH);
+			return;
+		}
+		tunables.queue_depth = depth;
+		break;
+	case TUNABLE_REPAINT_MARGIN:
+		if (!parse_msec(value, &tunables.repaint_margin_nsec)) {
+			fprintf(out, "error: invalid duration \"%s\"\n", value);
+			return;
+		}
+		break;
+	case TUNABLE_FRAME_TIMING_TOLERANCE:
+		if (!parse_msec(value, &tunables.frame_timing_tolerance_nsec)) {
+			fprintf(out, "error: invalid duration \"%s\"\n", value);
+			return;
+		}
+		break;
+	case TUNABLE_PRESENT_MODE:
+		if (strcmp(value, "fifo") == 0) {
+			tunables.present_mode = PRESENT_MODE_FIFO;
+		} else if (strcmp(value, "async") == 0) {
+			if (!control->device->async_page_flip) {
+				fprintf(out, "error: device doesn't support async page flips\n");
+				return;
+			}
+			tunables.present_mode = PRESENT_MODE_ASYNC;
+		} else {
+			fprintf(out, "error: present_mode must be fifo or async\n");
+			return;
+		}
+		break;
+	default:
+		return;
+	}
+
+	control->pending = tunables;
+	control->dirty = true;
+	fprintf(out, "ok\n");
+}
+
+static void print_stats(struct control *control, FILE *out)
+{
+	struct device *device = control->device;
+
+	for (int i = 0; i < device->num_outputs; i++) {
+		struct output *output = device->outputs[i];
+
+		fprintf(out, "[%s] %ux%u@%.2fHz, %" PRIu64 " frames, %" PRIu64 " mispredicted, animation frame %u\n",
+			output->name, output->mode.hdisplay,
+			output->mode.vdisplay,
+			1e9 / output->refresh_interval_nsec,
+			output->num_frames, output->num_mispredicted_frames,
+			output->frame_num);
+
+		if (output->latency)
+			latency_tracker_print(output->latency, output->name,
+					      out);
+	}
+
+	fprintf(out, "ok\n");
+}
+
+static void handle_command(struct control *control, FILE *out, char *line)
+{
+	char *saveptr, *command, *name, *value;
+	int tunable;
+
+	command = strtok_r(line, " \t", &saveptr);
+	if (!command)
+		return;
+
+	name = strtok_r(NULL, " \t", &saveptr);
+	value = strtok_r(NULL, " \t", &saveptr);
+
+	if (strcmp(command, "help") == 0) {
+		fprintf(out, "%sok\n", help_text);
+	} else if (strcmp(command, "stats") == 0) {
+		print_stats(control, out);
+	} else if (strcmp(command, "get") == 0) {
+		if (!name) {
+			for (int i = 0; i < TUNABLE__COUNT; i++)
+				print_tunable(control, out, i);
+			fprintf(out, "ok\n");
+		} else if ((tunable = find_tunable(name)) >= 0) {
+			print_tunable(control, out, tunable);
+			fprintf(out, "ok\n");
+		} else {
+			fprintf(out, "error: unknown tunable \"%s\"\n", name);
+		}
+	} else if (strcmp(command, "set") == 0) {
+		if (!name || !value || strtok_r(NULL, " \t", &saveptr)) {
+			fprintf(out, "error: usage: set <name> <value>\n");
+		} else if ((tunable = find_tunable(name)) >= 0) {
+			set_tunable(control, out, tunable, value);
+		} else {
+			fprintf(out, "error: unknown tunable \"%s\"\n", name);
+		}
+	} else {
+		fprintf(out, "error: unknown command \"%s\", try help\n",
+			command);
+	}
+}
+
+/* Send all of a reply, without blocking. Returns false if we couldn't. */
+static bool send_reply(int fd, const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t ret = send(fd, data, len, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+
+		data += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+static void client_close(struct control *control, int index)
+{
+	close(control->clients[index].fd);
+	control->clients[index] = control->clients[--control->num_clients];
+}
+
+/*
+ * Read what the client sent us and run all complete commands in it.
+ * Returns false if the client should be disconnected.
+ */
+static bool client_handle_input(struct control *control,
+				struct control_client *client)
+{
+	char *reply = NULL;
+	size_t reply_len = 0;
+	char *line, *newline;
+	ssize_t ret;
+	FILE *out;
+	bool ok;
+
+	ret = recv(client->fd, client->buf + client->len,
+		   sizeof(client->buf) - client->len, 0);
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return true;
+	if (ret <= 0)
+		return false;
+	client->len += ret;
+
+	out = open_memstream(&reply, &reply_len);
+	if (!out)
+		return false;
+
+	line = client->buf;
+	while ((newline = memchr(line, '\n',
+				 client->buf + client->len - line))) {
+		*newline = '\0';
+		if (newline > line && newline[-1] == '\r')
+			newline[-1] = '\0';
+
+		handle_command(control, out, line);
+		line = newline + 1;
+	}
+
+	client->len -= line - client->buf;
+	memmove(client->buf, line, client->len);
+
+	/* A full buffer without a newline; drop it and carry on. */
+	if (client->len == sizeof(client->buf)) {
+		fprintf(out, "error: line too long\n");
+		client->len = 0;
+	}
+
+	fclose(out);
+	ok = send_reply(client->fd, reply, reply_len);
+	free(reply);
+
+	return ok;
+}
+
+static void accept_client(struct control *control)
+{
+	static const char too_many[] = "error: too many clients\n";
+	int fd;
+
+	fd = accept4(control->listen_fd, NULL, NULL,
+		     SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			error("[control] couldn't accept client: %s\n",
+			      strerror(errno));
+		return;
+	}
+
+	if (control->num_clients == CONTROL_MAX_CLIENTS) {
+		send_reply(fd, too_many, sizeof(too_many) - 1);
+		close(fd);
+		return;
+	}
+
+	debug("[control] client connected\n");
+	control->clients[control->num_clients++] = (struct control_client) {
+		.fd = fd,
+	};
+}
+
+struct control *control_create(struct device *device, const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct control *control;
+	struct stat st;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		error("[control] socket path %s is too long\n", path);
+		return NULL;
+	}
+	strcpy(addr.sun_path, path);
+
+	control = calloc(1, sizeof(*control));
+	if (!control)
+		return NULL;
+	control->device = device;
+
+	control->path = strdup(path);
+	if (!control->path)
+		goto err;
+
+	/*
+	 * Remove the socket of an earlier run which didn't exit cleanly,
+	 * but don't go deleting anything else that happens to be there.
+	 */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	control->listen_fd = socket(AF_UNIX,
+				    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				    0);
+	if (control->listen_fd < 0) {
+		error("[control] couldn't create socket: %s\n", strerror(errno));
+		goto err_path;
+	}
+
+	if (bind(control->listen_fd, (struct sockaddr *) &addr,
+		 sizeof(addr)) != 0 ||
+	    listen(control->listen_fd, CONTROL_MAX_CLIENTS) != 0) {
+		error("[control] couldn't listen on %s: %s\n", path,
+		      strerror(errno));
+		goto err_fd;
+	}
+
+	printf("control socket listening on %s\n", path);
+	return control;
+
+err_fd:
+	close(control->listen_fd);
+err_path:
+	free(control->path);
+err:
+	free(control);
+	return NULL;
+}
+
+void control_destroy(struct control *control)
+{
+	while (control->num_clients > 0)
+		client_close(control, control->num_clients - 1);
+
+	close(control->listen_fd);
+	unlink(control->path);
+	free(control->path);
+	free(control);
+}
+
+int control_get_pollfds(struct control *control, struct pollfd *fds)
+{
+	fds[0] = (struct pollfd) {
+		.fd = control->listen_fd,
+		.events = POLLIN,
+	};
+
+	for (int i = 0; i < control->num_clients; i++) {
+		fds[1 + i] = (struct pollfd) {
+			.fd = control->clients[i].fd,
+			.events = POLLIN,
+		};
+	}
+
+	return 1 + control->num_clients;
+}
+
+void control_dispatch(struct control *control, struct pollfd *fds,
+		      int num_fds)
+{
+	/*
+	 * Clients are looked up by FD, since closing one reorders the
+	 * array.
+	 */
+	for (int i = 1; i < num_fds; i++) {
+		if (!fds[i].revents)
+			continue;
+
+		for (int j = 0; j < control->num_clients; j++) {
+			if (control->clients[j].fd != fds[i].fd)
+				continue;
+
+			if (!client_handle_input(control,
+						 &control->clients[j])) {
+				debug("[control] client disconnected\n");
+				client_close(control, j);
+			}
+			break;
+		}
+	}
+
+	if (num_fds > 0 && (fds[0].revents & POLLIN))
+		accept_client(control);
+}
+
+void control_apply(struct control *control)
+{
+	struct tunables *new = &control->pending;
+
+	if (!control->dirty)
+		return;
+
+	printf("[control] queue depth %u, repaint margin %.3fms, timing tolerance %.3fms, %s present mode\n",
+	       new->queue_depth, new->repaint_margin_nsec / 1e6,
+	       new->frame_timing_tolerance_nsec / 1e6,
+	       present_mode_names[new->present_mode]);
+
+	control->device->tunables = *new;
+	control->dirty = false;
+}
@@ -0,0 +1,57 @@
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+#include <poll.h>
+
+/*
+ * A Unix domain socket to query and change the device's tunables (queue
+ * depth, repaint margin, present mode, ...) while we run, and to read the
+ * per-output frame statistics.
+ *
+ * The protocol is line based: each command is one line, answered by one
+ * or more lines, the last of which is either "ok" or starts with "error:".
+ * Send "help" for the list of commands, e.g. with
+ *
+ *   socat - UNIX-CONNECT:/tmp/kms-quads.sock
+ *
+ * Changed tunables only become current when control_apply is called, which
+ * the main loop does before repainting any output, so a change never takes
+ * effect halfway through a frame.
+ */
+struct control;
+struct device;
+
+/* At most this many clients can be connected at the same time. */
+#define CONTROL_MAX_CLIENTS 4
+#define CONTROL_MAX_POLLFDS (1 + CONTROL_MAX_CLIENTS)
+
+/*
+ * Longest command line we accept, including the newline. Longer lines get
+ * "error: line too long" and are dropped.
+ */
+#define CONTROL_MAX_LINE 256
+
+/*
+ * Listen on a socket at path, replacing a stale socket left behind there.
+ * Returns NULL on failure.
+ */
+struct control *control_create(struct device *device, const char *path);
+void control_destroy(struct control *control);
+
+/*
+ * Fill in up to CONTROL_MAX_POLLFDS pollfds for the listening socket and
+ * the connected clients, returning how many.
+ */
+int control_get_pollfds(struct control *control, struct pollfd *fds);
+
+/*
+ * Accept new clients and handle the commands of the connected ones,
+ * given the pollfds from control_get_pollfds after polling them.
+ */
+void control_dispatch(struct control *control, struct pollfd *fds,
+		      int num_fds);
+
+/* Make the tunables changed since the last call current. */
+void control_apply(struct control *control);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Drives the control socket of control.c the way a client would: connects,
+ * sends get/set lines and checks the replies, and that a change only
+ * reaches the device's tunables at control_apply.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "kms-quads.h"
+#include "control.h"
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "[control-test] " __VA_ARGS__); \
+			failures++; \
+		} \
+	} while (0)
+
+/* Let the control socket handle whatever is pending on its fds. */
+static void dispatch(struct control *control)
+{
+	struct pollfd fds[CONTROL_MAX_POLLFDS];
+	int num_fds;
+
+	num_fds = control_get_pollfds(control, fds);
+	if (poll(fds, num_fds, 1000) > 0)
+		control_dispatch(control, fds, num_fds);
+}
+
+/*
+ * Send data, which doesn't need to be a whole line, let the control socket
+ * handle it, and read its reply into reply. The reply is empty if there
+ * was none.
+ */
+static void transact(struct control *control, int fd, const char *data,
+		     char *reply, size_t reply_size)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	size_t len = 0;
+	ssize_t ret;
+
+	if (send(fd, data, strlen(data), MSG_NOSIGNAL) < 0) {
+		perror("[control-test] send");
+		exit(EXIT_FAILURE);
+	}
+
+	dispatch(control);
+
+	while (len < reply_size - 1 && poll(&pfd, 1, 0) > 0) {
+		ret = recv(fd, reply + len, reply_size - 1 - len, 0);
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+	reply[len] = '\0';
+}
+
+/* Send a command and check its whole reply. */
+static void expect(struct control *control, int fd, const char *command,
+		   const char *expected)
+{
+	char reply[1024];
+
+	transact(control, fd, command, reply, sizeof(reply));
+	CHECK(strcmp(reply, expected) == 0,
+	      "\"%.*s\" got \"%s\", expected \"%s\"\n",
+	      (int) strcspn(command, "\n"), command, reply, expected);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct device device = {
+		.async_page_flip = false,
+		.tunables = {
+			.queue_depth = BUFFER_QUEUE_DEPTH,
+			.repaint_margin_nsec = REPAINT_MARGIN,
+			.frame_timing_tolerance_nsec = FRAME_TIMING_TOLERANCE,
+			.present_mode = PRESENT_MODE_FIFO,
+		},
+	};
+	struct control *control;
+	char dir[] = "/tmp/control-test-XXXXXX";
+	char long_line[CONTROL_MAX_LINE + 1];
+	char reply[1024];
+	int fd;
+
+	if (!mkdtemp(dir)) {
+		perror("[control-test] mkdtemp");
+		return EXIT_FAILURE;
+	}
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/sock", dir);
+
+	control = control_create(&device, addr.sun_path);
+	if (!control) {
+		rmdir(dir);
+		return EXIT_FAILURE;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 ||
+	    connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		perror("[control-test] connect");
+		control_destroy(control);
+		rmdir(dir);
+		return EXIT_FAILURE;
+	}
+
+	/* accept the client */
+	dispatch(control);
+
+	expect(control, fd, "get queue_depth\n", "queue_depth 3\nok\n");
+	expect(control, fd, "get\n",
+	       "queue_depth 3\n"
+	       "repaint_margin_ms 4.000\n"
+	       "timing_tolerance_ms 0.500\n"
+	       "present_mode fifo\n"
+	       "ok\n");
+	expect(control, fd, "get vsync\n", "error: unknown tunable \"vsync\"\n");
+
+	/* A change shows up in get right away, but not in the device yet. */
+	expect(control, fd, "set queue_depth 2\n", "ok\n");
+	expect(control, fd, "set repaint_margin_ms 2.5\r\n", "ok\n");
+	expect(control, fd, "get queue_depth\n", "queue_depth 2\nok\n");
+	CHECK(device.tunables.queue_depth == BUFFER_QUEUE_DEPTH,
+	      "set changed the device's tunables before control_apply\n");
+
+	control_apply(control);
+	CHECK(device.tunables.queue_depth == 2,
+	      "queue depth is %u after control_apply, should be 2\n",
+	      device.tunables.queue_depth);
+	CHECK(device.tunables.repaint_margin_nsec == 2500000,
+	      "repaint margin is %lld ns after control_apply, should be 2.5ms\n",
+	      (long long) device.tunables.repaint_margin_nsec);
+
+	/* Bad values are rejected and change nothing. */
+	expect(control, fd, "set queue_depth 1\n",
+	       "error: queue_depth must be between 2 and 3\n");
+	expect(control, fd, "set queue_depth 4\n",
+	       "error: queue_depth must be between 2 and 3\n");
+	expect(control, fd, "set queue_depth 2x\n",
+	       "error: queue_depth must be between 2 and 3\n");
+	expect(control, fd, "set repaint_margin_ms -1\n",
+	       "error: invalid duration \"-1\"\n");
+	expect(control, fd, "set timing_tolerance_ms 1001\n",
+	       "error: invalid duration \"1001\"\n");
+	expect(control, fd, "set repaint_margin_ms nan\n",
+	       "error: invalid duration \"nan\"\n");
+	expect(control, fd, "set present_mode mailbox\n",
+	       "error: present_mode must be fifo or async\n");
+	expect(control, fd, "set present_mode async\n",
+	       "error: device doesn't support async page flips\n");
+	expect(control, fd, "set queue_depth\n",
+	       "error: usage: set <name> <value>\n");
+	expect(control, fd, "set queue_depth 2 3\n",
+	       "error: usage: set <name> <value>\n");
+	expect(control, fd, "set vsync 1\n", "error: unknown tunable \"vsync\"\n");
+	expect(control, fd, "frobnicate\n",
+	       "error: unknown command \"frobnicate\", try help\n");
+
+	control_apply(control);
+	CHECK(device.tunables.queue_depth == 2 &&
+	      device.tunables.repaint_margin_nsec == 2500000 &&
+	      device.tunables.present_mode == PRESENT_MODE_FIFO,
+	      "a rejected set changed the tunables\n");
+
+	/* Commands split over several reads are put back together. */
+	transact(control, fd, "get queue", reply, sizeof(reply));
+	CHECK(reply[0] == '\0', "half a command got the reply \"%s\"\n", reply);
+	expect(control, fd, "_depth\n", "queue_depth 2\nok\n");
+
+	/*
+	 * A line that fills the whole buffer is dropped, and the client can
+	 * carry on afterwards.
+	 */
+	memset(long_line, 'x', sizeof(long_line) - 1);
+	long_line[sizeof(long_line) - 1] = '\0';
+	expect(control, fd, long_line, "error: line too long\n");
+	expect(control, fd, "get present_mode\n", "present_mode fifo\nok\n");
+
+	close(fd);
+	control_destroy(control);
+	rmdir(dir);
+
+	if (failures > 0) {
+		fprintf(stderr, "[control-test] %d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("[control-test] all checks passed\n");
+	return EXIT_SUCCESS;
+}
@@ -62,6 +62,9 @@
 #include <linux/vt.h>
 
 #include "kms-quads.h"
+#include "control.h"
+#include "flip_trace.h"
+#include "workpool.h"
 
 /*
  * Set up the VT/TTY so it runs in graphics mode and lets us handle our own
@@ -223,6 +226,20 @@ static struct device *device_open(const char *filename)
 	debug("device %s framebuffer modifiers\n",
 	      (ret->fb_modifiers) ? "supports" : "does not support");
 
+#ifdef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+	err = drmGetCap(ret->kms_fd, DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP, &cap);
+	ret->async_page_flip = (err == 0 && cap != 0);
+#endif
+	debug("device %s async page flips\n",
+	      (ret->async_page_flip) ? "supports" : "does not support");
+
+	ret->tunables = (struct tunables) {
+		.queue_depth = BUFFER_QUEUE_DEPTH,
+		.repaint_margin_nsec = REPAINT_MARGIN,
+		.frame_timing_tolerance_nsec = FRAME_TIMING_TOLERANCE,
+		.present_mode = PRESENT_MODE_FIFO,
+	};
+
 	/*
 	 * The two 'resource' properties describe the KMS capabilities for
 	 * this device.
@@ -297,6 +314,26 @@ static struct device *device_open(const char *filename)
 		if (!vk_device_create(ret)) {
 			abort();
 		}
+	} else {
+		/*
+		 * Without a GPU, filling the buffers is our whole rendering
+		 * cost, so spread it over all our CPUs. KMS_QUADS_THREADS
+		 * limits the number of worker threads; 0 (the default) means
+		 * one per CPU besides ours.
+		 */
+		const char *threads = getenv("KMS_QUADS_THREADS");
+		int err;
+
+		err = workpool_new(&ret->workpool, threads ? atoi(threads) : 0,
+				   true);
+		if (err != 0) {
+			fprintf(stderr, "couldn't create worker threads: %s\n",
+				strerror(err));
+			ret->workpool = NULL;
+		} else {
+			debug("filling buffers using %d threads\n",
+			      workpool_get_concurrency(ret->workpool));
+		}
 	}
 
 	printf("using device %s with %d outputs and %s rendering\n",
@@ -378,6 +415,12 @@ void device_destroy(struct device *device)
 		output_destroy(device->outputs[i]);
 	free(device->outputs);
 
+	if (device->control)
+		control_destroy(device->control);
+	if (device->recorder)
+		flip_recorder_destroy(device->recorder);
+	if (device->workpool)
+		workpool_destroy(device->workpool);
 	if (device->vk_device)
 		vk_device_destroy(device->vk_device);
 	if (device->gbm_device)
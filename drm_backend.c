@@ -0,0 +1,47 @@
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <drm_backend.h>
+
+const struct drm_backend drm_backend_libdrm = {
+    .name = "libdrm",
+
+    .set_client_cap = drmSetClientCap,
+    .get_cap = drmGetCap,
+
+    .get_resources = drmModeGetResources,
+    .free_resources = drmModeFreeResources,
+    .get_plane_resources = drmModeGetPlaneResources,
+    .free_plane_resources = drmModeFreePlaneResources,
+
+    .get_connector = drmModeGetConnector,
+    .free_connector = drmModeFreeConnector,
+    .get_encoder = drmModeGetEncoder,
+    .free_encoder = drmModeFreeEncoder,
+    .get_crtc = drmModeGetCrtc,
+    .free_crtc = drmModeFreeCrtc,
+    .get_plane = drmModeGetPlane,
+    .free_plane = drmModeFreePlane,
+
+    .object_get_properties = drmModeObjectGetProperties,
+    .free_object_properties = drmModeFreeObjectProperties,
+    .get_property = drmModeGetProperty,
+    .free_property = drmModeFreeProperty,
+    .object_set_property = drmModeObjectSetProperty,
+    .connector_set_property = drmModeConnectorSetProperty,
+
+    .create_property_blob = drmModeCreatePropertyBlob,
+    .destroy_property_blob = drmModeDestroyPropertyBlob,
+
+    .atomic_alloc = drmModeAtomicAlloc,
+    .atomic_free = drmModeAtomicFree,
+    .atomic_add_property = drmModeAtomicAddProperty,
+    .atomic_merge = drmModeAtomicMerge,
+    .atomic_commit = drmModeAtomicCommit,
+
+    .set_crtc = drmModeSetCrtc,
+    .page_flip = drmModePageFlip,
+    .set_plane = drmModeSetPlane,
+
+    .handle_event = drmHandleEvent,
+};
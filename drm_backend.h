@@ -0,0 +1,75 @@
+#ifndef _DRM_BACKEND_H
+#define _DRM_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+/**
+ * @brief The libdrm functions a @ref drmdev calls, so it can run on something
+ * other than a real KMS device.
+ *
+ * Every function has the same signature and semantics as the libdrm function
+ * it's named after, including failing with a negative value or NULL and errno
+ * set. Objects returned by a backend must be freed using the same backend.
+ *
+ * @ref drm_backend_libdrm forwards to libdrm, @ref drm_backend_mock (see
+ * mock_drm.h) simulates a device in memory.
+ */
+struct drm_backend {
+    const char *name;
+
+    int (*set_client_cap)(int fd, uint64_t capability, uint64_t value);
+    int (*get_cap)(int fd, uint64_t capability, uint64_t *value);
+
+    drmModeResPtr (*get_resources)(int fd);
+    void (*free_resources)(drmModeResPtr res);
+    drmModePlaneResPtr (*get_plane_resources)(int fd);
+    void (*free_plane_resources)(drmModePlaneResPtr plane_res);
+
+    drmModeConnectorPtr (*get_connector)(int fd, uint32_t connector_id);
+    void (*free_connector)(drmModeConnectorPtr connector);
+    drmModeEncoderPtr (*get_encoder)(int fd, uint32_t encoder_id);
+    void (*free_encoder)(drmModeEncoderPtr encoder);
+    drmModeCrtcPtr (*get_crtc)(int fd, uint32_t crtc_id);
+    void (*free_crtc)(drmModeCrtcPtr crtc);
+    drmModePlanePtr (*get_plane)(int fd, uint32_t plane_id);
+    void (*free_plane)(drmModePlanePtr plane);
+
+    drmModeObjectPropertiesPtr (*object_get_properties)(int fd, uint32_t object_id, uint32_t object_type);
+    void (*free_object_properties)(drmModeObjectPropertiesPtr props);
+    drmModePropertyPtr (*get_property)(int fd, uint32_t property_id);
+    void (*free_property)(drmModePropertyPtr prop);
+    int (*object_set_property)(int fd, uint32_t object_id, uint32_t object_type, uint32_t property_id, uint64_t value);
+    int (*connector_set_property)(int fd, uint32_t connector_id, uint32_t property_id, uint64_t value);
+
+    int (*create_property_blob)(int fd, const void *data, size_t size, uint32_t *id);
+    int (*destroy_property_blob)(int fd, uint32_t id);
+
+    drmModeAtomicReqPtr (*atomic_alloc)(void);
+    void (*atomic_free)(drmModeAtomicReqPtr req);
+    int (*atomic_add_property)(drmModeAtomicReqPtr req, uint32_t object_id, uint32_t property_id, uint64_t value);
+    int (*atomic_merge)(drmModeAtomicReqPtr base, drmModeAtomicReqPtr augment);
+    int (*atomic_commit)(int fd, drmModeAtomicReqPtr req, uint32_t flags, void *userdata);
+
+    int (*set_crtc)(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t x, uint32_t y, uint32_t *connectors, int n_connectors, drmModeModeInfoPtr mode);
+    int (*page_flip)(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t flags, void *userdata);
+    int (*set_plane)(
+        int fd,
+        uint32_t plane_id,
+        uint32_t crtc_id,
+        uint32_t fb_id,
+        uint32_t flags,
+        int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+        uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h
+    );
+
+    /// Read the pending events from @a fd and dispatch them to @a evctx.
+    int (*handle_event)(int fd, drmEventContextPtr evctx);
+};
+
+extern const struct drm_backend drm_backend_libdrm;
+
+#endif
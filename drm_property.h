@@ -0,0 +1,46 @@
+#ifndef _DRM_PROPERTY_H
+#define _DRM_PROPERTY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <xf86drmMode.h>
+
+/**
+ * Represents the values of an enum-type KMS property. These properties
+ * have a certain range of values you can use, exposed as strings from
+ * the kernel; userspace needs to look up the value that string
+ * corresponds to and use it.
+ */
+struct drm_property_enum_info {
+	const char *name; /**< name as string (static, not freed) */
+	bool valid; /**< true if value is supported; ignore if false */
+	uint64_t value; /**< raw value */
+};
+
+/**
+ * Holds information on a DRM property, including its ID and the enum
+ * values it holds.
+ *
+ * DRM properties are allocated dynamically, and maintained as DRM objects
+ * within the normal object ID space; they thus do not have a stable ID
+ * to refer to. This includes enum values, which must be referred to by
+ * integer values, but these are not stable.
+ *
+ * drm_property_info allows a cache to be maintained where we can use
+ * enum values internally to refer to properties, with the mapping to DRM
+ * ID values being maintained internally.
+ */
+struct drm_property_info {
+	const char *name; /**< name as string (static, not freed) */
+	uint32_t prop_id; /**< KMS property object ID */
+	unsigned int num_enum_values; /**< number of enum values */
+	struct drm_property_enum_info *enum_values; /**< array of enum values */
+};
+
+uint64_t
+drm_property_get_value(struct drm_property_info *info,
+		       const drmModeObjectProperties *props,
+		       uint64_t def);
+
+#endif
@@ -0,0 +1,704 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include <fbcache.h>
+
+enum fbcache_key_type {
+    FBCACHE_KEY_GEM_HANDLE,
+    FBCACHE_KEY_DMABUF_INODE
+};
+
+struct fbcache_key {
+    enum fbcache_key_type type;
+
+    /// GEM handles or dmabuf inodes, one per plane.
+    uint64_t ids[4];
+
+    uint32_t width, height;
+    uint32_t format;
+    uint64_t modifier;
+    uint32_t pitches[4];
+    uint32_t offsets[4];
+};
+
+struct fbcache_entry {
+    struct fbcache_entry *prev, *next;
+
+    struct fbcache_key key;
+    uint32_t fb_id;
+    size_t size;
+    int refcount;
+
+    /// The GEM handles we imported ourselves (dmabuf entries only), one per plane.
+    /// Every one holds a reference on the handle in @ref fbcache.imported_handles.
+    uint32_t owned_handles[4];
+};
+
+/**
+ * @brief A GEM handle on the import fd and how many planes of cached entries use it.
+ *
+ * Importing the same dmabuf twice on one fd gives the same handle, so entries
+ * for the same buffer with different format / geometry share it, and it may
+ * only be closed when the last of them is gone.
+ */
+struct fbcache_imported_handle {
+    uint32_t handle;
+    int refcount;
+};
+
+struct fbcache {
+    int fd;
+    bool supports_modifiers;
+
+    /// A separate open file of the same DRM device, for importing dmabufs. -1 until the first import.
+    int import_fd;
+
+    struct fbcache_imported_handle *imported_handles;
+    size_t n_imported_handles, max_imported_handles;
+
+    pthread_mutex_t mutex;
+
+    /// Most recently used entry first.
+    struct fbcache_entry *head, *tail;
+
+    size_t max_bytes;
+    struct fbcache_stats stats;
+};
+
+static int fbcache_lock(struct fbcache *cache) {
+    return pthread_mutex_lock(&cache->mutex);
+}
+
+static int fbcache_unlock(struct fbcache *cache) {
+    return pthread_mutex_unlock(&cache->mutex);
+}
+
+static bool key_equals(const struct fbcache_key *a, const struct fbcache_key *b) {
+    return a->type == b->type &&
+        a->width == b->width &&
+        a->height == b->height &&
+        a->format == b->format &&
+        a->modifier == b->modifier &&
+        memcmp(a->ids, b->ids, sizeof a->ids) == 0 &&
+        memcmp(a->pitches, b->pitches, sizeof a->pitches) == 0 &&
+        memcmp(a->offsets, b->offsets, sizeof a->offsets) == 0;
+}
+
+static void unlink_entry(struct fbcache *cache, struct fbcache_entry *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void push_entry(struct fbcache *cache, struct fbcache_entry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+static void close_gem_handle(int fd, uint32_t handle) {
+    struct drm_gem_close close_args = { .handle = handle };
+    int ok;
+
+    ok = drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &close_args);
+    if (ok < 0) {
+        perror("[fbcache] Could not close imported GEM handle. drmIoctl");
+    }
+}
+
+/**
+ * @brief Reference an imported GEM handle, adding it to the table if the cache doesn't use it yet.
+ */
+static int ref_imported_handle(struct fbcache *cache, uint32_t handle) {
+    struct fbcache_imported_handle *handles;
+    size_t max;
+
+    for (size_t i = 0; i < cache->n_imported_handles; i++) {
+        if (cache->imported_handles[i].handle == handle) {
+            cache->imported_handles[i].refcount++;
+            return 0;
+        }
+    }
+
+    if (cache->n_imported_handles == cache->max_imported_handles) {
+        max = cache->max_imported_handles ? cache->max_imported_handles * 2 : 8;
+
+        handles = realloc(cache->imported_handles, max * sizeof *handles);
+        if (handles == NULL) {
+            return ENOMEM;
+        }
+
+        cache->imported_handles = handles;
+        cache->max_imported_handles = max;
+    }
+
+    cache->imported_handles[cache->n_imported_handles++] = (struct fbcache_imported_handle) {
+        .handle = handle,
+        .refcount = 1,
+    };
+    cache->stats.n_imported_handles = cache->n_imported_handles;
+    return 0;
+}
+
+/**
+ * @brief Drop a reference to an imported GEM handle, and close it if nothing uses it anymore.
+ */
+static void unref_imported_handle(struct fbcache *cache, uint32_t handle) {
+    for (size_t i = 0; i < cache->n_imported_handles; i++) {
+        if (cache->imported_handles[i].handle != handle) {
+            continue;
+        }
+
+        if (--cache->imported_handles[i].refcount == 0) {
+            close_gem_handle(cache->import_fd, handle);
+            cache->imported_handles[i] = cache->imported_handles[--cache->n_imported_handles];
+            cache->stats.n_imported_handles = cache->n_imported_handles;
+        }
+        return;
+    }
+}
+
+static void unref_owned_handles(struct fbcache *cache, const uint32_t handles[4]) {
+    for (int i = 0; i < 4; i++) {
+        if (handles[i] != 0) {
+            unref_imported_handle(cache, handles[i]);
+        }
+    }
+}
+
+/// Framebuffers of dmabuf entries were created on the import fd.
+static int get_entry_fd(struct fbcache *cache, const struct fbcache_entry *entry) {
+    return entry->key.type == FBCACHE_KEY_DMABUF_INODE ? cache->import_fd : cache->fd;
+}
+
+/**
+ * @brief Remove the framebuffer from KMS and free the entry. The entry must already be unlinked.
+ */
+static void destroy_entry(struct fbcache *cache, struct fbcache_entry *entry) {
+    int ok;
+
+    ok = drmModeRmFB(get_entry_fd(cache, entry), entry->fb_id);
+    if (ok < 0) {
+        perror("[fbcache] Could not remove cached framebuffer. drmModeRmFB");
+    }
+
+    unref_owned_handles(cache, entry->owned_handles);
+
+    cache->stats.n_entries--;
+    cache->stats.n_bytes -= entry->size;
+
+    free(entry);
+}
+
+/**
+ * @brief Evict unreferenced entries, least recently used first, until we're inside the memory bound again.
+ */
+static void trim(struct fbcache *cache) {
+    struct fbcache_entry *entry, *prev;
+
+    for (entry = cache->tail; entry != NULL && cache->stats.n_bytes > cache->max_bytes; entry = prev) {
+        prev = entry->prev;
+
+        if (entry->refcount > 0) {
+            continue;
+        }
+
+        unlink_entry(cache, entry);
+        destroy_entry(cache, entry);
+        cache->stats.n_evictions++;
+    }
+}
+
+/**
+ * @brief Look up an entry and reference it. Must be called with the cache locked.
+ */
+static struct fbcache_entry *lookup_and_ref(struct fbcache *cache, const struct fbcache_key *key) {
+    struct fbcache_entry *entry;
+
+    for (entry = cache->head; entry != NULL; entry = entry->next) {
+        if (key_equals(&entry->key, key)) {
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        cache->stats.n_misses++;
+        return NULL;
+    }
+
+    if (entry->refcount++ == 0) {
+        cache->stats.n_referenced_entries++;
+    }
+
+    if (entry != cache->head) {
+        unlink_entry(cache, entry);
+        push_entry(cache, entry);
+    }
+
+    cache->stats.n_hits++;
+    return entry;
+}
+
+/**
+ * @brief The number of rows of plane @a plane of a @a height pixels high buffer.
+ * The chroma planes of 4:2:0 and 4:1:0 formats are vertically subsampled.
+ */
+static uint32_t get_plane_height(uint32_t format, int plane, uint32_t height) {
+    uint32_t vsub;
+
+    if (plane == 0) {
+        return height;
+    }
+
+    switch (format) {
+        case DRM_FORMAT_NV12:
+        case DRM_FORMAT_NV21:
+        case DRM_FORMAT_YUV420:
+        case DRM_FORMAT_YVU420:
+        case DRM_FORMAT_P010:
+        case DRM_FORMAT_P012:
+        case DRM_FORMAT_P016:
+            vsub = 2;
+            break;
+        case DRM_FORMAT_YUV410:
+        case DRM_FORMAT_YVU410:
+            vsub = 4;
+            break;
+        default:
+            vsub = 1;
+            break;
+    }
+
+    return (height + vsub - 1) / vsub;
+}
+
+/**
+ * @brief Create a new framebuffer for the key and insert it as a referenced entry.
+ * Must be called with the cache locked.
+ */
+static int add_entry(
+    struct fbcache *cache,
+    int fd,
+    const struct fbcache_key *key,
+    const uint32_t handles[4],
+    const uint32_t owned_handles[4],
+    uint32_t *fb_id_out
+) {
+    struct fbcache_entry *entry;
+    uint32_t fb_id;
+    int ok;
+
+    entry = calloc(1, sizeof *entry);
+    if (entry == NULL) {
+        return ENOMEM;
+    }
+
+    if (cache->supports_modifiers && key->modifier != DRM_FORMAT_MOD_INVALID) {
+        uint64_t modifiers[4] = { 0 };
+
+        // the kernel requires the modifier to be the same for every used plane, and 0 for the unused ones.
+        for (int i = 0; i < 4; i++) {
+            if (handles[i] != 0) {
+                modifiers[i] = key->modifier;
+            }
+        }
+
+        ok = drmModeAddFB2WithModifiers(
+            fd,
+            key->width, key->height,
+            key->format,
+            handles,
+            key->pitches,
+            key->offsets,
+            modifiers,
+            &fb_id,
+            DRM_MODE_FB_MODIFIERS
+        );
+    } else {
+        ok = drmModeAddFB2(
+            fd,
+            key->width, key->height,
+            key->format,
+            handles,
+            key->pitches,
+            key->offsets,
+            &fb_id,
+            0
+        );
+    }
+    if (ok < 0) {
+        ok = errno;
+        perror("[fbcache] Could not add framebuffer. drmModeAddFB2");
+        free(entry);
+        return ok;
+    }
+
+    entry->key = *key;
+    entry->fb_id = fb_id;
+    entry->refcount = 1;
+    if (owned_handles != NULL) {
+        memcpy(entry->owned_handles, owned_handles, sizeof entry->owned_handles);
+    }
+
+    entry->size = 0;
+    for (int i = 0; i < 4; i++) {
+        entry->size += (size_t) key->pitches[i] * get_plane_height(key->format, i, key->height);
+    }
+
+    push_entry(cache, entry);
+
+    cache->stats.n_entries++;
+    cache->stats.n_referenced_entries++;
+    cache->stats.n_bytes += entry->size;
+
+    // the new entry is referenced, so this will only evict older, unused ones.
+    trim(cache);
+
+    *fb_id_out = fb_id;
+    return 0;
+}
+
+/**
+ * @brief Open the DRM device of the cache a second time, to import dmabufs on.
+ *
+ * GEM handles are per open file, and importing a dmabuf that was exported on
+ * the same file gives back the exporter's handle (e.g. the one of a GBM BO).
+ * On a file of its own, every handle the cache gets is one it created, so
+ * closing it can't pull a buffer out from under anyone. Framebuffer IDs are
+ * global to the device, so the framebuffers can still be used on the cache's
+ * fd.
+ *
+ * A freshly opened primary node isn't authenticated, and PRIME_FD_TO_HANDLE
+ * needs DRM_AUTH, so unless we're root every import would fail with EACCES.
+ * The cache's fd is the DRM master when we're modesetting, so it can
+ * authenticate the new one with its magic.
+ */
+static int open_import_fd(struct fbcache *cache) {
+    drm_magic_t magic;
+    char *path;
+    int fd, ok;
+
+    path = drmGetDeviceNameFromFd2(cache->fd);
+    if (path == NULL) {
+        fprintf(stderr, "[fbcache] Could not find the device node of the DRM fd. drmGetDeviceNameFromFd2\n");
+        return ENODEV;
+    }
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        ok = errno;
+        fprintf(stderr, "[fbcache] Could not open %s for importing dmabufs. open: %s\n", path, strerror(ok));
+        free(path);
+        return ok;
+    }
+
+    free(path);
+
+    // if nobody was master (say, we're VT switched away), the new file just became it. Don't keep it from us.
+    drmDropMaster(fd);
+
+    ok = drmGetMagic(fd, &magic);
+    if (ok == 0) {
+        ok = drmAuthMagic(cache->fd, magic);
+    }
+    if (ok != 0) {
+        ok = -ok;
+        fprintf(stderr, "[fbcache] Could not authenticate the fd for importing dmabufs. drmAuthMagic: %s\n", strerror(ok));
+        close(fd);
+        return ok;
+    }
+
+    cache->import_fd = fd;
+    return 0;
+}
+
+int fbcache_new(
+    struct fbcache **cache_out,
+    int drm_fd,
+    size_t max_bytes
+) {
+    struct fbcache *cache;
+    uint64_t cap;
+    int ok;
+
+    cache = calloc(1, sizeof *cache);
+    if (cache == NULL) {
+        return ENOMEM;
+    }
+
+    ok = drmGetCap(drm_fd, DRM_CAP_ADDFB2_MODIFIERS, &cap);
+    cache->supports_modifiers = (ok == 0) && (cap != 0);
+
+    ok = pthread_mutex_init(&cache->mutex, NULL);
+    if (ok != 0) {
+        free(cache);
+        return ok;
+    }
+
+    cache->fd = drm_fd;
+    cache->import_fd = -1;
+    cache->imported_handles = NULL;
+    cache->n_imported_handles = 0;
+    cache->max_imported_handles = 0;
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->max_bytes = max_bytes;
+    cache->stats.max_bytes = max_bytes;
+
+    *cache_out = cache;
+    return 0;
+}
+
+void fbcache_destroy(
+    struct fbcache *cache
+) {
+    struct fbcache_entry *entry, *next;
+
+    for (entry = cache->head; entry != NULL; entry = next) {
+        next = entry->next;
+        destroy_entry(cache, entry);
+    }
+
+    if (cache->import_fd >= 0) {
+        close(cache->import_fd);
+    }
+
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->imported_handles);
+    free(cache);
+}
+
+int fbcache_get_for_gem(
+    struct fbcache *cache,
+    uint32_t width,
+    uint32_t height,
+    uint32_t format,
+    uint64_t modifier,
+    const uint32_t handles[4],
+    const uint32_t pitches[4],
+    const uint32_t offsets[4],
+    uint32_t *fb_id_out
+) {
+    struct fbcache_entry *entry;
+    struct fbcache_key key;
+    int ok;
+
+    memset(&key, 0, sizeof key);
+    key.type = FBCACHE_KEY_GEM_HANDLE;
+    key.width = width;
+    key.height = height;
+    key.format = format;
+    key.modifier = modifier;
+    for (int i = 0; i < 4 && handles[i] != 0; i++) {
+        key.ids[i] = handles[i];
+        key.pitches[i] = pitches[i];
+        key.offsets[i] = offsets[i];
+    }
+
+    fbcache_lock(cache);
+
+    entry = lookup_and_ref(cache, &key);
+    if (entry != NULL) {
+        *fb_id_out = entry->fb_id;
+        fbcache_unlock(cache);
+        return 0;
+    }
+
+    ok = add_entry(cache, cache->fd, &key, handles, NULL, fb_id_out);
+
+    fbcache_unlock(cache);
+    return ok;
+}
+
+int fbcache_get_for_dmabuf(
+    struct fbcache *cache,
+    uint32_t width,
+    uint32_t height,
+    uint32_t format,
+    uint64_t modifier,
+    const int fds[4],
+    const uint32_t pitches[4],
+    const uint32_t offsets[4],
+    uint32_t *fb_id_out
+) {
+    struct fbcache_entry *entry;
+    struct fbcache_key key;
+    uint32_t handles[4] = { 0 };
+    struct stat statbuf;
+    int ok, n_planes;
+
+    memset(&key, 0, sizeof key);
+    key.type = FBCACHE_KEY_DMABUF_INODE;
+    key.width = width;
+    key.height = height;
+    key.format = format;
+    key.modifier = modifier;
+
+    // Every dmabuf gets its own inode on the dmabuf pseudo-filesystem, which stays
+    // the same no matter how often the fd is dup'ed or passed around between processes.
+    // Since we keep a GEM handle (and thus a reference to the dmabuf) for every cached
+    // entry, the inode can't be reused while the entry exists.
+    n_planes = 0;
+    for (int i = 0; i < 4 && pitches[i] != 0; i++, n_planes++) {
+        ok = fstat(fds[i], &statbuf);
+        if (ok < 0) {
+            ok = errno;
+            perror("[fbcache] Could not stat dmabuf fd. fstat");
+            return ok;
+        }
+
+        key.ids[i] = statbuf.st_ino;
+        key.pitches[i] = pitches[i];
+        key.offsets[i] = offsets[i];
+    }
+
+    fbcache_lock(cache);
+
+    entry = lookup_and_ref(cache, &key);
+    if (entry != NULL) {
+        *fb_id_out = entry->fb_id;
+        fbcache_unlock(cache);
+        return 0;
+    }
+
+    if (cache->import_fd < 0) {
+        ok = open_import_fd(cache);
+        if (ok != 0) {
+            fbcache_unlock(cache);
+            return ok;
+        }
+    }
+
+    for (int i = 0; i < n_planes; i++) {
+        ok = drmPrimeFDToHandle(cache->import_fd, fds[i], handles + i);
+        if (ok < 0) {
+            ok = errno;
+            perror("[fbcache] Could not import dmabuf. drmPrimeFDToHandle");
+            handles[i] = 0;
+            unref_owned_handles(cache, handles);
+            fbcache_unlock(cache);
+            return ok;
+        }
+
+        ok = ref_imported_handle(cache, handles[i]);
+        if (ok != 0) {
+            // only a handle that's new to the table can fail, so nothing else uses it.
+            close_gem_handle(cache->import_fd, handles[i]);
+            handles[i] = 0;
+            unref_owned_handles(cache, handles);
+            fbcache_unlock(cache);
+            return ok;
+        }
+    }
+
+    ok = add_entry(cache, cache->import_fd, &key, handles, handles, fb_id_out);
+    if (ok != 0) {
+        unref_owned_handles(cache, handles);
+    }
+
+    fbcache_unlock(cache);
+    return ok;
+}
+
+int fbcache_release(
+    struct fbcache *cache,
+    uint32_t fb_id
+) {
+    struct fbcache_entry *entry;
+
+    fbcache_lock(cache);
+
+    for (entry = cache->head; entry != NULL; entry = entry->next) {
+        if (entry->fb_id == fb_id) {
+            break;
+        }
+    }
+
+    if (entry == NULL || entry->refcount == 0) {
+        fbcache_unlock(cache);
+        return EINVAL;
+    }
+
+    if (--entry->refcount == 0) {
+        cache->stats.n_referenced_entries--;
+        trim(cache);
+    }
+
+    fbcache_unlock(cache);
+    return 0;
+}
+
+void fbcache_forget_gem_handle(
+    struct fbcache *cache,
+    uint32_t handle
+) {
+    struct fbcache_entry *entry, *next;
+
+    if (handle == 0) {
+        return;
+    }
+
+    fbcache_lock(cache);
+
+    for (entry = cache->head; entry != NULL; entry = next) {
+        bool uses_handle = false;
+
+        next = entry->next;
+
+        if (entry->key.type != FBCACHE_KEY_GEM_HANDLE) {
+            continue;
+        }
+
+        for (int i = 0; i < 4; i++) {
+            if (entry->key.ids[i] == handle) {
+                uses_handle = true;
+                break;
+            }
+        }
+
+        if (uses_handle) {
+            if (entry->refcount > 0) {
+                cache->stats.n_referenced_entries--;
+            }
+            unlink_entry(cache, entry);
+            destroy_entry(cache, entry);
+        }
+    }
+
+    fbcache_unlock(cache);
+}
+
+void fbcache_get_stats(
+    struct fbcache *cache,
+    struct fbcache_stats *stats_out
+) {
+    fbcache_lock(cache);
+    *stats_out = cache->stats;
+    fbcache_unlock(cache);
+}
@@ -0,0 +1,127 @@
+#ifndef _FBCACHE_H
+#define _FBCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+/**
+ * @brief Caches KMS framebuffer objects so buffers that are scanned out
+ * repeatedly (swapchain images, recycled dmabufs from a decoder, client buffers)
+ * only pay for drmModeAddFB2 / drmModeRmFB once.
+ *
+ * Entries are keyed by the identity of the underlying buffer (GEM handle, or the
+ * inode of the dmabuf) together with format, modifier and geometry, so a buffer
+ * that gets reallocated with different parameters won't hit a stale framebuffer.
+ *
+ * Framebuffers handed out by @ref fbcache_get_for_gem / @ref fbcache_get_for_dmabuf
+ * are reference counted. As long as a reference is held, the entry is never evicted.
+ * Unreferenced entries are kept around (in LRU order) until the total size of the
+ * cached buffers exceeds the memory bound given to @ref fbcache_new.
+ */
+struct fbcache;
+
+struct fbcache_stats {
+    uint64_t n_hits;
+    uint64_t n_misses;
+    uint64_t n_evictions;
+
+    size_t n_entries;
+    size_t n_referenced_entries;
+    size_t n_bytes;
+    size_t max_bytes;
+
+    /// Distinct GEM handles the cache imported for dmabuf entries and still holds.
+    size_t n_imported_handles;
+};
+
+int fbcache_new(
+    struct fbcache **cache_out,
+    int drm_fd,
+    size_t max_bytes
+);
+
+/**
+ * @brief Remove all framebuffers from KMS and free the cache.
+ * Framebuffers that are still referenced are removed too, so make sure
+ * none of them are being scanned out anymore.
+ */
+void fbcache_destroy(
+    struct fbcache *cache
+);
+
+/**
+ * @brief Get a framebuffer for a buffer that's identified by GEM handles on the cache's DRM fd.
+ * (For example, a GBM BO or a dumb buffer.)
+ *
+ * The number of planes is the number of non-zero handles. Pass DRM_FORMAT_MOD_INVALID as the
+ * modifier to create the framebuffer without explicit modifiers.
+ *
+ * The returned framebuffer is referenced and needs to be released using @ref fbcache_release.
+ */
+int fbcache_get_for_gem(
+    struct fbcache *cache,
+    uint32_t width,
+    uint32_t height,
+    uint32_t format,
+    uint64_t modifier,
+    const uint32_t handles[4],
+    const uint32_t pitches[4],
+    const uint32_t offsets[4],
+    uint32_t *fb_id_out
+);
+
+/**
+ * @brief Get a framebuffer for a (possibly foreign) dmabuf.
+ *
+ * The number of planes is the number of non-zero pitches. The dmabuf fds are
+ * not consumed. The cache imports them on a second open file of the same DRM
+ * device, so the handles it gets are its own even for buffers allocated on the
+ * cache's fd (like GBM BOs), and keeps them until the last entry using them
+ * is evicted. The framebuffer can be used on the cache's fd like any other.
+ * The second file is authenticated through the cache's fd, so that has to be
+ * the DRM master at the time of the first import (unless we're root).
+ *
+ * The returned framebuffer is referenced and needs to be released using @ref fbcache_release.
+ */
+int fbcache_get_for_dmabuf(
+    struct fbcache *cache,
+    uint32_t width,
+    uint32_t height,
+    uint32_t format,
+    uint64_t modifier,
+    const int fds[4],
+    const uint32_t pitches[4],
+    const uint32_t offsets[4],
+    uint32_t *fb_id_out
+);
+
+/**
+ * @brief Drop a reference to a framebuffer obtained from this cache.
+ * The framebuffer stays cached until it's evicted.
+ */
+int fbcache_release(
+    struct fbcache *cache,
+    uint32_t fb_id
+);
+
+/**
+ * @brief Remove all framebuffers referencing this GEM handle, no matter if they're
+ * referenced or not. Call this before destroying the buffer behind the handle,
+ * since GEM handle values get reused by the kernel.
+ */
+void fbcache_forget_gem_handle(
+    struct fbcache *cache,
+    uint32_t handle
+);
+
+void fbcache_get_stats(
+    struct fbcache *cache,
+    struct fbcache_stats *stats_out
+);
+
+#endif
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include <fbcache.h>
+
+/// What meson counts as a skipped test.
+#define EXIT_SKIP 77
+
+static int failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "[fbcache-test] " __VA_ARGS__); \
+            failures++; \
+        } \
+    } while (0)
+
+/// The first DRM device that has dumb buffers, so this runs on any KMS driver.
+static int open_drm_device(void) {
+    char path[32];
+    uint64_t cap;
+    int fd;
+
+    for (int i = 0; i < 16; i++) {
+        snprintf(path, sizeof path, "/dev/dri/card%d", i);
+
+        fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        if (drmGetCap(fd, DRM_CAP_DUMB_BUFFER, &cap) == 0 && cap != 0) {
+            return fd;
+        }
+
+        close(fd);
+    }
+
+    return -1;
+}
+
+/// Whether @a handle is still a valid GEM handle on @a fd, by exporting it.
+static bool handle_is_valid(int fd, uint32_t handle) {
+    int dmabuf_fd;
+
+    if (drmPrimeHandleToFD(fd, handle, DRM_CLOEXEC, &dmabuf_fd) < 0) {
+        return false;
+    }
+
+    close(dmabuf_fd);
+    return true;
+}
+
+static int get_fb(struct fbcache *cache, int dmabuf_fd, uint32_t width, uint32_t height, uint32_t pitch, uint32_t *fb_id_out) {
+    int fds[4] = { dmabuf_fd, -1, -1, -1 };
+    uint32_t pitches[4] = { pitch, 0, 0, 0 };
+    uint32_t offsets[4] = { 0, 0, 0, 0 };
+
+    return fbcache_get_for_dmabuf(cache, width, height, DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_INVALID, fds, pitches, offsets, fb_id_out);
+}
+
+/*
+ * Two framebuffers with different geometry on one dmabuf, which was exported
+ * from a dumb buffer on the cache's own fd, like the GBM BOs of vulkan2.c.
+ * Both entries use the same imported GEM handle, which has to stay open until
+ * both are evicted, and the dumb buffer's handle must never be closed by the
+ * cache.
+ */
+int main(int argc, char **argv) {
+    struct drm_mode_create_dumb create_args;
+    struct drm_mode_destroy_dumb destroy_args;
+    struct fbcache_stats stats;
+    struct fbcache *cache;
+    uint32_t fb_a, fb_b;
+    int fd, dmabuf_fd, ok, ok_b;
+
+    fd = open_drm_device();
+    if (fd < 0) {
+        printf("[fbcache-test] No DRM device with dumb buffers, skipping.\n");
+        return EXIT_SKIP;
+    }
+
+    memset(&create_args, 0, sizeof create_args);
+    create_args.width = 64;
+    create_args.height = 64;
+    create_args.bpp = 32;
+    ok = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_args);
+    if (ok < 0) {
+        perror("[fbcache-test] Could not create dumb buffer. drmIoctl");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    ok = drmPrimeHandleToFD(fd, create_args.handle, DRM_CLOEXEC, &dmabuf_fd);
+    if (ok < 0) {
+        perror("[fbcache-test] Could not export dumb buffer. drmPrimeHandleToFD");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    // a bound of 0 evicts every entry as soon as it's released.
+    ok = fbcache_new(&cache, fd, 0);
+    if (ok != 0) {
+        fprintf(stderr, "[fbcache-test] Could not create framebuffer cache. fbcache_new: %s\n", strerror(ok));
+        close(dmabuf_fd);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    ok = get_fb(cache, dmabuf_fd, 64, 64, create_args.pitch, &fb_a);
+    if (ok != 0) {
+        printf("[fbcache-test] Can't add framebuffers on this device (%s), skipping.\n", strerror(ok));
+        fbcache_destroy(cache);
+        close(dmabuf_fd);
+        close(fd);
+        return EXIT_SKIP;
+    }
+
+    ok_b = get_fb(cache, dmabuf_fd, 32, 32, create_args.pitch, &fb_b);
+    CHECK(ok_b == 0, "Could not add the second framebuffer. fbcache_get_for_dmabuf: %s\n", strerror(ok_b));
+    CHECK(fb_a != fb_b, "Both geometries got the same framebuffer.\n");
+
+    fbcache_get_stats(cache, &stats);
+    CHECK(stats.n_entries == 2, "Expected 2 entries, got %zu.\n", stats.n_entries);
+    CHECK(stats.n_imported_handles == 1, "Expected both entries to share 1 imported handle, got %zu.\n", stats.n_imported_handles);
+
+    fbcache_release(cache, fb_a);
+
+    fbcache_get_stats(cache, &stats);
+    CHECK(stats.n_entries == 1, "Expected the first entry to be evicted, %zu entries left.\n", stats.n_entries);
+    CHECK(stats.n_imported_handles == 1, "Evicting the first entry closed the handle the second one uses.\n");
+    CHECK(handle_is_valid(fd, create_args.handle), "Evicting the first entry closed the dumb buffer's handle.\n");
+
+    if (ok_b == 0) {
+        fbcache_release(cache, fb_b);
+    }
+
+    fbcache_get_stats(cache, &stats);
+    CHECK(stats.n_entries == 0, "Expected all entries to be evicted, %zu entries left.\n", stats.n_entries);
+    CHECK(stats.n_imported_handles == 0, "%zu imported handles are still open after evicting everything.\n", stats.n_imported_handles);
+    CHECK(handle_is_valid(fd, create_args.handle), "Evicting the second entry closed the dumb buffer's handle.\n");
+
+    // the dmabuf can be imported again after its handle was closed.
+    ok = get_fb(cache, dmabuf_fd, 64, 64, create_args.pitch, &fb_a);
+    CHECK(ok == 0, "Could not add a framebuffer for the dmabuf again. fbcache_get_for_dmabuf: %s\n", strerror(ok));
+    if (ok == 0) {
+        fbcache_release(cache, fb_a);
+    }
+
+    fbcache_destroy(cache);
+
+    destroy_args.handle = create_args.handle;
+    ok = drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_args);
+    CHECK(ok == 0, "Could not destroy the dumb buffer, its handle was closed by the cache.\n");
+
+    close(dmabuf_fd);
+    close(fd);
+
+    if (failures > 0) {
+        fprintf(stderr, "[fbcache-test] %d checks failed.\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("[fbcache-test] All checks passed.\n");
+    return EXIT_SUCCESS;
+}
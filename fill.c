@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FILL_HAVE_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define FILL_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#include <fill.h>
+
+#define PIXEL(r, b) ((0xffu << 24) | ((uint32_t) (r) << 16) | (uint32_t) (b))
+
+static void fill_scalar(uint32_t *dst, uint32_t value, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = value;
+    }
+}
+
+static void copy_scalar(uint32_t *dst, const uint32_t *src, size_t n) {
+    memcpy(dst, src, n * sizeof *dst);
+}
+
+static void finish_none(void) {}
+
+static const struct fill_kernels scalar_kernels = {
+    .isa = FILL_ISA_SCALAR,
+    .name = "scalar",
+    .fill = fill_scalar,
+    .copy = copy_scalar,
+    .finish = finish_none,
+};
+
+/// Fill single pixels until @a dst is aligned to @a alignment bytes.
+static uint32_t *fill_head(uint32_t *dst, uint32_t value, size_t *n, uintptr_t alignment) {
+    while (*n > 0 && ((uintptr_t) dst & (alignment - 1)) != 0) {
+        *dst++ = value;
+        (*n)--;
+    }
+    return dst;
+}
+
+/// Copy single pixels until @a dst is aligned to @a alignment bytes. @a src is advanced as well.
+static uint32_t *copy_head(uint32_t *dst, const uint32_t **src, size_t *n, uintptr_t alignment) {
+    while (*n > 0 && ((uintptr_t) dst & (alignment - 1)) != 0) {
+        *dst++ = *(*src)++;
+        (*n)--;
+    }
+    return dst;
+}
+
+#ifdef FILL_HAVE_X86
+
+__attribute__((target("sse2")))
+static void fill_sse2(uint32_t *dst, uint32_t value, size_t n) {
+    __m128i v;
+
+    dst = fill_head(dst, value, &n, 16);
+
+    v = _mm_set1_epi32((int) value);
+
+    // one cache line per iteration
+    for (; n >= 16; n -= 16, dst += 16) {
+        _mm_stream_si128((__m128i *) dst + 0, v);
+        _mm_stream_si128((__m128i *) dst + 1, v);
+        _mm_stream_si128((__m128i *) dst + 2, v);
+        _mm_stream_si128((__m128i *) dst + 3, v);
+    }
+    for (; n >= 4; n -= 4, dst += 4) {
+        _mm_stream_si128((__m128i *) dst, v);
+    }
+
+    fill_scalar(dst, value, n);
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(uint32_t *dst, uint32_t value, size_t n) {
+    __m256i v;
+
+    dst = fill_head(dst, value, &n, 32);
+
+    v = _mm256_set1_epi32((int) value);
+
+    for (; n >= 16; n -= 16, dst += 16) {
+        _mm256_stream_si256((__m256i *) dst + 0, v);
+        _mm256_stream_si256((__m256i *) dst + 1, v);
+    }
+    for (; n >= 8; n -= 8, dst += 8) {
+        _mm256_stream_si256((__m256i *) dst, v);
+    }
+
+    fill_scalar(dst, value, n);
+}
+
+// the source is cached and usually not aligned the same way as the
+// destination, so only the stores are aligned.
+__attribute__((target("sse2")))
+static void copy_sse2(uint32_t *dst, const uint32_t *src, size_t n) {
+    __m128i a, b, c, d;
+
+    dst = copy_head(dst, &src, &n, 16);
+
+    for (; n >= 16; n -= 16, dst += 16, src += 16) {
+        a = _mm_loadu_si128((const __m128i *) src + 0);
+        b = _mm_loadu_si128((const __m128i *) src + 1);
+        c = _mm_loadu_si128((const __m128i *) src + 2);
+        d = _mm_loadu_si128((const __m128i *) src + 3);
+        _mm_stream_si128((__m128i *) dst + 0, a);
+        _mm_stream_si128((__m128i *) dst + 1, b);
+        _mm_stream_si128((__m128i *) dst + 2, c);
+        _mm_stream_si128((__m128i *) dst + 3, d);
+    }
+    for (; n >= 4; n -= 4, dst += 4, src += 4) {
+        _mm_stream_si128((__m128i *) dst, _mm_loadu_si128((const __m128i *) src));
+    }
+
+    copy_scalar(dst, src, n);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(uint32_t *dst, const uint32_t *src, size_t n) {
+    __m256i a, b;
+
+    dst = copy_head(dst, &src, &n, 32);
+
+    for (; n >= 16; n -= 16, dst += 16, src += 16) {
+        a = _mm256_loadu_si256((const __m256i *) src + 0);
+        b = _mm256_loadu_si256((const __m256i *) src + 1);
+        _mm256_stream_si256((__m256i *) dst + 0, a);
+        _mm256_stream_si256((__m256i *) dst + 1, b);
+    }
+    for (; n >= 8; n -= 8, dst += 8, src += 8) {
+        _mm256_stream_si256((__m256i *) dst, _mm256_loadu_si256((const __m256i *) src));
+    }
+
+    copy_scalar(dst, src, n);
+}
+
+__attribute__((target("sse2")))
+static void finish_sfence(void) {
+    _mm_sfence();
+}
+
+static const struct fill_kernels sse2_kernels = {
+    .isa = FILL_ISA_SSE2,
+    .name = "sse2",
+    .fill = fill_sse2,
+    .copy = copy_sse2,
+    .finish = finish_sfence,
+};
+
+static const struct fill_kernels avx2_kernels = {
+    .isa = FILL_ISA_AVX2,
+    .name = "avx2",
+    .fill = fill_avx2,
+    .copy = copy_avx2,
+    .finish = finish_sfence,
+};
+
+#endif
+
+#ifdef FILL_HAVE_NEON
+
+static void fill_neon(uint32_t *dst, uint32_t value, size_t n) {
+    uint32x4_t v;
+
+    dst = fill_head(dst, value, &n, 16);
+
+    v = vdupq_n_u32(value);
+
+    for (; n >= 16; n -= 16, dst += 16) {
+#ifdef __aarch64__
+        // there's no intrinsic for the non-temporal store pair instruction.
+        __asm__ volatile(
+            "stnp %q1, %q1, [%0]\n\t"
+            "stnp %q1, %q1, [%0, #32]"
+            :
+            : "r"(dst), "w"(v)
+            : "memory"
+        );
+#else
+        vst1q_u32(dst + 0, v);
+        vst1q_u32(dst + 4, v);
+        vst1q_u32(dst + 8, v);
+        vst1q_u32(dst + 12, v);
+#endif
+    }
+    for (; n >= 4; n -= 4, dst += 4) {
+        vst1q_u32(dst, v);
+    }
+
+    fill_scalar(dst, value, n);
+}
+
+static void copy_neon(uint32_t *dst, const uint32_t *src, size_t n) {
+    uint32x4_t a, b, c, d;
+
+    dst = copy_head(dst, &src, &n, 16);
+
+    for (; n >= 16; n -= 16, dst += 16, src += 16) {
+        a = vld1q_u32(src + 0);
+        b = vld1q_u32(src + 4);
+        c = vld1q_u32(src + 8);
+        d = vld1q_u32(src + 12);
+#ifdef __aarch64__
+        __asm__ volatile(
+            "stnp %q1, %q2, [%0]\n\t"
+            "stnp %q3, %q4, [%0, #32]"
+            :
+            : "r"(dst), "w"(a), "w"(b), "w"(c), "w"(d)
+            : "memory"
+        );
+#else
+        vst1q_u32(dst + 0, a);
+        vst1q_u32(dst + 4, b);
+        vst1q_u32(dst + 8, c);
+        vst1q_u32(dst + 12, d);
+#endif
+    }
+    for (; n >= 4; n -= 4, dst += 4, src += 4) {
+        vst1q_u32(dst, vld1q_u32(src));
+    }
+
+    copy_scalar(dst, src, n);
+}
+
+static const struct fill_kernels neon_kernels = {
+    .isa = FILL_ISA_NEON,
+    .name = "neon",
+    .fill = fill_neon,
+    .copy = copy_neon,
+    // stores are ordered by the dmb / syscall that comes before the atomic commit anyway.
+    .finish = finish_none,
+};
+
+#endif
+
+const struct fill_kernels *fill_get_kernels(enum fill_isa isa) {
+    switch (isa) {
+        case FILL_ISA_SCALAR:
+            return &scalar_kernels;
+#ifdef FILL_HAVE_X86
+        case FILL_ISA_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2") ? &sse2_kernels : NULL;
+        case FILL_ISA_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? &avx2_kernels : NULL;
+#endif
+#ifdef FILL_HAVE_NEON
+        case FILL_ISA_NEON:
+            // NEON is mandatory on aarch64, and on 32-bit ARM it's only compiled in
+            // if the toolchain targets it anyway.
+            return &neon_kernels;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+const struct fill_kernels *fill_get_best_kernels(void) {
+    static const enum fill_isa preference[] = { FILL_ISA_AVX2, FILL_ISA_SSE2, FILL_ISA_NEON };
+    const struct fill_kernels *kernels;
+    const char *forced;
+
+    // the stores are bound by memory bandwidth, so the widest kernels aren't
+    // always the fastest. Run fill-bench to see which one is on this machine.
+    forced = getenv("KMS_QUADS_FILL");
+    if (forced != NULL) {
+        for (int isa = 0; isa < FILL_N_ISAS; isa++) {
+            kernels = fill_get_kernels(isa);
+            if (kernels != NULL && strcmp(kernels->name, forced) == 0) {
+                return kernels;
+            }
+        }
+
+        fprintf(stderr, "[fill] KMS_QUADS_FILL=%s is not supported on this CPU, ignoring it.\n", forced);
+    }
+
+    for (size_t i = 0; i < sizeof preference / sizeof *preference; i++) {
+        kernels = fill_get_kernels(preference[i]);
+        if (kernels != NULL) {
+            return kernels;
+        }
+    }
+
+    return &scalar_kernels;
+}
+
+void fill_checkerboard(
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t pitch,
+    unsigned int width,
+    unsigned int height,
+    unsigned int split_x,
+    unsigned int split_y
+) {
+    fill_checkerboard_rows(kernels, dst, pitch, width, 0, height, split_x, split_y);
+}
+
+void fill_checkerboard_rows(
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t pitch,
+    unsigned int width,
+    unsigned int y_begin,
+    unsigned int y_end,
+    unsigned int split_x,
+    unsigned int split_y
+) {
+    fill_checkerboard_rect(kernels, dst, pitch, 0, width, y_begin, y_end, split_x, split_y);
+}
+
+void fill_checkerboard_rect(
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t pitch,
+    unsigned int x_begin,
+    unsigned int x_end,
+    unsigned int y_begin,
+    unsigned int y_end,
+    unsigned int split_x,
+    unsigned int split_y
+) {
+    unsigned int split;
+    uint32_t *row;
+    uint8_t b;
+
+    split = split_x < x_begin ? x_begin : split_x > x_end ? x_end : split_x;
+
+    for (unsigned int y = y_begin; y < y_end; y++) {
+        row = (uint32_t *) ((uint8_t *) dst + y * pitch);
+        b = y >= split_y ? 0xff : 0;
+
+        kernels->fill(row + x_begin, PIXEL(0, b), split - x_begin);
+        kernels->fill(row + split, PIXEL(0xff, b), x_end - split);
+    }
+
+    // non-temporal stores are only ordered by a fence on the same thread.
+    kernels->finish();
+}
+
+void fill_checkerboard_reference(
+    void *dst,
+    size_t pitch,
+    unsigned int width,
+    unsigned int height,
+    unsigned int split_x,
+    unsigned int split_y
+) {
+    for (unsigned int y = 0; y < height; y++) {
+        uint32_t *pix = (uint32_t *) ((uint8_t *) dst + y * pitch);
+        uint8_t b;
+
+        if (y >= split_y)
+            b = 0xff;
+        else
+            b = 0;
+
+        for (unsigned int x = 0; x < width; x++) {
+            uint32_t r;
+
+            if (x >= split_x)
+                r = 0xff;
+            else
+                r = 0;
+
+            *pix++ = (0xffu << 24 /* A */) | (r << 16) | \
+                (0x00 << 8 /* G */) | b;
+        }
+    }
+}
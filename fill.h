@@ -0,0 +1,118 @@
+#ifndef _FILL_H
+#define _FILL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief CPU kernels for filling dumb buffers.
+ *
+ * Dumb buffers are mapped write-combined, so reading from them is uncached
+ * and very slow, and writes are only fast if they cover whole cache lines.
+ * The kernels therefore only ever store, using the widest non-temporal stores
+ * the CPU has, and never read back from the destination.
+ *
+ * Which instruction sets are compiled in depends on the target architecture
+ * (SSE2 and AVX2 on x86, NEON on ARM), which of those are used depends on the
+ * CPU we're running on.
+ */
+enum fill_isa {
+    FILL_ISA_SCALAR,
+    FILL_ISA_SSE2,
+    FILL_ISA_AVX2,
+    FILL_ISA_NEON,
+
+    FILL_N_ISAS
+};
+
+struct fill_kernels {
+    enum fill_isa isa;
+    const char *name;
+
+    /// Set @a n pixels starting at @a dst to @a value. @a dst needs to be 4-byte aligned.
+    void (*fill)(uint32_t *dst, uint32_t value, size_t n);
+
+    /// Copy @a n pixels from (cached) @a src to @a dst. Both need to be 4-byte aligned.
+    void (*copy)(uint32_t *dst, const uint32_t *src, size_t n);
+
+    /// Make the non-temporal stores of all previous @ref fill and @ref copy calls visible,
+    /// needs to be called before the buffer is handed to KMS.
+    void (*finish)(void);
+};
+
+/**
+ * @brief The kernels for @a isa, or NULL if they're not compiled in or the CPU
+ * doesn't support them.
+ */
+const struct fill_kernels *fill_get_kernels(
+    enum fill_isa isa
+);
+
+/**
+ * @brief The widest kernels this CPU supports, or the ones named by the
+ * KMS_QUADS_FILL environment variable ("scalar", "sse2", "avx2", "neon").
+ * Never NULL.
+ */
+const struct fill_kernels *fill_get_best_kernels(void);
+
+/**
+ * @brief Fill a @a width x @a height XRGB8888 buffer with the kms-quads
+ * checkerboard: red right of @a split_x, blue below @a split_y.
+ *
+ * Every row consists of two constant spans, so rows are written with two
+ * @ref fill_kernels.fill calls each and nothing is read.
+ */
+void fill_checkerboard(
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t pitch,
+    unsigned int width,
+    unsigned int height,
+    unsigned int split_x,
+    unsigned int split_y
+);
+
+/**
+ * @brief Like @ref fill_checkerboard, but only fill the rows [@a y_begin, @a y_end),
+ * so the buffer can be filled in bands by multiple threads.
+ */
+void fill_checkerboard_rows(
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t pitch,
+    unsigned int width,
+    unsigned int y_begin,
+    unsigned int y_end,
+    unsigned int split_x,
+    unsigned int split_y
+);
+
+/**
+ * @brief Like @ref fill_checkerboard, but only fill the pixels [@a x_begin, @a x_end)
+ * of the rows [@a y_begin, @a y_end).
+ */
+void fill_checkerboard_rect(
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t pitch,
+    unsigned int x_begin,
+    unsigned int x_end,
+    unsigned int y_begin,
+    unsigned int y_end,
+    unsigned int split_x,
+    unsigned int split_y
+);
+
+/**
+ * @brief The original pixel-by-pixel checkerboard loop, to compare the kernels against.
+ */
+void fill_checkerboard_reference(
+    void *dst,
+    size_t pitch,
+    unsigned int width,
+    unsigned int height,
+    unsigned int split_x,
+    unsigned int split_y
+);
+
+#endif
@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <fill.h>
+#include <workpool.h>
+#include <shadowfb.h>
+#include <benchmark.h>
+
+// same as kms-quads.h & buffer.c
+#define NUM_ANIM_FRAMES 240
+#define BUFFER_QUEUE_DEPTH 3
+#define FILL_BAND_BYTES (256 * 1024)
+
+#define MAX_OUTPUTS 8
+
+struct fill_bench;
+
+struct fill_bench_output {
+    struct fill_bench *bench;
+
+    /// The ring of buffers, like the dumb buffers of an output. Only the
+    /// shadow run uses more than the first one.
+    void *buffers[BUFFER_QUEUE_DEPTH];
+
+    /// The buffer being filled.
+    void *mem;
+    unsigned int split_x, split_y;
+
+    struct shadowfb *shadow;
+};
+
+struct fill_bench {
+    size_t pitch;
+    unsigned int width, height;
+
+    /// Every frame, all outputs are filled. They're all the same size.
+    int n_outputs;
+    struct fill_bench_output outputs[MAX_OUTPUTS];
+
+    const struct fill_kernels *kernels;
+};
+
+static const char *metric_names[FILL_N_ISAS] = {
+    [FILL_ISA_SCALAR] = "scalar_mb_per_s",
+    [FILL_ISA_SSE2] = "sse2_mb_per_s",
+    [FILL_ISA_AVX2] = "avx2_mb_per_s",
+    [FILL_ISA_NEON] = "neon_mb_per_s",
+};
+
+static uint64_t get_monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void fill_band(void *userdata, unsigned int begin, unsigned int end) {
+    struct fill_bench_output *output = userdata;
+    struct fill_bench *bench = output->bench;
+
+    fill_checkerboard_rows(bench->kernels, output->mem, bench->pitch, bench->width, begin, end, output->split_x, output->split_y);
+}
+
+static void shadow_band(void *userdata, unsigned int begin, unsigned int end) {
+    struct fill_bench_output *output = userdata;
+    struct fill_bench *bench = output->bench;
+
+    shadowfb_fill_rows(output->shadow, bench->kernels, output->mem, bench->pitch, begin, end);
+}
+
+static unsigned int get_band_rows(const struct fill_bench *bench) {
+    return bench->pitch < FILL_BAND_BYTES ? FILL_BAND_BYTES / bench->pitch : 1;
+}
+
+/// Like @ref run, but going through a shadow framebuffer per output, and
+/// cycling through the ring of buffers. The average number of bytes written
+/// per frame and output is written to @a bytes_per_frame_out.
+static double run_shadow(struct fill_bench *bench, const struct fill_kernels *kernels, struct workpool *pool, int n_frames, double *bytes_per_frame_out) {
+    struct fill_bench_output *output;
+    uint64_t start, duration, bytes;
+
+    bench->kernels = kernels;
+    bytes = 0;
+
+    start = get_monotonic_ns();
+
+    for (int frame = 0; frame < n_frames; frame++) {
+        for (int i = 0; i < bench->n_outputs; i++) {
+            output = bench->outputs + i;
+            output->mem = output->buffers[frame % BUFFER_QUEUE_DEPTH];
+
+            bytes += shadowfb_begin_fill(
+                output->shadow,
+                frame % BUFFER_QUEUE_DEPTH,
+                bench->width * (frame % NUM_ANIM_FRAMES) / NUM_ANIM_FRAMES,
+                bench->height * (frame % NUM_ANIM_FRAMES) / NUM_ANIM_FRAMES
+            );
+
+            workpool_submit(pool, shadow_band, output, bench->height, get_band_rows(bench));
+        }
+
+        workpool_wait(pool);
+    }
+
+    duration = get_monotonic_ns() - start;
+
+    *bytes_per_frame_out = (double) bytes / n_frames / bench->n_outputs;
+    return (double) bench->width * bench->height * 4 * bench->n_outputs * n_frames / 1e6 / (duration / 1e9);
+}
+
+/// Check that going through the shadow gives the same pixels as the reference loop,
+/// with frames being skipped and the animation wrapping around.
+static bool verify_shadow(struct fill_bench *bench, const struct fill_kernels *kernels, struct workpool *pool, void *expected) {
+    struct fill_bench_output *output = bench->outputs;
+    unsigned int split_x, split_y;
+    int frame;
+
+    bench->kernels = kernels;
+
+    for (int i = 0; i < 2 * NUM_ANIM_FRAMES / 7; i++) {
+        frame = i * 7 % NUM_ANIM_FRAMES;
+        split_x = bench->width * frame / NUM_ANIM_FRAMES;
+        split_y = bench->height * frame / NUM_ANIM_FRAMES;
+
+        output->mem = output->buffers[i % BUFFER_QUEUE_DEPTH];
+        shadowfb_begin_fill(output->shadow, i % BUFFER_QUEUE_DEPTH, split_x, split_y);
+        workpool_submit(pool, shadow_band, output, bench->height, get_band_rows(bench));
+        workpool_wait(pool);
+
+        fill_checkerboard_reference(expected, bench->pitch, bench->width, bench->height, split_x, split_y);
+        if (memcmp(expected, output->mem, bench->pitch * bench->height) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// Fill @a n_frames frames of the animation of all outputs with @a kernels (or the reference loop if NULL),
+/// in bands on @a pool if it's not NULL, and return the throughput in MB/s.
+static double run(struct fill_bench *bench, const struct fill_kernels *kernels, struct workpool *pool, int n_frames) {
+    struct fill_bench_output *output;
+    unsigned int band_rows;
+    uint64_t start, duration;
+
+    bench->kernels = kernels;
+    band_rows = get_band_rows(bench);
+
+    start = get_monotonic_ns();
+
+    for (int frame = 0; frame < n_frames; frame++) {
+        for (int i = 0; i < bench->n_outputs; i++) {
+            output = bench->outputs + i;
+            output->mem = output->buffers[0];
+            output->split_x = bench->width * (frame % NUM_ANIM_FRAMES) / NUM_ANIM_FRAMES;
+            output->split_y = bench->height * (frame % NUM_ANIM_FRAMES) / NUM_ANIM_FRAMES;
+
+            if (kernels == NULL) {
+                fill_checkerboard_reference(output->mem, bench->pitch, bench->width, bench->height, output->split_x, output->split_y);
+            } else if (pool == NULL) {
+                fill_checkerboard(kernels, output->mem, bench->pitch, bench->width, bench->height, output->split_x, output->split_y);
+            } else {
+                workpool_submit(pool, fill_band, output, bench->height, band_rows);
+            }
+        }
+
+        if (pool != NULL) {
+            workpool_wait(pool);
+        }
+    }
+
+    duration = get_monotonic_ns() - start;
+
+    return (double) bench->width * bench->height * 4 * bench->n_outputs * n_frames / 1e6 / (duration / 1e9);
+}
+
+/// Check @a kernels produce the same pixels as the reference loop, for an odd split.
+static bool verify(struct fill_bench *bench, const struct fill_kernels *kernels, struct workpool *pool, void *expected) {
+    struct fill_bench_output *output = bench->outputs;
+
+    output->mem = output->buffers[0];
+    output->split_x = bench->width / 3 + 1;
+    output->split_y = bench->height / 3 + 1;
+    fill_checkerboard_reference(expected, bench->pitch, bench->width, bench->height, output->split_x, output->split_y);
+
+    bench->kernels = kernels;
+    if (pool != NULL) {
+        workpool_submit(pool, fill_band, output, bench->height, 7);
+        workpool_wait(pool);
+    } else {
+        fill_checkerboard(kernels, output->mem, bench->pitch, bench->width, bench->height, output->split_x, output->split_y);
+    }
+
+    return memcmp(expected, output->mem, bench->pitch * bench->height) == 0;
+}
+
+static void print_usage(const char *argv0) {
+    printf(
+        "usage: %s [options]\n"
+        "\n"
+        "Measures how fast the checkerboard of the dumb buffer path can be filled\n"
+        "with each of the fill kernels this CPU supports, compared to the original\n"
+        "pixel-by-pixel loop, how the fastest one scales when the buffers are filled\n"
+        "in bands by worker threads, and how many bytes per frame are left to write\n"
+        "when only the damage is copied from a shadow framebuffer. Fills ordinary\n"
+        "(cached) memory, so the absolute numbers are higher than for a\n"
+        "write-combined dumb buffer.\n"
+        "\n"
+        "  --size=WIDTHxHEIGHT        Buffer size. (default: 1920x1080)\n"
+        "  --outputs=N                Number of buffers filled per frame. (default: 1)\n"
+        "  --threads=N                Number of worker threads for the threaded run,\n"
+        "                             0 for one per CPU. (default: 0)\n"
+        "  --frames=N                 Number of frames to fill per kernel. (default: 240)\n"
+        "  --benchmark=FILE           Write the MB/s of each kernel as JSON to FILE\n"
+        "                             (or stdout if FILE is \"-\").\n"
+        "  --baseline=FILE            Compare against the JSON written by an earlier\n"
+        "                             --benchmark run and fail if anything regressed.\n"
+        "  --tolerance=PERCENT        How much worse than the baseline is still ok. (default: 10)\n"
+        "  --help                     Show this help.\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    const struct fill_kernels *kernels;
+    struct benchmark_report report;
+    const struct fill_kernels *best_kernels;
+    struct fill_bench bench;
+    struct workpool *pool;
+    const char *benchmark_path, *baseline_path;
+    double tolerance, reference, mb_per_s, best, bytes_per_frame;
+    void *expected;
+    int opt, n_frames, n_threads, n_regressions, ok;
+
+    static const struct option long_options[] = {
+        { "size", required_argument, NULL, 's' },
+        { "outputs", required_argument, NULL, 'o' },
+        { "threads", required_argument, NULL, 'j' },
+        { "frames", required_argument, NULL, 'n' },
+        { "benchmark", required_argument, NULL, 'b' },
+        { "baseline", required_argument, NULL, 'B' },
+        { "tolerance", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    bench.width = 1920;
+    bench.height = 1080;
+    bench.n_outputs = 1;
+    n_threads = 0;
+    n_frames = NUM_ANIM_FRAMES;
+    benchmark_path = NULL;
+    baseline_path = NULL;
+    tolerance = 10.0;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%ux%u", &bench.width, &bench.height) != 2 || bench.width == 0 || bench.height == 0) {
+                    fprintf(stderr, "[fill-bench] Invalid size \"%s\", expected WIDTHxHEIGHT.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'o':
+                bench.n_outputs = atoi(optarg);
+                if (bench.n_outputs <= 0 || bench.n_outputs > MAX_OUTPUTS) {
+                    fprintf(stderr, "[fill-bench] Invalid number of outputs \"%s\", expected 1 to %d.\n", optarg, MAX_OUTPUTS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                n_threads = atoi(optarg);
+                if (n_threads < 0) {
+                    fprintf(stderr, "[fill-bench] Invalid number of threads \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                n_frames = atoi(optarg);
+                if (n_frames <= 0) {
+                    fprintf(stderr, "[fill-bench] Invalid number of frames \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                benchmark_path = optarg;
+                break;
+            case 'B':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    // dumb buffers usually have a pitch aligned to 64 bytes.
+    bench.pitch = ((size_t) bench.width * 4 + 63) & ~(size_t) 63;
+
+    for (int i = 0; i < bench.n_outputs; i++) {
+        bench.outputs[i].bench = &bench;
+
+        for (int j = 0; j < BUFFER_QUEUE_DEPTH; j++) {
+            bench.outputs[i].buffers[j] = malloc(bench.pitch * bench.height);
+            if (bench.outputs[i].buffers[j] == NULL) {
+                fprintf(stderr, "[fill-bench] Couldn't allocate the buffers.\n");
+                return EXIT_FAILURE;
+            }
+
+            // also faults in the pages, so that doesn't count towards the first run.
+            memset(bench.outputs[i].buffers[j], 0, bench.pitch * bench.height);
+        }
+    }
+
+    expected = malloc(bench.pitch * bench.height);
+    if (expected == NULL) {
+        fprintf(stderr, "[fill-bench] Couldn't allocate the buffers.\n");
+        return EXIT_FAILURE;
+    }
+
+    // the padding at the end of the rows is never written, but compared.
+    memset(expected, 0, bench.pitch * bench.height);
+
+    ok = workpool_new(&pool, n_threads, true);
+    if (ok != 0) {
+        fprintf(stderr, "[fill-bench] Couldn't create the worker threads: %s\n", strerror(ok));
+        return EXIT_FAILURE;
+    }
+
+    benchmark_report_init(&report, "fill");
+
+    reference = run(&bench, NULL, NULL, n_frames);
+    printf("%-10s %8.0f MB/s\n", "reference", reference);
+    benchmark_report_add(&report, "reference_mb_per_s", "MB/s", reference, true);
+
+    best = 0.0;
+    best_kernels = NULL;
+    ok = EXIT_SUCCESS;
+    for (int isa = 0; isa < FILL_N_ISAS; isa++) {
+        kernels = fill_get_kernels(isa);
+        if (kernels == NULL) {
+            continue;
+        }
+
+        if (!verify(&bench, kernels, NULL, expected)) {
+            fprintf(stderr, "[fill-bench] The %s kernels fill different pixels than the reference loop.\n", kernels->name);
+            ok = EXIT_FAILURE;
+            continue;
+        }
+
+        mb_per_s = run(&bench, kernels, NULL, n_frames);
+        printf("%-10s %8.0f MB/s (%.2fx)\n", kernels->name, mb_per_s, mb_per_s / reference);
+        benchmark_report_add(&report, metric_names[isa], "MB/s", mb_per_s, true);
+
+        if (mb_per_s > best) {
+            best = mb_per_s;
+            best_kernels = kernels;
+        }
+    }
+
+    printf("dispatch picks %s\n", fill_get_best_kernels()->name);
+    benchmark_report_add(&report, "best_speedup", "x", best / reference, true);
+
+    if (best_kernels != NULL) {
+        if (verify(&bench, best_kernels, pool, expected)) {
+            mb_per_s = run(&bench, best_kernels, pool, n_frames);
+            printf(
+                "%s on %d threads: %.0f MB/s (%.2fx single-threaded)\n",
+                best_kernels->name,
+                workpool_get_concurrency(pool),
+                mb_per_s,
+                mb_per_s / best
+            );
+            benchmark_report_add(&report, "threaded_mb_per_s", "MB/s", mb_per_s, true);
+        } else {
+            fprintf(stderr, "[fill-bench] Filling in bands on multiple threads gives different pixels than the reference loop.\n");
+            ok = EXIT_FAILURE;
+        }
+    }
+
+    if (best_kernels != NULL) {
+        for (int i = 0; i < bench.n_outputs; i++) {
+            if (shadowfb_new(&bench.outputs[i].shadow, bench.width, bench.height, BUFFER_QUEUE_DEPTH) != 0) {
+                fprintf(stderr, "[fill-bench] Couldn't allocate the shadow framebuffers.\n");
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (verify_shadow(&bench, best_kernels, pool, expected)) {
+            mb_per_s = run_shadow(&bench, best_kernels, pool, n_frames, &bytes_per_frame);
+            printf(
+                "%s from shadow: %.0f MB/s (%.2fx single-threaded), %.0f bytes written per frame (%.1f%% of the buffer)\n",
+                best_kernels->name,
+                mb_per_s,
+                mb_per_s / best,
+                bytes_per_frame,
+                100.0 * bytes_per_frame / (bench.pitch * bench.height)
+            );
+            benchmark_report_add(&report, "shadow_mb_per_s", "MB/s", mb_per_s, true);
+            benchmark_report_add(&report, "shadow_bytes_per_frame", "bytes", bytes_per_frame, false);
+        } else {
+            fprintf(stderr, "[fill-bench] Copying the damage from the shadow framebuffer gives different pixels than the reference loop.\n");
+            ok = EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < bench.n_outputs; i++) {
+            shadowfb_destroy(bench.outputs[i].shadow);
+        }
+    }
+
+    workpool_destroy(pool);
+    free(expected);
+    for (int i = 0; i < bench.n_outputs; i++) {
+        for (int j = 0; j < BUFFER_QUEUE_DEPTH; j++) {
+            free(bench.outputs[i].buffers[j]);
+        }
+    }
+
+    if (benchmark_path != NULL && benchmark_report_save(&report, benchmark_path) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (baseline_path != NULL) {
+        if (benchmark_report_compare(&report, baseline_path, tolerance / 100.0, stdout, &n_regressions) != 0 || n_regressions > 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return ok;
+}
@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+
+#include <flip_trace.h>
+#include <frame_timing.h>
+#include <benchmark.h>
+
+/// How many of the last frames the adaptive policy looks at.
+#define ADAPTIVE_WINDOW 32
+
+/// What the adaptive policy adds to the 95th percentile of the recent render times.
+#define ADAPTIVE_SLACK_NS (1000000ull)
+
+enum policy {
+    /// What main.c does: repaint as soon as the last flip completed, commit when done.
+    POLICY_IMMEDIATE,
+
+    /// Wait until the repaint margin before the next vblank, then repaint. Less latency, but the frame has to be done in time.
+    POLICY_DEADLINE,
+
+    /// Like @ref POLICY_DEADLINE, with the margin following the recent render times.
+    POLICY_ADAPTIVE,
+
+    N_POLICIES
+};
+
+static const char *policy_names[N_POLICIES] = {
+    [POLICY_IMMEDIATE] = "immediate",
+    [POLICY_DEADLINE] = "deadline",
+    [POLICY_ADAPTIVE] = "adaptive",
+};
+
+/// The benchmark_report metric names of each policy: missed frames, skipped vblanks, p50 and p99 latency.
+static const char *metric_names[N_POLICIES][4] = {
+    [POLICY_IMMEDIATE] = { "immediate_missed_frames", "immediate_skipped_vblanks", "immediate_latency_p50_ms", "immediate_latency_p99_ms" },
+    [POLICY_DEADLINE] = { "deadline_missed_frames", "deadline_skipped_vblanks", "deadline_latency_p50_ms", "deadline_latency_p99_ms" },
+    [POLICY_ADAPTIVE] = { "adaptive_missed_frames", "adaptive_skipped_vblanks", "adaptive_latency_p50_ms", "adaptive_latency_p99_ms" },
+};
+
+/// The vblanks of one CRTC, as far as the trace saw them.
+struct timeline {
+    uint32_t crtc_id;
+
+    size_t n;
+    uint32_t *sequences;
+    uint64_t *timestamps;
+
+    /// Estimated from the timestamps, since the panel may not run at exactly the mode's refresh rate.
+    uint64_t interval_ns;
+};
+
+/// The workload of one frame, taken from the trace.
+struct frame {
+    /// From the flip event of the frame before to starting to render. Event dispatch, and other outputs repainting.
+    uint64_t wake_ns;
+
+    /// From starting to render to the frame being ready to flip: rendered and committed.
+    uint64_t work_ns;
+};
+
+struct replay_stats {
+    int n_frames;
+
+    /// Frames that flipped later than the vblank they were scheduled for.
+    int n_missed;
+
+    /// Vblanks that didn't show a new frame.
+    int n_skipped_vblanks;
+
+    /// Render start to flip of every frame.
+    int64_t *latencies;
+};
+
+static uint64_t get_monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_i64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/// Index of the last element <= @a value of the sorted array @a values, or -1.
+static ssize_t find_last_le_u64(const uint64_t *values, size_t n, uint64_t value) {
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (values[mid] <= value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (ssize_t) lo - 1;
+}
+
+static ssize_t find_last_le_u32(const uint32_t *values, size_t n, uint32_t value) {
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (values[mid] <= value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (ssize_t) lo - 1;
+}
+
+/**
+ * @brief Collect the flips of @a crtc_id from the trace into a timeline, and the
+ * workload of each frame into @a frames.
+ */
+static int timeline_new(struct timeline *timeline, struct frame **frames_out, size_t *n_frames_out, const struct flip_trace_event *events, size_t n_events, uint32_t crtc_id) {
+    const struct flip_trace_event *prev = NULL;
+    struct frame *frames;
+    uint64_t *intervals;
+    size_t n_frames = 0, n_intervals = 0;
+
+    memset(timeline, 0, sizeof *timeline);
+    timeline->crtc_id = crtc_id;
+
+    timeline->sequences = malloc(n_events * sizeof *timeline->sequences);
+    timeline->timestamps = malloc(n_events * sizeof *timeline->timestamps);
+    intervals = malloc(n_events * sizeof *intervals);
+    frames = malloc(n_events * sizeof *frames);
+    if (timeline->sequences == NULL || timeline->timestamps == NULL || intervals == NULL || frames == NULL) {
+        free(frames);
+        free(intervals);
+        free(timeline->timestamps);
+        free(timeline->sequences);
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < n_events; i++) {
+        const struct flip_trace_event *event = events + i;
+
+        if (event->crtc_id != crtc_id) {
+            continue;
+        }
+
+        // a flip always lands on a later vblank; anything else is a driver bug we can't replay.
+        if (prev != NULL && (event->sequence <= prev->sequence || event->flip_ns <= prev->flip_ns)) {
+            continue;
+        }
+
+        timeline->sequences[timeline->n] = event->sequence;
+        timeline->timestamps[timeline->n] = event->flip_ns;
+        timeline->n++;
+
+        if (prev != NULL) {
+            intervals[n_intervals++] = (event->flip_ns - prev->flip_ns) / (event->sequence - prev->sequence);
+
+            frames[n_frames].wake_ns = event->render_start_ns > prev->flip_ns ? event->render_start_ns - prev->flip_ns : 0;
+            frames[n_frames].work_ns = 0;
+            if (event->render_start_ns != 0) {
+                uint64_t ready = event->render_done_ns > event->commit_ns ? event->render_done_ns : event->commit_ns;
+                frames[n_frames].work_ns = ready > event->render_start_ns ? ready - event->render_start_ns : 0;
+            }
+            n_frames++;
+        }
+
+        prev = event;
+    }
+
+    // the median, so a few late events don't skew it.
+    if (n_intervals > 0) {
+        qsort(intervals, n_intervals, sizeof *intervals, compare_u64);
+        timeline->interval_ns = intervals[n_intervals / 2];
+    } else if (prev != NULL) {
+        timeline->interval_ns = prev->refresh_interval_ns;
+    }
+    free(intervals);
+
+    if (timeline->n == 0 || timeline->interval_ns == 0) {
+        free(frames);
+        free(timeline->timestamps);
+        free(timeline->sequences);
+        return EINVAL;
+    }
+
+    *frames_out = frames;
+    *n_frames_out = n_frames;
+    return 0;
+}
+
+static void timeline_fini(struct timeline *timeline) {
+    free(timeline->timestamps);
+    free(timeline->sequences);
+}
+
+/// The timestamp of vblank @a sequence: as recorded if the trace has it, otherwise extrapolated from the last one before.
+static uint64_t timeline_get_vblank(const struct timeline *timeline, uint32_t sequence) {
+    ssize_t i;
+
+    i = find_last_le_u32(timeline->sequences, timeline->n, sequence);
+    if (i < 0) {
+        return timeline->timestamps[0] - (uint64_t) (timeline->sequences[0] - sequence) * timeline->interval_ns;
+    }
+
+    return timeline->timestamps[i] + (uint64_t) (sequence - timeline->sequences[i]) * timeline->interval_ns;
+}
+
+/// The first vblank after @a time_ns, where a flip committed at @a time_ns would land.
+static uint64_t timeline_get_next_vblank(const struct timeline *timeline, uint64_t time_ns, uint32_t *sequence_out) {
+    uint32_t sequence;
+    uint64_t vblank;
+    ssize_t i;
+
+    i = find_last_le_u64(timeline->timestamps, timeline->n, time_ns);
+    if (i < 0) {
+        *sequence_out = timeline->sequences[0];
+        return timeline->timestamps[0];
+    }
+
+    // the recorded timestamps jitter, so check the estimate against them.
+    sequence = timeline->sequences[i] + (time_ns - timeline->timestamps[i]) / timeline->interval_ns + 1;
+    vblank = timeline_get_vblank(timeline, sequence);
+    while (vblank <= time_ns) {
+        sequence++;
+        vblank = timeline_get_vblank(timeline, sequence);
+    }
+
+    *sequence_out = sequence;
+    return vblank;
+}
+
+/// The @a percentile of the @a n values in @a sorted.
+static int64_t get_percentile(const int64_t *sorted, int n, int percentile) {
+    if (n == 0) {
+        return 0;
+    }
+    return sorted[(int) ((int64_t) (n - 1) * percentile / 100)];
+}
+
+static uint64_t get_adaptive_margin(const uint64_t *recent, size_t n, uint64_t interval_ns) {
+    uint64_t sorted[ADAPTIVE_WINDOW], margin;
+
+    if (n == 0) {
+        return interval_ns / 2;
+    }
+
+    memcpy(sorted, recent, n * sizeof *sorted);
+    qsort(sorted, n, sizeof *sorted, compare_u64);
+
+    margin = sorted[(n - 1) * 95 / 100] + ADAPTIVE_SLACK_NS;
+    if (margin > interval_ns) {
+        margin = interval_ns;
+    }
+    return margin;
+}
+
+/**
+ * @brief Run the frames of a trace through a scheduling policy, on the vblanks of the trace.
+ *
+ * Every frame starts when its policy says so, but not before the flip event of the frame
+ * before plus its recorded wake-up delay, and takes as long to render and commit as it did
+ * when it was recorded. It flips on the first vblank after that.
+ */
+static void replay(const struct timeline *timeline, const struct frame *frames, size_t n_frames, enum policy policy, uint64_t margin_ns, struct replay_stats *stats) {
+    uint64_t recent[ADAPTIVE_WINDOW];
+    uint64_t interval = timeline->interval_ns;
+    uint64_t last_flip, event, start, target, ready, flip;
+    uint32_t last_sequence, sequence;
+    size_t n_recent = 0;
+
+    stats->n_frames = 0;
+    stats->n_missed = 0;
+    stats->n_skipped_vblanks = 0;
+
+    last_flip = timeline->timestamps[0];
+    last_sequence = timeline->sequences[0];
+
+    for (size_t i = 0; i < n_frames; i++) {
+        event = last_flip + frames[i].wake_ns;
+
+        if (policy == POLICY_ADAPTIVE) {
+            margin_ns = get_adaptive_margin(recent, n_recent, interval);
+        }
+
+        // the vblank the frame is for, the same way main.c predicts it.
+        target = frame_timing_predict(last_flip, event, interval, margin_ns, NULL);
+
+        start = event;
+        if (policy != POLICY_IMMEDIATE && target - margin_ns > start) {
+            start = target - margin_ns;
+        }
+
+        ready = start + frames[i].work_ns;
+        flip = timeline_get_next_vblank(timeline, ready, &sequence);
+
+        if (flip > target + interval / 2) {
+            stats->n_missed++;
+        }
+        stats->n_skipped_vblanks += sequence - last_sequence - 1;
+        stats->latencies[stats->n_frames++] = (int64_t) (flip - start);
+
+        // a ring of the last ADAPTIVE_WINDOW render times.
+        if (n_recent < ADAPTIVE_WINDOW) {
+            recent[n_recent++] = frames[i].work_ns;
+        } else {
+            recent[i % ADAPTIVE_WINDOW] = frames[i].work_ns;
+        }
+
+        last_flip = flip;
+        last_sequence = sequence;
+    }
+}
+
+/// The same statistics for what actually happened when the trace was recorded.
+static void get_recorded_stats(const struct timeline *timeline, const struct flip_trace_event *events, size_t n_events, struct replay_stats *stats) {
+    const struct flip_trace_event *prev = NULL;
+
+    stats->n_frames = 0;
+    stats->n_missed = 0;
+    stats->n_skipped_vblanks = 0;
+
+    for (size_t i = 0; i < n_events; i++) {
+        const struct flip_trace_event *event = events + i;
+
+        if (event->crtc_id != timeline->crtc_id) {
+            continue;
+        }
+        if (prev != NULL && (event->sequence <= prev->sequence || event->flip_ns <= prev->flip_ns)) {
+            continue;
+        }
+
+        if (prev != NULL) {
+            if (event->predicted_ns != 0 && event->flip_ns > event->predicted_ns + timeline->interval_ns / 2) {
+                stats->n_missed++;
+            }
+            stats->n_skipped_vblanks += event->sequence - prev->sequence - 1;
+            stats->latencies[stats->n_frames++] = event->render_start_ns != 0 ? (int64_t) (event->flip_ns - event->render_start_ns) : 0;
+        }
+
+        prev = event;
+    }
+}
+
+static void print_stats(const char *name, struct replay_stats *stats) {
+    qsort(stats->latencies, stats->n_frames, sizeof *stats->latencies, compare_i64);
+
+    printf(
+        "  %-10s %8d %8d %9.2f %9.2f %9.2f\n",
+        name,
+        stats->n_missed,
+        stats->n_skipped_vblanks,
+        get_percentile(stats->latencies, stats->n_frames, 50) / 1e6,
+        get_percentile(stats->latencies, stats->n_frames, 99) / 1e6,
+        stats->n_frames > 0 ? stats->latencies[stats->n_frames - 1] / 1e6 : 0.0
+    );
+}
+
+static void print_usage(const char *argv0) {
+    printf(
+        "usage: %s [options] TRACE\n"
+        "\n"
+        "Replays a flip trace recorded with KMS_QUADS_RECORD (or kms-mock-bench\n"
+        "--record) through different frame scheduling policies, on the vblank\n"
+        "timestamps and with the render times of the trace, and reports the\n"
+        "missed frames and render-to-flip latency of each.\n"
+        "\n"
+        "Policies:\n"
+        "  immediate  Repaint as soon as the last frame flipped (what kms-quads does).\n"
+        "  deadline   Repaint the margin before the next vblank.\n"
+        "  adaptive   Repaint the recent 95th percentile render time + 1ms before the\n"
+        "             next vblank.\n"
+        "\n"
+        "  --margin=MS                The repaint margin of the immediate and deadline\n"
+        "                             policies. (default: 4)\n"
+        "  --benchmark=FILE           Write the results as JSON to FILE\n"
+        "                             (or stdout if FILE is \"-\").\n"
+        "  --baseline=FILE            Compare against the JSON written by an earlier\n"
+        "                             --benchmark run and fail if anything regressed.\n"
+        "  --tolerance=PERCENT        How much worse than the baseline is still ok. (default: 10)\n"
+        "  --help                     Show this help.\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    struct benchmark_report report;
+    struct flip_trace_event *events;
+    struct replay_stats stats, totals[N_POLICIES];
+    struct timeline timeline;
+    struct frame *frames;
+    const char *benchmark_path, *baseline_path;
+    uint32_t crtc_ids[32];
+    uint64_t margin_ns, start, replay_ns, simulated_ns;
+    double tolerance;
+    size_t n_events, n_frames;
+    int opt, n_crtcs, n_regressions, ok;
+
+    static const struct option long_options[] = {
+        { "margin", required_argument, NULL, 'm' },
+        { "benchmark", required_argument, NULL, 'b' },
+        { "baseline", required_argument, NULL, 'B' },
+        { "tolerance", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    margin_ns = 4 * 1000000ull;
+    benchmark_path = NULL;
+    baseline_path = NULL;
+    tolerance = 10.0;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'm':
+                margin_ns = (uint64_t) (atof(optarg) * 1e6);
+                if (margin_ns == 0) {
+                    fprintf(stderr, "[flip-replay] Invalid repaint margin \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                benchmark_path = optarg;
+                break;
+            case 'B':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ok = flip_trace_load(argv[optind], &events, &n_events);
+    if (ok != 0) {
+        return EXIT_FAILURE;
+    }
+
+    n_crtcs = 0;
+    for (size_t i = 0; i < n_events; i++) {
+        bool found = false;
+
+        for (int j = 0; j < n_crtcs; j++) {
+            found |= crtc_ids[j] == events[i].crtc_id;
+        }
+        if (!found && n_crtcs < 32) {
+            crtc_ids[n_crtcs++] = events[i].crtc_id;
+        }
+    }
+
+    stats.latencies = malloc((n_events + 1) * sizeof *stats.latencies);
+    for (int i = 0; i < N_POLICIES; i++) {
+        totals[i] = (struct replay_stats) { .latencies = malloc((n_events + 1) * sizeof *stats.latencies) };
+    }
+    if (stats.latencies == NULL) {
+        fprintf(stderr, "[flip-replay] Couldn't allocate the statistics.\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < N_POLICIES; i++) {
+        if (totals[i].latencies == NULL) {
+            fprintf(stderr, "[flip-replay] Couldn't allocate the statistics.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    benchmark_report_init(&report, "flip-replay");
+
+    replay_ns = 0;
+    simulated_ns = 0;
+    for (int i = 0; i < n_crtcs; i++) {
+        ok = timeline_new(&timeline, &frames, &n_frames, events, n_events, crtc_ids[i]);
+        if (ok != 0) {
+            fprintf(stderr, "[flip-replay] Not enough flips on CRTC %u to replay.\n", crtc_ids[i]);
+            continue;
+        }
+
+        printf("CRTC %u: %zu frames, %.3f ms refresh interval\n", crtc_ids[i], n_frames, timeline.interval_ns / 1e6);
+        printf("  %-10s %8s %8s %9s %9s %9s\n", "policy", "missed", "skipped", "p50 ms", "p99 ms", "max ms");
+
+        get_recorded_stats(&timeline, events, n_events, &stats);
+        print_stats("recorded", &stats);
+
+        for (int j = 0; j < N_POLICIES; j++) {
+            start = get_monotonic_ns();
+            replay(&timeline, frames, n_frames, j, margin_ns, &stats);
+            replay_ns += get_monotonic_ns() - start;
+            simulated_ns += timeline.timestamps[timeline.n - 1] - timeline.timestamps[0];
+
+            print_stats(policy_names[j], &stats);
+
+            totals[j].n_missed += stats.n_missed;
+            totals[j].n_skipped_vblanks += stats.n_skipped_vblanks;
+            memcpy(totals[j].latencies + totals[j].n_frames, stats.latencies, stats.n_frames * sizeof *stats.latencies);
+            totals[j].n_frames += stats.n_frames;
+        }
+
+        free(frames);
+        timeline_fini(&timeline);
+    }
+
+    printf("replayed %.1f s of frames in %.3f ms (%.0fx real time)\n", simulated_ns / 1e9, replay_ns / 1e6, replay_ns > 0 ? (double) simulated_ns / replay_ns : 0.0);
+
+    for (int i = 0; i < N_POLICIES; i++) {
+        qsort(totals[i].latencies, totals[i].n_frames, sizeof *totals[i].latencies, compare_i64);
+
+        benchmark_report_add(&report, metric_names[i][0], "frames", totals[i].n_missed, false);
+        benchmark_report_add(&report, metric_names[i][1], "vblanks", totals[i].n_skipped_vblanks, false);
+        benchmark_report_add(&report, metric_names[i][2], "ms", get_percentile(totals[i].latencies, totals[i].n_frames, 50) / 1e6, false);
+        benchmark_report_add(&report, metric_names[i][3], "ms", get_percentile(totals[i].latencies, totals[i].n_frames, 99) / 1e6, false);
+
+        free(totals[i].latencies);
+    }
+
+    free(stats.latencies);
+    free(events);
+
+    if (benchmark_path != NULL && benchmark_report_save(&report, benchmark_path) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (baseline_path != NULL) {
+        if (benchmark_report_compare(&report, baseline_path, tolerance / 100.0, stdout, &n_regressions) != 0 || n_regressions > 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
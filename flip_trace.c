@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <flip_trace.h>
+
+#define FLIP_TRACE_HEADER "# kms-quads flip trace"
+#define FLIP_TRACE_VERSION 1
+
+struct flip_recorder {
+    FILE *file;
+    char *buffer;
+};
+
+int flip_recorder_new(struct flip_recorder **recorder_out, const char *path) {
+    struct flip_recorder *recorder;
+    int ok;
+
+    recorder = malloc(sizeof *recorder);
+    if (recorder == NULL) {
+        return ENOMEM;
+    }
+
+    recorder->file = fopen(path, "w");
+    if (recorder->file == NULL) {
+        ok = errno;
+        fprintf(stderr, "[flip_trace] Could not open \"%s\" for writing. fopen: %s\n", path, strerror(ok));
+        free(recorder);
+        return ok;
+    }
+
+    // a few hundred events, so we're not writing to the file every frame.
+    recorder->buffer = malloc(64 * 1024);
+    if (recorder->buffer != NULL) {
+        setvbuf(recorder->file, recorder->buffer, _IOFBF, 64 * 1024);
+    }
+
+    fprintf(
+        recorder->file,
+        FLIP_TRACE_HEADER " %d\n"
+        "# crtc sequence flip_ns predicted_ns refresh_ns render_start_ns render_done_ns commit_ns\n",
+        FLIP_TRACE_VERSION
+    );
+
+    *recorder_out = recorder;
+    return 0;
+}
+
+void flip_recorder_destroy(struct flip_recorder *recorder) {
+    if (fclose(recorder->file) != 0) {
+        perror("[flip_trace] Could not write the flip trace. fclose");
+    }
+    free(recorder->buffer);
+    free(recorder);
+}
+
+void flip_recorder_add(struct flip_recorder *recorder, const struct flip_trace_event *event) {
+    fprintf(
+        recorder->file,
+        "%" PRIu32 " %" PRIu32 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+        event->crtc_id,
+        event->sequence,
+        event->flip_ns,
+        event->predicted_ns,
+        event->refresh_interval_ns,
+        event->render_start_ns,
+        event->render_done_ns,
+        event->commit_ns
+    );
+}
+
+int flip_trace_load(const char *path, struct flip_trace_event **events_out, size_t *n_events_out) {
+    struct flip_trace_event *events, event;
+    size_t n_events, n_allocated;
+    char line[512];
+    FILE *file;
+    int version, line_no, ok;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        ok = errno;
+        fprintf(stderr, "[flip_trace] Could not open \"%s\". fopen: %s\n", path, strerror(ok));
+        return ok;
+    }
+
+    if (fgets(line, sizeof line, file) == NULL ||
+        strncmp(line, FLIP_TRACE_HEADER, strlen(FLIP_TRACE_HEADER)) != 0 ||
+        sscanf(line + strlen(FLIP_TRACE_HEADER), "%d", &version) != 1) {
+        fprintf(stderr, "[flip_trace] \"%s\" is not a flip trace.\n", path);
+        fclose(file);
+        return EINVAL;
+    }
+
+    if (version != FLIP_TRACE_VERSION) {
+        fprintf(stderr, "[flip_trace] \"%s\" is a version %d flip trace, only version %d is supported.\n", path, version, FLIP_TRACE_VERSION);
+        fclose(file);
+        return EINVAL;
+    }
+
+    events = NULL;
+    n_events = 0;
+    n_allocated = 0;
+    line_no = 1;
+    ok = 0;
+
+    while (fgets(line, sizeof line, file) != NULL) {
+        line_no++;
+
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+
+        if (sscanf(
+                line,
+                "%" SCNu32 " %" SCNu32 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+                &event.crtc_id,
+                &event.sequence,
+                &event.flip_ns,
+                &event.predicted_ns,
+                &event.refresh_interval_ns,
+                &event.render_start_ns,
+                &event.render_done_ns,
+                &event.commit_ns
+            ) != 8) {
+            fprintf(stderr, "[flip_trace] %s:%d: Expected 8 numbers.\n", path, line_no);
+            ok = EINVAL;
+            break;
+        }
+
+        if (n_events == n_allocated) {
+            size_t n = n_allocated ? 2 * n_allocated : 1024;
+            void *new_events = realloc(events, n * sizeof *events);
+            if (new_events == NULL) {
+                ok = ENOMEM;
+                break;
+            }
+            events = new_events;
+            n_allocated = n;
+        }
+
+        events[n_events++] = event;
+    }
+
+    if (ok == 0 && ferror(file)) {
+        ok = EIO;
+    }
+
+    fclose(file);
+
+    if (ok != 0) {
+        free(events);
+        return ok;
+    }
+
+    *events_out = events;
+    *n_events_out = n_events;
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef _FLIP_TRACE_H
+#define _FLIP_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Traces of the flip events of a running instance, for replaying
+ * them through the frame scheduling offline (see flip_replay.c).
+ *
+ * A trace is a text file with one line per flip event, after a
+ * "# kms-quads flip trace 1" header:
+ *
+ *     crtc sequence flip_ns predicted_ns refresh_ns render_start_ns render_done_ns commit_ns
+ *
+ * All times are CLOCK_MONOTONIC nanoseconds, 0 if unknown. Lines starting
+ * with '#' are comments.
+ */
+struct flip_recorder;
+
+struct flip_trace_event {
+    /// The CRTC, sequence number and timestamp the kernel gave the flip event.
+    uint32_t crtc_id;
+    uint32_t sequence;
+    uint64_t flip_ns;
+
+    /// When the scheduler predicted the flip to happen.
+    uint64_t predicted_ns;
+
+    /// The refresh interval of the mode.
+    uint64_t refresh_interval_ns;
+
+    /// When the frame started rendering, finished rendering and was committed.
+    uint64_t render_start_ns;
+    uint64_t render_done_ns;
+    uint64_t commit_ns;
+};
+
+/// Start writing a trace to @a path, replacing what's there.
+int flip_recorder_new(
+    struct flip_recorder **recorder_out,
+    const char *path
+);
+
+/// Write out what's buffered and close the file.
+void flip_recorder_destroy(
+    struct flip_recorder *recorder
+);
+
+/// Add an event. Buffered, so it's cheap enough for the event handler.
+void flip_recorder_add(
+    struct flip_recorder *recorder,
+    const struct flip_trace_event *event
+);
+
+/**
+ * @brief Read a trace written by a @ref flip_recorder.
+ *
+ * @param events_out The events, in the order they were recorded. Free with free().
+ */
+int flip_trace_load(
+    const char *path,
+    struct flip_trace_event **events_out,
+    size_t *n_events_out
+);
+
+#endif
@@ -0,0 +1,29 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <frame_timing.h>
+
+uint64_t frame_timing_predict(
+    uint64_t last_flip_ns,
+    uint64_t now_ns,
+    uint64_t interval_ns,
+    uint64_t margin_ns,
+    unsigned int *n_intervals_out
+) {
+    uint64_t too_soon;
+    unsigned int n;
+
+    // the first interval that ends after the margin, without stepping through all the missed ones.
+    too_soon = now_ns + margin_ns;
+    if (last_flip_ns > too_soon || interval_ns == 0) {
+        n = 0;
+    } else {
+        n = (too_soon - last_flip_ns) / interval_ns + 1;
+    }
+
+    if (n_intervals_out != NULL) {
+        *n_intervals_out = n;
+    }
+
+    return last_flip_ns + (uint64_t) n * interval_ns;
+}
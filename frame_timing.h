@@ -0,0 +1,27 @@
+#ifndef _FRAME_TIMING_H
+#define _FRAME_TIMING_H
+
+#include <stdint.h>
+
+/**
+ * @brief Predict when the next frame will be on screen.
+ *
+ * Starting from the completion time of the last flip, @a last_flip_ns, the
+ * prediction is advanced by whole refresh intervals until there's at least
+ * @a margin_ns left from @a now_ns to render and commit the frame. All times
+ * are in CLOCK_MONOTONIC nanoseconds.
+ *
+ * @param n_intervals_out How many refresh intervals the prediction was
+ *   advanced by, i.e. how many animation frames to step; more than one if
+ *   frames were missed. May be NULL.
+ * @returns The predicted completion time of the next flip.
+ */
+uint64_t frame_timing_predict(
+    uint64_t last_flip_ns,
+    uint64_t now_ns,
+    uint64_t interval_ns,
+    uint64_t margin_ns,
+    unsigned int *n_intervals_out
+);
+
+#endif
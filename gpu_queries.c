@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <vulkan/vulkan.h>
+
+#include <gpu_queries.h>
+
+#define N_PIPELINE_STATISTICS 4
+
+static const VkQueryPipelineStatisticFlags pipeline_statistics_flags =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+struct gpu_queries {
+    VkDevice device;
+    int n_slots;
+
+    /// Two timestamps per slot, VK_NULL_HANDLE if timestamps aren't supported.
+    VkQueryPool timestamp_pool;
+    uint64_t timestamp_mask;
+    float timestamp_period;
+
+    /// One pipeline statistics query per slot, or VK_NULL_HANDLE.
+    VkQueryPool statistics_pool;
+
+    /// Whether the slot was submitted and not read back yet.
+    bool *pending;
+};
+
+int gpu_queries_new(
+    struct gpu_queries **queries_out,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    uint32_t queue_family_index,
+    int n_slots,
+    bool pipeline_statistics
+) {
+    VkQueryPool timestamp_pool, statistics_pool;
+    VkPhysicalDeviceProperties props;
+    struct gpu_queries *queries;
+    uint32_t n_queue_families, valid_bits;
+    VkResult vk_ok;
+    bool *pending;
+    int ok;
+
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &n_queue_families, NULL);
+
+    VkQueueFamilyProperties queue_families[n_queue_families];
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &n_queue_families, queue_families);
+
+    valid_bits = queue_family_index < n_queue_families ? queue_families[queue_family_index].timestampValidBits : 0;
+
+    if (valid_bits == 0 && !pipeline_statistics) {
+        return ENOTSUP;
+    }
+
+    queries = malloc(sizeof *queries);
+    if (queries == NULL) {
+        return ENOMEM;
+    }
+
+    pending = calloc(n_slots, sizeof *pending);
+    if (pending == NULL) {
+        ok = ENOMEM;
+        goto fail_free_queries;
+    }
+
+    timestamp_pool = VK_NULL_HANDLE;
+    if (valid_bits != 0) {
+        vk_ok = vkCreateQueryPool(
+            device,
+            &(const VkQueryPoolCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .flags = 0,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = 2 * n_slots,
+                .pipelineStatistics = 0,
+                .pNext = NULL,
+            },
+            NULL,
+            &timestamp_pool
+        );
+        if (vk_ok != VK_SUCCESS) {
+            fprintf(stderr, "[gpu queries] Could not create timestamp query pool. vkCreateQueryPool: %d\n", vk_ok);
+            ok = EIO;
+            goto fail_free_pending;
+        }
+    }
+
+    statistics_pool = VK_NULL_HANDLE;
+    if (pipeline_statistics) {
+        vk_ok = vkCreateQueryPool(
+            device,
+            &(const VkQueryPoolCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .flags = 0,
+                .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+                .queryCount = n_slots,
+                .pipelineStatistics = pipeline_statistics_flags,
+                .pNext = NULL,
+            },
+            NULL,
+            &statistics_pool
+        );
+        if (vk_ok != VK_SUCCESS) {
+            fprintf(stderr, "[gpu queries] Could not create pipeline statistics query pool. vkCreateQueryPool: %d\n", vk_ok);
+            ok = EIO;
+            goto fail_maybe_destroy_timestamp_pool;
+        }
+    }
+
+    queries->device = device;
+    queries->n_slots = n_slots;
+    queries->timestamp_pool = timestamp_pool;
+    queries->timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (((uint64_t) 1) << valid_bits) - 1;
+    queries->timestamp_period = props.limits.timestampPeriod;
+    queries->statistics_pool = statistics_pool;
+    queries->pending = pending;
+
+    *queries_out = queries;
+    return 0;
+
+
+    fail_maybe_destroy_timestamp_pool:
+    if (timestamp_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, timestamp_pool, NULL);
+    }
+
+    fail_free_pending:
+    free(pending);
+
+    fail_free_queries:
+    free(queries);
+    return ok;
+}
+
+void gpu_queries_destroy(struct gpu_queries *queries) {
+    if (queries->statistics_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(queries->device, queries->statistics_pool, NULL);
+    }
+    if (queries->timestamp_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(queries->device, queries->timestamp_pool, NULL);
+    }
+    free(queries->pending);
+    free(queries);
+}
+
+void gpu_queries_cmd_begin(struct gpu_queries *queries, VkCommandBuffer cmdbuf, int slot) {
+    if (queries->timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(cmdbuf, queries->timestamp_pool, 2 * slot, 2);
+        vkCmdWriteTimestamp(cmdbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queries->timestamp_pool, 2 * slot);
+    }
+
+    if (queries->statistics_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(cmdbuf, queries->statistics_pool, slot, 1);
+    }
+}
+
+void gpu_queries_cmd_begin_pass(struct gpu_queries *queries, VkCommandBuffer cmdbuf, int slot) {
+    if (queries->statistics_pool != VK_NULL_HANDLE) {
+        vkCmdBeginQuery(cmdbuf, queries->statistics_pool, slot, 0);
+    }
+}
+
+void gpu_queries_cmd_end_pass(struct gpu_queries *queries, VkCommandBuffer cmdbuf, int slot) {
+    if (queries->statistics_pool != VK_NULL_HANDLE) {
+        vkCmdEndQuery(cmdbuf, queries->statistics_pool, slot);
+    }
+}
+
+void gpu_queries_cmd_end(struct gpu_queries *queries, VkCommandBuffer cmdbuf, int slot) {
+    if (queries->timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(cmdbuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queries->timestamp_pool, 2 * slot + 1);
+    }
+}
+
+void gpu_queries_on_submit(struct gpu_queries *queries, int slot) {
+    queries->pending[slot] = true;
+}
+
+bool gpu_queries_read(struct gpu_queries *queries, int slot, struct gpu_query_results *results_out) {
+    struct gpu_query_results results = { 0 };
+    VkResult vk_ok;
+
+    if (!queries->pending[slot]) {
+        return false;
+    }
+
+    if (queries->timestamp_pool != VK_NULL_HANDLE) {
+        // value, availability for each of the two timestamps
+        uint64_t data[2][2];
+
+        vk_ok = vkGetQueryPoolResults(
+            queries->device,
+            queries->timestamp_pool,
+            2 * slot, 2,
+            sizeof(data), data,
+            sizeof(data[0]),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+        );
+        if ((vk_ok != VK_SUCCESS && vk_ok != VK_NOT_READY) || !data[0][1] || !data[1][1]) {
+            return false;
+        }
+
+        results.gpu_time_ns = (uint64_t) (((data[1][0] - data[0][0]) & queries->timestamp_mask) * (double) queries->timestamp_period);
+    }
+
+    if (queries->statistics_pool != VK_NULL_HANDLE) {
+        uint64_t data[N_PIPELINE_STATISTICS + 1];
+
+        vk_ok = vkGetQueryPoolResults(
+            queries->device,
+            queries->statistics_pool,
+            slot, 1,
+            sizeof(data), data,
+            sizeof(data),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+        );
+        if ((vk_ok != VK_SUCCESS && vk_ok != VK_NOT_READY) || !data[N_PIPELINE_STATISTICS]) {
+            return false;
+        }
+
+        // results are in the order of the bits in pipeline_statistics_flags.
+        results.has_pipeline_statistics = true;
+        results.n_input_vertices = data[0];
+        results.n_vertex_shader_invocations = data[1];
+        results.n_clipping_primitives = data[2];
+        results.n_fragment_shader_invocations = data[3];
+    }
+
+    queries->pending[slot] = false;
+
+    *results_out = results;
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef _GPU_QUERIES_H
+#define _GPU_QUERIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief GPU timestamp and (optionally) pipeline statistics queries, one set per slot.
+ *
+ * Each slot is meant to be used by one command buffer (for example one per swapchain image).
+ * The command buffer resets its own queries, so it can be pre-recorded and resubmitted.
+ * Results are read back without waiting, usually one frame after the submission,
+ * so the CPU never stalls on the GPU.
+ */
+struct gpu_queries;
+
+struct gpu_query_results {
+    /// GPU time between the begin and end timestamps, in nanoseconds.
+    uint64_t gpu_time_ns;
+
+    /// Only valid if pipeline statistics are enabled.
+    bool has_pipeline_statistics;
+    uint64_t n_input_vertices;
+    uint64_t n_vertex_shader_invocations;
+    uint64_t n_clipping_primitives;
+    uint64_t n_fragment_shader_invocations;
+};
+
+/**
+ * @brief Create the query pools. Timestamps are only supported if the queue family has
+ * a non-zero timestampValidBits. Pipeline statistics queries need the pipelineStatisticsQuery
+ * feature to be enabled on @a device.
+ *
+ * @returns ENOTSUP if the queue family supports neither timestamps nor pipeline statistics.
+ */
+int gpu_queries_new(
+    struct gpu_queries **queries_out,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    uint32_t queue_family_index,
+    int n_slots,
+    bool pipeline_statistics
+);
+
+void gpu_queries_destroy(
+    struct gpu_queries *queries
+);
+
+/**
+ * @brief Reset the queries of @a slot and write the begin timestamp. Needs to be recorded
+ * outside of a render pass, before @ref gpu_queries_cmd_begin_pass.
+ */
+void gpu_queries_cmd_begin(
+    struct gpu_queries *queries,
+    VkCommandBuffer cmdbuf,
+    int slot
+);
+
+/**
+ * @brief Begin the pipeline statistics query of @a slot. Can be recorded inside a render pass.
+ */
+void gpu_queries_cmd_begin_pass(
+    struct gpu_queries *queries,
+    VkCommandBuffer cmdbuf,
+    int slot
+);
+
+void gpu_queries_cmd_end_pass(
+    struct gpu_queries *queries,
+    VkCommandBuffer cmdbuf,
+    int slot
+);
+
+/**
+ * @brief Write the end timestamp of @a slot.
+ */
+void gpu_queries_cmd_end(
+    struct gpu_queries *queries,
+    VkCommandBuffer cmdbuf,
+    int slot
+);
+
+/**
+ * @brief Tell the queries that a command buffer using @a slot was submitted.
+ * Until then, @ref gpu_queries_read won't try to read the slot.
+ */
+void gpu_queries_on_submit(
+    struct gpu_queries *queries,
+    int slot
+);
+
+/**
+ * @brief Read the results of the last submission of @a slot, without waiting.
+ *
+ * @returns true if results were available, false if the GPU isn't done yet or
+ * the slot was never submitted.
+ */
+bool gpu_queries_read(
+    struct gpu_queries *queries,
+    int slot,
+    struct gpu_query_results *results_out
+);
+
+#endif
@@ -0,0 +1,108 @@
+#version 450 core
+
+// Draws lots of cubes in one instanced draw, without any vertex or uniform buffers.
+// The cube geometry comes from gl_VertexIndex, the position and rotation of each
+// cube from a hash of gl_InstanceIndex and the time. So the CPU only has to
+// update the push constants each frame, no matter how many cubes there are.
+
+layout(push_constant) uniform push_constants {
+    mat4 projectionMatrix;
+    float time;
+    // half the side length of the volume the cubes are spread over
+    float extent;
+    // distance from the camera to the center of that volume
+    float distance;
+    // size of a single cube
+    float scale;
+};
+
+layout(location = 0) out vec4 vVaryingColor;
+
+// Same specialization constants as vkcube.vert.
+layout(constant_id = 0) const float light_x = 2.0;
+layout(constant_id = 1) const float light_y = 2.0;
+layout(constant_id = 2) const float light_z = 20.0;
+layout(constant_id = 3) const bool lighting = true;
+
+vec4 lightSource = vec4(light_x, light_y, light_z, 0.0);
+
+// The corners of each face in triangle strip order, same as in the vertex buffer
+// of the single cube scene.
+const vec3 corners[24] = vec3[24](
+    // front
+    vec3(-1.0, -1.0, +1.0), vec3(+1.0, -1.0, +1.0), vec3(-1.0, +1.0, +1.0), vec3(+1.0, +1.0, +1.0),
+    // back
+    vec3(+1.0, -1.0, -1.0), vec3(-1.0, -1.0, -1.0), vec3(+1.0, +1.0, -1.0), vec3(-1.0, +1.0, -1.0),
+    // right
+    vec3(+1.0, -1.0, +1.0), vec3(+1.0, -1.0, -1.0), vec3(+1.0, +1.0, +1.0), vec3(+1.0, +1.0, -1.0),
+    // left
+    vec3(-1.0, -1.0, -1.0), vec3(-1.0, -1.0, +1.0), vec3(-1.0, +1.0, -1.0), vec3(-1.0, +1.0, +1.0),
+    // top
+    vec3(-1.0, +1.0, +1.0), vec3(+1.0, +1.0, +1.0), vec3(-1.0, +1.0, -1.0), vec3(+1.0, +1.0, -1.0),
+    // bottom
+    vec3(-1.0, -1.0, -1.0), vec3(+1.0, -1.0, -1.0), vec3(-1.0, -1.0, +1.0), vec3(+1.0, -1.0, +1.0)
+);
+
+const vec3 normals[6] = vec3[6](
+    vec3(+0.0, +0.0, +1.0),
+    vec3(+0.0, +0.0, -1.0),
+    vec3(+1.0, +0.0, +0.0),
+    vec3(-1.0, +0.0, +0.0),
+    vec3(+0.0, +1.0, +0.0),
+    vec3(+0.0, -1.0, +0.0)
+);
+
+// two triangles per face, with the same winding as the triangle strip
+const uint face_indices[6] = uint[6](0, 1, 2, 2, 1, 3);
+
+// PCG hash, from "Hash Functions for GPU Rendering" (Jarzynski, Olano)
+uint hash(uint v) {
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(inout uint seed) {
+    seed = hash(seed);
+    return float(seed) * (1.0 / 4294967295.0);
+}
+
+mat3 rotation(vec3 axis, float angle) {
+    float s = sin(angle);
+    float c = cos(angle);
+    float oc = 1.0 - c;
+
+    return mat3(
+        oc * axis.x * axis.x + c,          oc * axis.x * axis.y + axis.z * s, oc * axis.z * axis.x - axis.y * s,
+        oc * axis.x * axis.y - axis.z * s, oc * axis.y * axis.y + c,          oc * axis.y * axis.z + axis.x * s,
+        oc * axis.z * axis.x + axis.y * s, oc * axis.y * axis.z - axis.x * s, oc * axis.z * axis.z + c
+    );
+}
+
+void main()
+{
+    uint face = uint(gl_VertexIndex) / 6u;
+    vec3 corner = corners[face * 4u + face_indices[uint(gl_VertexIndex) % 6u]];
+
+    uint seed = hash(uint(gl_InstanceIndex));
+
+    vec3 center = (vec3(random(seed), random(seed), random(seed)) * 2.0 - 1.0) * extent;
+    vec3 axis = normalize(vec3(random(seed), random(seed), random(seed)) * 2.0 - 1.0 + vec3(0.0, 0.0, 0.001));
+    float speed = mix(0.5, 2.0, random(seed)) * (random(seed) < 0.5 ? -1.0 : 1.0);
+    float phase = random(seed) * 6.2831853;
+
+    mat3 rotate = rotation(axis, phase + speed * time);
+
+    vec3 vPosition3 = center + rotate * (corner * scale) - vec3(0.0, 0.0, distance);
+    gl_Position = projectionMatrix * vec4(vPosition3, 1.0);
+
+    float diff = 1.0;
+    if (lighting) {
+        vec3 vEyeNormal = rotate * normals[face];
+        vec3 vLightDir = normalize(lightSource.xyz - vPosition3);
+        diff = max(0.0, dot(vEyeNormal, vLightDir));
+    }
+
+    // same colors as the single cube, where each corner has the color of its position.
+    vVaryingColor = vec4(diff * (corner * 0.5 + 0.5), 1.0);
+}
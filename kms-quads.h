@@ -66,6 +66,9 @@
 
 /* Utility header from Weston to more easily handle time values. */
 #include "timespec-util.h"
+#include "drm_property.h"
+#include "edid.h"
+#include "latency.h"
 
 
 #ifdef DEBUG
@@ -79,46 +82,22 @@
 #define ARRAY_LENGTH(x) (sizeof(x) / sizeof((x)[0]))
 
 struct buffer;
+struct control;
 struct device;
+struct flip_recorder;
 struct output;
+struct shadowfb;
+struct softcube;
+struct workpool;
 
 
 #define BUFFER_QUEUE_DEPTH 3 /* how many buffers to allocate per output */
+#define REPAINT_MARGIN (4 * 1000000LL) /* default, see struct tunables */
+#define FRAME_TIMING_TOLERANCE (NSEC_PER_SEC / 2000) /* default, ditto */
 #define NUM_ANIM_FRAMES 240 /* how many frames before we wrap around */
+#define LATENCY_WINDOW 256 /* how many frames the latency statistics are over */
 
 
-/**
- * Represents the values of an enum-type KMS property. These properties
- * have a certain range of values you can use, exposed as strings from
- * the kernel; userspace needs to look up the value that string
- * corresponds to and use it.
- */
-struct drm_property_enum_info {
-	const char *name; /**< name as string (static, not freed) */
-	bool valid; /**< true if value is supported; ignore if false */
-	uint64_t value; /**< raw value */
-};
-
-/**
- * Holds information on a DRM property, including its ID and the enum
- * values it holds.
- *
- * DRM properties are allocated dynamically, and maintained as DRM objects
- * within the normal object ID space; they thus do not have a stable ID
- * to refer to. This includes enum values, which must be referred to by
- * integer values, but these are not stable.
- *
- * drm_property_info allows a cache to be maintained where we can use
- * enum values internally to refer to properties, with the mapping to DRM
- * ID values being maintained internally.
- */
-struct drm_property_info {
-	const char *name; /**< name as string (static, not freed) */
-	uint32_t prop_id; /**< KMS property object ID */
-	unsigned int num_enum_values; /**< number of enum values */
-	struct drm_property_enum_info *enum_values; /**< array of enum values */
-};
-
 /**
  * List of properties attached to DRM planes
  */
@@ -201,6 +180,12 @@ struct buffer {
 	 */
 	bool in_use;
 
+	/*
+	 * Timestamps of the frame last rendered into this buffer, from
+	 * repaint_one_output until its flip completes.
+	 */
+	struct latency_record latency;
+
 	/*
 	 * The GEM handle for this buffer, returned from the dumb-buffer
 	 * creation ioctl. GEM names are also returned from
@@ -266,6 +251,15 @@ struct buffer {
 	struct {
 		uint32_t *mem;
 		unsigned int size;
+
+		/* Checkerboard boundaries of the fill in progress. */
+		unsigned int split_x, split_y;
+
+		/*
+		 * Whether the fill in progress copies from the output's
+		 * shadow framebuffer, rather than writing every pixel.
+		 */
+		bool from_shadow;
 	} dumb;
 
 	struct {
@@ -364,6 +358,19 @@ struct output {
 	/* Buffers allocated by us. */
 	struct buffer *buffers[BUFFER_QUEUE_DEPTH];
 
+	/*
+	 * Cached copy of what we're rendering in software, which knows what
+	 * changed in each of our dumb buffers since they were last filled.
+	 * Created on the first fill; NULL when rendering with Vulkan.
+	 */
+	struct shadowfb *shadow;
+
+	/*
+	 * CPU rasterizer for the cube, when drawing it into dumb buffers
+	 * (KMS_QUADS_SCENE=cube). Created on the first fill.
+	 */
+	struct softcube *softcube;
+
 	/*
 	 * The buffer we've just committed to KMS, waiting for it to send the
 	 * atomic-complete event to tell us it's started displaying; set by
@@ -386,6 +393,19 @@ struct output {
 	struct timespec last_frame;
 	struct timespec next_frame;
 
+	/*
+	 * Latency of the last frames, and their per-stage budgets; see
+	 * latency.h. NULL if it couldn't be allocated.
+	 */
+	struct latency_tracker *latency;
+
+	/*
+	 * Number of flips completed, and how many of them were off from
+	 * their predicted time by more than the tolerance.
+	 */
+	uint64_t num_frames;
+	uint64_t num_mispredicted_frames;
+
 	/*
 	 * The frame of the animation to display.
 	 */
@@ -404,6 +424,45 @@ struct output {
 	} egl;
 };
 
+/*
+ * How flips are synchronised to the display.
+ */
+enum present_mode {
+	/* Flip at vblank; never tears, and paces us to the refresh rate. */
+	PRESENT_MODE_FIFO = 0,
+	/*
+	 * Flip as soon as the commit arrives (DRM_MODE_PAGE_FLIP_ASYNC),
+	 * which can tear but doesn't wait for vblank. Needs driver support
+	 * for async flips through atomic.
+	 */
+	PRESENT_MODE_ASYNC,
+};
+
+/*
+ * Parameters of the presentation pipeline which can be changed at runtime,
+ * through the control socket (see control.h). The main loop only picks up
+ * changes at the start of an iteration, so they take effect with the next
+ * frame of each output.
+ */
+struct tunables {
+	/*
+	 * How many of the BUFFER_QUEUE_DEPTH buffers of each output we
+	 * cycle through. At least 2: one being displayed, one to render to.
+	 */
+	unsigned int queue_depth;
+
+	/*
+	 * How long before the predicted flip we need to start repainting,
+	 * to have the frame rendered and committed in time.
+	 */
+	int64_t repaint_margin_nsec;
+
+	/* How far off a flip can be from our prediction before we complain. */
+	int64_t frame_timing_tolerance_nsec;
+
+	enum present_mode present_mode;
+};
+
 /*
  * A device is one KMS node from /dev/dri/ and its resources.
  *
@@ -439,6 +498,9 @@ struct device {
 	/* Whether or not the device supports format modifiers. */
 	bool fb_modifiers;
 
+	/* Whether or not atomic commits can be async page flips. */
+	bool async_page_flip;
+
 	/* The GBM device is our buffer allocator, and we create an EGL
 	 * display from that to import buffers into. */
 	struct gbm_device *gbm_device;
@@ -454,6 +516,28 @@ struct device {
 
 	/* vulkan device */
 	struct vk_device *vk_device;
+
+	/*
+	 * Worker threads which fill the dumb buffers of all outputs in
+	 * bands of rows, when rendering in software. NULL when rendering
+	 * with Vulkan, or if the threads couldn't be started.
+	 */
+	struct workpool *workpool;
+
+	/* Current presentation parameters. */
+	struct tunables tunables;
+
+	/*
+	 * Socket to query and change the tunables at runtime, if enabled
+	 * with KMS_QUADS_CONTROL; NULL otherwise.
+	 */
+	struct control *control;
+
+	/*
+	 * Where the flip events are written for replaying them offline, if
+	 * enabled with KMS_QUADS_RECORD; NULL otherwise.
+	 */
+	struct flip_recorder *recorder;
 };
 
 /*
@@ -480,7 +564,11 @@ struct buffer *buffer_egl_create(struct device *device, struct output *output);
 void buffer_destroy(struct buffer *buffer);
 void buffer_egl_destroy(struct device *device, struct buffer *buffer);
 
-/* Fill a buffer for a given animation step. */
+/*
+ * Fill a buffer for a given animation step. When the device has worker
+ * threads, dumb buffers are only queued to be filled; workpool_wait() must be
+ * called before the buffer is handed to KMS.
+ */
 void buffer_fill(struct buffer *buffer, int frame_num);
 void buffer_egl_fill(struct buffer *buffer, int frame_num);
 
@@ -510,21 +598,6 @@ void output_add_atomic_req(struct output *output, drmModeAtomicReqPtr req,
 int atomic_commit(struct device *device, drmModeAtomicReqPtr req,
 		  bool allow_modeset);
 
-/*
- * Parse the very basic information from the EDID block, as described in
- * edid.c. The EDID parser could be fairly trivially extended to pull
- * more information, such as the mode.
- */
-struct edid_info {
-	char eisa_id[13];
-	char monitor_name[13];
-	char pnp_id[5];
-	char serial_number[13];
-};
-
-struct edid_info *
-edid_parse(const uint8_t *data, size_t length);
-
 bool
 gl_extension_supported(const char *haystack, const char *needle);
 
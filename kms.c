@@ -57,6 +57,8 @@
 #include <linux/vt.h>
 
 #include "kms-quads.h"
+#include "shadowfb.h"
+#include "softcube.h"
 
 /*
  * All the properties we support for the different object types, as well as
@@ -129,57 +131,6 @@ static const struct drm_property_info crtc_props[] = {
 	[WDRM_CRTC_OUT_FENCE_PTR] = { .name = "OUT_FENCE_PTR", },
 };
 
-/**
- * Get the current value of a KMS property
- *
- * Given a drmModeObjectGetProperties return, as well as the drm_property_info
- * for the target property, return the current value of that property,
- * with an optional default. If the property is a KMS enum type, the return
- * value will be translated into the appropriate internal enum.
- *
- * If the property is not present, the default value will be returned.
- *
- * @param info Internal structure for property to look up
- * @param props Raw KMS properties for the target object
- * @param def Value to return if property is not found
- */
-static uint64_t
-drm_property_get_value(struct drm_property_info *info,
-		       const drmModeObjectProperties *props,
-		       uint64_t def)
-{
-	unsigned int i;
-
-	if (info->prop_id == 0)
-		return def;
-
-	for (i = 0; i < props->count_props; i++) {
-		unsigned int j;
-
-		if (props->props[i] != info->prop_id)
-			continue;
-
-		/* Simple (non-enum) types can return the value directly */
-		if (info->num_enum_values == 0)
-			return props->prop_values[i];
-
-		/* Map from raw value to enum value */
-		for (j = 0; j < info->num_enum_values; j++) {
-			if (!info->enum_values[j].valid)
-				continue;
-			if (info->enum_values[j].value != props->prop_values[i])
-				continue;
-
-			return j;
-		}
-
-		/* We don't have a mapping for this enum; return default. */
-		break;
-	}
-
-	return def;
-}
-
 /**
  * Cache DRM property values
  *
@@ -592,6 +543,20 @@ struct output *output_create(struct device *device,
 	debug("[%s] refresh interval %" PRIu64 "ns / %" PRIu64 "ms\n", output->name, output->refresh_interval_nsec, output->refresh_interval_nsec / 1000000UL);
 	output->mode_blob_id = mode_blob_create(device, &output->mode);
 
+	/*
+	 * Track where the time goes in each frame. KMS_QUADS_LATENCY_BUDGETS
+	 * overrides the per-stage budgets, e.g. "render=2,gpu=8" (in ms).
+	 */
+	if (latency_tracker_new(&output->latency, LATENCY_WINDOW,
+				output->refresh_interval_nsec) != 0) {
+		output->latency = NULL;
+	} else if (getenv("KMS_QUADS_LATENCY_BUDGETS") &&
+		   latency_tracker_parse_budgets(output->latency,
+						 getenv("KMS_QUADS_LATENCY_BUDGETS")) != 0) {
+		fprintf(stderr, "[%s] invalid KMS_QUADS_LATENCY_BUDGETS \"%s\"\n",
+			output->name, getenv("KMS_QUADS_LATENCY_BUDGETS"));
+	}
+
 	/*
 	 * Now we have all our objects lined up, get their property lists from
 	 * KMS and use that to fill in the props structures we have above, so
@@ -647,6 +612,19 @@ void output_destroy(struct output *output)
 			buffer_destroy(output->buffers[i]);
 	}
 
+	if (output->shadow)
+		shadowfb_destroy(output->shadow);
+
+	if (output->softcube)
+		softcube_destroy(output->softcube);
+
+	if (output->latency) {
+		if (latency_tracker_get_n_frames(output->latency) > 0)
+			latency_tracker_print(output->latency, output->name,
+					      stdout);
+		latency_tracker_destroy(output->latency);
+	}
+
 	if (output->mode_blob_id != 0)
 		drmModeDestroyPropertyBlob(device->kms_fd, output->mode_blob_id);
 
@@ -835,6 +813,23 @@ int atomic_commit(struct device *device, drmModeAtomicReqPtr req,
 	if (allow_modeset)
 		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
 
+	/*
+	 * Async flips can't be combined with a modeset, and drivers are
+	 * picky about what else may change in an async commit. If it gets
+	 * rejected, go back to flipping at vblank rather than giving up.
+	 */
+	if (device->tunables.present_mode == PRESENT_MODE_ASYNC &&
+	    !allow_modeset) {
+		ret = drmModeAtomicCommit(device->kms_fd, req,
+					  flags | DRM_MODE_PAGE_FLIP_ASYNC,
+					  device);
+		if (ret != -EINVAL)
+			return ret;
+
+		error("async page flip rejected, switching back to FIFO\n");
+		device->tunables.present_mode = PRESENT_MODE_FIFO;
+	}
+
 	return drmModeAtomicCommit(device->kms_fd, req, flags, device);
 }
 
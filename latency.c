@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <latency.h>
+
+/// The margin the main loop leaves between repainting and the predicted flip.
+#define RENDER_MARGIN_NS (4 * 1000000ll)
+
+struct latency_tracker {
+    int64_t budgets[LATENCY_N_STAGES];
+
+    /// Ring buffer of the durations of the last frames.
+    int window;
+    int n_frames_in_window;
+    int next;
+    int64_t (*durations)[LATENCY_N_STAGES];
+    unsigned int *over_budget;
+
+    uint64_t n_frames;
+
+    /// Scratch space for sorting the durations of a stage.
+    int64_t *sorted;
+};
+
+static const char *stage_names[LATENCY_N_STAGES] = {
+    [LATENCY_STAGE_RENDER] = "render",
+    [LATENCY_STAGE_GPU] = "gpu",
+    [LATENCY_STAGE_COMMIT] = "commit",
+    [LATENCY_STAGE_FLIP] = "flip",
+    [LATENCY_STAGE_SCANOUT] = "scanout",
+    [LATENCY_STAGE_TOTAL] = "total",
+};
+
+const char *latency_stage_name(enum latency_stage stage) {
+    return stage_names[stage];
+}
+
+static int64_t get_interval(uint64_t begin, uint64_t end) {
+    if (begin == 0 || end == 0) {
+        return 0;
+    }
+    return (int64_t) (end - begin);
+}
+
+int64_t latency_record_get_stage(const struct latency_record *record, enum latency_stage stage) {
+    switch (stage) {
+        case LATENCY_STAGE_RENDER: return get_interval(record->render_start_ns, record->submit_ns);
+        case LATENCY_STAGE_GPU: return get_interval(record->submit_ns, record->render_done_ns);
+        case LATENCY_STAGE_COMMIT: return get_interval(record->render_done_ns, record->commit_ns);
+        case LATENCY_STAGE_FLIP: return get_interval(record->commit_ns, record->flip_ns);
+        case LATENCY_STAGE_SCANOUT: return get_interval(record->flip_ns, record->scanout_ns);
+        case LATENCY_STAGE_TOTAL: return get_interval(record->render_start_ns, record->scanout_ns);
+        default: return 0;
+    }
+}
+
+int latency_tracker_new(struct latency_tracker **tracker_out, int window, int64_t refresh_interval_ns) {
+    struct latency_tracker *tracker;
+
+    if (window <= 0) {
+        return EINVAL;
+    }
+
+    tracker = malloc(sizeof *tracker);
+    if (tracker == NULL) {
+        return ENOMEM;
+    }
+
+    tracker->durations = calloc(window, sizeof *tracker->durations);
+    tracker->over_budget = calloc(window, sizeof *tracker->over_budget);
+    tracker->sorted = calloc(window, sizeof *tracker->sorted);
+    if (tracker->durations == NULL || tracker->over_budget == NULL || tracker->sorted == NULL) {
+        free(tracker->sorted);
+        free(tracker->over_budget);
+        free(tracker->durations);
+        free(tracker);
+        return ENOMEM;
+    }
+
+    tracker->window = window;
+    tracker->n_frames_in_window = 0;
+    tracker->next = 0;
+    tracker->n_frames = 0;
+
+    tracker->budgets[LATENCY_STAGE_RENDER] = RENDER_MARGIN_NS;
+    tracker->budgets[LATENCY_STAGE_GPU] = refresh_interval_ns;
+    tracker->budgets[LATENCY_STAGE_COMMIT] = RENDER_MARGIN_NS;
+    tracker->budgets[LATENCY_STAGE_FLIP] = refresh_interval_ns;
+    tracker->budgets[LATENCY_STAGE_SCANOUT] = refresh_interval_ns;
+    tracker->budgets[LATENCY_STAGE_TOTAL] = 2 * refresh_interval_ns + RENDER_MARGIN_NS;
+
+    *tracker_out = tracker;
+    return 0;
+}
+
+void latency_tracker_destroy(struct latency_tracker *tracker) {
+    free(tracker->sorted);
+    free(tracker->over_budget);
+    free(tracker->durations);
+    free(tracker);
+}
+
+void latency_tracker_set_budget(struct latency_tracker *tracker, enum latency_stage stage, int64_t budget_ns) {
+    tracker->budgets[stage] = budget_ns;
+}
+
+int64_t latency_tracker_get_budget(struct latency_tracker *tracker, enum latency_stage stage) {
+    return tracker->budgets[stage];
+}
+
+int latency_tracker_parse_budgets(struct latency_tracker *tracker, const char *spec) {
+    int64_t budgets[LATENCY_N_STAGES];
+    const char *name, *equals;
+    char *end;
+    double ms;
+    int stage;
+
+    memcpy(budgets, tracker->budgets, sizeof budgets);
+
+    name = spec;
+    while (*name != '\0') {
+        equals = strchr(name, '=');
+        if (equals == NULL) {
+            return EINVAL;
+        }
+
+        for (stage = 0; stage < LATENCY_N_STAGES; stage++) {
+            if (strlen(stage_names[stage]) == (size_t) (equals - name) && strncmp(name, stage_names[stage], equals - name) == 0) {
+                break;
+            }
+        }
+        if (stage == LATENCY_N_STAGES) {
+            return EINVAL;
+        }
+
+        ms = strtod(equals + 1, &end);
+        if (end == equals + 1 || ms < 0.0 || (*end != ',' && *end != '\0')) {
+            return EINVAL;
+        }
+
+        budgets[stage] = (int64_t) (ms * 1000000.0);
+
+        name = *end == ',' ? end + 1 : end;
+    }
+
+    memcpy(tracker->budgets, budgets, sizeof budgets);
+    return 0;
+}
+
+unsigned int latency_tracker_add(struct latency_tracker *tracker, const struct latency_record *record) {
+    int64_t *durations;
+    unsigned int over_budget;
+
+    durations = tracker->durations[tracker->next];
+
+    over_budget = 0;
+    for (int stage = 0; stage < LATENCY_N_STAGES; stage++) {
+        durations[stage] = latency_record_get_stage(record, stage);
+
+        if (tracker->budgets[stage] > 0 && durations[stage] > tracker->budgets[stage]) {
+            over_budget |= 1u << stage;
+        }
+    }
+
+    tracker->over_budget[tracker->next] = over_budget;
+    tracker->next = (tracker->next + 1) % tracker->window;
+    if (tracker->n_frames_in_window < tracker->window) {
+        tracker->n_frames_in_window++;
+    }
+    tracker->n_frames++;
+
+    return over_budget;
+}
+
+uint64_t latency_tracker_get_n_frames(struct latency_tracker *tracker) {
+    return tracker->n_frames;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+void latency_tracker_get_stats(struct latency_tracker *tracker, enum latency_stage stage, struct latency_stats *stats_out) {
+    int64_t sum;
+    int n;
+
+    n = tracker->n_frames_in_window;
+
+    memset(stats_out, 0, sizeof *stats_out);
+    stats_out->n_frames = n;
+    if (n == 0) {
+        return;
+    }
+
+    sum = 0;
+    for (int i = 0; i < n; i++) {
+        tracker->sorted[i] = tracker->durations[i][stage];
+        sum += tracker->sorted[i];
+
+        if (tracker->over_budget[i] & (1u << stage)) {
+            stats_out->n_over_budget++;
+        }
+    }
+
+    qsort(tracker->sorted, n, sizeof *tracker->sorted, compare_int64);
+
+    stats_out->min_ns = tracker->sorted[0];
+    stats_out->max_ns = tracker->sorted[n - 1];
+    stats_out->mean_ns = sum / n;
+    stats_out->p50_ns = tracker->sorted[(n - 1) / 2];
+    stats_out->p99_ns = tracker->sorted[(n - 1) * 99 / 100];
+}
+
+void latency_tracker_print(struct latency_tracker *tracker, const char *name, FILE *file) {
+    struct latency_stats stats;
+
+    fprintf(
+        file,
+        "[%s] latency over the last %d frames (ms):\n"
+        "  %-8s %8s %8s %8s %8s %8s %8s %6s\n",
+        name,
+        tracker->n_frames_in_window,
+        "stage", "min", "mean", "p50", "p99", "max", "budget", "over"
+    );
+
+    for (int stage = 0; stage < LATENCY_N_STAGES; stage++) {
+        latency_tracker_get_stats(tracker, stage, &stats);
+
+        fprintf(
+            file,
+            "  %-8s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %6d\n",
+            stage_names[stage],
+            stats.min_ns / 1e6,
+            stats.mean_ns / 1e6,
+            stats.p50_ns / 1e6,
+            stats.p99_ns / 1e6,
+            stats.max_ns / 1e6,
+            tracker->budgets[stage] / 1e6,
+            stats.n_over_budget
+        );
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Where the time goes between starting to render a frame and it
+ * being on screen.
+ *
+ * Every frame gets a @ref latency_record with the CLOCK_MONOTONIC timestamps
+ * of each step, which is added to a per-output @ref latency_tracker once the
+ * frame has been flipped. The tracker keeps the last frames for rolling
+ * statistics, and reports which stages of a frame took longer than their
+ * budget.
+ */
+struct latency_tracker;
+
+enum latency_stage {
+    /// Render start to submission (vkQueueSubmit, or queueing the fill to the worker threads).
+    LATENCY_STAGE_RENDER,
+
+    /// Submission to the render fence signalling / the worker threads finishing.
+    LATENCY_STAGE_GPU,
+
+    /// Rendering done to the atomic commit. Negative with explicit fencing,
+    /// where we commit before rendering has finished.
+    LATENCY_STAGE_COMMIT,
+
+    /// Atomic commit to the flip completing.
+    LATENCY_STAGE_FLIP,
+
+    /// Flip completion to the middle line of the frame being scanned out.
+    LATENCY_STAGE_SCANOUT,
+
+    /// Render start to mid-scanout.
+    LATENCY_STAGE_TOTAL,
+
+    LATENCY_N_STAGES
+};
+
+/// Timestamps of one frame, in CLOCK_MONOTONIC nanoseconds. 0 if unknown.
+struct latency_record {
+    uint64_t render_start_ns;
+    uint64_t submit_ns;
+    uint64_t render_done_ns;
+    uint64_t commit_ns;
+    uint64_t flip_ns;
+    uint64_t scanout_ns;
+};
+
+struct latency_stats {
+    /// Number of frames the statistics are over.
+    int n_frames;
+
+    int64_t min_ns, mean_ns, p50_ns, p99_ns, max_ns;
+
+    /// Number of those frames where this stage was over budget.
+    int n_over_budget;
+};
+
+const char *latency_stage_name(enum latency_stage stage);
+
+/// The duration of @a stage in @a record, 0 if a timestamp is missing.
+int64_t latency_record_get_stage(const struct latency_record *record, enum latency_stage stage);
+
+/**
+ * @brief Create a tracker keeping the last @a window frames.
+ *
+ * The default budgets are derived from the output's refresh interval: a few
+ * milliseconds for rendering and committing (the margin the main loop leaves
+ * before the predicted flip), a frame for the GPU, flip and scanout, and two
+ * frames plus those few milliseconds in total.
+ */
+int latency_tracker_new(struct latency_tracker **tracker_out, int window, int64_t refresh_interval_ns);
+
+void latency_tracker_destroy(struct latency_tracker *tracker);
+
+/// Set the budget of @a stage. 0 means no budget.
+void latency_tracker_set_budget(struct latency_tracker *tracker, enum latency_stage stage, int64_t budget_ns);
+
+int64_t latency_tracker_get_budget(struct latency_tracker *tracker, enum latency_stage stage);
+
+/**
+ * @brief Set budgets from a string like "render=2,gpu=4.5,total=40", in milliseconds.
+ *
+ * @returns EINVAL if @a spec can't be parsed, in which case no budget is changed.
+ */
+int latency_tracker_parse_budgets(struct latency_tracker *tracker, const char *spec);
+
+/**
+ * @brief Add the record of a frame that's been flipped.
+ *
+ * @returns a bitmask of the stages (1 << stage) that were over budget.
+ */
+unsigned int latency_tracker_add(struct latency_tracker *tracker, const struct latency_record *record);
+
+/// The total number of frames added, including the ones no longer in the window.
+uint64_t latency_tracker_get_n_frames(struct latency_tracker *tracker);
+
+/// Statistics of @a stage over the frames in the window.
+void latency_tracker_get_stats(struct latency_tracker *tracker, enum latency_stage stage, struct latency_stats *stats_out);
+
+/// Print the statistics of all stages as a table, prefixed by @a name.
+void latency_tracker_print(struct latency_tracker *tracker, const char *name, FILE *file);
+
+#endif
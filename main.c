@@ -54,13 +54,25 @@
 #include <unistd.h>
 
 #include "kms-quads.h"
+#include "control.h"
+#include "flip_trace.h"
+#include "frame_timing.h"
+#include "workpool.h"
 
-/* Allow the driver to drift half a millisecond every frame. */
-#define FRAME_TIMING_TOLERANCE (NSEC_PER_SEC / 2000)
+static uint64_t now_nsec(void)
+{
+	struct timespec now;
+	int ret;
+
+	ret = clock_gettime(CLOCK_MONOTONIC, &now);
+	assert(ret == 0);
+
+	return timespec_to_nsec(&now);
+}
 
 static struct buffer *find_free_buffer(struct output *output)
 {
-	for (int i = 0; i < BUFFER_QUEUE_DEPTH; i++) {
+	for (unsigned int i = 0; i < output->device->tunables.queue_depth; i++) {
 		if (!output->buffers[i]->in_use)
 			return output->buffers[i];
 	}
@@ -68,6 +80,57 @@ static struct buffer *find_free_buffer(struct output *output)
 	assert(0 && "could not find free buffer for output!");
 }
 
+/*
+ * Complete the latency record of the buffer which has just started being
+ * displayed, and complain about every stage of it that went over budget.
+ */
+static void record_latency(struct output *output, struct timespec *completion)
+{
+	struct buffer *buffer = output->buffer_pending;
+	struct latency_record *record = &buffer->latency;
+	uint64_t fence_time, line_nsec;
+	unsigned int over_budget;
+
+	if (!output->latency)
+		return;
+
+	/*
+	 * With explicit fencing, the render fence tells us when the GPU
+	 * actually finished; it has signalled by now, since KMS waited for it.
+	 */
+	if (buffer->render_fence_fd >= 0) {
+		fence_time = linux_sync_file_get_fence_time(buffer->render_fence_fd);
+		if (fence_time != 0)
+			record->render_done_ns = fence_time;
+	}
+
+	/*
+	 * The completion timestamp is when the first line starts being
+	 * scanned out, so the middle of the picture is on screen half the
+	 * active lines later.
+	 */
+	record->flip_ns = timespec_to_nsec(completion);
+	line_nsec = output->refresh_interval_nsec / output->mode.vtotal;
+	record->scanout_ns = record->flip_ns +
+		line_nsec * output->mode.vdisplay / 2;
+
+	over_budget = latency_tracker_add(output->latency, record);
+	for (int i = 0; i < LATENCY_N_STAGES; i++) {
+		if (!(over_budget & (1u << i)))
+			continue;
+
+		error("[%s] LATENCY %s took %.2fms, budget is %.2fms\n",
+		      output->name, latency_stage_name(i),
+		      latency_record_get_stage(record, i) / 1e6,
+		      latency_tracker_get_budget(output->latency, i) / 1e6);
+	}
+
+#ifdef DEBUG
+	if (latency_tracker_get_n_frames(output->latency) % LATENCY_WINDOW == 0)
+		latency_tracker_print(output->latency, output->name, stderr);
+#endif
+}
+
 /*
  * Informs us that an atomic commit has completed for the given CRTC. This will
  * be called one for each output (identified by the crtc_id) for each commit.
@@ -122,8 +185,10 @@ static void atomic_event_handler(int fd,
 	 * steadily and predictably, if more slowly.
 	 */
 	delta_nsec = timespec_sub_to_nsec(&completion, &output->next_frame);
+	output->num_frames++;
 	if (timespec_to_nsec(&output->last_frame) != 0 &&
-	    llabs((long long) delta_nsec) > FRAME_TIMING_TOLERANCE) {
+	    llabs((long long) delta_nsec) > device->tunables.frame_timing_tolerance_nsec) {
+		output->num_mispredicted_frames++;
 		debug("[%s] FRAME %" PRIi64 "ns %s: expected %" PRIu64 ", got %" PRIu64 "\n",
 		      output->name,
 		      delta_nsec,
@@ -172,6 +237,24 @@ static void atomic_event_handler(int fd,
 		      linux_sync_file_get_fence_time(output->buffer_pending->render_fence_fd));
 	}
 
+	record_latency(output, &completion);
+
+	/* Keep the raw event, to replay it offline with flip-replay. */
+	if (device->recorder) {
+		struct flip_trace_event event = {
+			.crtc_id = crtc_id,
+			.sequence = sequence,
+			.flip_ns = timespec_to_nsec(&completion),
+			.predicted_ns = timespec_to_nsec(&output->next_frame),
+			.refresh_interval_ns = output->refresh_interval_nsec,
+			.render_start_ns = output->buffer_pending->latency.render_start_ns,
+			.render_done_ns = output->buffer_pending->latency.render_done_ns,
+			.commit_ns = output->buffer_pending->latency.commit_ns,
+		};
+
+		flip_recorder_add(device->recorder, &event);
+	}
+
 	if (output->buffer_last) {
 		assert(output->buffer_last->in_use);
 		debug("\treleasing buffer with FB ID %" PRIu32 "\n", output->buffer_last->fb_id);
@@ -188,7 +271,8 @@ static void atomic_event_handler(int fd,
  */
 static void advance_frame(struct output *output, struct timespec *now)
 {
-	struct timespec too_soon;
+	unsigned int n_intervals;
+	uint64_t next;
 
 	/* For our first tick, we won't have predicted a time. */
 	if (timespec_to_nsec(&output->last_frame) == 0L)
@@ -197,24 +281,22 @@ static void advance_frame(struct output *output, struct timespec *now)
 	/*
 	 * Starting from our last frame completion time, advance the predicted
 	 * completion for our next frame by one frame's refresh time, until we
-	 * have at least a 4ms margin in which to paint a new buffer and submit
-	 * our frame to KMS.
+	 * have at least the repaint margin (4ms by default) in which to paint
+	 * a new buffer and submit our frame to KMS.
 	 *
 	 * This will skip frames in the animation if necessary, so it is
 	 * temporally correct.
 	 */
-	timespec_add_msec(&too_soon, now, 4);
-	output->next_frame = output->last_frame;
-
-	while (timespec_sub_to_nsec(&too_soon, &output->next_frame) >= 0) {
-		timespec_add_nsec(&output->next_frame, &output->next_frame,
-				  output->refresh_interval_nsec);
-		output->frame_num = (output->frame_num + 1) % NUM_ANIM_FRAMES;
-	}
+	next = frame_timing_predict(timespec_to_nsec(&output->last_frame),
+				    timespec_to_nsec(now),
+				    output->refresh_interval_nsec,
+				    output->device->tunables.repaint_margin_nsec,
+				    &n_intervals);
+	timespec_from_nsec(&output->next_frame, next);
+	output->frame_num = (output->frame_num + n_intervals) % NUM_ANIM_FRAMES;
 }
 
-static void repaint_one_output(struct output *output, drmModeAtomicReqPtr req,
-			       bool *needs_modeset)
+static void repaint_one_output(struct output *output)
 {
 	struct timespec now;
 	struct buffer *buffer;
@@ -228,16 +310,41 @@ static void repaint_one_output(struct output *output, drmModeAtomicReqPtr req,
 	 * displayed, use this to derive a target position for our animation
 	 * (such that it remains as linear as possible over time, even at
 	 * the cost of dropping frames), render the content for that position.
+	 *
+	 * With software rendering, this only queues the buffer to be filled
+	 * by the worker threads, so all outputs get filled in parallel.
 	 */
 	buffer = find_free_buffer(output);
 	assert(buffer);
 	advance_frame(output, &now);
+
+	buffer->latency = (struct latency_record) {
+		.render_start_ns = timespec_to_nsec(&now),
+	};
 	buffer_fill(buffer, output->frame_num);
 
-	/* Add the output's new state to the atomic modesetting request. */
-	output_add_atomic_req(output, req, buffer);
+	/*
+	 * Rendering might not be done yet; the worker threads and the
+	 * render fence tell us when it is.
+	 */
+	buffer->latency.submit_ns = now_nsec();
+	buffer->latency.render_done_ns = buffer->latency.submit_ns;
+
 	buffer->in_use = true;
 	output->buffer_pending = buffer;
+}
+
+static void commit_one_output(struct output *output, drmModeAtomicReqPtr req,
+			      bool *needs_modeset)
+{
+	struct timespec now;
+	int ret;
+
+	ret = clock_gettime(CLOCK_MONOTONIC, &now);
+	assert(ret == 0);
+
+	/* Add the output's new state to the atomic modesetting request. */
+	output_add_atomic_req(output, req, output->buffer_pending);
 	output->needs_repaint = false;
 
 	/*
@@ -320,6 +427,32 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 * KMS_QUADS_CONTROL=<path> creates a control socket there, through
+	 * which the tunables can be changed while we run.
+	 */
+	if (getenv("KMS_QUADS_CONTROL")) {
+		device->control = control_create(device,
+						 getenv("KMS_QUADS_CONTROL"));
+		if (!device->control) {
+			ret = 4;
+			goto out;
+		}
+	}
+
+	/*
+	 * KMS_QUADS_RECORD=<path> writes every flip event there, along with
+	 * the render times of the frame, for replaying with flip-replay.
+	 */
+	if (getenv("KMS_QUADS_RECORD")) {
+		ret = flip_recorder_new(&device->recorder,
+					getenv("KMS_QUADS_RECORD"));
+		if (ret != 0) {
+			ret = 4;
+			goto out;
+		}
+	}
+
 	printf("finished initialization\n");
 
 	/* Our main rendering loop, which we spin forever. */
@@ -332,10 +465,17 @@ int main(int argc, char *argv[])
 			.version = 3,
 			.page_flip_handler2 = atomic_event_handler,
 		};
-		struct pollfd poll_fd = {
-			.fd = device->kms_fd,
-			.events = POLLIN,
+		struct pollfd poll_fds[1 + CONTROL_MAX_POLLFDS] = {
+			{ .fd = device->kms_fd, .events = POLLIN, },
 		};
+		int num_poll_fds = 1;
+
+		/*
+		 * Pick up changes made through the control socket since the
+		 * last iteration, before we start repainting any output.
+		 */
+		if (device->control)
+			control_apply(device->control);
 
 		/*
 		 * Allocate an atomic-modesetting request structure for any
@@ -360,6 +500,29 @@ int main(int argc, char *argv[])
 		 * of any hardware changes it would need to perform to reach
 		 * the target state.
 		 */
+		for (int i = 0; i < device->num_outputs; i++) {
+			struct output *output = device->outputs[i];
+			if (output->needs_repaint)
+				repaint_one_output(output);
+		}
+
+		/*
+		 * KMS may start scanning out as soon as we commit, so all
+		 * the bands queued above need to be filled by then.
+		 */
+		if (device->workpool) {
+			uint64_t done;
+
+			workpool_wait(device->workpool);
+
+			done = now_nsec();
+			for (int i = 0; i < device->num_outputs; i++) {
+				struct output *output = device->outputs[i];
+				if (output->needs_repaint)
+					output->buffer_pending->latency.render_done_ns = done;
+			}
+		}
+
 		for (int i = 0; i < device->num_outputs; i++) {
 			struct output *output = device->outputs[i];
 			if (output->needs_repaint) {
@@ -367,7 +530,7 @@ int main(int argc, char *argv[])
 				 * Add this output's new state to the atomic
 				 * request.
 				 */
-				repaint_one_output(output, req, &needs_modeset);
+				commit_one_output(output, req, &needs_modeset);
 				output_count++;
 			}
 		}
@@ -398,6 +561,17 @@ int main(int argc, char *argv[])
 			break;
 		}
 
+		if (output_count) {
+			uint64_t committed = now_nsec();
+
+			for (int i = 0; i < device->num_outputs; i++) {
+				struct output *output = device->outputs[i];
+				if (output->buffer_pending &&
+				    output->buffer_pending->latency.commit_ns == 0)
+					output->buffer_pending->latency.commit_ns = committed;
+			}
+		}
+
 		/*
 		 * The out-fence FD from KMS signals when the commit we've just
 		 * made becomes active, at the same time as the event handler
@@ -406,7 +580,8 @@ int main(int argc, char *argv[])
 		 */
 		for (int i = 0; i < device->num_outputs; i++) {
 			struct output *output = device->outputs[i];
-			if (output->explicit_fencing && output->buffer_last) {
+			if (output->explicit_fencing && output->buffer_last &&
+			    output->commit_fence_fd >= 0) {
 				assert(linux_sync_file_is_valid(output->commit_fence_fd));
 				fd_replace(&output->buffer_last->kms_fence_fd,
 					   output->commit_fence_fd);
@@ -420,18 +595,31 @@ int main(int argc, char *argv[])
 		 * completes, we will receive one event per output (making
 		 * the DRM FD be readable and waking us from poll), which we
 		 * then dispatch through drmHandleEvent into our callback.
+		 *
+		 * Clients of the control socket can wake us up too, in which
+		 * case nothing needs repainting on the next iteration.
 		 */
-		ret = poll(&poll_fd, 1, -1);
+		if (device->control)
+			num_poll_fds += control_get_pollfds(device->control,
+							    &poll_fds[1]);
+
+		ret = poll(poll_fds, num_poll_fds, -1);
 		if (ret == -1) {
 			fprintf(stderr, "error polling KMS FD: %d\n", ret);
 			break;
 		}
 
-		ret = drmHandleEvent(device->kms_fd, &evctx);
-		if (ret == -1) {
-			fprintf(stderr, "error reading KMS events: %d\n", ret);
-			break;
+		if (poll_fds[0].revents & POLLIN) {
+			ret = drmHandleEvent(device->kms_fd, &evctx);
+			if (ret == -1) {
+				fprintf(stderr, "error reading KMS events: %d\n", ret);
+				break;
+			}
 		}
+
+		if (device->control)
+			control_dispatch(device->control, &poll_fds[1],
+					 num_poll_fds - 1);
 	}
 
 out:
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+#include <memtrack.h>
+
+struct memtrack_counter {
+    VkDeviceSize current, peak;
+};
+
+struct memtrack {
+    pthread_mutex_t mutex;
+
+    VkPhysicalDevice physical_device;
+    VkPhysicalDeviceMemoryProperties memory_props;
+    bool budget_supported;
+    uint32_t main_heap;
+
+    struct memtrack_counter heaps[VK_MAX_MEMORY_HEAPS];
+    struct memtrack_counter heap_kinds[VK_MAX_MEMORY_HEAPS][MEMTRACK_N_KINDS];
+    struct memtrack_counter outputs[MEMTRACK_MAX_OUTPUTS];
+};
+
+static const char *kind_names[MEMTRACK_N_KINDS] = {
+    [MEMTRACK_KIND_SCANOUT] = "scanout",
+    [MEMTRACK_KIND_OFFSCREEN] = "offscreen",
+    [MEMTRACK_KIND_BUFFER] = "buffers",
+};
+
+int memtrack_new(struct memtrack **memtrack_out, VkPhysicalDevice physical_device, bool budget_supported) {
+    struct memtrack *memtrack;
+    VkDeviceSize main_heap_size;
+    int ok;
+
+    memtrack = malloc(sizeof *memtrack);
+    if (memtrack == NULL) {
+        return ENOMEM;
+    }
+
+    ok = pthread_mutex_init(&memtrack->mutex, NULL);
+    if (ok != 0) {
+        free(memtrack);
+        return ok;
+    }
+
+    memtrack->physical_device = physical_device;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memtrack->memory_props);
+    memtrack->budget_supported = budget_supported;
+
+    // every device has at least one device local heap.
+    memtrack->main_heap = 0;
+    main_heap_size = 0;
+    for (uint32_t i = 0; i < memtrack->memory_props.memoryHeapCount; i++) {
+        const VkMemoryHeap *heap = memtrack->memory_props.memoryHeaps + i;
+
+        if ((heap->flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && heap->size > main_heap_size) {
+            memtrack->main_heap = i;
+            main_heap_size = heap->size;
+        }
+    }
+
+    memset(memtrack->heaps, 0, sizeof memtrack->heaps);
+    memset(memtrack->heap_kinds, 0, sizeof memtrack->heap_kinds);
+    memset(memtrack->outputs, 0, sizeof memtrack->outputs);
+
+    *memtrack_out = memtrack;
+    return 0;
+}
+
+void memtrack_destroy(struct memtrack *memtrack) {
+    pthread_mutex_destroy(&memtrack->mutex);
+    free(memtrack);
+}
+
+static void counter_add(struct memtrack_counter *counter, VkDeviceSize size) {
+    counter->current += size;
+    if (counter->current > counter->peak) {
+        counter->peak = counter->current;
+    }
+}
+
+static void counter_remove(struct memtrack_counter *counter, VkDeviceSize size) {
+    counter->current = counter->current >= size ? counter->current - size : 0;
+}
+
+void memtrack_add(struct memtrack *memtrack, int output, enum memtrack_kind kind, uint32_t memory_type, VkDeviceSize size) {
+    uint32_t heap;
+
+    if (memory_type >= memtrack->memory_props.memoryTypeCount) {
+        fprintf(stderr, "[memtrack] Memory type %" PRIu32 " doesn't exist.\n", memory_type);
+        return;
+    }
+
+    heap = memtrack->memory_props.memoryTypes[memory_type].heapIndex;
+
+    pthread_mutex_lock(&memtrack->mutex);
+    counter_add(memtrack->heaps + heap, size);
+    counter_add(&memtrack->heap_kinds[heap][kind], size);
+    if (output >= 0 && output < MEMTRACK_MAX_OUTPUTS) {
+        counter_add(memtrack->outputs + output, size);
+    }
+    pthread_mutex_unlock(&memtrack->mutex);
+}
+
+void memtrack_remove(struct memtrack *memtrack, int output, enum memtrack_kind kind, uint32_t memory_type, VkDeviceSize size) {
+    uint32_t heap;
+
+    if (memory_type >= memtrack->memory_props.memoryTypeCount) {
+        return;
+    }
+
+    heap = memtrack->memory_props.memoryTypes[memory_type].heapIndex;
+
+    pthread_mutex_lock(&memtrack->mutex);
+    counter_remove(memtrack->heaps + heap, size);
+    counter_remove(&memtrack->heap_kinds[heap][kind], size);
+    if (output >= 0 && output < MEMTRACK_MAX_OUTPUTS) {
+        counter_remove(memtrack->outputs + output, size);
+    }
+    pthread_mutex_unlock(&memtrack->mutex);
+}
+
+uint32_t memtrack_get_n_heaps(struct memtrack *memtrack) {
+    return memtrack->memory_props.memoryHeapCount;
+}
+
+uint32_t memtrack_get_main_heap(struct memtrack *memtrack) {
+    return memtrack->main_heap;
+}
+
+void memtrack_get_heap_stats(struct memtrack *memtrack, uint32_t heap, struct memtrack_heap_stats *stats_out) {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+        .pNext = NULL,
+    };
+    VkPhysicalDeviceMemoryProperties2 props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+        .pNext = &budget_props,
+    };
+    VkDeviceSize used;
+
+    memset(stats_out, 0, sizeof *stats_out);
+    if (heap >= memtrack->memory_props.memoryHeapCount) {
+        return;
+    }
+
+    stats_out->size = memtrack->memory_props.memoryHeaps[heap].size;
+    stats_out->device_local = memtrack->memory_props.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+
+    pthread_mutex_lock(&memtrack->mutex);
+    stats_out->tracked = memtrack->heaps[heap].current;
+    stats_out->peak = memtrack->heaps[heap].peak;
+    for (int i = 0; i < MEMTRACK_N_KINDS; i++) {
+        stats_out->by_kind[i] = memtrack->heap_kinds[heap][i].current;
+    }
+    pthread_mutex_unlock(&memtrack->mutex);
+
+    if (memtrack->budget_supported) {
+        vkGetPhysicalDeviceMemoryProperties2(memtrack->physical_device, &props);
+        stats_out->budget = budget_props.heapBudget[heap];
+        stats_out->usage = budget_props.heapUsage[heap];
+    } else {
+        stats_out->budget = stats_out->size;
+        stats_out->usage = stats_out->tracked;
+    }
+
+    // GBM buffers are allocated by the kernel driver, depending on the driver
+    // they may or may not show up in the usage.
+    used = stats_out->usage > stats_out->tracked ? stats_out->usage : stats_out->tracked;
+    stats_out->headroom = stats_out->budget > used ? stats_out->budget - used : 0;
+}
+
+void memtrack_get_output_stats(struct memtrack *memtrack, int output, VkDeviceSize *tracked_out, VkDeviceSize *peak_out) {
+    if (output < 0 || output >= MEMTRACK_MAX_OUTPUTS) {
+        *tracked_out = 0;
+        *peak_out = 0;
+        return;
+    }
+
+    pthread_mutex_lock(&memtrack->mutex);
+    *tracked_out = memtrack->outputs[output].current;
+    *peak_out = memtrack->outputs[output].peak;
+    pthread_mutex_unlock(&memtrack->mutex);
+}
+
+#define MIB(bytes) ((double) (bytes) / (1024.0 * 1024.0))
+
+void memtrack_print(struct memtrack *memtrack, FILE *file) {
+    struct memtrack_heap_stats stats;
+    VkDeviceSize tracked, peak;
+
+    fprintf(file, "device memory%s:\n", memtrack->budget_supported ? "" : " (no VK_EXT_memory_budget, budget is the heap size)");
+
+    for (uint32_t i = 0; i < memtrack->memory_props.memoryHeapCount; i++) {
+        memtrack_get_heap_stats(memtrack, i, &stats);
+
+        fprintf(
+            file,
+            "  heap %" PRIu32 "%s: %.1f MiB, budget %.1f MiB, usage %.1f MiB, tracked %.1f MiB (peak %.1f MiB), headroom %.1f MiB\n",
+            i,
+            stats.device_local ? " (device local)" : "",
+            MIB(stats.size),
+            MIB(stats.budget),
+            MIB(stats.usage),
+            MIB(stats.tracked),
+            MIB(stats.peak),
+            MIB(stats.headroom)
+        );
+
+        for (int kind = 0; kind < MEMTRACK_N_KINDS; kind++) {
+            if (stats.by_kind[kind] > 0) {
+                fprintf(file, "    %-10s %.1f MiB\n", kind_names[kind], MIB(stats.by_kind[kind]));
+            }
+        }
+    }
+
+    for (int i = 0; i < MEMTRACK_MAX_OUTPUTS; i++) {
+        memtrack_get_output_stats(memtrack, i, &tracked, &peak);
+        if (peak > 0) {
+            fprintf(file, "  output %d: %.1f MiB (peak %.1f MiB)\n", i, MIB(tracked), MIB(peak));
+        }
+    }
+}
+
+void memtrack_plan_render_targets(
+    struct memtrack *memtrack,
+    VkDeviceSize full_depth_size,
+    VkDeviceSize low_depth_size,
+    int min_buffers,
+    int max_buffers,
+    struct memtrack_plan *plan_out
+) {
+    struct memtrack_heap_stats stats;
+    VkDeviceSize reserve, available;
+    int n;
+
+    memtrack_get_heap_stats(memtrack, memtrack->main_heap, &stats);
+
+    reserve = stats.budget / 8;
+    available = stats.headroom > reserve ? stats.headroom - reserve : 0;
+
+    for (n = max_buffers; n >= min_buffers; n--) {
+        if (n * full_depth_size <= available) {
+            plan_out->n_buffers = n;
+            plan_out->low_depth = false;
+            return;
+        }
+    }
+
+    if (low_depth_size > 0) {
+        for (n = max_buffers; n >= min_buffers; n--) {
+            if (n * low_depth_size <= available) {
+                plan_out->n_buffers = n;
+                plan_out->low_depth = true;
+                return;
+            }
+        }
+    }
+
+    fprintf(
+        stderr,
+        "[memtrack] Not even %d render targets fit into the memory budget (%.1f MiB available).\n",
+        min_buffers,
+        MIB(available)
+    );
+
+    plan_out->n_buffers = min_buffers;
+    plan_out->low_depth = low_depth_size > 0;
+}
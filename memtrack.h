@@ -0,0 +1,170 @@
+#ifndef _MEMTRACK_H
+#define _MEMTRACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vulkan/vulkan.h>
+
+#define MEMTRACK_MAX_OUTPUTS 4
+
+/// For allocations that don't belong to any output, like vertex buffers.
+#define MEMTRACK_NO_OUTPUT (-1)
+
+/**
+ * @brief Accounting of all the device memory we allocate, per memory heap,
+ * per output and per kind of allocation.
+ *
+ * vkalloc knows about blocks, but not what they're used for, and neither
+ * knows about memory that's allocated by GBM and only imported into vulkan.
+ * So every allocation site reports its allocations here.
+ *
+ * If VK_EXT_memory_budget is supported, the budget and usage of each heap
+ * (as reported by the driver, including other processes on some drivers) are
+ * queried too, otherwise the heap size is used as the budget.
+ *
+ * All functions are thread-safe.
+ */
+struct memtrack;
+
+enum memtrack_kind {
+    /// GBM buffers that are scanned out and rendered into.
+    MEMTRACK_KIND_SCANOUT,
+
+    /// Render targets of headless mode.
+    MEMTRACK_KIND_OFFSCREEN,
+
+    /// Vertex, index, uniform & staging buffers.
+    MEMTRACK_KIND_BUFFER,
+
+    MEMTRACK_N_KINDS
+};
+
+struct memtrack_heap_stats {
+    VkDeviceSize size;
+    bool device_local;
+
+    /// How much this process can allocate from the heap without hurting
+    /// performance (or failing). The heap size without VK_EXT_memory_budget.
+    VkDeviceSize budget;
+
+    /// How much memory this process has allocated from the heap according to
+    /// the driver. Same as @ref tracked without VK_EXT_memory_budget.
+    VkDeviceSize usage;
+
+    /// The sum of all allocations reported to memtrack, and its peak.
+    VkDeviceSize tracked, peak;
+
+    /// budget - max(usage, tracked), or 0 if we're over budget.
+    VkDeviceSize headroom;
+
+    VkDeviceSize by_kind[MEMTRACK_N_KINDS];
+};
+
+/**
+ * @brief What to allocate for the render targets of an output, see @ref memtrack_plan_render_targets.
+ */
+struct memtrack_plan {
+    int n_buffers;
+
+    /// Whether to use a 16 bit format instead of a 32 bit one.
+    bool low_depth;
+};
+
+int memtrack_new(
+    struct memtrack **memtrack_out,
+    VkPhysicalDevice physical_device,
+    bool budget_supported
+);
+
+void memtrack_destroy(
+    struct memtrack *memtrack
+);
+
+/**
+ * @brief Record an allocation of @a size bytes from memory type @a memory_type,
+ * made for @a output (or MEMTRACK_NO_OUTPUT).
+ */
+void memtrack_add(
+    struct memtrack *memtrack,
+    int output,
+    enum memtrack_kind kind,
+    uint32_t memory_type,
+    VkDeviceSize size
+);
+
+/**
+ * @brief Undo @ref memtrack_add, with the exact same arguments.
+ */
+void memtrack_remove(
+    struct memtrack *memtrack,
+    int output,
+    enum memtrack_kind kind,
+    uint32_t memory_type,
+    VkDeviceSize size
+);
+
+uint32_t memtrack_get_n_heaps(
+    struct memtrack *memtrack
+);
+
+/**
+ * @brief The largest device local heap. That's where render targets and
+ * scanout buffers end up (on unified memory devices, it's the only heap anyway).
+ */
+uint32_t memtrack_get_main_heap(
+    struct memtrack *memtrack
+);
+
+/**
+ * @brief Get the current stats of @a heap. This queries the budget, so don't
+ * do it every frame.
+ */
+void memtrack_get_heap_stats(
+    struct memtrack *memtrack,
+    uint32_t heap,
+    struct memtrack_heap_stats *stats_out
+);
+
+/**
+ * @brief Bytes currently allocated for @a output (of all kinds), and the peak.
+ */
+void memtrack_get_output_stats(
+    struct memtrack *memtrack,
+    int output,
+    VkDeviceSize *tracked_out,
+    VkDeviceSize *peak_out
+);
+
+/**
+ * @brief Print totals, peaks and headroom of all heaps and outputs.
+ */
+void memtrack_print(
+    struct memtrack *memtrack,
+    FILE *file
+);
+
+/**
+ * @brief Decide how many render targets to allocate, and at which depth, so
+ * they fit into the headroom of the main heap while keeping a reserve of
+ * 1/8th of the budget.
+ *
+ * Buffers are dropped first (down to @a min_buffers), since that only costs
+ * some pipelining. If even @a min_buffers full-depth buffers don't fit, the
+ * depth is lowered. If that doesn't fit either, the result is @a min_buffers
+ * low-depth buffers and the allocations will probably fail.
+ *
+ * @param full_depth_size Size of one 32 bit render target.
+ * @param low_depth_size Size of one 16 bit render target, or 0 if the output can't do 16 bit.
+ */
+void memtrack_plan_render_targets(
+    struct memtrack *memtrack,
+    VkDeviceSize full_depth_size,
+    VkDeviceSize low_depth_size,
+    int min_buffers,
+    int max_buffers,
+    struct memtrack_plan *plan_out
+);
+
+#endif
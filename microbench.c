@@ -0,0 +1,651 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <drm_backend.h>
+#include <modesetting.h>
+#include <mock_drm.h>
+#include <drm_property.h>
+#include <edid.h>
+#include <timespec-util.h>
+#include <benchmark.h>
+
+/// Results are written here, so the compiler can't drop the loops.
+static volatile uint64_t sink;
+
+static uint64_t get_monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// The properties a primary plane update sets every frame, in the order main.c puts them.
+static const char *const plane_update_props[] = {
+    "FB_ID", "CRTC_ID",
+    "SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+    "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H",
+};
+
+#define N_PLANE_UPDATE_PROPS (sizeof plane_update_props / sizeof *plane_update_props)
+
+/// How many properties are put into one atomic request before starting a new one, roughly a frame with a few planes.
+#define PROPS_PER_REQ 64
+
+/// How many properties the fake objects of the drm_property_get_value cases have, like a plane on a typical driver.
+#define N_FAKE_PROPS 24
+
+struct microbench {
+    struct mock_drm *mock;
+    struct drmdev *drmdev;
+    uint32_t primary_plane_id;
+
+    /// drm_property_get_value looks through these.
+    drmModeObjectProperties props;
+    uint32_t prop_ids[N_FAKE_PROPS];
+    uint64_t prop_values[N_FAKE_PROPS];
+    struct drm_property_info range_info;
+    struct drm_property_info enum_info;
+    struct drm_property_enum_info enum_values[4];
+
+    uint8_t edid[128];
+};
+
+/**
+ * @brief A hot path to time. @a run does @a n operations; the metric is the
+ * time of one of them, so it doesn't change with the number of iterations.
+ */
+struct microbench_case {
+    const char *name;
+    int (*run)(struct microbench *bench, int n);
+};
+
+/// Like configure_drmdev in vulkan2.c: the first connected connector, its preferred mode and an encoder & CRTC for it.
+static int configure(struct microbench *bench) {
+    struct drm_connector *connector;
+    struct drm_encoder *encoder;
+    struct drm_crtc *crtc;
+    const drmModeModeInfo *mode = NULL;
+    struct drmdev *drmdev = bench->drmdev;
+    int ok;
+
+    for_each_connector_in_drmdev(drmdev, connector) {
+        if (connector->connector->connection == DRM_MODE_CONNECTED) {
+            break;
+        }
+    }
+    if (connector == NULL) {
+        return ENODEV;
+    }
+
+    for (int i = 0; i < connector->connector->count_modes; i++) {
+        if (connector->connector->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+            mode = connector->connector->modes + i;
+            break;
+        }
+    }
+    if (mode == NULL) {
+        return ENODEV;
+    }
+
+    for_each_encoder_in_drmdev(drmdev, encoder) {
+        if (encoder->encoder->encoder_id == connector->connector->encoders[0]) {
+            break;
+        }
+    }
+    if (encoder == NULL) {
+        return ENODEV;
+    }
+
+    for_each_crtc_in_drmdev(drmdev, crtc) {
+        if (encoder->encoder->possible_crtcs & crtc->bitmask) {
+            break;
+        }
+    }
+    if (crtc == NULL) {
+        return ENODEV;
+    }
+
+    ok = drmdev_configure(drmdev, connector->connector->connector_id, encoder->encoder->encoder_id, crtc->crtc->crtc_id, mode);
+    if (ok != 0) {
+        return ok;
+    }
+
+    return drmdev_get_primary_plane_id(drmdev, &bench->primary_plane_id);
+}
+
+/// A 1080p monitor with name, serial number and a detailed timing descriptor, which edid_parse skips.
+static void make_edid(uint8_t edid[128]) {
+    static const uint8_t header[] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+    static const uint8_t detailed_timing[] = {
+        0x02, 0x3a, 0x80, 0x18, 0x71, 0x38, 0x2d, 0x40, 0x58, 0x2c, 0x45, 0x00, 0x56, 0x50, 0x21, 0x00, 0x00, 0x1e,
+    };
+    uint8_t sum;
+
+    memset(edid, 0, 128);
+    memcpy(edid, header, sizeof header);
+
+    // "KMS", product 0x1234, serial 1234567
+    edid[0x08] = ('K' - 'A' + 1) << 2 | ('M' - 'A' + 1) >> 3;
+    edid[0x09] = (('M' - 'A' + 1) << 5 | ('S' - 'A' + 1)) & 0xff;
+    edid[0x0a] = 0x34;
+    edid[0x0b] = 0x12;
+    edid[0x0c] = 1234567 & 0xff;
+    edid[0x0d] = (1234567 >> 8) & 0xff;
+    edid[0x0e] = (1234567 >> 16) & 0xff;
+    edid[0x12] = 1;
+    edid[0x13] = 4;
+
+    memcpy(edid + 0x36, detailed_timing, sizeof detailed_timing);
+
+    edid[0x48 + 3] = 0xfc;
+    memcpy(edid + 0x48 + 5, "kms-quads\n   ", 13);
+
+    edid[0x5a + 3] = 0xff;
+    memcpy(edid + 0x5a + 5, "KQ0000000042\n", 13);
+
+    edid[0x6c + 3] = 0xfe;
+    memcpy(edid + 0x6c + 5, "microbench\n  ", 13);
+
+    sum = 0;
+    for (int i = 0; i < 127; i++) {
+        sum += edid[i];
+    }
+    edid[127] = -sum;
+}
+
+static int microbench_new(struct microbench *bench) {
+    struct mock_drm_config config;
+    int ok;
+
+    memset(bench, 0, sizeof *bench);
+
+    // the manual clock, so no timerfd wakeups get in the way.
+    mock_drm_get_default_config(&config);
+    config.manual_clock = true;
+
+    ok = mock_drm_new(&bench->mock, &config);
+    if (ok != 0) {
+        fprintf(stderr, "[microbench] Couldn't create the mock device. mock_drm_new: %s\n", strerror(ok));
+        return ok;
+    }
+
+    ok = drmdev_new_with_backend(&bench->drmdev, mock_drm_get_fd(bench->mock), &drm_backend_mock);
+    if (ok != 0) {
+        fprintf(stderr, "[microbench] Couldn't create a drmdev on the mock device. drmdev_new_with_backend: %s\n", strerror(ok));
+        mock_drm_destroy(bench->mock);
+        return ok;
+    }
+
+    ok = configure(bench);
+    if (ok != 0) {
+        fprintf(stderr, "[microbench] Couldn't configure the mock device. %s\n", strerror(ok));
+        mock_drm_destroy(bench->mock);
+        return ok;
+    }
+
+    // property IDs are handed out in one ID space with the other objects, so they're spread out.
+    for (int i = 0; i < N_FAKE_PROPS; i++) {
+        bench->prop_ids[i] = 40 + 3 * i;
+        bench->prop_values[i] = i;
+    }
+    bench->props.count_props = N_FAKE_PROPS;
+    bench->props.props = bench->prop_ids;
+    bench->props.prop_values = bench->prop_values;
+
+    // the worst case: the last property.
+    bench->range_info = (struct drm_property_info) {
+        .name = "CRTC_H",
+        .prop_id = bench->prop_ids[N_FAKE_PROPS - 1],
+    };
+
+    // like the "type" property of a plane, somewhere in the middle.
+    bench->enum_values[0] = (struct drm_property_enum_info) { .name = "Overlay", .valid = true, .value = 0 };
+    bench->enum_values[1] = (struct drm_property_enum_info) { .name = "Primary", .valid = true, .value = 1 };
+    bench->enum_values[2] = (struct drm_property_enum_info) { .name = "Cursor", .valid = true, .value = 2 };
+    bench->enum_values[3] = (struct drm_property_enum_info) { .name = "Unknown", .valid = false };
+    bench->prop_values[N_FAKE_PROPS / 2] = 2;
+    bench->enum_info = (struct drm_property_info) {
+        .name = "type",
+        .prop_id = bench->prop_ids[N_FAKE_PROPS / 2],
+        .num_enum_values = 4,
+        .enum_values = bench->enum_values,
+    };
+
+    make_edid(bench->edid);
+
+    return 0;
+}
+
+/// There's no drmdev_destroy, so the drmdev leaks. It's only a few objects.
+static void microbench_destroy(struct microbench *bench) {
+    mock_drm_destroy(bench->mock);
+}
+
+/// Check the cases compute the right thing, before timing them.
+static bool verify(struct microbench *bench) {
+    struct drmdev_atomic_req *req;
+    struct edid_info *edid;
+    struct timespec a, b, r;
+    bool ok = true;
+
+    if (drm_property_get_value(&bench->range_info, &bench->props, 1234) != N_FAKE_PROPS - 1) {
+        fprintf(stderr, "[microbench] drm_property_get_value returned the wrong value.\n");
+        ok = false;
+    }
+    if (drm_property_get_value(&bench->enum_info, &bench->props, 1234) != 2) {
+        fprintf(stderr, "[microbench] drm_property_get_value returned the wrong enum value.\n");
+        ok = false;
+    }
+
+    edid = edid_parse(bench->edid, sizeof bench->edid);
+    if (edid == NULL) {
+        fprintf(stderr, "[microbench] edid_parse couldn't parse the EDID.\n");
+        ok = false;
+    } else {
+        if (strcmp(edid->pnp_id, "KMS") != 0 ||
+            strcmp(edid->monitor_name, "kms-quads") != 0 ||
+            strcmp(edid->serial_number, "KQ0000000042") != 0 ||
+            strcmp(edid->eisa_id, "microbench") != 0) {
+            fprintf(stderr, "[microbench] edid_parse returned the wrong strings.\n");
+            ok = false;
+        }
+        free(edid);
+    }
+
+    a = (struct timespec) { .tv_sec = 10, .tv_nsec = 999999999 };
+    timespec_add_nsec(&r, &a, 16666667);
+    timespec_from_nsec(&b, 11016666666ll);
+    if (!timespec_eq(&r, &b) || timespec_sub_to_nsec(&r, &a) != 16666667) {
+        fprintf(stderr, "[microbench] The timespec arithmetic is wrong.\n");
+        ok = false;
+    }
+
+    if (drmdev_new_atomic_req(bench->drmdev, &req) != 0) {
+        fprintf(stderr, "[microbench] Couldn't create an atomic request.\n");
+        return false;
+    }
+    for (size_t i = 0; i < N_PLANE_UPDATE_PROPS; i++) {
+        if (drmdev_atomic_req_put_plane_property(req, bench->primary_plane_id, plane_update_props[i], 1) != 0) {
+            fprintf(stderr, "[microbench] The primary plane doesn't have a \"%s\" property.\n", plane_update_props[i]);
+            ok = false;
+        }
+    }
+    if (drmdev_atomic_req_put_crtc_property(req, "ACTIVE", 1) != 0 ||
+        drmdev_atomic_req_put_connector_property(req, "CRTC_ID", bench->drmdev->selected_crtc->crtc->crtc_id) != 0) {
+        fprintf(stderr, "[microbench] Couldn't put the CRTC & connector properties.\n");
+        ok = false;
+    }
+    drmdev_destroy_atomic_req(req);
+
+    return ok;
+}
+
+/*
+ * drmdev_atomic_req_put_*_property: find the property by name, then add it to
+ * the request. Requests are recycled every PROPS_PER_REQ properties, so they
+ * don't grow without bound; that's amortized into the per-call time.
+ */
+static int put_properties(struct microbench *bench, int n, int which) {
+    struct drmdev_atomic_req *req;
+    int ok, n_props;
+
+    req = NULL;
+    n_props = PROPS_PER_REQ;
+    for (int i = 0; i < n; i++) {
+        if (n_props == PROPS_PER_REQ) {
+            if (req != NULL) {
+                drmdev_destroy_atomic_req(req);
+            }
+            ok = drmdev_new_atomic_req(bench->drmdev, &req);
+            if (ok != 0) {
+                return ok;
+            }
+            n_props = 0;
+        }
+
+        if (which == 0) {
+            ok = drmdev_atomic_req_put_connector_property(req, "CRTC_ID", bench->drmdev->selected_crtc->crtc->crtc_id);
+        } else if (which == 1) {
+            ok = drmdev_atomic_req_put_crtc_property(req, (i & 1) ? "ACTIVE" : "MODE_ID", 1);
+        } else {
+            ok = drmdev_atomic_req_put_plane_property(req, bench->primary_plane_id, plane_update_props[i % N_PLANE_UPDATE_PROPS], i);
+        }
+        if (ok != 0) {
+            drmdev_destroy_atomic_req(req);
+            return ok;
+        }
+        n_props++;
+    }
+
+    if (req != NULL) {
+        drmdev_destroy_atomic_req(req);
+    }
+    return 0;
+}
+
+static int run_put_connector_property(struct microbench *bench, int n) {
+    return put_properties(bench, n, 0);
+}
+
+static int run_put_crtc_property(struct microbench *bench, int n) {
+    return put_properties(bench, n, 1);
+}
+
+static int run_put_plane_property(struct microbench *bench, int n) {
+    return put_properties(bench, n, 2);
+}
+
+/*
+ * One frame's worth of atomic request churn: a request for the primary plane
+ * update, one for an overlay, the overlay merged into the primary one (like
+ * assign_planes does after a successful test commit), and both freed.
+ */
+static int atomic_churn(const struct drm_backend *backend, int n) {
+    drmModeAtomicReq *base, *augment;
+
+    for (int i = 0; i < n; i++) {
+        base = backend->atomic_alloc();
+        augment = backend->atomic_alloc();
+        if (base == NULL || augment == NULL) {
+            return ENOMEM;
+        }
+
+        for (uint32_t j = 0; j < N_PLANE_UPDATE_PROPS; j++) {
+            backend->atomic_add_property(base, 31, 40 + j, i);
+            backend->atomic_add_property(augment, 32, 40 + j, i);
+        }
+
+        if (backend->atomic_merge(base, augment) < 0) {
+            return errno;
+        }
+
+        backend->atomic_free(augment);
+        backend->atomic_free(base);
+    }
+
+    return 0;
+}
+
+static int run_atomic_churn_libdrm(struct microbench *bench, int n) {
+    return atomic_churn(&drm_backend_libdrm, n);
+}
+
+static int run_atomic_churn_mock(struct microbench *bench, int n) {
+    return atomic_churn(&drm_backend_mock, n);
+}
+
+static int run_drm_property_get_value(struct microbench *bench, int n) {
+    uint64_t sum = 0;
+
+    for (int i = 0; i < n; i++) {
+        sum += drm_property_get_value(&bench->range_info, &bench->props, 0);
+    }
+
+    sink = sum;
+    return 0;
+}
+
+static int run_drm_property_get_value_enum(struct microbench *bench, int n) {
+    uint64_t sum = 0;
+
+    for (int i = 0; i < n; i++) {
+        sum += drm_property_get_value(&bench->enum_info, &bench->props, 0);
+    }
+
+    sink = sum;
+    return 0;
+}
+
+/// What connecting an output costs: parsing the EDID blob, including the allocation.
+static int run_edid_parse(struct microbench *bench, int n) {
+    struct edid_info *edid;
+
+    for (int i = 0; i < n; i++) {
+        edid = edid_parse(bench->edid, sizeof bench->edid);
+        if (edid == NULL) {
+            return EINVAL;
+        }
+
+        sink += (uint8_t) edid->monitor_name[0];
+        free(edid);
+    }
+
+    return 0;
+}
+
+/// Stepping a frame time forward by a refresh interval, like the frame scheduling in main.c.
+static int run_timespec_add_nsec(struct microbench *bench, int n) {
+    struct timespec t = { .tv_sec = 1000, .tv_nsec = 0 };
+
+    for (int i = 0; i < n; i++) {
+        timespec_add_nsec(&t, &t, 16666667 + (i & 7));
+    }
+
+    sink = t.tv_nsec;
+    return 0;
+}
+
+/// The difference between a flip timestamp and now, like the frame scheduling in main.c.
+static int run_timespec_sub_to_nsec(struct microbench *bench, int n) {
+    struct timespec a = { .tv_sec = 1000, .tv_nsec = 999999999 };
+    struct timespec b = { .tv_sec = 998, .tv_nsec = 1 };
+    int64_t sum = 0;
+
+    for (int i = 0; i < n; i++) {
+        b.tv_nsec = i & 0xffff;
+        sum += timespec_sub_to_nsec(&a, &b);
+    }
+
+    sink = sum;
+    return 0;
+}
+
+static const struct microbench_case cases[] = {
+    { "drmdev_put_connector_property_ns", run_put_connector_property },
+    { "drmdev_put_crtc_property_ns", run_put_crtc_property },
+    { "drmdev_put_plane_property_ns", run_put_plane_property },
+    { "atomic_churn_libdrm_ns", run_atomic_churn_libdrm },
+    { "atomic_churn_mock_ns", run_atomic_churn_mock },
+    { "drm_property_get_value_ns", run_drm_property_get_value },
+    { "drm_property_get_value_enum_ns", run_drm_property_get_value_enum },
+    { "edid_parse_ns", run_edid_parse },
+    { "timespec_add_nsec_ns", run_timespec_add_nsec },
+    { "timespec_sub_to_nsec_ns", run_timespec_sub_to_nsec },
+};
+
+#define N_CASES (sizeof cases / sizeof *cases)
+
+/**
+ * @brief Find how many operations take at least @a min_time_ns, so the clock
+ * overhead and resolution don't matter. Doubles from 1 until it's enough.
+ */
+static int calibrate(struct microbench *bench, const struct microbench_case *c, uint64_t min_time_ns, int *n_out) {
+    uint64_t start, elapsed;
+    int n, ok;
+
+    n = 1;
+    while (true) {
+        start = get_monotonic_ns();
+        ok = c->run(bench, n);
+        elapsed = get_monotonic_ns() - start;
+        if (ok != 0) {
+            return ok;
+        }
+
+        if (elapsed >= min_time_ns || n >= (1 << 28)) {
+            break;
+        }
+
+        n *= 2;
+    }
+
+    *n_out = n;
+    return 0;
+}
+
+static void print_usage(const char *argv0) {
+    printf(
+        "usage: %s [options]\n"
+        "\n"
+        "Times the modesetting, EDID, KMS property and timespec hot paths, on a\n"
+        "simulated KMS device so it runs anywhere. Every case is repeated and the\n"
+        "median time per call is reported, along with the min, max, mean and\n"
+        "standard deviation of the repetitions.\n"
+        "\n"
+        "  --repetitions=N            How often to time every case. (default: 15)\n"
+        "  --min-time=MS              How long one repetition of a case runs at least. (default: 10)\n"
+        "  --filter=STRING            Only run the cases with STRING in their name.\n"
+        "  --benchmark=FILE           Write the results as JSON to FILE\n"
+        "                             (or stdout if FILE is \"-\").\n"
+        "  --baseline=FILE            Compare against the JSON written by an earlier\n"
+        "                             --benchmark run and fail if anything regressed.\n"
+        "  --tolerance=PERCENT        How much worse than the baseline is still ok. (default: 10)\n"
+        "  --help                     Show this help.\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    struct benchmark_report report;
+    struct microbench bench;
+    const char *benchmark_path, *baseline_path, *filter;
+    uint64_t start, elapsed, min_time_ns;
+    double tolerance, *samples;
+    int opt, n_repetitions, n_iterations, n_regressions, ok;
+
+    static const struct option long_options[] = {
+        { "repetitions", required_argument, NULL, 'r' },
+        { "min-time", required_argument, NULL, 'm' },
+        { "filter", required_argument, NULL, 'f' },
+        { "benchmark", required_argument, NULL, 'b' },
+        { "baseline", required_argument, NULL, 'B' },
+        { "tolerance", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    n_repetitions = 15;
+    min_time_ns = 10000000;
+    filter = NULL;
+    benchmark_path = NULL;
+    baseline_path = NULL;
+    tolerance = 10.0;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'r':
+                n_repetitions = atoi(optarg);
+                if (n_repetitions <= 0) {
+                    fprintf(stderr, "[microbench] Invalid number of repetitions \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "[microbench] Invalid minimum time \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                min_time_ns = (uint64_t) atoi(optarg) * 1000000;
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'b':
+                benchmark_path = optarg;
+                break;
+            case 'B':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    samples = malloc(n_repetitions * sizeof *samples);
+    if (samples == NULL) {
+        fprintf(stderr, "[microbench] Couldn't allocate the samples.\n");
+        return EXIT_FAILURE;
+    }
+
+    ok = microbench_new(&bench);
+    if (ok != 0) {
+        free(samples);
+        return EXIT_FAILURE;
+    }
+
+    if (!verify(&bench)) {
+        microbench_destroy(&bench);
+        free(samples);
+        return EXIT_FAILURE;
+    }
+
+    benchmark_report_init(&report, "micro");
+
+    for (size_t i = 0; i < N_CASES; i++) {
+        if (filter != NULL && strstr(cases[i].name, filter) == NULL) {
+            continue;
+        }
+
+        ok = calibrate(&bench, cases + i, min_time_ns, &n_iterations);
+        if (ok != 0) {
+            fprintf(stderr, "[microbench] %s failed. %s\n", cases[i].name, strerror(ok));
+            microbench_destroy(&bench);
+            free(samples);
+            return EXIT_FAILURE;
+        }
+
+        for (int j = 0; j < n_repetitions; j++) {
+            start = get_monotonic_ns();
+            cases[i].run(&bench, n_iterations);
+            elapsed = get_monotonic_ns() - start;
+
+            samples[j] = (double) elapsed / n_iterations;
+        }
+
+        benchmark_report_add_samples(&report, cases[i].name, "ns", samples, n_repetitions, false);
+
+        printf(
+            "%-34s %10.2f ns  (min %.2f, max %.2f, stddev %.2f, %d x %d calls)\n",
+            cases[i].name,
+            report.metrics[report.n_metrics - 1].value,
+            report.metrics[report.n_metrics - 1].min,
+            report.metrics[report.n_metrics - 1].max,
+            report.metrics[report.n_metrics - 1].stddev,
+            n_repetitions,
+            n_iterations
+        );
+    }
+
+    microbench_destroy(&bench);
+    free(samples);
+
+    ok = EXIT_SUCCESS;
+
+    if (benchmark_path != NULL && benchmark_report_save(&report, benchmark_path) != 0) {
+        ok = EXIT_FAILURE;
+    }
+
+    if (baseline_path != NULL) {
+        if (benchmark_report_compare(&report, baseline_path, tolerance / 100.0, stdout, &n_regressions) != 0 || n_regressions > 0) {
+            ok = EXIT_FAILURE;
+        }
+    }
+
+    return ok;
+}
@@ -0,0 +1,1711 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <mock_drm.h>
+
+/// Properties of the simulated objects. Every one is a single property object, shared by all objects of its type.
+enum mock_prop {
+    PROP_CONNECTOR_CRTC_ID,
+
+    PROP_CRTC_ACTIVE,
+    PROP_CRTC_MODE_ID,
+
+    PROP_PLANE_TYPE,
+    PROP_PLANE_FB_ID,
+    PROP_PLANE_CRTC_ID,
+    PROP_PLANE_SRC_X,
+    PROP_PLANE_SRC_Y,
+    PROP_PLANE_SRC_W,
+    PROP_PLANE_SRC_H,
+    PROP_PLANE_CRTC_X,
+    PROP_PLANE_CRTC_Y,
+    PROP_PLANE_CRTC_W,
+    PROP_PLANE_CRTC_H,
+    PROP_PLANE_ZPOS,
+    PROP_PLANE_ROTATION,
+
+    N_PROPS
+};
+
+struct mock_prop_info {
+    uint32_t object_type;
+    const char *name;
+    uint32_t flags;
+
+    /// Min and max, for range properties.
+    uint64_t min, max;
+};
+
+static const struct mock_prop_info prop_infos[N_PROPS] = {
+    [PROP_CONNECTOR_CRTC_ID] = { DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", DRM_MODE_PROP_OBJECT | DRM_MODE_PROP_ATOMIC },
+
+    [PROP_CRTC_ACTIVE] = { DRM_MODE_OBJECT_CRTC, "ACTIVE", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC, 0, 1 },
+    [PROP_CRTC_MODE_ID] = { DRM_MODE_OBJECT_CRTC, "MODE_ID", DRM_MODE_PROP_BLOB | DRM_MODE_PROP_ATOMIC },
+
+    [PROP_PLANE_TYPE] = { DRM_MODE_OBJECT_PLANE, "type", DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE },
+    [PROP_PLANE_FB_ID] = { DRM_MODE_OBJECT_PLANE, "FB_ID", DRM_MODE_PROP_OBJECT | DRM_MODE_PROP_ATOMIC },
+    [PROP_PLANE_CRTC_ID] = { DRM_MODE_OBJECT_PLANE, "CRTC_ID", DRM_MODE_PROP_OBJECT | DRM_MODE_PROP_ATOMIC },
+    [PROP_PLANE_SRC_X] = { DRM_MODE_OBJECT_PLANE, "SRC_X", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC, 0, UINT32_MAX },
+    [PROP_PLANE_SRC_Y] = { DRM_MODE_OBJECT_PLANE, "SRC_Y", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC, 0, UINT32_MAX },
+    [PROP_PLANE_SRC_W] = { DRM_MODE_OBJECT_PLANE, "SRC_W", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC, 0, UINT32_MAX },
+    [PROP_PLANE_SRC_H] = { DRM_MODE_OBJECT_PLANE, "SRC_H", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC, 0, UINT32_MAX },
+    [PROP_PLANE_CRTC_X] = { DRM_MODE_OBJECT_PLANE, "CRTC_X", DRM_MODE_PROP_SIGNED_RANGE | DRM_MODE_PROP_ATOMIC, (uint64_t) INT32_MIN, INT32_MAX },
+    [PROP_PLANE_CRTC_Y] = { DRM_MODE_OBJECT_PLANE, "CRTC_Y", DRM_MODE_PROP_SIGNED_RANGE | DRM_MODE_PROP_ATOMIC, (uint64_t) INT32_MIN, INT32_MAX },
+    [PROP_PLANE_CRTC_W] = { DRM_MODE_OBJECT_PLANE, "CRTC_W", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC, 0, INT32_MAX },
+    [PROP_PLANE_CRTC_H] = { DRM_MODE_OBJECT_PLANE, "CRTC_H", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC, 0, INT32_MAX },
+    // the max depends on the number of planes per CRTC.
+    [PROP_PLANE_ZPOS] = { DRM_MODE_OBJECT_PLANE, "zpos", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC, 0, 0 },
+    [PROP_PLANE_ROTATION] = { DRM_MODE_OBJECT_PLANE, "rotation", DRM_MODE_PROP_BITMASK | DRM_MODE_PROP_ATOMIC },
+};
+
+static const char *const plane_type_names[] = {
+    [DRM_PLANE_TYPE_OVERLAY] = "Overlay",
+    [DRM_PLANE_TYPE_PRIMARY] = "Primary",
+    [DRM_PLANE_TYPE_CURSOR] = "Cursor",
+};
+
+static const char *const rotation_names[] = {
+    "rotate-0", "rotate-90", "rotate-180", "rotate-270", "reflect-x", "reflect-y",
+};
+
+struct mock_object {
+    uint32_t type;
+
+    /// Index among the objects of the same type.
+    int index;
+
+    /// The current value of each property of this object type.
+    uint64_t values[N_PROPS];
+
+    /// For CRTCs, the mode MODE_ID pointed to when it was committed, since the blob can be destroyed since.
+    drmModeModeInfo mode;
+};
+
+struct mock_blob {
+    uint32_t id;
+    size_t size;
+    void *data;
+    struct mock_blob *next;
+};
+
+struct mock_flip {
+    bool pending;
+    uint64_t completion_ns;
+    void *userdata;
+};
+
+/// The mock's drmModeAtomicReq.
+struct mock_atomic_req {
+    int n_items, n_allocated_items;
+    struct {
+        uint32_t object_id;
+        uint32_t prop_id;
+        uint64_t value;
+    } *items;
+};
+
+struct mock_drm {
+    pthread_mutex_t mutex;
+
+    struct mock_drm_config config;
+    int fd;
+
+    uint64_t epoch_ns;
+    uint64_t refresh_interval_ns;
+    uint64_t manual_time_ns;
+
+    drmModeModeInfo modes[2];
+
+    bool universal_planes;
+    bool atomic;
+
+    int n_planes_per_crtc;
+    int n_planes;
+
+    /// All connectors, then encoders, CRTCs and planes. The ID of an object is its index + 1.
+    int n_objects;
+    struct mock_object *objects;
+
+    /// The new state while checking a commit.
+    struct mock_object *scratch;
+
+    uint32_t first_encoder_id, first_crtc_id, first_plane_id, first_prop_id;
+
+    struct mock_blob *blobs;
+    uint32_t next_blob_id;
+
+    /// Indexed by CRTC.
+    struct mock_flip *flips;
+
+    struct mock_drm_stats stats;
+
+    struct mock_drm *next;
+};
+
+static pthread_mutex_t mocks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_drm *mocks;
+
+static int fail(int err) {
+    errno = err;
+    return -err;
+}
+
+static uint64_t get_monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// Find the mock with fd @a fd and lock it. Sets errno to EBADF and returns NULL if there's none.
+static struct mock_drm *lock_mock(int fd) {
+    struct mock_drm *mock;
+
+    pthread_mutex_lock(&mocks_mutex);
+    for (mock = mocks; mock != NULL; mock = mock->next) {
+        if (mock->fd == fd) {
+            break;
+        }
+    }
+    if (mock != NULL) {
+        pthread_mutex_lock(&mock->mutex);
+    }
+    pthread_mutex_unlock(&mocks_mutex);
+
+    if (mock == NULL) {
+        errno = EBADF;
+    }
+    return mock;
+}
+
+static void unlock_mock(struct mock_drm *mock) {
+    pthread_mutex_unlock(&mock->mutex);
+}
+
+static uint64_t get_time(struct mock_drm *mock) {
+    return mock->config.manual_clock ? mock->manual_time_ns : get_monotonic_ns();
+}
+
+static uint64_t next_vblank(struct mock_drm *mock, uint64_t time_ns) {
+    if (time_ns < mock->epoch_ns) {
+        return mock->epoch_ns;
+    }
+    return mock->epoch_ns + ((time_ns - mock->epoch_ns) / mock->refresh_interval_ns + 1) * mock->refresh_interval_ns;
+}
+
+static uint64_t get_next_event_time(struct mock_drm *mock) {
+    uint64_t next = 0;
+
+    for (int i = 0; i < mock->config.n_crtcs; i++) {
+        if (mock->flips[i].pending && (next == 0 || mock->flips[i].completion_ns < next)) {
+            next = mock->flips[i].completion_ns;
+        }
+    }
+
+    return next;
+}
+
+/// Arm the timerfd so it's readable once the next flip has completed.
+static void update_timer(struct mock_drm *mock) {
+    struct itimerspec spec = { 0 };
+    uint64_t next;
+    int flags = 0;
+
+    next = get_next_event_time(mock);
+    if (next != 0 && mock->config.manual_clock) {
+        // fire right away if it's due, otherwise wait for mock_drm_set_time.
+        if (next <= mock->manual_time_ns) {
+            spec.it_value.tv_nsec = 1;
+        }
+    } else if (next != 0) {
+        spec.it_value.tv_sec = next / 1000000000ull;
+        spec.it_value.tv_nsec = next % 1000000000ull;
+        flags = TFD_TIMER_ABSTIME;
+    }
+
+    timerfd_settime(mock->fd, flags, &spec, NULL);
+}
+
+static struct mock_object *get_object(struct mock_object *objects, struct mock_drm *mock, uint32_t id, uint32_t type) {
+    if (id == 0 || id > (uint32_t) mock->n_objects) {
+        return NULL;
+    }
+    if (type != DRM_MODE_OBJECT_ANY && objects[id - 1].type != type) {
+        return NULL;
+    }
+    return objects + id - 1;
+}
+
+static struct mock_blob *get_blob(struct mock_drm *mock, uint32_t id) {
+    for (struct mock_blob *blob = mock->blobs; blob != NULL; blob = blob->next) {
+        if (blob->id == id) {
+            return blob;
+        }
+    }
+    return NULL;
+}
+
+static uint32_t crtc_id(struct mock_drm *mock, int index) {
+    return mock->first_crtc_id + index;
+}
+
+static uint32_t plane_id(struct mock_drm *mock, int index) {
+    return mock->first_plane_id + index;
+}
+
+static int plane_crtc_index(struct mock_drm *mock, int plane_index) {
+    return plane_index / mock->n_planes_per_crtc;
+}
+
+static void get_prop_range(struct mock_drm *mock, enum mock_prop prop, uint64_t *min, uint64_t *max) {
+    *min = prop_infos[prop].min;
+    *max = prop == PROP_PLANE_ZPOS ? (uint64_t) (mock->n_planes_per_crtc - 1) : prop_infos[prop].max;
+}
+
+/// Check a value against the property's type, without looking at the rest of the state.
+static int check_prop_value(struct mock_drm *mock, enum mock_prop prop, uint64_t value) {
+    uint64_t min, max;
+
+    switch (prop) {
+        case PROP_CONNECTOR_CRTC_ID:
+        case PROP_PLANE_CRTC_ID:
+            if (value != 0 && (value < mock->first_crtc_id || value >= mock->first_crtc_id + mock->config.n_crtcs)) {
+                return ENOENT;
+            }
+            return 0;
+        case PROP_CRTC_MODE_ID:
+            if (value != 0) {
+                struct mock_blob *blob = get_blob(mock, value);
+                if (blob == NULL) {
+                    return ENOENT;
+                }
+                if (blob->size != sizeof(drmModeModeInfo)) {
+                    return EINVAL;
+                }
+            }
+            return 0;
+        case PROP_PLANE_FB_ID:
+            return 0;
+        case PROP_PLANE_ROTATION:
+            // exactly one rotation, any reflections, and nothing the planes can't do.
+            if ((value & ~(uint64_t) mock->config.supported_rotations) || __builtin_popcountll(value & DRM_MODE_ROTATE_MASK) != 1) {
+                return EINVAL;
+            }
+            return 0;
+        default:
+            get_prop_range(mock, prop, &min, &max);
+            if (prop_infos[prop].flags & DRM_MODE_PROP_SIGNED_RANGE) {
+                if ((int64_t) value < (int64_t) min || (int64_t) value > (int64_t) max) {
+                    return EINVAL;
+                }
+            } else if (value < min || value > max) {
+                return EINVAL;
+            }
+            return 0;
+    }
+}
+
+static int set_prop(struct mock_drm *mock, struct mock_object *objects, uint32_t object_id, uint32_t prop_id, uint64_t value, uint32_t *affected_crtcs) {
+    struct mock_object *object;
+    enum mock_prop prop;
+    int ok;
+
+    object = get_object(objects, mock, object_id, DRM_MODE_OBJECT_ANY);
+    if (object == NULL) {
+        return ENOENT;
+    }
+
+    if (prop_id < mock->first_prop_id || prop_id >= mock->first_prop_id + N_PROPS) {
+        return ENOENT;
+    }
+    prop = prop_id - mock->first_prop_id;
+
+    if (prop_infos[prop].object_type != object->type || (prop_infos[prop].flags & DRM_MODE_PROP_IMMUTABLE)) {
+        return EINVAL;
+    }
+
+    ok = check_prop_value(mock, prop, value);
+    if (ok != 0) {
+        return ok;
+    }
+
+    // the CRTCs an object was on and is going to be on are both affected.
+    if (object->type == DRM_MODE_OBJECT_CRTC) {
+        *affected_crtcs |= 1u << object->index;
+    } else {
+        uint64_t crtc = object->values[object->type == DRM_MODE_OBJECT_PLANE ? PROP_PLANE_CRTC_ID : PROP_CONNECTOR_CRTC_ID];
+        if (crtc != 0) {
+            *affected_crtcs |= 1u << (crtc - mock->first_crtc_id);
+        }
+        if ((prop == PROP_PLANE_CRTC_ID || prop == PROP_CONNECTOR_CRTC_ID) && value != 0) {
+            *affected_crtcs |= 1u << (value - mock->first_crtc_id);
+        }
+    }
+
+    if (prop == PROP_CRTC_MODE_ID) {
+        if (value != 0) {
+            memcpy(&object->mode, get_blob(mock, value)->data, sizeof object->mode);
+        } else {
+            memset(&object->mode, 0, sizeof object->mode);
+        }
+    }
+
+    object->values[prop] = value;
+    return 0;
+}
+
+static bool needs_modeset(struct mock_drm *mock) {
+    for (int i = 0; i < mock->n_objects; i++) {
+        const struct mock_object *old = mock->objects + i, *new = mock->scratch + i;
+
+        if (old->type == DRM_MODE_OBJECT_CRTC &&
+            (old->values[PROP_CRTC_ACTIVE] != new->values[PROP_CRTC_ACTIVE] || memcmp(&old->mode, &new->mode, sizeof old->mode) != 0)) {
+            return true;
+        }
+        if (old->type == DRM_MODE_OBJECT_CONNECTOR && old->values[PROP_CONNECTOR_CRTC_ID] != new->values[PROP_CONNECTOR_CRTC_ID]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int check_plane(struct mock_drm *mock, const struct mock_object *plane, const struct mock_object *crtc) {
+    const uint64_t *v = plane->values;
+    double scale_x, scale_y;
+
+    if ((v[PROP_PLANE_FB_ID] == 0) != (v[PROP_PLANE_CRTC_ID] == 0)) {
+        return EINVAL;
+    }
+
+    if (v[PROP_PLANE_FB_ID] == 0) {
+        return 0;
+    }
+
+    if (plane_crtc_index(mock, plane->index) != crtc->index || !crtc->values[PROP_CRTC_ACTIVE]) {
+        return EINVAL;
+    }
+
+    if (v[PROP_PLANE_SRC_W] == 0 || v[PROP_PLANE_SRC_H] == 0 || v[PROP_PLANE_CRTC_W] == 0 || v[PROP_PLANE_CRTC_H] == 0) {
+        return EINVAL;
+    }
+
+    // same as the kernel, scaling factors outside of what the hardware can do are ERANGE.
+    scale_x = (v[PROP_PLANE_SRC_W] / 65536.0) / v[PROP_PLANE_CRTC_W];
+    scale_y = (v[PROP_PLANE_SRC_H] / 65536.0) / v[PROP_PLANE_CRTC_H];
+    if (scale_x > mock->config.max_scale || scale_x < 1.0 / mock->config.max_scale ||
+        scale_y > mock->config.max_scale || scale_y < 1.0 / mock->config.max_scale) {
+        return ERANGE;
+    }
+
+    if (mock->config.primary_must_cover_crtc && v[PROP_PLANE_TYPE] == DRM_PLANE_TYPE_PRIMARY &&
+        (v[PROP_PLANE_CRTC_X] != 0 || v[PROP_PLANE_CRTC_Y] != 0 ||
+         v[PROP_PLANE_CRTC_W] != crtc->mode.hdisplay || v[PROP_PLANE_CRTC_H] != crtc->mode.vdisplay)) {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+/// Check the new state in mock->scratch against the configured constraints.
+static int check_state(struct mock_drm *mock) {
+    struct mock_object *objects = mock->scratch;
+    int ok;
+
+    for (int i = 0; i < mock->config.n_crtcs; i++) {
+        const struct mock_object *crtc = objects + crtc_id(mock, i) - 1;
+        uint64_t zpos_used = 0;
+        int n_connectors = 0, n_active_planes = 0;
+
+        for (int j = 0; j < mock->config.n_connectors; j++) {
+            if (objects[j].values[PROP_CONNECTOR_CRTC_ID] == crtc_id(mock, i)) {
+                n_connectors++;
+            }
+        }
+
+        if (crtc->values[PROP_CRTC_ACTIVE] && (crtc->values[PROP_CRTC_MODE_ID] == 0 || n_connectors == 0)) {
+            return EINVAL;
+        }
+
+        for (int j = i * mock->n_planes_per_crtc; j < (i + 1) * mock->n_planes_per_crtc; j++) {
+            const struct mock_object *plane = objects + plane_id(mock, j) - 1;
+
+            ok = check_plane(mock, plane, crtc);
+            if (ok != 0) {
+                return ok;
+            }
+
+            if (plane->values[PROP_PLANE_FB_ID] == 0) {
+                continue;
+            }
+
+            n_active_planes++;
+
+            if (zpos_used & (1ull << plane->values[PROP_PLANE_ZPOS])) {
+                return EINVAL;
+            }
+            zpos_used |= 1ull << plane->values[PROP_PLANE_ZPOS];
+        }
+
+        if (mock->config.max_active_planes > 0 && n_active_planes > mock->config.max_active_planes) {
+            return EINVAL;
+        }
+    }
+
+    // planes of other CRTCs can't be put on this one.
+    for (int j = 0; j < mock->n_planes; j++) {
+        const struct mock_object *plane = objects + plane_id(mock, j) - 1;
+        uint64_t crtc = plane->values[PROP_PLANE_CRTC_ID];
+
+        if (crtc != 0 && crtc != crtc_id(mock, plane_crtc_index(mock, j))) {
+            return EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Commit the state in mock->scratch, after checking it. Shared by the atomic and legacy calls.
+ *
+ * @a affected_crtcs is a bitmask of the CRTCs the changes touched; they get a flip event each if
+ * @a flags has DRM_MODE_PAGE_FLIP_EVENT.
+ */
+static int commit_scratch(struct mock_drm *mock, uint32_t flags, uint32_t affected_crtcs, void *userdata) {
+    bool modeset;
+    uint64_t now;
+    int ok;
+
+    if (flags & DRM_MODE_ATOMIC_TEST_ONLY) {
+        mock->stats.n_test_commits++;
+    }
+
+    modeset = needs_modeset(mock);
+    if (modeset && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+        ok = EINVAL;
+        goto fail;
+    }
+
+    if ((flags & DRM_MODE_PAGE_FLIP_ASYNC) && (modeset || !mock->config.async_page_flip)) {
+        ok = EINVAL;
+        goto fail;
+    }
+
+    if ((flags & DRM_MODE_PAGE_FLIP_EVENT) && affected_crtcs == 0) {
+        ok = EINVAL;
+        goto fail;
+    }
+
+    ok = check_state(mock);
+    if (ok != 0) {
+        goto fail;
+    }
+
+    if (flags & DRM_MODE_ATOMIC_TEST_ONLY) {
+        return 0;
+    }
+
+    // like the kernel, we don't queue a second flip on a CRTC before the first one completed.
+    for (int i = 0; i < mock->config.n_crtcs; i++) {
+        if ((affected_crtcs & (1u << i)) && mock->flips[i].pending) {
+            ok = EBUSY;
+            goto fail;
+        }
+    }
+
+    memcpy(mock->objects, mock->scratch, mock->n_objects * sizeof *mock->objects);
+
+    mock->stats.n_commits++;
+    if (modeset) {
+        mock->stats.n_modesets++;
+    }
+
+    now = get_time(mock);
+    for (int i = 0; i < mock->config.n_crtcs; i++) {
+        if (!(affected_crtcs & (1u << i))) {
+            continue;
+        }
+
+        mock->stats.n_flips++;
+
+        if (flags & DRM_MODE_PAGE_FLIP_EVENT) {
+            mock->flips[i] = (struct mock_flip) {
+                .pending = true,
+                .completion_ns = (flags & DRM_MODE_PAGE_FLIP_ASYNC) ? now : next_vblank(mock, now),
+                .userdata = userdata,
+            };
+        }
+    }
+
+    update_timer(mock);
+    return 0;
+
+    fail:
+    mock->stats.n_rejected_commits++;
+    return ok;
+}
+
+void mock_drm_get_default_config(struct mock_drm_config *config_out) {
+    *config_out = (struct mock_drm_config) {
+        .n_connectors = 2,
+        .n_crtcs = 2,
+        .n_overlay_planes = 2,
+        .width = 1920,
+        .height = 1080,
+        .refresh_millihz = 60000,
+        .manual_clock = false,
+        .atomic = true,
+        .async_page_flip = false,
+        .max_active_planes = 0,
+        .max_scale = 4.0f,
+        .supported_rotations = DRM_MODE_ROTATE_0 | DRM_MODE_ROTATE_180 | DRM_MODE_REFLECT_X | DRM_MODE_REFLECT_Y,
+        .primary_must_cover_crtc = true,
+    };
+}
+
+/// A mode with CVT-like blanking, so the refresh rate computed from the timings matches.
+static void fill_mode(drmModeModeInfo *mode, uint16_t width, uint16_t height, uint32_t refresh_millihz, bool preferred) {
+    memset(mode, 0, sizeof *mode);
+
+    mode->hdisplay = width;
+    mode->hsync_start = width + 48;
+    mode->hsync_end = width + 80;
+    mode->htotal = width + 160;
+    mode->vdisplay = height;
+    mode->vsync_start = height + 3;
+    mode->vsync_end = height + 8;
+    mode->vtotal = height + 45;
+    mode->clock = (uint32_t) ((uint64_t) mode->htotal * mode->vtotal * refresh_millihz / 1000000);
+    mode->vrefresh = (refresh_millihz + 500) / 1000;
+    mode->type = DRM_MODE_TYPE_DRIVER | (preferred ? DRM_MODE_TYPE_PREFERRED : 0);
+    snprintf(mode->name, sizeof mode->name, "%ux%u", width, height);
+}
+
+int mock_drm_new(struct mock_drm **mock_out, const struct mock_drm_config *config) {
+    struct mock_drm *mock;
+    uint32_t id;
+
+    if (config->n_connectors <= 0 || config->n_crtcs <= 0 || config->n_crtcs > 32 || config->n_overlay_planes < 0 ||
+        config->n_overlay_planes >= 63 || config->width == 0 || config->height == 0 || config->refresh_millihz == 0 ||
+        config->max_scale < 1.0f) {
+        return EINVAL;
+    }
+
+    mock = calloc(1, sizeof *mock);
+    if (mock == NULL) {
+        return ENOMEM;
+    }
+
+    mock->config = *config;
+    mock->n_planes_per_crtc = 1 + config->n_overlay_planes;
+    mock->n_planes = config->n_crtcs * mock->n_planes_per_crtc;
+    mock->n_objects = 2 * config->n_connectors + config->n_crtcs + mock->n_planes;
+
+    mock->objects = calloc(mock->n_objects, sizeof *mock->objects);
+    mock->scratch = calloc(mock->n_objects, sizeof *mock->scratch);
+    mock->flips = calloc(config->n_crtcs, sizeof *mock->flips);
+    if (mock->objects == NULL || mock->scratch == NULL || mock->flips == NULL) {
+        goto fail_free;
+    }
+
+    mock->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (mock->fd < 0) {
+        goto fail_free;
+    }
+
+    // all objects are in one ID space, like on a real device.
+    id = 1;
+    for (int i = 0; i < config->n_connectors; i++, id++) {
+        mock->objects[id - 1] = (struct mock_object) { .type = DRM_MODE_OBJECT_CONNECTOR, .index = i };
+    }
+    mock->first_encoder_id = id;
+    for (int i = 0; i < config->n_connectors; i++, id++) {
+        mock->objects[id - 1] = (struct mock_object) { .type = DRM_MODE_OBJECT_ENCODER, .index = i };
+    }
+    mock->first_crtc_id = id;
+    for (int i = 0; i < config->n_crtcs; i++, id++) {
+        mock->objects[id - 1] = (struct mock_object) { .type = DRM_MODE_OBJECT_CRTC, .index = i };
+    }
+    mock->first_plane_id = id;
+    for (int i = 0; i < mock->n_planes; i++, id++) {
+        bool primary = i % mock->n_planes_per_crtc == 0;
+
+        mock->objects[id - 1] = (struct mock_object) { .type = DRM_MODE_OBJECT_PLANE, .index = i };
+        mock->objects[id - 1].values[PROP_PLANE_TYPE] = primary ? DRM_PLANE_TYPE_PRIMARY : DRM_PLANE_TYPE_OVERLAY;
+        mock->objects[id - 1].values[PROP_PLANE_ZPOS] = i % mock->n_planes_per_crtc;
+        mock->objects[id - 1].values[PROP_PLANE_ROTATION] = DRM_MODE_ROTATE_0;
+    }
+    mock->first_prop_id = id;
+    mock->next_blob_id = id + N_PROPS;
+
+    fill_mode(mock->modes + 0, config->width, config->height, config->refresh_millihz, true);
+    fill_mode(mock->modes + 1, config->width / 2, config->height / 2, config->refresh_millihz, false);
+
+    mock->refresh_interval_ns = 1000000000000ull / config->refresh_millihz;
+    mock->epoch_ns = get_monotonic_ns();
+    mock->manual_time_ns = mock->epoch_ns;
+
+    pthread_mutex_init(&mock->mutex, NULL);
+
+    pthread_mutex_lock(&mocks_mutex);
+    mock->next = mocks;
+    mocks = mock;
+    pthread_mutex_unlock(&mocks_mutex);
+
+    *mock_out = mock;
+    return 0;
+
+    fail_free:
+    free(mock->flips);
+    free(mock->scratch);
+    free(mock->objects);
+    free(mock);
+    return ENOMEM;
+}
+
+void mock_drm_destroy(struct mock_drm *mock) {
+    pthread_mutex_lock(&mocks_mutex);
+    for (struct mock_drm **cursor = &mocks; *cursor != NULL; cursor = &(*cursor)->next) {
+        if (*cursor == mock) {
+            *cursor = mock->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mocks_mutex);
+
+    while (mock->blobs != NULL) {
+        struct mock_blob *blob = mock->blobs;
+        mock->blobs = blob->next;
+        free(blob->data);
+        free(blob);
+    }
+
+    close(mock->fd);
+    pthread_mutex_destroy(&mock->mutex);
+    free(mock->flips);
+    free(mock->scratch);
+    free(mock->objects);
+    free(mock);
+}
+
+int mock_drm_get_fd(struct mock_drm *mock) {
+    return mock->fd;
+}
+
+uint64_t mock_drm_get_time(struct mock_drm *mock) {
+    uint64_t time;
+
+    pthread_mutex_lock(&mock->mutex);
+    time = get_time(mock);
+    pthread_mutex_unlock(&mock->mutex);
+
+    return time;
+}
+
+void mock_drm_set_time(struct mock_drm *mock, uint64_t time_ns) {
+    pthread_mutex_lock(&mock->mutex);
+    if (time_ns > mock->manual_time_ns) {
+        mock->manual_time_ns = time_ns;
+        update_timer(mock);
+    }
+    pthread_mutex_unlock(&mock->mutex);
+}
+
+uint64_t mock_drm_get_refresh_interval(struct mock_drm *mock) {
+    return mock->refresh_interval_ns;
+}
+
+uint64_t mock_drm_get_next_vblank(struct mock_drm *mock, uint64_t time_ns) {
+    return next_vblank(mock, time_ns);
+}
+
+uint64_t mock_drm_get_next_event_time(struct mock_drm *mock) {
+    uint64_t time;
+
+    pthread_mutex_lock(&mock->mutex);
+    time = get_next_event_time(mock);
+    pthread_mutex_unlock(&mock->mutex);
+
+    return time;
+}
+
+void mock_drm_get_stats(struct mock_drm *mock, struct mock_drm_stats *stats_out) {
+    pthread_mutex_lock(&mock->mutex);
+    *stats_out = mock->stats;
+    pthread_mutex_unlock(&mock->mutex);
+}
+
+/*
+ * The backend.
+ */
+
+static int mock_set_client_cap(int fd, uint64_t capability, uint64_t value) {
+    struct mock_drm *mock;
+    int ok = 0;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -EBADF;
+    }
+
+    if (capability == DRM_CLIENT_CAP_UNIVERSAL_PLANES) {
+        mock->universal_planes = value != 0;
+    } else if (capability == DRM_CLIENT_CAP_ATOMIC && !mock->config.atomic) {
+        ok = fail(EOPNOTSUPP);
+    } else if (capability == DRM_CLIENT_CAP_ATOMIC) {
+        // atomic implies universal planes.
+        mock->atomic = value != 0;
+        mock->universal_planes |= mock->atomic;
+    } else {
+        ok = fail(EINVAL);
+    }
+
+    unlock_mock(mock);
+    return ok;
+}
+
+static int mock_get_cap(int fd, uint64_t capability, uint64_t *value) {
+    struct mock_drm *mock;
+    int ok = 0;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -EBADF;
+    }
+
+    switch (capability) {
+        case DRM_CAP_TIMESTAMP_MONOTONIC:
+        case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+            *value = 1;
+            break;
+        case DRM_CAP_DUMB_BUFFER:
+        case DRM_CAP_ADDFB2_MODIFIERS:
+            *value = 0;
+            break;
+        case DRM_CAP_ASYNC_PAGE_FLIP:
+            *value = mock->config.async_page_flip;
+            break;
+#ifdef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+        case DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP:
+            *value = mock->config.async_page_flip && mock->config.atomic;
+            break;
+#endif
+        default:
+            ok = fail(EINVAL);
+            break;
+    }
+
+    unlock_mock(mock);
+    return ok;
+}
+
+static drmModeResPtr mock_get_resources(int fd) {
+    struct mock_drm *mock;
+    drmModeRes *res;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return NULL;
+    }
+
+    res = calloc(1, sizeof *res);
+    if (res == NULL) {
+        goto fail_unlock;
+    }
+
+    res->count_crtcs = mock->config.n_crtcs;
+    res->count_connectors = mock->config.n_connectors;
+    res->count_encoders = mock->config.n_connectors;
+    res->crtcs = calloc(res->count_crtcs, sizeof *res->crtcs);
+    res->connectors = calloc(res->count_connectors, sizeof *res->connectors);
+    res->encoders = calloc(res->count_encoders, sizeof *res->encoders);
+    if (res->crtcs == NULL || res->connectors == NULL || res->encoders == NULL) {
+        goto fail_free;
+    }
+
+    for (int i = 0; i < mock->config.n_crtcs; i++) {
+        res->crtcs[i] = crtc_id(mock, i);
+    }
+    for (int i = 0; i < mock->config.n_connectors; i++) {
+        res->connectors[i] = 1 + i;
+        res->encoders[i] = mock->first_encoder_id + i;
+    }
+
+    res->min_width = res->min_height = 1;
+    res->max_width = res->max_height = 8192;
+
+    unlock_mock(mock);
+    return res;
+
+    fail_free:
+    free(res->encoders);
+    free(res->connectors);
+    free(res->crtcs);
+    free(res);
+    fail_unlock:
+    unlock_mock(mock);
+    errno = ENOMEM;
+    return NULL;
+}
+
+static void mock_free_resources(drmModeResPtr res) {
+    if (res == NULL) {
+        return;
+    }
+    free(res->encoders);
+    free(res->connectors);
+    free(res->crtcs);
+    free(res->fbs);
+    free(res);
+}
+
+static drmModePlaneResPtr mock_get_plane_resources(int fd) {
+    struct mock_drm *mock;
+    drmModePlaneRes *plane_res;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return NULL;
+    }
+
+    plane_res = calloc(1, sizeof *plane_res);
+    if (plane_res != NULL) {
+        plane_res->planes = calloc(mock->n_planes, sizeof *plane_res->planes);
+    }
+    if (plane_res == NULL || plane_res->planes == NULL) {
+        free(plane_res);
+        unlock_mock(mock);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // without universal planes, only overlay planes are exposed.
+    for (int i = 0; i < mock->n_planes; i++) {
+        if (mock->universal_planes || i % mock->n_planes_per_crtc != 0) {
+            plane_res->planes[plane_res->count_planes++] = plane_id(mock, i);
+        }
+    }
+
+    unlock_mock(mock);
+    return plane_res;
+}
+
+static void mock_free_plane_resources(drmModePlaneResPtr plane_res) {
+    if (plane_res == NULL) {
+        return;
+    }
+    free(plane_res->planes);
+    free(plane_res);
+}
+
+/// The object properties of @a object, in libdrm's format.
+static int get_object_props(struct mock_drm *mock, const struct mock_object *object, uint32_t **props_out, uint64_t **values_out, uint32_t *n_props_out) {
+    uint32_t *props;
+    uint64_t *values;
+    uint32_t n = 0;
+
+    props = calloc(N_PROPS, sizeof *props);
+    values = calloc(N_PROPS, sizeof *values);
+    if (props == NULL || values == NULL) {
+        free(props);
+        free(values);
+        return ENOMEM;
+    }
+
+    for (int i = 0; i < N_PROPS; i++) {
+        if (prop_infos[i].object_type == object->type) {
+            props[n] = mock->first_prop_id + i;
+            values[n] = object->values[i];
+            n++;
+        }
+    }
+
+    *props_out = props;
+    *values_out = values;
+    *n_props_out = n;
+    return 0;
+}
+
+static drmModeConnectorPtr mock_get_connector(int fd, uint32_t connector_id) {
+    struct mock_drm *mock;
+    struct mock_object *object;
+    drmModeConnector *connector;
+    uint32_t n_props;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return NULL;
+    }
+
+    object = get_object(mock->objects, mock, connector_id, DRM_MODE_OBJECT_CONNECTOR);
+    if (object == NULL) {
+        unlock_mock(mock);
+        errno = ENOENT;
+        return NULL;
+    }
+
+    connector = calloc(1, sizeof *connector);
+    if (connector == NULL) {
+        goto fail_unlock;
+    }
+
+    connector->connector_id = connector_id;
+    connector->encoder_id = object->values[PROP_CONNECTOR_CRTC_ID] != 0 ? mock->first_encoder_id + object->index : 0;
+    connector->connector_type = DRM_MODE_CONNECTOR_HDMIA;
+    connector->connector_type_id = 1 + object->index;
+    connector->connection = DRM_MODE_CONNECTED;
+    connector->mmWidth = 520;
+    connector->mmHeight = 290;
+    connector->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+
+    connector->count_modes = 2;
+    connector->modes = calloc(2, sizeof *connector->modes);
+    connector->count_encoders = 1;
+    connector->encoders = calloc(1, sizeof *connector->encoders);
+    if (connector->modes == NULL || connector->encoders == NULL ||
+        get_object_props(mock, object, &connector->props, &connector->prop_values, &n_props) != 0) {
+        goto fail_free;
+    }
+    connector->count_props = n_props;
+
+    memcpy(connector->modes, mock->modes, sizeof mock->modes);
+    connector->encoders[0] = mock->first_encoder_id + object->index;
+
+    unlock_mock(mock);
+    return connector;
+
+    fail_free:
+    free(connector->encoders);
+    free(connector->modes);
+    free(connector);
+    fail_unlock:
+    unlock_mock(mock);
+    errno = ENOMEM;
+    return NULL;
+}
+
+static void mock_free_connector(drmModeConnectorPtr connector) {
+    if (connector == NULL) {
+        return;
+    }
+    free(connector->encoders);
+    free(connector->prop_values);
+    free(connector->props);
+    free(connector->modes);
+    free(connector);
+}
+
+static drmModeEncoderPtr mock_get_encoder(int fd, uint32_t encoder_id) {
+    struct mock_drm *mock;
+    struct mock_object *object;
+    drmModeEncoder *encoder;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return NULL;
+    }
+
+    object = get_object(mock->objects, mock, encoder_id, DRM_MODE_OBJECT_ENCODER);
+    if (object == NULL) {
+        unlock_mock(mock);
+        errno = ENOENT;
+        return NULL;
+    }
+
+    encoder = calloc(1, sizeof *encoder);
+    if (encoder == NULL) {
+        unlock_mock(mock);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    encoder->encoder_id = encoder_id;
+    encoder->encoder_type = DRM_MODE_ENCODER_TMDS;
+    // the encoder drives whatever CRTC its connector is on.
+    encoder->crtc_id = mock->objects[object->index].values[PROP_CONNECTOR_CRTC_ID];
+    encoder->possible_crtcs = (uint32_t) ((1ull << mock->config.n_crtcs) - 1);
+    encoder->possible_clones = 0;
+
+    unlock_mock(mock);
+    return encoder;
+}
+
+static void mock_free_encoder(drmModeEncoderPtr encoder) {
+    free(encoder);
+}
+
+static drmModeCrtcPtr mock_get_crtc(int fd, uint32_t id) {
+    struct mock_drm *mock;
+    struct mock_object *object, *primary;
+    drmModeCrtc *crtc;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return NULL;
+    }
+
+    object = get_object(mock->objects, mock, id, DRM_MODE_OBJECT_CRTC);
+    if (object == NULL) {
+        unlock_mock(mock);
+        errno = ENOENT;
+        return NULL;
+    }
+
+    crtc = calloc(1, sizeof *crtc);
+    if (crtc == NULL) {
+        unlock_mock(mock);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    primary = mock->objects + plane_id(mock, object->index * mock->n_planes_per_crtc) - 1;
+
+    crtc->crtc_id = id;
+    crtc->buffer_id = primary->values[PROP_PLANE_FB_ID];
+    crtc->x = primary->values[PROP_PLANE_SRC_X] >> 16;
+    crtc->y = primary->values[PROP_PLANE_SRC_Y] >> 16;
+    crtc->mode_valid = object->values[PROP_CRTC_MODE_ID] != 0;
+    if (crtc->mode_valid) {
+        crtc->mode = object->mode;
+        crtc->width = object->mode.hdisplay;
+        crtc->height = object->mode.vdisplay;
+    }
+    crtc->gamma_size = 0;
+
+    unlock_mock(mock);
+    return crtc;
+}
+
+static void mock_free_crtc(drmModeCrtcPtr crtc) {
+    free(crtc);
+}
+
+static drmModePlanePtr mock_get_plane(int fd, uint32_t id) {
+    struct mock_drm *mock;
+    struct mock_object *object;
+    drmModePlane *plane;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return NULL;
+    }
+
+    object = get_object(mock->objects, mock, id, DRM_MODE_OBJECT_PLANE);
+    if (object == NULL) {
+        unlock_mock(mock);
+        errno = ENOENT;
+        return NULL;
+    }
+
+    plane = calloc(1, sizeof *plane);
+    if (plane != NULL) {
+        plane->formats = calloc(1, sizeof *plane->formats);
+    }
+    if (plane == NULL || plane->formats == NULL) {
+        free(plane);
+        unlock_mock(mock);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    plane->count_formats = 1;
+    plane->formats[0] = DRM_FORMAT_XRGB8888;
+    plane->plane_id = id;
+    plane->crtc_id = object->values[PROP_PLANE_CRTC_ID];
+    plane->fb_id = object->values[PROP_PLANE_FB_ID];
+    plane->crtc_x = object->values[PROP_PLANE_CRTC_X];
+    plane->crtc_y = object->values[PROP_PLANE_CRTC_Y];
+    plane->x = object->values[PROP_PLANE_SRC_X] >> 16;
+    plane->y = object->values[PROP_PLANE_SRC_Y] >> 16;
+    plane->possible_crtcs = 1u << plane_crtc_index(mock, object->index);
+    plane->gamma_size = 0;
+
+    unlock_mock(mock);
+    return plane;
+}
+
+static void mock_free_plane(drmModePlanePtr plane) {
+    if (plane == NULL) {
+        return;
+    }
+    free(plane->formats);
+    free(plane);
+}
+
+static drmModeObjectPropertiesPtr mock_object_get_properties(int fd, uint32_t object_id, uint32_t object_type) {
+    struct mock_drm *mock;
+    struct mock_object *object;
+    drmModeObjectProperties *props;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return NULL;
+    }
+
+    object = get_object(mock->objects, mock, object_id, object_type);
+    if (object == NULL) {
+        unlock_mock(mock);
+        errno = ENOENT;
+        return NULL;
+    }
+
+    props = calloc(1, sizeof *props);
+    if (props == NULL || get_object_props(mock, object, &props->props, &props->prop_values, &props->count_props) != 0) {
+        free(props);
+        unlock_mock(mock);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    unlock_mock(mock);
+    return props;
+}
+
+static void mock_free_object_properties(drmModeObjectPropertiesPtr props) {
+    if (props == NULL) {
+        return;
+    }
+    free(props->prop_values);
+    free(props->props);
+    free(props);
+}
+
+static drmModePropertyPtr mock_get_property(int fd, uint32_t property_id) {
+    const struct mock_prop_info *info;
+    struct mock_drm *mock;
+    drmModePropertyRes *prop;
+    enum mock_prop index;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return NULL;
+    }
+
+    if (property_id < mock->first_prop_id || property_id >= mock->first_prop_id + N_PROPS) {
+        unlock_mock(mock);
+        errno = ENOENT;
+        return NULL;
+    }
+    index = property_id - mock->first_prop_id;
+    info = prop_infos + index;
+
+    prop = calloc(1, sizeof *prop);
+    if (prop == NULL) {
+        goto fail_unlock;
+    }
+
+    prop->prop_id = property_id;
+    prop->flags = info->flags;
+    snprintf(prop->name, sizeof prop->name, "%s", info->name);
+
+    if (info->flags & (DRM_MODE_PROP_RANGE | DRM_MODE_PROP_SIGNED_RANGE)) {
+        prop->count_values = 2;
+        prop->values = calloc(2, sizeof *prop->values);
+        if (prop->values == NULL) {
+            goto fail_free;
+        }
+        get_prop_range(mock, index, prop->values + 0, prop->values + 1);
+    } else if (index == PROP_PLANE_TYPE || index == PROP_PLANE_ROTATION) {
+        bool rotation = index == PROP_PLANE_ROTATION;
+        int n = rotation ? 6 : 3;
+
+        prop->enums = calloc(n, sizeof *prop->enums);
+        prop->values = calloc(n, sizeof *prop->values);
+        if (prop->enums == NULL || prop->values == NULL) {
+            goto fail_free;
+        }
+
+        // bitmask enums are bit numbers, not values.
+        for (int i = 0; i < n; i++) {
+            if (rotation && !(mock->config.supported_rotations & (1u << i))) {
+                continue;
+            }
+
+            prop->enums[prop->count_enums].value = i;
+            snprintf(prop->enums[prop->count_enums].name, sizeof prop->enums[0].name, "%s", rotation ? rotation_names[i] : plane_type_names[i]);
+            prop->values[prop->count_values++] = i;
+            prop->count_enums++;
+        }
+    }
+
+    unlock_mock(mock);
+    return prop;
+
+    fail_free:
+    free(prop->enums);
+    free(prop->values);
+    free(prop);
+    fail_unlock:
+    unlock_mock(mock);
+    errno = ENOMEM;
+    return NULL;
+}
+
+static void mock_free_property(drmModePropertyPtr prop) {
+    if (prop == NULL) {
+        return;
+    }
+    free(prop->blob_ids);
+    free(prop->enums);
+    free(prop->values);
+    free(prop);
+}
+
+/// Set a single property, the legacy (non-atomic) way, which may modeset.
+static int set_single_prop(int fd, uint32_t object_id, uint32_t object_type, uint32_t property_id, uint64_t value) {
+    struct mock_drm *mock;
+    uint32_t affected_crtcs = 0;
+    int ok;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -EBADF;
+    }
+
+    if (get_object(mock->objects, mock, object_id, object_type) == NULL) {
+        unlock_mock(mock);
+        return fail(ENOENT);
+    }
+
+    memcpy(mock->scratch, mock->objects, mock->n_objects * sizeof *mock->scratch);
+
+    ok = set_prop(mock, mock->scratch, object_id, property_id, value, &affected_crtcs);
+    if (ok == 0) {
+        ok = commit_scratch(mock, DRM_MODE_ATOMIC_ALLOW_MODESET, affected_crtcs, NULL);
+    }
+
+    unlock_mock(mock);
+    return ok != 0 ? fail(ok) : 0;
+}
+
+static int mock_object_set_property(int fd, uint32_t object_id, uint32_t object_type, uint32_t property_id, uint64_t value) {
+    return set_single_prop(fd, object_id, object_type, property_id, value);
+}
+
+static int mock_connector_set_property(int fd, uint32_t connector_id, uint32_t property_id, uint64_t value) {
+    return set_single_prop(fd, connector_id, DRM_MODE_OBJECT_CONNECTOR, property_id, value);
+}
+
+static int create_blob(struct mock_drm *mock, const void *data, size_t size, uint32_t *id) {
+    struct mock_blob *blob;
+
+    blob = calloc(1, sizeof *blob);
+    if (blob == NULL) {
+        return ENOMEM;
+    }
+
+    blob->data = malloc(size > 0 ? size : 1);
+    if (blob->data == NULL) {
+        free(blob);
+        return ENOMEM;
+    }
+    memcpy(blob->data, data, size);
+
+    blob->id = mock->next_blob_id++;
+    blob->size = size;
+    blob->next = mock->blobs;
+    mock->blobs = blob;
+
+    *id = blob->id;
+    return 0;
+}
+
+static int mock_create_property_blob(int fd, const void *data, size_t size, uint32_t *id) {
+    struct mock_drm *mock;
+    int ok;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -EBADF;
+    }
+
+    ok = create_blob(mock, data, size, id);
+
+    unlock_mock(mock);
+    return ok != 0 ? fail(ok) : 0;
+}
+
+static int mock_destroy_property_blob(int fd, uint32_t id) {
+    struct mock_drm *mock;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -EBADF;
+    }
+
+    // CRTCs keep a copy of their mode, so blobs that are in use can go away.
+    for (struct mock_blob **cursor = &mock->blobs; *cursor != NULL; cursor = &(*cursor)->next) {
+        struct mock_blob *blob = *cursor;
+
+        if (blob->id == id) {
+            *cursor = blob->next;
+            free(blob->data);
+            free(blob);
+            unlock_mock(mock);
+            return 0;
+        }
+    }
+
+    unlock_mock(mock);
+    return fail(ENOENT);
+}
+
+static drmModeAtomicReqPtr mock_atomic_alloc(void) {
+    return (drmModeAtomicReqPtr) calloc(1, sizeof(struct mock_atomic_req));
+}
+
+static void mock_atomic_free(drmModeAtomicReqPtr req) {
+    struct mock_atomic_req *mock_req = (struct mock_atomic_req *) req;
+
+    if (mock_req == NULL) {
+        return;
+    }
+    free(mock_req->items);
+    free(mock_req);
+}
+
+static int mock_atomic_add_property(drmModeAtomicReqPtr req, uint32_t object_id, uint32_t property_id, uint64_t value) {
+    struct mock_atomic_req *mock_req = (struct mock_atomic_req *) req;
+
+    if (mock_req == NULL) {
+        return fail(EINVAL);
+    }
+
+    if (mock_req->n_items == mock_req->n_allocated_items) {
+        int n = mock_req->n_allocated_items ? 2 * mock_req->n_allocated_items : 16;
+        void *items = realloc(mock_req->items, n * sizeof *mock_req->items);
+        if (items == NULL) {
+            return fail(ENOMEM);
+        }
+        mock_req->items = items;
+        mock_req->n_allocated_items = n;
+    }
+
+    mock_req->items[mock_req->n_items].object_id = object_id;
+    mock_req->items[mock_req->n_items].prop_id = property_id;
+    mock_req->items[mock_req->n_items].value = value;
+
+    // like libdrm, returns the new number of properties in the request.
+    return ++mock_req->n_items;
+}
+
+static int mock_atomic_merge(drmModeAtomicReqPtr base, drmModeAtomicReqPtr augment) {
+    struct mock_atomic_req *mock_augment = (struct mock_atomic_req *) augment;
+    int ok;
+
+    if (base == NULL) {
+        return fail(EINVAL);
+    }
+    if (mock_augment == NULL) {
+        return 0;
+    }
+
+    for (int i = 0; i < mock_augment->n_items; i++) {
+        ok = mock_atomic_add_property(base, mock_augment->items[i].object_id, mock_augment->items[i].prop_id, mock_augment->items[i].value);
+        if (ok < 0) {
+            return ok;
+        }
+    }
+
+    return 0;
+}
+
+static int mock_atomic_commit(int fd, drmModeAtomicReqPtr req, uint32_t flags, void *userdata) {
+    struct mock_atomic_req *mock_req = (struct mock_atomic_req *) req;
+    struct mock_drm *mock;
+    uint32_t affected_crtcs = 0;
+    int ok = 0;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -EBADF;
+    }
+
+    if (!mock->atomic || mock_req == NULL || (flags & ~DRM_MODE_ATOMIC_FLAGS) ||
+        ((flags & DRM_MODE_ATOMIC_TEST_ONLY) && (flags & DRM_MODE_PAGE_FLIP_EVENT))) {
+        ok = EINVAL;
+        mock->stats.n_rejected_commits++;
+        goto out;
+    }
+
+    memcpy(mock->scratch, mock->objects, mock->n_objects * sizeof *mock->scratch);
+
+    for (int i = 0; i < mock_req->n_items; i++) {
+        ok = set_prop(mock, mock->scratch, mock_req->items[i].object_id, mock_req->items[i].prop_id, mock_req->items[i].value, &affected_crtcs);
+        if (ok != 0) {
+            mock->stats.n_rejected_commits++;
+            goto out;
+        }
+    }
+
+    ok = commit_scratch(mock, flags, affected_crtcs, userdata);
+
+    out:
+    unlock_mock(mock);
+    return ok != 0 ? fail(ok) : 0;
+}
+
+static int mock_set_crtc(int fd, uint32_t id, uint32_t fb_id, uint32_t x, uint32_t y, uint32_t *connectors, int n_connectors, drmModeModeInfoPtr mode) {
+    struct mock_drm *mock;
+    struct mock_object *crtc, *primary;
+    uint32_t mode_id = 0;
+    int ok;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -EBADF;
+    }
+
+    crtc = get_object(mock->objects, mock, id, DRM_MODE_OBJECT_CRTC);
+    if (crtc == NULL) {
+        unlock_mock(mock);
+        return fail(ENOENT);
+    }
+
+    // legacy modesets don't have a blob, so make one for the CRTC.
+    if (mode != NULL) {
+        ok = create_blob(mock, mode, sizeof *mode, &mode_id);
+        if (ok != 0) {
+            unlock_mock(mock);
+            return fail(ok);
+        }
+    }
+
+    memcpy(mock->scratch, mock->objects, mock->n_objects * sizeof *mock->scratch);
+    crtc = mock->scratch + id - 1;
+    primary = mock->scratch + plane_id(mock, crtc->index * mock->n_planes_per_crtc) - 1;
+
+    crtc->values[PROP_CRTC_ACTIVE] = mode != NULL;
+    crtc->values[PROP_CRTC_MODE_ID] = mode_id;
+    if (mode != NULL) {
+        crtc->mode = *mode;
+    } else {
+        memset(&crtc->mode, 0, sizeof crtc->mode);
+    }
+
+    // the connectors are replaced, not added to.
+    for (int i = 0; i < mock->config.n_connectors; i++) {
+        if (mock->scratch[i].values[PROP_CONNECTOR_CRTC_ID] == id) {
+            mock->scratch[i].values[PROP_CONNECTOR_CRTC_ID] = 0;
+        }
+    }
+    ok = 0;
+    for (int i = 0; i < n_connectors && ok == 0; i++) {
+        if (get_object(mock->scratch, mock, connectors[i], DRM_MODE_OBJECT_CONNECTOR) == NULL) {
+            ok = ENOENT;
+        } else {
+            mock->scratch[connectors[i] - 1].values[PROP_CONNECTOR_CRTC_ID] = mode != NULL ? id : 0;
+        }
+    }
+
+    primary->values[PROP_PLANE_FB_ID] = mode != NULL ? fb_id : 0;
+    primary->values[PROP_PLANE_CRTC_ID] = mode != NULL ? id : 0;
+    primary->values[PROP_PLANE_SRC_X] = (uint64_t) x << 16;
+    primary->values[PROP_PLANE_SRC_Y] = (uint64_t) y << 16;
+    primary->values[PROP_PLANE_SRC_W] = mode != NULL ? (uint64_t) mode->hdisplay << 16 : 0;
+    primary->values[PROP_PLANE_SRC_H] = mode != NULL ? (uint64_t) mode->vdisplay << 16 : 0;
+    primary->values[PROP_PLANE_CRTC_X] = 0;
+    primary->values[PROP_PLANE_CRTC_Y] = 0;
+    primary->values[PROP_PLANE_CRTC_W] = mode != NULL ? mode->hdisplay : 0;
+    primary->values[PROP_PLANE_CRTC_H] = mode != NULL ? mode->vdisplay : 0;
+
+    if (ok == 0) {
+        ok = commit_scratch(mock, DRM_MODE_ATOMIC_ALLOW_MODESET, 1u << crtc->index, NULL);
+    }
+
+    unlock_mock(mock);
+    return ok != 0 ? fail(ok) : 0;
+}
+
+static int mock_page_flip(int fd, uint32_t id, uint32_t fb_id, uint32_t flags, void *userdata) {
+    struct mock_drm *mock;
+    struct mock_object *crtc;
+    int ok;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -EBADF;
+    }
+
+    crtc = get_object(mock->objects, mock, id, DRM_MODE_OBJECT_CRTC);
+    if (crtc == NULL) {
+        unlock_mock(mock);
+        return fail(ENOENT);
+    }
+
+    if (!crtc->values[PROP_CRTC_ACTIVE] || fb_id == 0 || (flags & ~(uint32_t) DRM_MODE_PAGE_FLIP_FLAGS)) {
+        unlock_mock(mock);
+        return fail(EINVAL);
+    }
+
+    memcpy(mock->scratch, mock->objects, mock->n_objects * sizeof *mock->scratch);
+    mock->scratch[plane_id(mock, crtc->index * mock->n_planes_per_crtc) - 1].values[PROP_PLANE_FB_ID] = fb_id;
+
+    ok = commit_scratch(mock, flags, 1u << crtc->index, userdata);
+
+    unlock_mock(mock);
+    return ok != 0 ? fail(ok) : 0;
+}
+
+static int mock_set_plane(
+    int fd,
+    uint32_t id,
+    uint32_t crtc,
+    uint32_t fb_id,
+    uint32_t flags,
+    int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+    uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h
+) {
+    struct mock_drm *mock;
+    struct mock_object *plane;
+    uint32_t affected_crtcs = 0;
+    int ok;
+
+    (void) flags;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -EBADF;
+    }
+
+    plane = get_object(mock->objects, mock, id, DRM_MODE_OBJECT_PLANE);
+    if (plane == NULL) {
+        unlock_mock(mock);
+        return fail(ENOENT);
+    }
+
+    memcpy(mock->scratch, mock->objects, mock->n_objects * sizeof *mock->scratch);
+
+    // a zero FB disables the plane.
+    ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_FB_ID, fb_id, &affected_crtcs);
+    if (ok == 0) ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_CRTC_ID, fb_id != 0 ? crtc : 0, &affected_crtcs);
+    if (ok == 0) ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_CRTC_X, (uint64_t) (int64_t) crtc_x, &affected_crtcs);
+    if (ok == 0) ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_CRTC_Y, (uint64_t) (int64_t) crtc_y, &affected_crtcs);
+    if (ok == 0) ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_CRTC_W, crtc_w, &affected_crtcs);
+    if (ok == 0) ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_CRTC_H, crtc_h, &affected_crtcs);
+    if (ok == 0) ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_SRC_X, src_x, &affected_crtcs);
+    if (ok == 0) ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_SRC_Y, src_y, &affected_crtcs);
+    if (ok == 0) ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_SRC_W, src_w, &affected_crtcs);
+    if (ok == 0) ok = set_prop(mock, mock->scratch, id, mock->first_prop_id + PROP_PLANE_SRC_H, src_h, &affected_crtcs);
+
+    // drmModeSetPlane blocks until the plane is updated, so there's nothing pending afterwards.
+    if (ok == 0) {
+        ok = commit_scratch(mock, 0, affected_crtcs, NULL);
+    }
+
+    unlock_mock(mock);
+    return ok != 0 ? fail(ok) : 0;
+}
+
+static int mock_handle_event(int fd, drmEventContextPtr evctx) {
+    struct mock_drm *mock;
+    struct {
+        uint32_t crtc_id;
+        uint64_t completion_ns;
+        unsigned int sequence;
+        void *userdata;
+    } events[32];
+    uint64_t expirations, now;
+    int n_events = 0;
+
+    mock = lock_mock(fd);
+    if (mock == NULL) {
+        return -1;
+    }
+
+    // just to clear the fd, we look at the time ourselves.
+    if (read(mock->fd, &expirations, sizeof expirations) < 0 && errno != EAGAIN) {
+        unlock_mock(mock);
+        return -1;
+    }
+
+    now = get_time(mock);
+    for (int i = 0; i < mock->config.n_crtcs; i++) {
+        struct mock_flip *flip = mock->flips + i;
+
+        if (!flip->pending || flip->completion_ns > now) {
+            continue;
+        }
+
+        events[n_events].crtc_id = crtc_id(mock, i);
+        events[n_events].completion_ns = flip->completion_ns;
+        events[n_events].sequence = (flip->completion_ns - mock->epoch_ns) / mock->refresh_interval_ns;
+        events[n_events].userdata = flip->userdata;
+        n_events++;
+
+        flip->pending = false;
+    }
+
+    mock->stats.n_events += n_events;
+    update_timer(mock);
+
+    // the handlers will probably commit again, so they're called without the lock.
+    unlock_mock(mock);
+
+    for (int i = 0; i < n_events; i++) {
+        unsigned int tv_sec = events[i].completion_ns / 1000000000ull;
+        unsigned int tv_usec = (events[i].completion_ns % 1000000000ull) / 1000;
+
+        if (evctx->version >= 3 && evctx->page_flip_handler2 != NULL) {
+            evctx->page_flip_handler2(fd, events[i].sequence, tv_sec, tv_usec, events[i].crtc_id, events[i].userdata);
+        } else if (evctx->page_flip_handler != NULL) {
+            evctx->page_flip_handler(fd, events[i].sequence, tv_sec, tv_usec, events[i].userdata);
+        }
+    }
+
+    return 0;
+}
+
+const struct drm_backend drm_backend_mock = {
+    .name = "mock",
+
+    .set_client_cap = mock_set_client_cap,
+    .get_cap = mock_get_cap,
+
+    .get_resources = mock_get_resources,
+    .free_resources = mock_free_resources,
+    .get_plane_resources = mock_get_plane_resources,
+    .free_plane_resources = mock_free_plane_resources,
+
+    .get_connector = mock_get_connector,
+    .free_connector = mock_free_connector,
+    .get_encoder = mock_get_encoder,
+    .free_encoder = mock_free_encoder,
+    .get_crtc = mock_get_crtc,
+    .free_crtc = mock_free_crtc,
+    .get_plane = mock_get_plane,
+    .free_plane = mock_free_plane,
+
+    .object_get_properties = mock_object_get_properties,
+    .free_object_properties = mock_free_object_properties,
+    .get_property = mock_get_property,
+    .free_property = mock_free_property,
+    .object_set_property = mock_object_set_property,
+    .connector_set_property = mock_connector_set_property,
+
+    .create_property_blob = mock_create_property_blob,
+    .destroy_property_blob = mock_destroy_property_blob,
+
+    .atomic_alloc = mock_atomic_alloc,
+    .atomic_free = mock_atomic_free,
+    .atomic_add_property = mock_atomic_add_property,
+    .atomic_merge = mock_atomic_merge,
+    .atomic_commit = mock_atomic_commit,
+
+    .set_crtc = mock_set_crtc,
+    .page_flip = mock_page_flip,
+    .set_plane = mock_set_plane,
+
+    .handle_event = mock_handle_event,
+};
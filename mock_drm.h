@@ -0,0 +1,144 @@
+#ifndef _MOCK_DRM_H
+#define _MOCK_DRM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <drm_backend.h>
+
+/**
+ * @brief A simulated KMS device, for running the modesetting and frame
+ * scheduling code without display hardware.
+ *
+ * Calls through @ref drm_backend_mock with the fd of a mock behave like
+ * libdrm on a driver with the configured connectors, CRTCs and planes: the
+ * objects have the usual atomic properties (CRTC_ID, FB_ID, SRC_* / CRTC_*,
+ * zpos, rotation, MODE_ID, ACTIVE, ...), atomic commits are checked against
+ * the configured constraints (so TEST_ONLY commits fail like they would on
+ * hardware), and flips complete at the next vblank with a page flip event.
+ *
+ * Framebuffers aren't simulated: any non-zero FB_ID is accepted.
+ *
+ * Time is either CLOCK_MONOTONIC, in which case the fd becomes readable
+ * when a flip completes and it can be polled in a normal event loop, or a
+ * manual clock which only advances with @ref mock_drm_set_time, for
+ * deterministic tests. Every CRTC has a vblank at every multiple of the
+ * refresh interval since the mock was created.
+ *
+ * Thread-safe.
+ */
+struct mock_drm;
+
+struct mock_drm_config {
+    /// Number of connectors, each with its own encoder, all connected.
+    int n_connectors;
+
+    /// Number of CRTCs. Every encoder can drive every CRTC.
+    int n_crtcs;
+
+    /// Overlay planes per CRTC, besides its primary plane. Planes can only be used with their own CRTC.
+    int n_overlay_planes;
+
+    /// The preferred mode of all connectors. A half-size mode is added as the second mode.
+    uint16_t width, height;
+    uint32_t refresh_millihz;
+
+    /// Only advance the time with @ref mock_drm_set_time.
+    bool manual_clock;
+
+    /// Whether DRM_CLIENT_CAP_ATOMIC can be enabled.
+    bool atomic;
+
+    /// Whether DRM_MODE_PAGE_FLIP_ASYNC is supported, by atomic commits and legacy page flips.
+    bool async_page_flip;
+
+    /// Most planes that can be enabled on a CRTC at the same time. 0 means all.
+    int max_active_planes;
+
+    /// How much planes can scale their source, e.g. 4.0 for up to 4x up- and downscaling. 1.0 disables scaling.
+    float max_scale;
+
+    /// The rotation values the planes support, as a DRM_MODE_ROTATE_* / DRM_MODE_REFLECT_* bitmask.
+    uint32_t supported_rotations;
+
+    /// Reject commits where the primary plane doesn't cover the whole CRTC, like a lot of drivers do.
+    bool primary_must_cover_crtc;
+};
+
+/**
+ * @brief Counters of what was asked of the mock, e.g. for checking
+ * that something didn't commit more often than it should.
+ */
+struct mock_drm_stats {
+    uint64_t n_commits;
+    uint64_t n_test_commits;
+    uint64_t n_rejected_commits;
+    uint64_t n_modesets;
+    uint64_t n_flips;
+    uint64_t n_events;
+};
+
+/// A 1920x1080@60Hz device with 2 connectors and CRTCs, 2 overlay planes each and typical constraints.
+void mock_drm_get_default_config(struct mock_drm_config *config_out);
+
+int mock_drm_new(
+    struct mock_drm **mock_out,
+    const struct mock_drm_config *config
+);
+
+void mock_drm_destroy(
+    struct mock_drm *mock
+);
+
+/**
+ * @brief The fd to pass to the backend functions. It becomes readable when
+ * flip events are ready to be dispatched with drm_backend_mock.handle_event.
+ */
+int mock_drm_get_fd(
+    struct mock_drm *mock
+);
+
+/// The current time of the mock, in CLOCK_MONOTONIC nanoseconds (or whatever the manual clock is at).
+uint64_t mock_drm_get_time(
+    struct mock_drm *mock
+);
+
+/**
+ * @brief Advance the manual clock to @a time_ns. Flips that have completed by
+ * then make the fd readable. The clock never goes backwards.
+ */
+void mock_drm_set_time(
+    struct mock_drm *mock,
+    uint64_t time_ns
+);
+
+/// The refresh interval of all CRTCs, in nanoseconds.
+uint64_t mock_drm_get_refresh_interval(
+    struct mock_drm *mock
+);
+
+/// The time of the first vblank after @a time_ns.
+uint64_t mock_drm_get_next_vblank(
+    struct mock_drm *mock,
+    uint64_t time_ns
+);
+
+/// When the earliest pending flip completes, or 0 if there is none.
+uint64_t mock_drm_get_next_event_time(
+    struct mock_drm *mock
+);
+
+void mock_drm_get_stats(
+    struct mock_drm *mock,
+    struct mock_drm_stats *stats_out
+);
+
+/**
+ * @brief The libdrm calls, on mocks. Passing an fd that isn't one of a mock
+ * fails with EBADF.
+ *
+ * Atomic requests allocated by this backend can only be used with it.
+ */
+extern const struct drm_backend drm_backend_mock;
+
+#endif
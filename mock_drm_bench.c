@@ -0,0 +1,758 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+
+#include <modesetting.h>
+#include <mock_drm.h>
+#include <frame_timing.h>
+#include <flip_trace.h>
+#include <latency.h>
+#include <benchmark.h>
+
+/// Same as REPAINT_MARGIN in kms-quads.h.
+#define REPAINT_MARGIN_NS (4 * 1000000ull)
+
+struct bench {
+    struct mock_drm *mock;
+    struct drmdev *drmdev;
+
+    uint32_t primary_plane_id;
+
+    /// Overlay planes of the selected CRTC.
+    int n_overlay_planes;
+    uint32_t overlay_plane_ids[8];
+
+    bool needs_modeset;
+};
+
+/// What the page flip handler saw of the last flip.
+struct flip_result {
+    bool done;
+    unsigned int sequence;
+    uint32_t crtc_id;
+    uint64_t time_ns;
+};
+
+/// xorshift, so the simulated frame times are the same on every run.
+static uint32_t random_state = 1;
+
+static uint32_t random_u32(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static uint64_t random_ns(uint64_t min, uint64_t max) {
+    return min + random_u32() % (max - min + 1);
+}
+
+static uint64_t get_monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void on_page_flip(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, unsigned int crtc_id, void *userdata) {
+    struct flip_result *result = userdata;
+
+    result->done = true;
+    result->sequence = sequence;
+    result->crtc_id = crtc_id;
+    result->time_ns = (uint64_t) tv_sec * 1000000000ull + (uint64_t) tv_usec * 1000ull;
+}
+
+/// Advance the clock to the next flip completion and dispatch its event, like the event loop would after poll.
+static int wait_for_flip(struct bench *bench) {
+    drmEventContext evctx = {
+        .version = 3,
+        .page_flip_handler2 = on_page_flip,
+    };
+    struct pollfd fd = {
+        .fd = mock_drm_get_fd(bench->mock),
+        .events = POLLIN,
+    };
+    uint64_t next;
+
+    next = mock_drm_get_next_event_time(bench->mock);
+    if (next == 0) {
+        return ENOENT;
+    }
+
+    mock_drm_set_time(bench->mock, next);
+
+    if (poll(&fd, 1, 1000) != 1) {
+        fprintf(stderr, "[mock-bench] The mock fd didn't become readable when a flip completed.\n");
+        return EIO;
+    }
+
+    if (drm_backend_mock.handle_event(fd.fd, &evctx) != 0) {
+        return errno;
+    }
+
+    return 0;
+}
+
+/// Like configure_drmdev in vulkan2.c: the first connected connector, its preferred mode and an encoder & CRTC for it.
+static int configure(struct bench *bench) {
+    struct drm_connector *connector;
+    struct drm_encoder *encoder;
+    struct drm_crtc *crtc;
+    const drmModeModeInfo *mode = NULL;
+    struct drmdev *drmdev = bench->drmdev;
+    int ok;
+
+    for_each_connector_in_drmdev(drmdev, connector) {
+        if (connector->connector->connection == DRM_MODE_CONNECTED) {
+            break;
+        }
+    }
+    if (connector == NULL) {
+        return ENODEV;
+    }
+
+    for (int i = 0; i < connector->connector->count_modes; i++) {
+        if (connector->connector->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+            mode = connector->connector->modes + i;
+            break;
+        }
+    }
+    if (mode == NULL) {
+        return ENODEV;
+    }
+
+    for_each_encoder_in_drmdev(drmdev, encoder) {
+        if (encoder->encoder->encoder_id == connector->connector->encoders[0]) {
+            break;
+        }
+    }
+    if (encoder == NULL) {
+        return ENODEV;
+    }
+
+    for_each_crtc_in_drmdev(drmdev, crtc) {
+        if (encoder->encoder->possible_crtcs & crtc->bitmask) {
+            break;
+        }
+    }
+    if (crtc == NULL) {
+        return ENODEV;
+    }
+
+    ok = drmdev_configure(drmdev, connector->connector->connector_id, encoder->encoder->encoder_id, crtc->crtc->crtc_id, mode);
+    if (ok != 0) {
+        return ok;
+    }
+
+    ok = drmdev_get_primary_plane_id(drmdev, &bench->primary_plane_id);
+    if (ok != 0) {
+        return ok;
+    }
+
+    bench->n_overlay_planes = 0;
+    for (size_t i = 0; i < drmdev->n_planes && bench->n_overlay_planes < 8; i++) {
+        if (drmdev->planes[i].type == DRM_PLANE_TYPE_OVERLAY && (drmdev->planes[i].plane->possible_crtcs & drmdev->selected_crtc->bitmask)) {
+            bench->overlay_plane_ids[bench->n_overlay_planes++] = drmdev->planes[i].plane->plane_id;
+        }
+    }
+
+    bench->needs_modeset = true;
+    return 0;
+}
+
+static int bench_new(struct bench *bench, const struct mock_drm_config *config) {
+    int ok;
+
+    memset(bench, 0, sizeof *bench);
+
+    ok = mock_drm_new(&bench->mock, config);
+    if (ok != 0) {
+        fprintf(stderr, "[mock-bench] Couldn't create the mock device. mock_drm_new: %s\n", strerror(ok));
+        return ok;
+    }
+
+    ok = drmdev_new_with_backend(&bench->drmdev, mock_drm_get_fd(bench->mock), &drm_backend_mock);
+    if (ok != 0) {
+        fprintf(stderr, "[mock-bench] Couldn't create a drmdev on the mock device. drmdev_new_with_backend: %s\n", strerror(ok));
+        mock_drm_destroy(bench->mock);
+        return ok;
+    }
+
+    ok = configure(bench);
+    if (ok != 0) {
+        fprintf(stderr, "[mock-bench] Couldn't configure the mock device. %s\n", strerror(ok));
+        mock_drm_destroy(bench->mock);
+        return ok;
+    }
+
+    return 0;
+}
+
+/// There's no drmdev_destroy, so the drmdev leaks. It's only a few objects.
+static void bench_destroy(struct bench *bench) {
+    mock_drm_destroy(bench->mock);
+}
+
+static int put_plane(struct drmdev_atomic_req *req, uint32_t plane_id, uint32_t fb_id, uint32_t crtc_id, int src_w, int src_h, int x, int y, int w, int h) {
+    int ok;
+
+    ok = drmdev_atomic_req_put_plane_property(req, plane_id, "FB_ID", fb_id);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_ID", crtc_id);
+    // source coordinates are 16.16 fixed point
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "SRC_X", 0);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "SRC_Y", 0);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "SRC_W", (uint64_t) src_w << 16);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "SRC_H", (uint64_t) src_h << 16);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_X", (uint64_t) (int64_t) x);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_Y", (uint64_t) (int64_t) y);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_W", w);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_H", h);
+    return ok;
+}
+
+/**
+ * @brief Like cube_commit_plane in vulkan2.c: show @a fb_id on the primary plane, with its
+ * top left @a src_width x @a src_height pixels scaled to the whole mode.
+ */
+static int commit_primary(struct bench *bench, uint32_t fb_id, int src_width, int src_height, uint32_t flags, void *userdata) {
+    struct drmdev_atomic_req *req;
+    const drmModeModeInfo *mode = bench->drmdev->selected_mode;
+    int ok;
+
+    ok = drmdev_new_atomic_req(bench->drmdev, &req);
+    if (ok != 0) {
+        return ok;
+    }
+
+    ok = put_plane(req, bench->primary_plane_id, fb_id, bench->drmdev->selected_crtc->crtc->crtc_id, src_width, src_height, 0, 0, mode->hdisplay, mode->vdisplay);
+    if (ok == 0 && bench->needs_modeset) {
+        ok = drmdev_atomic_req_put_modeset_props(req, &flags);
+    }
+    if (ok == 0) {
+        ok = drmdev_atomic_req_commit(req, flags, userdata);
+    }
+
+    drmdev_destroy_atomic_req(req);
+
+    if (ok == 0 && !(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+        bench->needs_modeset = false;
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Put as many of @a n_layers full-screen layers as possible on the overlay planes,
+ * from the bottom up, using TEST_ONLY commits the way a compositor would.
+ *
+ * @returns The number of layers that got a plane.
+ */
+static int assign_planes(struct bench *bench, int n_layers) {
+    struct drmdev_atomic_req *req;
+    const drmModeModeInfo *mode = bench->drmdev->selected_mode;
+    uint32_t crtc_id = bench->drmdev->selected_crtc->crtc->crtc_id;
+    int n_assigned = 0, ok;
+
+    ok = drmdev_new_atomic_req(bench->drmdev, &req);
+    if (ok != 0) {
+        return 0;
+    }
+
+    ok = put_plane(req, bench->primary_plane_id, 1, crtc_id, mode->hdisplay, mode->vdisplay, 0, 0, mode->hdisplay, mode->vdisplay);
+
+    for (int i = 0; i < bench->n_overlay_planes && n_assigned < n_layers && ok == 0; i++) {
+        struct drmdev_atomic_req *test;
+
+        // try the plane on top of what we already have, and keep it if the driver is fine with that.
+        ok = drmdev_new_atomic_req(bench->drmdev, &test);
+        if (ok != 0) {
+            break;
+        }
+
+        ok = bench->drmdev->backend->atomic_merge(test->atomic_req, req->atomic_req) < 0 ? errno : 0;
+        if (ok == 0) ok = put_plane(test, bench->overlay_plane_ids[i], 2 + i, crtc_id, 256, 256, 64 * i, 64 * i, 256, 256);
+        if (ok == 0) ok = drmdev_atomic_req_put_plane_property(test, bench->overlay_plane_ids[i], "zpos", 1 + n_assigned);
+        if (ok == 0 && drmdev_atomic_req_commit(test, DRM_MODE_ATOMIC_TEST_ONLY, NULL) == 0) {
+            drmdev_destroy_atomic_req(req);
+            req = test;
+            n_assigned++;
+        } else {
+            drmdev_destroy_atomic_req(test);
+        }
+    }
+
+    drmdev_destroy_atomic_req(req);
+    return n_assigned;
+}
+
+/// advance_frame in main.c as it was before frame_timing_predict, to check it against.
+static uint64_t predict_reference(uint64_t last_flip_ns, uint64_t now_ns, uint64_t interval_ns, uint64_t margin_ns, unsigned int *n_intervals_out) {
+    uint64_t next = last_flip_ns;
+
+    *n_intervals_out = 0;
+    while ((int64_t) (now_ns + margin_ns - next) >= 0) {
+        next += interval_ns;
+        (*n_intervals_out)++;
+    }
+
+    return next;
+}
+
+static bool verify_prediction(void) {
+    uint64_t interval = 16666666, a, b;
+    unsigned int n_a, n_b;
+
+    for (int i = 0; i < 100000; i++) {
+        uint64_t last = 1000000000ull + random_ns(0, 1000000000ull);
+        uint64_t now = last - 2000000 + random_ns(0, 20 * interval);
+
+        a = predict_reference(last, now, interval, REPAINT_MARGIN_NS, &n_a);
+        b = frame_timing_predict(last, now, interval, REPAINT_MARGIN_NS, &n_b);
+        if (a != b || n_a != n_b) {
+            fprintf(stderr, "[mock-bench] frame_timing_predict(%llu, %llu) is %llu (+%u), should be %llu (+%u).\n",
+                    (unsigned long long) last, (unsigned long long) now, (unsigned long long) b, n_b, (unsigned long long) a, n_a);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// The constraints of the mock, seen through drmdev: which commits it takes and which events it sends.
+static bool verify_mock(void) {
+    struct mock_drm_config config;
+    struct flip_result result = { 0 };
+    struct bench bench;
+    uint64_t interval, before;
+    unsigned int sequence;
+    bool ok = true;
+    int width, height, n;
+
+#define CHECK(cond, ...) do { if (!(cond)) { fprintf(stderr, "[mock-bench] " __VA_ARGS__); ok = false; } } while (0)
+
+    mock_drm_get_default_config(&config);
+    config.manual_clock = true;
+    config.max_active_planes = 2;
+    if (bench_new(&bench, &config) != 0) {
+        return false;
+    }
+
+    width = bench.drmdev->selected_mode->hdisplay;
+    height = bench.drmdev->selected_mode->vdisplay;
+    interval = mock_drm_get_refresh_interval(bench.mock);
+
+    CHECK(drmdev_plane_get_type(bench.drmdev, bench.primary_plane_id) == DRM_PLANE_TYPE_PRIMARY, "drmdev_get_primary_plane_id didn't find the primary plane.\n");
+    CHECK(bench.n_overlay_planes == config.n_overlay_planes, "Found %d overlay planes for the CRTC, should be %d.\n", bench.n_overlay_planes, config.n_overlay_planes);
+
+    // can't flip before the mode is set.
+    bench.needs_modeset = false;
+    CHECK(commit_primary(&bench, 1, width, height, DRM_MODE_ATOMIC_TEST_ONLY, NULL) == EINVAL, "Flipping an inactive CRTC should fail.\n");
+    bench.needs_modeset = true;
+
+    CHECK(commit_primary(&bench, 1, width, height, DRM_MODE_ATOMIC_TEST_ONLY, NULL) == 0, "The modeset should pass a TEST_ONLY commit.\n");
+    CHECK(commit_primary(&bench, 1, width, height, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_TEST_ONLY, NULL) == EINVAL, "TEST_ONLY commits can't ask for events.\n");
+    CHECK(commit_primary(&bench, 1, width, height, 0, NULL) == 0, "Couldn't set the mode.\n");
+    CHECK(!bench.needs_modeset, "Still needs a modeset after setting the mode.\n");
+
+    // scaling: 1/4 is the most the default config can do.
+    CHECK(commit_primary(&bench, 1, width / 4, height / 4, DRM_MODE_ATOMIC_TEST_ONLY, NULL) == 0, "4x upscaling should be possible.\n");
+    CHECK(commit_primary(&bench, 1, width / 8, height / 8, DRM_MODE_ATOMIC_TEST_ONLY, NULL) == ERANGE, "8x upscaling should fail with ERANGE.\n");
+
+    // only 2 planes at once, so only one overlay.
+    n = assign_planes(&bench, 3);
+    CHECK(n == 1, "%d layers were put on overlay planes, should be 1.\n", n);
+
+    // flips complete at the next vblank, one sequence number later.
+    before = mock_drm_get_time(bench.mock);
+    CHECK(commit_primary(&bench, 2, width, height, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK, &result) == 0, "Couldn't flip.\n");
+    CHECK(commit_primary(&bench, 3, width, height, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK, &result) == EBUSY, "A second flip before the first one completed should fail with EBUSY.\n");
+    CHECK(wait_for_flip(&bench) == 0 && result.done, "The flip didn't complete.\n");
+    // event timestamps are in microseconds.
+    CHECK(result.time_ns / 1000 == mock_drm_get_next_vblank(bench.mock, before) / 1000, "The flip didn't complete at the next vblank.\n");
+    CHECK(result.crtc_id == bench.drmdev->selected_crtc->crtc->crtc_id, "The event is for CRTC %u, should be %u.\n", result.crtc_id, bench.drmdev->selected_crtc->crtc->crtc_id);
+
+    sequence = result.sequence;
+    mock_drm_set_time(bench.mock, mock_drm_get_time(bench.mock) + 2 * interval + interval / 2);
+    result.done = false;
+    CHECK(commit_primary(&bench, 3, width, height, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK, &result) == 0, "Couldn't flip.\n");
+    CHECK(wait_for_flip(&bench) == 0 && result.done, "The flip didn't complete.\n");
+    CHECK(result.sequence == sequence + 3, "The sequence went from %u to %u after 3 vblanks.\n", sequence, result.sequence);
+
+    // no async flips on this device.
+    CHECK(commit_primary(&bench, 4, width, height, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC, &result) == EINVAL, "Async flips should be rejected.\n");
+
+    bench_destroy(&bench);
+
+#undef CHECK
+
+    return ok;
+}
+
+static struct latency_record make_record(uint64_t start_ns, uint64_t render_ms) {
+    return (struct latency_record) {
+        .render_start_ns = start_ns,
+        .submit_ns = start_ns + render_ms * 1000000,
+        .render_done_ns = start_ns + render_ms * 1000000,
+        .commit_ns = start_ns + render_ms * 1000000,
+        .flip_ns = start_ns + 16000000,
+        .scanout_ns = start_ns + 24000000,
+    };
+}
+
+/// The budget parser, and the statistics and alerts of latency.c for frames with known stage durations.
+static bool verify_latency(void) {
+    struct latency_tracker *tracker;
+    struct latency_record record;
+    struct latency_stats stats;
+    unsigned int over_budget;
+    bool ok = true;
+    int n_alerts;
+
+#define CHECK(cond, ...) do { if (!(cond)) { fprintf(stderr, "[mock-bench] " __VA_ARGS__); ok = false; } } while (0)
+
+    if (latency_tracker_new(&tracker, 8, 16666666) != 0) {
+        return false;
+    }
+
+    CHECK(latency_tracker_parse_budgets(tracker, "render=5,gpu=4.5,total=40") == 0, "Couldn't parse a valid budget spec.\n");
+    CHECK(latency_tracker_get_budget(tracker, LATENCY_STAGE_RENDER) == 5000000, "The render budget should be 5ms.\n");
+    CHECK(latency_tracker_get_budget(tracker, LATENCY_STAGE_GPU) == 4500000, "The gpu budget should be 4.5ms.\n");
+    CHECK(latency_tracker_get_budget(tracker, LATENCY_STAGE_TOTAL) == 40000000, "The total budget should be 40ms.\n");
+
+    // a bad spec changes nothing, not even the stages before the bad one.
+    CHECK(latency_tracker_parse_budgets(tracker, "gpu=1,render=abc") == EINVAL, "\"render=abc\" should be rejected.\n");
+    CHECK(latency_tracker_parse_budgets(tracker, "gpu=1,vsync=2") == EINVAL, "\"vsync=2\" should be rejected.\n");
+    CHECK(latency_tracker_parse_budgets(tracker, "gpu=1,render=-1") == EINVAL, "Negative budgets should be rejected.\n");
+    CHECK(latency_tracker_parse_budgets(tracker, "gpu=1,render") == EINVAL, "\"render\" without a value should be rejected.\n");
+    CHECK(latency_tracker_get_budget(tracker, LATENCY_STAGE_GPU) == 4500000, "A rejected spec changed the gpu budget.\n");
+
+    // 1ms to 10ms of rendering, only the last 8 of which are in the window.
+    n_alerts = 0;
+    for (int i = 1; i <= 10; i++) {
+        record = make_record(1000000000ull * i, i);
+        over_budget = latency_tracker_add(tracker, &record);
+
+        CHECK(!!(over_budget & (1u << LATENCY_STAGE_RENDER)) == (i > 5), "Rendering for %dms should %sbe over the 5ms budget.\n", i, i > 5 ? "" : "not ");
+        CHECK(!(over_budget & (1u << LATENCY_STAGE_TOTAL)), "24ms from render start to scanout went over the 40ms budget.\n");
+        n_alerts += !!(over_budget & (1u << LATENCY_STAGE_RENDER));
+    }
+    CHECK(n_alerts == 5, "%d render budget alerts, should be 5.\n", n_alerts);
+    CHECK(latency_tracker_get_n_frames(tracker) == 10, "%llu frames tracked, should be 10.\n", (unsigned long long) latency_tracker_get_n_frames(tracker));
+
+    latency_tracker_get_stats(tracker, LATENCY_STAGE_RENDER, &stats);
+    CHECK(stats.n_frames == 8, "The render stats are over %d frames, should be the window of 8.\n", stats.n_frames);
+    CHECK(stats.min_ns == 3000000 && stats.max_ns == 10000000, "Render min/max are %lld/%lldns, should be 3/10ms.\n", (long long) stats.min_ns, (long long) stats.max_ns);
+    CHECK(stats.mean_ns == 6500000, "Render mean is %lldns, should be 6.5ms.\n", (long long) stats.mean_ns);
+    CHECK(stats.p50_ns == 6000000 && stats.p99_ns == 9000000, "Render p50/p99 are %lld/%lldns, should be 6/9ms.\n", (long long) stats.p50_ns, (long long) stats.p99_ns);
+    CHECK(stats.n_over_budget == 5, "%d frames over the render budget in the window, should be 5.\n", stats.n_over_budget);
+
+    // the stages add up: everything after the render stage is the same for every frame.
+    latency_tracker_get_stats(tracker, LATENCY_STAGE_FLIP, &stats);
+    CHECK(stats.min_ns == 6000000 && stats.max_ns == 13000000, "Flip min/max are %lld/%lldns, should be 6/13ms.\n", (long long) stats.min_ns, (long long) stats.max_ns);
+    latency_tracker_get_stats(tracker, LATENCY_STAGE_TOTAL, &stats);
+    CHECK(stats.min_ns == 24000000 && stats.max_ns == 24000000, "Total latency should always be 24ms.\n");
+    latency_tracker_get_stats(tracker, LATENCY_STAGE_GPU, &stats);
+    CHECK(stats.max_ns == 0 && stats.n_over_budget == 0, "No GPU time was recorded, but the stats say otherwise.\n");
+
+    latency_tracker_destroy(tracker);
+
+#undef CHECK
+
+    return ok;
+}
+
+struct loop_stats {
+    int n_frames;
+    int n_mispredicted;
+    int n_skipped;
+    int n_commits;
+
+    /// Frames that were rendered for longer than a frame, and render budget alerts of the latency tracker.
+    int n_slow_renders;
+    int n_render_alerts;
+};
+
+/**
+ * @brief The repaint loop of main.c on the mock: predict the next flip with @ref frame_timing_predict,
+ * "render" for a simulated time, commit and wait for the flip. The render times are random but the
+ * same on every run, with the odd frame that takes too long or starts late.
+ *
+ * The flips are written to @a recorder, if it's not NULL, and the latency of every frame,
+ * from render start to the middle of the picture being scanned out, is added to @a latency.
+ */
+static int run_repaint_loop(struct bench *bench, int n_frames, struct flip_recorder *recorder, struct latency_tracker *latency, struct loop_stats *stats) {
+    const drmModeModeInfo *mode = bench->drmdev->selected_mode;
+    struct flip_result result = { 0 };
+    uint64_t interval, last_flip, now, render_start, predicted;
+    unsigned int n_intervals, over_budget;
+    int width, height, ok;
+
+    memset(stats, 0, sizeof *stats);
+
+    width = mode->hdisplay;
+    height = mode->vdisplay;
+    interval = mock_drm_get_refresh_interval(bench->mock);
+
+    ok = commit_primary(bench, 1, width, height, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_ALLOW_MODESET, &result);
+    if (ok == 0) ok = wait_for_flip(bench);
+    if (ok != 0) {
+        return ok;
+    }
+    last_flip = result.time_ns;
+
+    for (int i = 0; i < n_frames; i++) {
+        uint32_t dice = random_u32() % 100;
+
+        // dispatching the event, and sometimes a stall before we get to repaint.
+        now = mock_drm_get_time(bench->mock) + (dice < 2 ? random_ns(interval / 2, interval) : random_ns(0, 1000000));
+        mock_drm_set_time(bench->mock, now);
+
+        render_start = now;
+        predicted = frame_timing_predict(last_flip, now, interval, REPAINT_MARGIN_NS, &n_intervals);
+        if (n_intervals > 1) {
+            stats->n_skipped += n_intervals - 1;
+        }
+
+        // rendering, sometimes for longer than a frame.
+        now += dice >= 2 && dice < 5 ? random_ns(interval, 2 * interval) : random_ns(interval / 4, interval / 2);
+        if (dice >= 2 && dice < 5) {
+            stats->n_slow_renders++;
+        }
+        mock_drm_set_time(bench->mock, now);
+
+        result.done = false;
+        ok = commit_primary(bench, 2 + (i & 1), width, height, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK, &result);
+        if (ok == 0) ok = wait_for_flip(bench);
+        if (ok != 0) {
+            return ok;
+        }
+        stats->n_commits++;
+
+        // the event only has microseconds, so the prediction can be off by a bit without being a frame off.
+        if (result.time_ns + interval / 2 < predicted || result.time_ns > predicted + interval / 2) {
+            stats->n_mispredicted++;
+        }
+        if (recorder != NULL) {
+            flip_recorder_add(recorder, &(struct flip_trace_event) {
+                .crtc_id = result.crtc_id,
+                .sequence = result.sequence,
+                .flip_ns = result.time_ns,
+                .predicted_ns = predicted,
+                .refresh_interval_ns = interval,
+                .render_start_ns = render_start,
+                .render_done_ns = now,
+                .commit_ns = now,
+            });
+        }
+
+        // same as record_latency in main.c.
+        over_budget = latency_tracker_add(latency, &(struct latency_record) {
+            .render_start_ns = render_start,
+            .submit_ns = now,
+            .render_done_ns = now,
+            .commit_ns = now,
+            .flip_ns = result.time_ns,
+            .scanout_ns = result.time_ns + interval / mode->vtotal * mode->vdisplay / 2,
+        });
+        if (over_budget & (1u << LATENCY_STAGE_RENDER)) {
+            stats->n_render_alerts++;
+        }
+
+        last_flip = result.time_ns;
+        stats->n_frames++;
+    }
+
+    return 0;
+}
+
+static void print_usage(const char *argv0) {
+    printf(
+        "usage: %s [options]\n"
+        "\n"
+        "Runs the modesetting code and the frame scheduling of main.c on a\n"
+        "simulated KMS device (mock_drm.c), so it can be tested and timed without\n"
+        "display hardware. Checks the commits the mock accepts and rejects and the\n"
+        "flip events it sends, simulates a repaint loop with a manual clock and counts\n"
+        "mispredicted frames and latency budget alerts, and times commits through drmdev.\n"
+        "\n"
+        "  --frames=N                 Number of frames of the simulated repaint loop. (default: 10000)\n"
+        "  --record=FILE              Write the flips of the repaint loop to FILE, as a\n"
+        "                             trace for flip-replay.\n"
+        "  --benchmark=FILE           Write the results as JSON to FILE\n"
+        "                             (or stdout if FILE is \"-\").\n"
+        "  --baseline=FILE            Compare against the JSON written by an earlier\n"
+        "                             --benchmark run and fail if anything regressed.\n"
+        "  --tolerance=PERCENT        How much worse than the baseline is still ok. (default: 10)\n"
+        "  --help                     Show this help.\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    struct benchmark_report report;
+    struct mock_drm_config config;
+    struct mock_drm_stats mock_stats;
+    struct loop_stats stats;
+    struct bench bench;
+    struct flip_recorder *recorder;
+    struct latency_tracker *latency;
+    struct latency_stats render_stats, flip_stats, total_stats;
+    const char *benchmark_path, *baseline_path, *record_path;
+    double tolerance, commits_per_sec, test_commits_per_sec;
+    uint64_t start;
+    int opt, n_frames, n_test_commits, n_regressions, ok;
+
+    static const struct option long_options[] = {
+        { "frames", required_argument, NULL, 'f' },
+        { "record", required_argument, NULL, 'r' },
+        { "benchmark", required_argument, NULL, 'b' },
+        { "baseline", required_argument, NULL, 'B' },
+        { "tolerance", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    n_frames = 10000;
+    record_path = NULL;
+    benchmark_path = NULL;
+    baseline_path = NULL;
+    tolerance = 10.0;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+                n_frames = atoi(optarg);
+                if (n_frames <= 0) {
+                    fprintf(stderr, "[mock-bench] Invalid number of frames \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            case 'b':
+                benchmark_path = optarg;
+                break;
+            case 'B':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    benchmark_report_init(&report, "mock-drm");
+
+    ok = verify_prediction() && verify_mock() && verify_latency() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    mock_drm_get_default_config(&config);
+    config.manual_clock = true;
+    if (bench_new(&bench, &config) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    recorder = NULL;
+    if (record_path != NULL && flip_recorder_new(&recorder, record_path) != 0) {
+        bench_destroy(&bench);
+        return EXIT_FAILURE;
+    }
+
+    // over the whole run, and with a render budget only the frames that render for longer than a frame go over.
+    if (latency_tracker_new(&latency, n_frames, mock_drm_get_refresh_interval(bench.mock)) != 0) {
+        bench_destroy(&bench);
+        return EXIT_FAILURE;
+    }
+    latency_tracker_set_budget(latency, LATENCY_STAGE_RENDER, mock_drm_get_refresh_interval(bench.mock) * 3 / 4);
+
+    // the simulated repaint loop. Deterministic, so the frame counts can be compared exactly.
+    random_state = 1;
+    start = get_monotonic_ns();
+    if (run_repaint_loop(&bench, n_frames, recorder, latency, &stats) != 0) {
+        fprintf(stderr, "[mock-bench] The simulated repaint loop failed.\n");
+        latency_tracker_destroy(latency);
+        bench_destroy(&bench);
+        return EXIT_FAILURE;
+    }
+    commits_per_sec = stats.n_commits / ((get_monotonic_ns() - start) / 1e9);
+
+    if (recorder != NULL) {
+        flip_recorder_destroy(recorder);
+    }
+
+    mock_drm_get_stats(bench.mock, &mock_stats);
+    if (mock_stats.n_events != mock_stats.n_commits || mock_stats.n_rejected_commits != 0) {
+        fprintf(stderr, "[mock-bench] %llu commits but %llu events and %llu rejected commits.\n",
+                (unsigned long long) mock_stats.n_commits, (unsigned long long) mock_stats.n_events, (unsigned long long) mock_stats.n_rejected_commits);
+        ok = EXIT_FAILURE;
+    }
+
+    latency_tracker_get_stats(latency, LATENCY_STAGE_RENDER, &render_stats);
+    latency_tracker_get_stats(latency, LATENCY_STAGE_FLIP, &flip_stats);
+    latency_tracker_get_stats(latency, LATENCY_STAGE_TOTAL, &total_stats);
+    latency_tracker_destroy(latency);
+
+    if (stats.n_render_alerts != stats.n_slow_renders || render_stats.n_over_budget != stats.n_slow_renders) {
+        fprintf(stderr, "[mock-bench] %d frames rendered for longer than a frame, but there were %d render budget alerts and %d frames over budget.\n",
+                stats.n_slow_renders, stats.n_render_alerts, render_stats.n_over_budget);
+        ok = EXIT_FAILURE;
+    }
+    if (total_stats.n_frames != stats.n_frames ||
+        total_stats.min_ns > total_stats.p50_ns || total_stats.p50_ns > total_stats.p99_ns || total_stats.p99_ns > total_stats.max_ns) {
+        fprintf(stderr, "[mock-bench] The latency stats are inconsistent: %d frames, min %lld, p50 %lld, p99 %lld, max %lld ns.\n",
+                total_stats.n_frames, (long long) total_stats.min_ns, (long long) total_stats.p50_ns, (long long) total_stats.p99_ns, (long long) total_stats.max_ns);
+        ok = EXIT_FAILURE;
+    }
+    // a commit is always shown at the next vblank, since the loop waits for every flip.
+    if (flip_stats.max_ns > (int64_t) mock_drm_get_refresh_interval(bench.mock)) {
+        fprintf(stderr, "[mock-bench] A flip took %lldns from commit to vblank, longer than a frame.\n", (long long) flip_stats.max_ns);
+        ok = EXIT_FAILURE;
+    }
+
+    printf("repaint loop:      %d frames, %d mispredicted, %d skipped, %.0f commits/s\n", stats.n_frames, stats.n_mispredicted, stats.n_skipped, commits_per_sec);
+    printf("latency:           p50 %.2fms, p99 %.2fms, max %.2fms, %d render budget alerts\n", total_stats.p50_ns / 1e6, total_stats.p99_ns / 1e6, total_stats.max_ns / 1e6, stats.n_render_alerts);
+    benchmark_report_add(&report, "repaint_commits_per_sec", "1/s", commits_per_sec, true);
+    benchmark_report_add(&report, "mispredicted_frames", "frames", stats.n_mispredicted, false);
+    benchmark_report_add(&report, "skipped_frames", "frames", stats.n_skipped, false);
+    benchmark_report_add(&report, "latency_p99_ms", "ms", total_stats.p99_ns / 1e6, false);
+
+    // what testing a plane configuration costs, through drmdev's property lookups.
+    start = get_monotonic_ns();
+    for (int i = 0; i < n_frames; i++) {
+        assign_planes(&bench, bench.n_overlay_planes);
+    }
+    n_test_commits = -(int) mock_stats.n_test_commits;
+    mock_drm_get_stats(bench.mock, &mock_stats);
+    n_test_commits += mock_stats.n_test_commits;
+    test_commits_per_sec = n_test_commits / ((get_monotonic_ns() - start) / 1e9);
+
+    printf("plane assignment:  %d TEST_ONLY commits, %.0f commits/s\n", n_test_commits, test_commits_per_sec);
+    benchmark_report_add(&report, "test_commits_per_sec", "1/s", test_commits_per_sec, true);
+
+    bench_destroy(&bench);
+
+    if (benchmark_path != NULL && benchmark_report_save(&report, benchmark_path) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (baseline_path != NULL) {
+        if (benchmark_report_compare(&report, baseline_path, tolerance / 100.0, stdout, &n_regressions) != 0 || n_regressions > 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return ok;
+}
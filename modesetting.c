@@ -36,39 +36,39 @@ static int fetch_connectors(struct drmdev *drmdev, struct drm_connector **connec
         drmModePropertyRes **props_info;
         drmModeConnector *connector;
 
-        connector = drmModeGetConnector(drmdev->fd, drmdev->res->connectors[i]);
+        connector = drmdev->backend->get_connector(drmdev->fd, drmdev->res->connectors[i]);
         if (connector == NULL) {
             ok = errno;
             perror("[modesetting] Could not get DRM device connector. drmModeGetConnector");
             goto fail_free_connectors;
         }
 
-        props = drmModeObjectGetProperties(drmdev->fd, drmdev->res->connectors[i], DRM_MODE_OBJECT_CONNECTOR);
+        props = drmdev->backend->object_get_properties(drmdev->fd, drmdev->res->connectors[i], DRM_MODE_OBJECT_CONNECTOR);
         if (props == NULL) {
             ok = errno;
             perror("[modesetting] Could not get DRM device connectors properties. drmModeObjectGetProperties");
-            drmModeFreeConnector(connector);
+            drmdev->backend->free_connector(connector);
             goto fail_free_connectors;
         }
 
         props_info = calloc(props->count_props, sizeof *props_info);
         if (props_info == NULL) {
             ok = ENOMEM;
-            drmModeFreeObjectProperties(props);
-            drmModeFreeConnector(connector);
+            drmdev->backend->free_object_properties(props);
+            drmdev->backend->free_connector(connector);
             goto fail_free_connectors;
         }
 
         for (int j = 0; j < props->count_props; j++) {
-            props_info[j] = drmModeGetProperty(drmdev->fd, props->props[j]);
+            props_info[j] = drmdev->backend->get_property(drmdev->fd, props->props[j]);
             if (props_info[j] == NULL) {
                 ok = errno;
                 perror("[modesetting] Could not get DRM device connector properties' info. drmModeGetProperty");
                 for (int k = 0; k < (j-1); k++)
-                    drmModeFreeProperty(props_info[j]);
+                    drmdev->backend->free_property(props_info[j]);
                 free(props_info);
-                drmModeFreeObjectProperties(props);
-                drmModeFreeConnector(connector);
+                drmdev->backend->free_object_properties(props);
+                drmdev->backend->free_connector(connector);
                 goto fail_free_connectors;
             }
         }
@@ -86,10 +86,10 @@ static int fetch_connectors(struct drmdev *drmdev, struct drm_connector **connec
     fail_free_connectors:
     for (int i = 0; i < n_allocated_connectors; i++) {
         for (int j = 0; j < connectors[i].props->count_props; j++)
-            drmModeFreeProperty(connectors[i].props_info[j]);
+            drmdev->backend->free_property(connectors[i].props_info[j]);
         free(connectors[i].props_info);
-        drmModeFreeObjectProperties(connectors[i].props);
-        drmModeFreeConnector(connectors[i].connector);
+        drmdev->backend->free_object_properties(connectors[i].props);
+        drmdev->backend->free_connector(connectors[i].connector);
     }
 
     free(connectors);
@@ -99,13 +99,13 @@ static int fetch_connectors(struct drmdev *drmdev, struct drm_connector **connec
     return ok;
 }
 
-static int free_connectors(struct drm_connector *connectors, size_t n_connectors) {
+static int free_connectors(const struct drm_backend *backend, struct drm_connector *connectors, size_t n_connectors) {
     for (int i = 0; i < n_connectors; i++) {
         for (int j = 0; j < connectors[i].props->count_props; j++)
-            drmModeFreeProperty(connectors[i].props_info[j]);
+            backend->free_property(connectors[i].props_info[j]);
         free(connectors[i].props_info);
-        drmModeFreeObjectProperties(connectors[i].props);
-        drmModeFreeConnector(connectors[i].connector);
+        backend->free_object_properties(connectors[i].props);
+        backend->free_connector(connectors[i].connector);
     }
 
     free(connectors);
@@ -129,7 +129,7 @@ static int fetch_encoders(struct drmdev *drmdev, struct drm_encoder **encoders_o
     for (int i = 0; i < drmdev->res->count_encoders; i++, n_allocated_encoders++) {
         drmModeEncoder *encoder;
 
-        encoder = drmModeGetEncoder(drmdev->fd, drmdev->res->encoders[i]);
+        encoder = drmdev->backend->get_encoder(drmdev->fd, drmdev->res->encoders[i]);
         if (encoder == NULL) {
             ok = errno;
             perror("[modesetting] Could not get DRM device encoder. drmModeGetEncoder");
@@ -146,7 +146,7 @@ static int fetch_encoders(struct drmdev *drmdev, struct drm_encoder **encoders_o
 
     fail_free_encoders:
     for (int i = 0; i < n_allocated_encoders; i++) {
-        drmModeFreeEncoder(encoders[i].encoder);
+        drmdev->backend->free_encoder(encoders[i].encoder);
     }
 
     free(encoders);
@@ -156,9 +156,9 @@ static int fetch_encoders(struct drmdev *drmdev, struct drm_encoder **encoders_o
     return ok;
 }
 
-static int free_encoders(struct drm_encoder *encoders, size_t n_encoders) {
+static int free_encoders(const struct drm_backend *backend, struct drm_encoder *encoders, size_t n_encoders) {
     for (int i = 0; i < n_encoders; i++) {
-        drmModeFreeEncoder(encoders[i].encoder);
+        backend->free_encoder(encoders[i].encoder);
     }
 
     free(encoders);
@@ -183,39 +183,39 @@ static int fetch_crtcs(struct drmdev *drmdev, struct drm_crtc **crtcs_out, size_
         drmModePropertyRes **props_info;
         drmModeCrtc *crtc;
 
-        crtc = drmModeGetCrtc(drmdev->fd, drmdev->res->crtcs[i]);
+        crtc = drmdev->backend->get_crtc(drmdev->fd, drmdev->res->crtcs[i]);
         if (crtc == NULL) {
             ok = errno;
             perror("[modesetting] Could not get DRM device CRTC. drmModeGetCrtc");
             goto fail_free_crtcs;
         }
 
-        props = drmModeObjectGetProperties(drmdev->fd, drmdev->res->crtcs[i], DRM_MODE_OBJECT_CRTC);
+        props = drmdev->backend->object_get_properties(drmdev->fd, drmdev->res->crtcs[i], DRM_MODE_OBJECT_CRTC);
         if (props == NULL) {
             ok = errno;
             perror("[modesetting] Could not get DRM device CRTCs properties. drmModeObjectGetProperties");
-            drmModeFreeCrtc(crtc);
+            drmdev->backend->free_crtc(crtc);
             goto fail_free_crtcs;
         }
 
         props_info = calloc(props->count_props, sizeof *props_info);
         if (props_info == NULL) {
             ok = ENOMEM;
-            drmModeFreeObjectProperties(props);
-            drmModeFreeCrtc(crtc);
+            drmdev->backend->free_object_properties(props);
+            drmdev->backend->free_crtc(crtc);
             goto fail_free_crtcs;
         }
 
         for (int j = 0; j < props->count_props; j++) {
-            props_info[j] = drmModeGetProperty(drmdev->fd, props->props[j]);
+            props_info[j] = drmdev->backend->get_property(drmdev->fd, props->props[j]);
             if (props_info[j] == NULL) {
                 ok = errno;
                 perror("[modesetting] Could not get DRM device CRTCs properties' info. drmModeGetProperty");
                 for (int k = 0; k < (j-1); k++)
-                    drmModeFreeProperty(props_info[j]);
+                    drmdev->backend->free_property(props_info[j]);
                 free(props_info);
-                drmModeFreeObjectProperties(props);
-                drmModeFreeCrtc(crtc);
+                drmdev->backend->free_object_properties(props);
+                drmdev->backend->free_crtc(crtc);
                 goto fail_free_crtcs;
             }
         }
@@ -237,10 +237,10 @@ static int fetch_crtcs(struct drmdev *drmdev, struct drm_crtc **crtcs_out, size_
     fail_free_crtcs:
     for (int i = 0; i < n_allocated_crtcs; i++) {
         for (int j = 0; j < crtcs[i].props->count_props; j++)
-            drmModeFreeProperty(crtcs[i].props_info[j]);
+            drmdev->backend->free_property(crtcs[i].props_info[j]);
         free(crtcs[i].props_info);
-        drmModeFreeObjectProperties(crtcs[i].props);
-        drmModeFreeCrtc(crtcs[i].crtc);
+        drmdev->backend->free_object_properties(crtcs[i].props);
+        drmdev->backend->free_crtc(crtcs[i].crtc);
     }
 
     free(crtcs);
@@ -250,13 +250,13 @@ static int fetch_crtcs(struct drmdev *drmdev, struct drm_crtc **crtcs_out, size_
     return ok;
 }
 
-static int free_crtcs(struct drm_crtc *crtcs, size_t n_crtcs) {
+static int free_crtcs(const struct drm_backend *backend, struct drm_crtc *crtcs, size_t n_crtcs) {
     for (int i = 0; i < n_crtcs; i++) {
         for (int j = 0; j < crtcs[i].props->count_props; j++)
-            drmModeFreeProperty(crtcs[i].props_info[j]);
+            backend->free_property(crtcs[i].props_info[j]);
         free(crtcs[i].props_info);
-        drmModeFreeObjectProperties(crtcs[i].props);
-        drmModeFreeCrtc(crtcs[i].crtc);
+        backend->free_object_properties(crtcs[i].props);
+        backend->free_crtc(crtcs[i].crtc);
     }
 
     free(crtcs);
@@ -281,39 +281,39 @@ static int fetch_planes(struct drmdev *drmdev, struct drm_plane **planes_out, si
         drmModePropertyRes **props_info;
         drmModePlane *plane;
 
-        plane = drmModeGetPlane(drmdev->fd, drmdev->plane_res->planes[i]);
+        plane = drmdev->backend->get_plane(drmdev->fd, drmdev->plane_res->planes[i]);
         if (plane == NULL) {
             ok = errno;
             perror("[modesetting] Could not get DRM device plane. drmModeGetPlane");
             goto fail_free_planes;
         }
 
-        props = drmModeObjectGetProperties(drmdev->fd, drmdev->plane_res->planes[i], DRM_MODE_OBJECT_PLANE);
+        props = drmdev->backend->object_get_properties(drmdev->fd, drmdev->plane_res->planes[i], DRM_MODE_OBJECT_PLANE);
         if (props == NULL) {
             ok = errno;
             perror("[modesetting] Could not get DRM device planes' properties. drmModeObjectGetProperties");
-            drmModeFreePlane(plane);
+            drmdev->backend->free_plane(plane);
             goto fail_free_planes;
         }
 
         props_info = calloc(props->count_props, sizeof *props_info);
         if (props_info == NULL) {
             ok = ENOMEM;
-            drmModeFreeObjectProperties(props);
-            drmModeFreePlane(plane);
+            drmdev->backend->free_object_properties(props);
+            drmdev->backend->free_plane(plane);
             goto fail_free_planes;
         }
 
         for (int j = 0; j < props->count_props; j++) {
-            props_info[j] = drmModeGetProperty(drmdev->fd, props->props[j]);
+            props_info[j] = drmdev->backend->get_property(drmdev->fd, props->props[j]);
             if (props_info[j] == NULL) {
                 ok = errno;
                 perror("[modesetting] Could not get DRM device planes' properties' info. drmModeGetProperty");
                 for (int k = 0; k < (j-1); k++)
-                    drmModeFreeProperty(props_info[j]);
+                    drmdev->backend->free_property(props_info[j]);
                 free(props_info);
-                drmModeFreeObjectProperties(props);
-                drmModeFreePlane(plane);
+                drmdev->backend->free_object_properties(props);
+                drmdev->backend->free_plane(plane);
                 goto fail_free_planes;
             }
 
@@ -342,10 +342,10 @@ static int fetch_planes(struct drmdev *drmdev, struct drm_plane **planes_out, si
     fail_free_planes:
     for (int i = 0; i < n_allocated_planes; i++) {
         for (int j = 0; j < planes[i].props->count_props; j++)
-            drmModeFreeProperty(planes[i].props_info[j]);
+            drmdev->backend->free_property(planes[i].props_info[j]);
         free(planes[i].props_info);
-        drmModeFreeObjectProperties(planes[i].props);
-        drmModeFreePlane(planes[i].plane);
+        drmdev->backend->free_object_properties(planes[i].props);
+        drmdev->backend->free_plane(planes[i].plane);
     }
 
     free(planes);
@@ -355,13 +355,13 @@ static int fetch_planes(struct drmdev *drmdev, struct drm_plane **planes_out, si
     return ok;
 }
 
-static int free_planes(struct drm_plane *planes, size_t n_planes) {
+static int free_planes(const struct drm_backend *backend, struct drm_plane *planes, size_t n_planes) {
     for (int i = 0; i < n_planes; i++) {
         for (int j = 0; j < planes[i].props->count_props; j++)
-            drmModeFreeProperty(planes[i].props_info[j]);
+            backend->free_property(planes[i].props_info[j]);
         free(planes[i].props_info);
-        drmModeFreeObjectProperties(planes[i].props);
-        drmModeFreePlane(planes[i].plane);
+        backend->free_object_properties(planes[i].props);
+        backend->free_plane(planes[i].plane);
     }
 
     free(planes);
@@ -374,9 +374,10 @@ float mode_get_vrefresh(const drmModeModeInfo *mode) {
     return mode->clock * 1000.0 / (mode->htotal * mode->vtotal);
 }
 
-int drmdev_new_from_fd(
+int drmdev_new_with_backend(
     struct drmdev **drmdev_out,
-    int fd
+    int fd,
+    const struct drm_backend *backend
 ) {
     struct drmdev *drmdev;
     int ok;
@@ -387,15 +388,16 @@ int drmdev_new_from_fd(
     }
 
     drmdev->fd = fd;
+    drmdev->backend = backend;
 
-    ok = drmSetClientCap(drmdev->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+    ok = drmdev->backend->set_client_cap(drmdev->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
     if (ok < 0) {
         ok = errno;
         perror("[modesetting] Could not set DRM client universal planes capable. drmSetClientCap");
         goto fail_free_drmdev;
     }
     
-    ok = drmSetClientCap(drmdev->fd, DRM_CLIENT_CAP_ATOMIC, 1);
+    ok = drmdev->backend->set_client_cap(drmdev->fd, DRM_CLIENT_CAP_ATOMIC, 1);
     if ((ok < 0) && (errno == EOPNOTSUPP)) {
         drmdev->supports_atomic_modesetting = false;
     } else if (ok < 0) {
@@ -406,14 +408,14 @@ int drmdev_new_from_fd(
         drmdev->supports_atomic_modesetting = true;
     }
 
-    drmdev->res = drmModeGetResources(drmdev->fd);
+    drmdev->res = drmdev->backend->get_resources(drmdev->fd);
     if (drmdev->res == NULL) {
         ok = errno;
         perror("[modesetting] Could not get DRM device resources. drmModeGetResources");
         goto fail_free_drmdev;
     }
 
-    drmdev->plane_res = drmModeGetPlaneResources(drmdev->fd);
+    drmdev->plane_res = drmdev->backend->get_plane_resources(drmdev->fd);
     if (drmdev->plane_res == NULL) {
         ok = errno;
         perror("[modesetting] Could not get DRM device planes resources. drmModeGetPlaneResources");
@@ -446,19 +448,19 @@ int drmdev_new_from_fd(
 
 
     fail_free_crtcs:
-    free_crtcs(drmdev->crtcs, drmdev->n_crtcs);
+    free_crtcs(drmdev->backend, drmdev->crtcs, drmdev->n_crtcs);
 
     fail_free_encoders:
-    free_encoders(drmdev->encoders, drmdev->n_encoders);
+    free_encoders(drmdev->backend, drmdev->encoders, drmdev->n_encoders);
 
     fail_free_connectors:
-    free_connectors(drmdev->connectors, drmdev->n_connectors);
+    free_connectors(drmdev->backend, drmdev->connectors, drmdev->n_connectors);
 
     fail_free_plane_resources:
-    drmModeFreePlaneResources(drmdev->plane_res);
+    drmdev->backend->free_plane_resources(drmdev->plane_res);
 
     fail_free_resources:
-    drmModeFreeResources(drmdev->res);
+    drmdev->backend->free_resources(drmdev->res);
 
     fail_free_drmdev:
     free(drmdev);
@@ -466,6 +468,13 @@ int drmdev_new_from_fd(
     return ok;
 }
 
+int drmdev_new_from_fd(
+    struct drmdev **drmdev_out,
+    int fd
+) {
+    return drmdev_new_with_backend(drmdev_out, fd, &drm_backend_libdrm);
+}
+
 int drmdev_new_from_path(
     struct drmdev **drmdev_out,
     const char *path
@@ -537,7 +546,7 @@ int drmdev_configure(
 
     mode_id = 0;
     if (drmdev->supports_atomic_modesetting) {
-        ok = drmModeCreatePropertyBlob(drmdev->fd, mode, sizeof(*mode), &mode_id);
+        ok = drmdev->backend->create_property_blob(drmdev->fd, mode, sizeof(*mode), &mode_id);
         if (ok < 0) {
             perror("[modesetting] Could not create property blob for DRM mode. drmModeCreatePropertyBlob");
             drmdev_unlock(drmdev);
@@ -545,11 +554,11 @@ int drmdev_configure(
         }
 
         if (drmdev->selected_mode != NULL) {
-            ok = drmModeDestroyPropertyBlob(drmdev->fd, drmdev->selected_mode_blob_id);
+            ok = drmdev->backend->destroy_property_blob(drmdev->fd, drmdev->selected_mode_blob_id);
             if (ok < 0) {
                 ok = errno;
                 perror("[modesetting] Could not destroy old DRM mode property blob. drmModeDestroyPropertyBlob");
-                drmModeDestroyPropertyBlob(drmdev->fd, mode_id);
+                drmdev->backend->destroy_property_blob(drmdev->fd, mode_id);
                 drmdev_unlock(drmdev);
                 return ok;
             }
@@ -617,6 +626,24 @@ int drmdev_plane_get_type(
     return plane->type;
 }
 
+int drmdev_get_primary_plane_id(
+    struct drmdev *drmdev,
+    uint32_t *plane_id_out
+) {
+    if (drmdev->selected_crtc == NULL) {
+        return EINVAL;
+    }
+
+    for (int i = 0; i < drmdev->n_planes; i++) {
+        if (drmdev->planes[i].type == DRM_PLANE_TYPE_PRIMARY && (drmdev->planes[i].plane->possible_crtcs & drmdev->selected_crtc->bitmask)) {
+            *plane_id_out = drmdev->planes[i].plane->plane_id;
+            return 0;
+        }
+    }
+
+    return ENOENT;
+}
+
 int drmdev_plane_supports_setting_rotation_value(
     struct drmdev *drmdev,
     uint32_t plane_id,
@@ -836,7 +863,7 @@ int drmdev_new_atomic_req(
 
     req->drmdev = drmdev;
 
-    req->atomic_req = drmModeAtomicAlloc();
+    req->atomic_req = drmdev->backend->atomic_alloc();
     if (req->atomic_req == NULL) {
         free(req);
         return ENOMEM;
@@ -850,7 +877,7 @@ int drmdev_new_atomic_req(
 void drmdev_destroy_atomic_req(
     struct drmdev_atomic_req *req
 ) {
-    drmModeAtomicFree(req->atomic_req);
+    req->drmdev->backend->atomic_free(req->atomic_req);
     free(req);
 }
 
@@ -866,7 +893,7 @@ int drmdev_atomic_req_put_connector_property(
     for (int i = 0; i < req->drmdev->selected_connector->props->count_props; i++) {
         drmModePropertyRes *prop = req->drmdev->selected_connector->props_info[i];
         if (strcmp(prop->name, name) == 0) {
-            ok = drmModeAtomicAddProperty(
+            ok = req->drmdev->backend->atomic_add_property(
                 req->atomic_req,
                 req->drmdev->selected_connector->connector->connector_id,
                 prop->prop_id, value
@@ -899,7 +926,7 @@ int drmdev_atomic_req_put_crtc_property(
     for (int i = 0; i < req->drmdev->selected_crtc->props->count_props; i++) {
         drmModePropertyRes *prop = req->drmdev->selected_crtc->props_info[i];
         if (strcmp(prop->name, name) == 0) {
-            ok = drmModeAtomicAddProperty(
+            ok = req->drmdev->backend->atomic_add_property(
                 req->atomic_req,
                 req->drmdev->selected_crtc->crtc->crtc_id,
                 prop->prop_id,
@@ -951,7 +978,7 @@ int drmdev_atomic_req_put_plane_property(
         prop = plane->props_info[i];
         
         if (strcmp(prop->name, name) == 0) {
-            ok = drmModeAtomicAddProperty(
+            ok = req->drmdev->backend->atomic_add_property(
                 req->atomic_req,
                 plane_id,
                 prop->prop_id,
@@ -1003,7 +1030,7 @@ int drmdev_atomic_req_put_modeset_props(
         return ok;
     }
 
-    ok = drmModeAtomicMerge(req->atomic_req, augment->atomic_req);
+    ok = req->drmdev->backend->atomic_merge(req->atomic_req, augment->atomic_req);
     if (ok < 0) {
         ok = errno;
         perror("[modesetting] Could not apply modesetting properties to atomic request. drmModeAtomicMerge");
@@ -1029,10 +1056,13 @@ int drmdev_atomic_req_commit(
 
     drmdev_lock(req->drmdev);
 
-    ok = drmModeAtomicCommit(req->drmdev->fd, req->atomic_req, flags, userdata);
+    ok = req->drmdev->backend->atomic_commit(req->drmdev->fd, req->atomic_req, flags, userdata);
     if (ok < 0) {
         ok = errno;
-        perror("[modesetting] Could not commit atomic request. drmModeAtomicCommit");
+        // failing is what TEST_ONLY commits are for, that's not worth an error message.
+        if (!(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+            perror("[modesetting] Could not commit atomic request. drmModeAtomicCommit");
+        }
         drmdev_unlock(req->drmdev);
         return ok;
     }
@@ -1049,7 +1079,7 @@ int drmdev_legacy_set_mode_and_fb(
 
     drmdev_lock(drmdev);
 
-    ok = drmModeSetCrtc(
+    ok = drmdev->backend->set_crtc(
         drmdev->fd,
         drmdev->selected_crtc->crtc->crtc_id,
         fb_id,
@@ -1080,7 +1110,7 @@ int drmdev_legacy_primary_plane_pageflip(
 
     drmdev_lock(drmdev);
 
-    ok = drmModePageFlip(
+    ok = drmdev->backend->page_flip(
         drmdev->fd,
         drmdev->selected_crtc->crtc->crtc_id,
         fb_id,
@@ -1116,7 +1146,7 @@ int drmdev_legacy_overlay_plane_pageflip(
 
     drmdev_lock(drmdev);
 
-    ok = drmModeSetPlane(
+    ok = drmdev->backend->set_plane(
         drmdev->fd,
         plane_id,
         drmdev->selected_crtc->crtc->crtc_id,
@@ -1149,7 +1179,7 @@ int drmdev_legacy_set_connector_property(
     for (int i = 0; i < drmdev->selected_connector->props->count_props; i++) {
         drmModePropertyRes *prop = drmdev->selected_connector->props_info[i];
         if (strcmp(prop->name, name) == 0) {
-            ok = drmModeConnectorSetProperty(
+            ok = drmdev->backend->connector_set_property(
                 drmdev->fd,
                 drmdev->selected_connector->connector->connector_id,
                 prop->prop_id,
@@ -1183,7 +1213,7 @@ int drmdev_legacy_set_crtc_property(
     for (int i = 0; i < drmdev->selected_crtc->props->count_props; i++) {
         drmModePropertyRes *prop = drmdev->selected_crtc->props_info[i];
         if (strcmp(prop->name, name) == 0) {
-            ok = drmModeObjectSetProperty(
+            ok = drmdev->backend->object_set_property(
                 drmdev->fd,
                 drmdev->selected_crtc->crtc->crtc_id,
                 DRM_MODE_OBJECT_CRTC,
@@ -1236,7 +1266,7 @@ int drmdev_legacy_set_plane_property(
         prop = plane->props_info[i];
         
         if (strcmp(prop->name, name) == 0) {
-            ok = drmModeObjectSetProperty(
+            ok = drmdev->backend->object_set_property(
                 drmdev->fd,
                 plane_id,
                 DRM_MODE_OBJECT_PLANE,
@@ -7,6 +7,8 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include <drm_backend.h>
+
 struct drm_connector {
     drmModeConnector *connector;
 	drmModeObjectProperties *props;
@@ -35,6 +37,9 @@ struct drm_plane {
 struct drmdev {
     int fd;
 
+    /// What the libdrm calls go to; libdrm itself unless created with @ref drmdev_new_with_backend.
+    const struct drm_backend *backend;
+
     pthread_mutex_t mutex;
     bool supports_atomic_modesetting;
 
@@ -71,6 +76,16 @@ int drmdev_new_from_fd(
     int fd
 );
 
+/**
+ * @brief Create a drmdev that calls @a backend instead of libdrm, e.g. to run
+ * on a simulated device (see mock_drm.h). @a fd is passed to the backend.
+ */
+int drmdev_new_with_backend(
+    struct drmdev **drmdev_out,
+    int fd,
+    const struct drm_backend *backend
+);
+
 int drmdev_new_from_path(
     struct drmdev **drmdev_out,
     const char *path
@@ -89,6 +104,14 @@ int drmdev_plane_get_type(
     uint32_t plane_id
 );
 
+/**
+ * @brief Find a primary plane that can be used with the selected CRTC.
+ */
+int drmdev_get_primary_plane_id(
+    struct drmdev *drmdev,
+    uint32_t *plane_id_out
+);
+
 int drmdev_plane_supports_setting_rotation_value(
     struct drmdev *drmdev,
     uint32_t plane_id,
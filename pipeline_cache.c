@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <vulkan/vulkan.h>
+
+#include <pipeline_cache.h>
+
+#define PIPELINE_CACHE_FILE_MAGIC 0x43504b56 // "VKPC"
+#define PIPELINE_CACHE_FILE_VERSION 1
+
+/**
+ * @brief Prepended to the data returned by vkGetPipelineCacheData.
+ */
+struct pipeline_cache_file_header {
+    uint32_t magic;
+    uint32_t version;
+
+    /// How long creating the pipelines took when the cache was still empty.
+    uint64_t cold_create_time_ns;
+
+    uint64_t data_size;
+};
+
+struct pipeline_cache {
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+    VkPipelineCache cache;
+
+    /// NULL if we don't know where to persist the cache.
+    char *path;
+
+    bool is_warm;
+    uint64_t cold_create_time_ns;
+    uint64_t create_time_ns;
+    unsigned n_pipelines_created;
+};
+
+static uint64_t get_monotonic_time_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+static char *get_cache_path(const char *app_name) {
+    const char *base, *suffix;
+    char dir[PATH_MAX];
+    char *path;
+    int ok;
+
+    base = getenv("XDG_CACHE_HOME");
+    suffix = "";
+    if (base == NULL || base[0] == '\0') {
+        base = getenv("HOME");
+        suffix = "/.cache";
+        if (base == NULL || base[0] == '\0') {
+            return NULL;
+        }
+    }
+
+    ok = snprintf(dir, sizeof dir, "%s%s", base, suffix);
+    if (ok < 0 || (size_t) ok >= sizeof dir) {
+        return NULL;
+    }
+
+    // $HOME/.cache may not exist yet on a freshly flashed board.
+    ok = mkdir(dir, 0755);
+    if (ok < 0 && errno != EEXIST) {
+        return NULL;
+    }
+
+    ok = snprintf(dir, sizeof dir, "%s%s/%s", base, suffix, app_name);
+    if (ok < 0 || (size_t) ok >= sizeof dir) {
+        return NULL;
+    }
+
+    ok = mkdir(dir, 0755);
+    if (ok < 0 && errno != EEXIST) {
+        return NULL;
+    }
+
+    path = malloc(strlen(dir) + sizeof "/pipeline-cache.bin");
+    if (path == NULL) {
+        return NULL;
+    }
+
+    sprintf(path, "%s/pipeline-cache.bin", dir);
+    return path;
+}
+
+/**
+ * @brief Read the cache file and check it was written for this physical device.
+ * On success, @p data_out will point to the malloc'ed vulkan pipeline cache data.
+ */
+static int read_cache_file(
+    const char *path,
+    VkPhysicalDevice physical_device,
+    void **data_out,
+    size_t *data_size_out,
+    uint64_t *cold_create_time_ns_out
+) {
+    struct pipeline_cache_file_header header;
+    VkPipelineCacheHeaderVersionOne vk_header;
+    VkPhysicalDeviceProperties props;
+    struct stat statbuf;
+    size_t n_read;
+    void *data;
+    FILE *file;
+    int ok;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        return errno;
+    }
+
+    ok = fstat(fileno(file), &statbuf);
+    if (ok < 0) {
+        ok = errno;
+        goto fail_close_file;
+    }
+
+    n_read = fread(&header, 1, sizeof header, file);
+    if (n_read != sizeof header ||
+        header.magic != PIPELINE_CACHE_FILE_MAGIC ||
+        header.version != PIPELINE_CACHE_FILE_VERSION ||
+        header.data_size != (uint64_t) statbuf.st_size - sizeof header ||
+        header.data_size < sizeof vk_header) {
+        ok = EINVAL;
+        goto fail_close_file;
+    }
+
+    data = malloc(header.data_size);
+    if (data == NULL) {
+        ok = ENOMEM;
+        goto fail_close_file;
+    }
+
+    n_read = fread(data, 1, header.data_size, file);
+    if (n_read != header.data_size) {
+        ok = EIO;
+        goto fail_free_data;
+    }
+
+    // The driver is supposed to validate this too, but some (older) drivers
+    // just crash on foreign data, so better check it ourselves.
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+    memcpy(&vk_header, data, sizeof vk_header);
+    if (vk_header.headerSize < sizeof vk_header ||
+        vk_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        vk_header.vendorID != props.vendorID ||
+        vk_header.deviceID != props.deviceID ||
+        memcmp(vk_header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        ok = ESTALE;
+        goto fail_free_data;
+    }
+
+    fclose(file);
+
+    *data_out = data;
+    *data_size_out = header.data_size;
+    *cold_create_time_ns_out = header.cold_create_time_ns;
+    return 0;
+
+
+    fail_free_data:
+    free(data);
+
+    fail_close_file:
+    fclose(file);
+    return ok;
+}
+
+int pipeline_cache_new(
+    struct pipeline_cache **cache_out,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    const char *app_name
+) {
+    struct pipeline_cache *cache;
+    VkPipelineCache vkcache;
+    uint64_t cold_create_time_ns;
+    VkResult vk_ok;
+    size_t data_size;
+    void *data;
+    int ok;
+
+    cache = malloc(sizeof *cache);
+    if (cache == NULL) {
+        return ENOMEM;
+    }
+
+    cache->path = get_cache_path(app_name);
+    if (cache->path == NULL) {
+        fprintf(stderr, "[pipeline cache] Could not determine pipeline cache location, pipeline cache won't be persisted.\n");
+    }
+
+    data = NULL;
+    data_size = 0;
+    cold_create_time_ns = 0;
+    if (cache->path != NULL) {
+        ok = read_cache_file(cache->path, physical_device, &data, &data_size, &cold_create_time_ns);
+        if (ok == ESTALE) {
+            fprintf(stderr, "[pipeline cache] Pipeline cache at \"%s\" was created for a different GPU or driver, ignoring it.\n", cache->path);
+        } else if (ok != 0 && ok != ENOENT) {
+            fprintf(stderr, "[pipeline cache] Could not load pipeline cache from \"%s\", ignoring it. read_cache_file: %s\n", cache->path, strerror(ok));
+        }
+    }
+
+    vk_ok = vkCreatePipelineCache(
+        device,
+        &(const VkPipelineCacheCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+            .flags = 0,
+            .initialDataSize = data_size,
+            .pInitialData = data,
+            .pNext = NULL,
+        },
+        NULL,
+        &vkcache
+    );
+    if (vk_ok != VK_SUCCESS && data != NULL) {
+        // try again without the initial data.
+        free(data);
+        data = NULL;
+        data_size = 0;
+
+        vk_ok = vkCreatePipelineCache(
+            device,
+            &(const VkPipelineCacheCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+                .flags = 0,
+                .initialDataSize = 0,
+                .pInitialData = NULL,
+                .pNext = NULL,
+            },
+            NULL,
+            &vkcache
+        );
+    }
+
+    free(data);
+
+    if (vk_ok != VK_SUCCESS) {
+        fprintf(stderr, "[pipeline cache] Could not create pipeline cache. vkCreatePipelineCache: %d\n", vk_ok);
+        free(cache->path);
+        free(cache);
+        return EINVAL;
+    }
+
+    cache->physical_device = physical_device;
+    cache->device = device;
+    cache->cache = vkcache;
+    cache->is_warm = data_size > 0;
+    cache->cold_create_time_ns = cache->is_warm ? cold_create_time_ns : 0;
+    cache->create_time_ns = 0;
+    cache->n_pipelines_created = 0;
+
+    *cache_out = cache;
+    return 0;
+}
+
+void pipeline_cache_destroy(
+    struct pipeline_cache *cache
+) {
+    vkDestroyPipelineCache(cache->device, cache->cache, NULL);
+    free(cache->path);
+    free(cache);
+}
+
+VkPipelineCache pipeline_cache_get_handle(
+    struct pipeline_cache *cache
+) {
+    return cache->cache;
+}
+
+VkResult pipeline_cache_create_graphics_pipelines(
+    struct pipeline_cache *cache,
+    uint32_t n_create_infos,
+    const VkGraphicsPipelineCreateInfo *create_infos,
+    VkPipeline *pipelines_out
+) {
+    uint64_t start;
+    VkResult ok;
+
+    start = get_monotonic_time_ns();
+
+    ok = vkCreateGraphicsPipelines(cache->device, cache->cache, n_create_infos, create_infos, NULL, pipelines_out);
+    if (ok == VK_SUCCESS) {
+        cache->create_time_ns += get_monotonic_time_ns() - start;
+        cache->n_pipelines_created += n_create_infos;
+    }
+
+    return ok;
+}
+
+void pipeline_cache_report(
+    struct pipeline_cache *cache
+) {
+    if (cache->is_warm && cache->cold_create_time_ns > 0) {
+        fprintf(
+            stderr,
+            "[pipeline cache] Warm start: created %u pipelines in %.2f ms (%.2f ms on cold start, saved %.2f ms).\n",
+            cache->n_pipelines_created,
+            cache->create_time_ns / 1000000.0,
+            cache->cold_create_time_ns / 1000000.0,
+            ((int64_t) cache->cold_create_time_ns - (int64_t) cache->create_time_ns) / 1000000.0
+        );
+    } else {
+        fprintf(
+            stderr,
+            "[pipeline cache] %s start: created %u pipelines in %.2f ms.\n",
+            cache->is_warm ? "Warm" : "Cold",
+            cache->n_pipelines_created,
+            cache->create_time_ns / 1000000.0
+        );
+    }
+}
+
+int pipeline_cache_save(
+    struct pipeline_cache *cache
+) {
+    struct pipeline_cache_file_header header;
+    char tmp_path[PATH_MAX];
+    size_t data_size;
+    VkResult vk_ok;
+    void *data;
+    int ok, fd;
+
+    if (cache->path == NULL || cache->n_pipelines_created == 0) {
+        return 0;
+    }
+
+    vk_ok = vkGetPipelineCacheData(cache->device, cache->cache, &data_size, NULL);
+    if (vk_ok != VK_SUCCESS) {
+        fprintf(stderr, "[pipeline cache] Could not query pipeline cache data size. vkGetPipelineCacheData: %d\n", vk_ok);
+        return EIO;
+    }
+
+    data = malloc(data_size);
+    if (data == NULL) {
+        return ENOMEM;
+    }
+
+    vk_ok = vkGetPipelineCacheData(cache->device, cache->cache, &data_size, data);
+    if (vk_ok != VK_SUCCESS) {
+        fprintf(stderr, "[pipeline cache] Could not get pipeline cache data. vkGetPipelineCacheData: %d\n", vk_ok);
+        free(data);
+        return EIO;
+    }
+
+    header.magic = PIPELINE_CACHE_FILE_MAGIC;
+    header.version = PIPELINE_CACHE_FILE_VERSION;
+    header.cold_create_time_ns = cache->is_warm ? cache->cold_create_time_ns : cache->create_time_ns;
+    header.data_size = data_size;
+
+    ok = snprintf(tmp_path, sizeof tmp_path, "%s.%ld.tmp", cache->path, (long) getpid());
+    if (ok < 0 || (size_t) ok >= sizeof tmp_path) {
+        free(data);
+        return ENAMETOOLONG;
+    }
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ok = errno;
+        perror("[pipeline cache] Could not open temporary pipeline cache file. open");
+        free(data);
+        return ok;
+    }
+
+    errno = 0;
+    if (write(fd, &header, sizeof header) != sizeof header ||
+        write(fd, data, data_size) != (ssize_t) data_size) {
+        ok = errno ? errno : EIO;
+        perror("[pipeline cache] Could not write pipeline cache. write");
+        goto fail_unlink;
+    }
+
+    // make sure the data is on disk before the rename makes it visible,
+    // otherwise a power loss could leave an empty file behind.
+    ok = fsync(fd);
+    if (ok < 0) {
+        ok = errno;
+        perror("[pipeline cache] Could not flush pipeline cache. fsync");
+        goto fail_unlink;
+    }
+
+    close(fd);
+    free(data);
+
+    ok = rename(tmp_path, cache->path);
+    if (ok < 0) {
+        ok = errno;
+        perror("[pipeline cache] Could not replace pipeline cache. rename");
+        unlink(tmp_path);
+        return ok;
+    }
+
+    return 0;
+
+
+    fail_unlink:
+    close(fd);
+    unlink(tmp_path);
+    free(data);
+    return ok;
+}
@@ -0,0 +1,67 @@
+#ifndef _PIPELINE_CACHE_H
+#define _PIPELINE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief A VkPipelineCache that's persisted to disk, so pipelines don't have to be
+ * compiled from scratch on every launch.
+ *
+ * The cache is loaded from `$XDG_CACHE_HOME/<app_name>/pipeline-cache.bin`
+ * (or `$HOME/.cache/<app_name>/...`) and only used if the vendor, device and
+ * pipeline cache UUID in the header match the physical device. Otherwise,
+ * an empty cache is created. If neither environment variable is set, the cache
+ * is only kept in memory.
+ */
+struct pipeline_cache;
+
+int pipeline_cache_new(
+    struct pipeline_cache **cache_out,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    const char *app_name
+);
+
+/**
+ * @brief Destroy the VkPipelineCache. Does not write it to disk, use
+ * @ref pipeline_cache_save for that.
+ */
+void pipeline_cache_destroy(
+    struct pipeline_cache *cache
+);
+
+VkPipelineCache pipeline_cache_get_handle(
+    struct pipeline_cache *cache
+);
+
+/**
+ * @brief Like vkCreateGraphicsPipelines, but using the cache, and keeping track of
+ * how long pipeline creation took so we can tell how much time a warm cache saves.
+ */
+VkResult pipeline_cache_create_graphics_pipelines(
+    struct pipeline_cache *cache,
+    uint32_t n_create_infos,
+    const VkGraphicsPipelineCreateInfo *create_infos,
+    VkPipeline *pipelines_out
+);
+
+/**
+ * @brief Log whether this was a warm or cold start, how long pipeline creation
+ * took and, on a warm start, how much time that saved compared to the cold start.
+ */
+void pipeline_cache_report(
+    struct pipeline_cache *cache
+);
+
+/**
+ * @brief Write the cache to disk. The file is replaced atomically, so a crash
+ * or a concurrent instance can never leave a truncated cache behind.
+ */
+int pipeline_cache_save(
+    struct pipeline_cache *cache
+);
+
+#endif
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+#include <pipeline_variants.h>
+
+struct pipeline_variant {
+    struct pipeline_variant_key key;
+    VkPipeline pipeline;
+};
+
+struct pipeline_variants {
+    pthread_mutex_t mutex;
+
+    VkDevice device;
+    pipeline_variant_create_cb create;
+    void *userdata;
+
+    /// There are only ever a handful of variants, so a linear search is fine.
+    struct pipeline_variant *variants;
+    unsigned n_variants, max_variants;
+
+    uint64_t n_hits, n_misses;
+};
+
+void pipeline_variant_key_set_uint(struct pipeline_variant_key *key, uint32_t constant_id, uint32_t value) {
+    if (constant_id >= PIPELINE_VARIANT_MAX_CONSTANTS) {
+        fprintf(stderr, "[pipeline variants] Specialization constant ID %u is out of range.\n", constant_id);
+        return;
+    }
+
+    key->values[constant_id] = value;
+    if (constant_id >= key->n_constants) {
+        key->n_constants = constant_id + 1;
+    }
+}
+
+void pipeline_variant_key_set_bool(struct pipeline_variant_key *key, uint32_t constant_id, bool value) {
+    // that's what VkBool32 is
+    pipeline_variant_key_set_uint(key, constant_id, value ? VK_TRUE : VK_FALSE);
+}
+
+void pipeline_variant_key_set_float(struct pipeline_variant_key *key, uint32_t constant_id, float value) {
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof bits);
+    pipeline_variant_key_set_uint(key, constant_id, bits);
+}
+
+static bool key_equals(const struct pipeline_variant_key *a, const struct pipeline_variant_key *b) {
+    return a->n_constants == b->n_constants && memcmp(a->values, b->values, a->n_constants * sizeof(uint32_t)) == 0;
+}
+
+int pipeline_variants_new(
+    struct pipeline_variants **variants_out,
+    VkDevice device,
+    pipeline_variant_create_cb create,
+    void *userdata
+) {
+    struct pipeline_variants *variants;
+    int ok;
+
+    variants = malloc(sizeof *variants);
+    if (variants == NULL) {
+        return ENOMEM;
+    }
+
+    ok = pthread_mutex_init(&variants->mutex, NULL);
+    if (ok != 0) {
+        free(variants);
+        return ok;
+    }
+
+    variants->device = device;
+    variants->create = create;
+    variants->userdata = userdata;
+    variants->variants = NULL;
+    variants->n_variants = 0;
+    variants->max_variants = 0;
+    variants->n_hits = 0;
+    variants->n_misses = 0;
+
+    *variants_out = variants;
+    return 0;
+}
+
+void pipeline_variants_destroy(struct pipeline_variants *variants) {
+    for (unsigned i = 0; i < variants->n_variants; i++) {
+        vkDestroyPipeline(variants->device, variants->variants[i].pipeline, NULL);
+    }
+
+    pthread_mutex_destroy(&variants->mutex);
+    free(variants->variants);
+    free(variants);
+}
+
+VkResult pipeline_variants_get(
+    struct pipeline_variants *variants,
+    const struct pipeline_variant_key *key,
+    VkPipeline *pipeline_out
+) {
+    VkSpecializationMapEntry entries[PIPELINE_VARIANT_MAX_CONSTANTS];
+    struct pipeline_variant *new_variants;
+    VkPipeline pipeline;
+    VkResult ok;
+
+    pthread_mutex_lock(&variants->mutex);
+
+    for (unsigned i = 0; i < variants->n_variants; i++) {
+        if (key_equals(&variants->variants[i].key, key)) {
+            variants->n_hits++;
+            *pipeline_out = variants->variants[i].pipeline;
+            pthread_mutex_unlock(&variants->mutex);
+            return VK_SUCCESS;
+        }
+    }
+
+    variants->n_misses++;
+
+    if (variants->n_variants == variants->max_variants) {
+        new_variants = realloc(variants->variants, (variants->max_variants ? 2 * variants->max_variants : 4) * sizeof *new_variants);
+        if (new_variants == NULL) {
+            pthread_mutex_unlock(&variants->mutex);
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+
+        variants->variants = new_variants;
+        variants->max_variants = variants->max_variants ? 2 * variants->max_variants : 4;
+    }
+
+    for (uint32_t i = 0; i < key->n_constants; i++) {
+        entries[i] = (VkSpecializationMapEntry) {
+            .constantID = i,
+            .offset = i * sizeof(uint32_t),
+            .size = sizeof(uint32_t),
+        };
+    }
+
+    // Pipeline creation can take a while, but creating the same variant twice
+    // concurrently would be even worse. So we keep holding the lock.
+    ok = variants->create(
+        variants->userdata,
+        &(const VkSpecializationInfo) {
+            .mapEntryCount = key->n_constants,
+            .pMapEntries = entries,
+            .dataSize = key->n_constants * sizeof(uint32_t),
+            .pData = key->values,
+        },
+        &pipeline
+    );
+    if (ok != VK_SUCCESS) {
+        pthread_mutex_unlock(&variants->mutex);
+        return ok;
+    }
+
+    variants->variants[variants->n_variants].key = *key;
+    variants->variants[variants->n_variants].pipeline = pipeline;
+    variants->n_variants++;
+
+    pthread_mutex_unlock(&variants->mutex);
+
+    *pipeline_out = pipeline;
+    return VK_SUCCESS;
+}
+
+void pipeline_variants_get_stats(struct pipeline_variants *variants, struct pipeline_variants_stats *stats_out) {
+    pthread_mutex_lock(&variants->mutex);
+    stats_out->n_variants = variants->n_variants;
+    stats_out->n_hits = variants->n_hits;
+    stats_out->n_misses = variants->n_misses;
+    pthread_mutex_unlock(&variants->mutex);
+}
@@ -0,0 +1,93 @@
+#ifndef _PIPELINE_VARIANTS_H
+#define _PIPELINE_VARIANTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+#define PIPELINE_VARIANT_MAX_CONSTANTS 16
+
+/**
+ * @brief Specialized variants of one pipeline, created on first use and cached by
+ * the values of their specialization constants.
+ *
+ * Knobs like the light position or feature toggles are specialization constants
+ * in the shaders instead of uniforms, so the driver can fold them into the shader
+ * code (and drop disabled features entirely). One GLSL file can then be used for
+ * all variants.
+ *
+ * The actual pipeline creation is left to a callback, which gets the
+ * VkSpecializationInfo for the variant and should use it for all shader stages.
+ * (Map entries for constants a shader doesn't have are ignored.)
+ *
+ * All functions are thread-safe.
+ */
+struct pipeline_variants;
+
+/**
+ * @brief The values of all specialization constants of a variant.
+ *
+ * Constant ID i has the value values[i]. Every value is 32 bits wide,
+ * like bool, int, uint and float specialization constants are.
+ */
+struct pipeline_variant_key {
+    uint32_t n_constants;
+    uint32_t values[PIPELINE_VARIANT_MAX_CONSTANTS];
+};
+
+typedef VkResult (*pipeline_variant_create_cb)(
+    void *userdata,
+    const VkSpecializationInfo *specialization,
+    VkPipeline *pipeline_out
+);
+
+struct pipeline_variants_stats {
+    unsigned n_variants;
+    uint64_t n_hits;
+    uint64_t n_misses;
+};
+
+static inline void pipeline_variant_key_init(struct pipeline_variant_key *key) {
+    key->n_constants = 0;
+    for (int i = 0; i < PIPELINE_VARIANT_MAX_CONSTANTS; i++) {
+        key->values[i] = 0;
+    }
+}
+
+void pipeline_variant_key_set_uint(struct pipeline_variant_key *key, uint32_t constant_id, uint32_t value);
+
+void pipeline_variant_key_set_bool(struct pipeline_variant_key *key, uint32_t constant_id, bool value);
+
+void pipeline_variant_key_set_float(struct pipeline_variant_key *key, uint32_t constant_id, float value);
+
+int pipeline_variants_new(
+    struct pipeline_variants **variants_out,
+    VkDevice device,
+    pipeline_variant_create_cb create,
+    void *userdata
+);
+
+/**
+ * @brief Destroy all the variants that were created.
+ */
+void pipeline_variants_destroy(
+    struct pipeline_variants *variants
+);
+
+/**
+ * @brief Get the variant for @a key, creating it if it doesn't exist yet.
+ * The pipeline is owned by @a variants and stays valid until it's destroyed.
+ */
+VkResult pipeline_variants_get(
+    struct pipeline_variants *variants,
+    const struct pipeline_variant_key *key,
+    VkPipeline *pipeline_out
+);
+
+void pipeline_variants_get_stats(
+    struct pipeline_variants *variants,
+    struct pipeline_variants_stats *stats_out
+);
+
+#endif
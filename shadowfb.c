@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <shadowfb.h>
+
+#define MAX_DAMAGE_RECTS 8
+
+struct rect {
+    unsigned int x1, y1, x2, y2;
+};
+
+/**
+ * A list of rectangles that don't contain each other. Rectangles that can be
+ * merged without covering more pixels are merged, and if there are too many,
+ * everything is merged into the bounding box.
+ */
+struct damage {
+    int n_rects;
+    struct rect rects[MAX_DAMAGE_RECTS];
+};
+
+struct shadowfb {
+    unsigned int width, height;
+    size_t pitch;
+    uint32_t *mem;
+
+    /// Whether the shadow contains the checkerboard at split_x, split_y.
+    bool valid;
+    unsigned int split_x, split_y;
+
+    /// What changed in the shadow this frame. Rendered by @ref shadowfb_fill_rows.
+    struct damage frame_damage;
+
+    /// What's being copied to the buffer this frame.
+    struct damage copy_damage;
+
+    /// What changed since each buffer of the ring was last filled.
+    int n_buffers;
+    struct damage *buffer_damage;
+};
+
+static bool rect_is_empty(const struct rect *rect) {
+    return rect->x1 >= rect->x2 || rect->y1 >= rect->y2;
+}
+
+static bool rect_contains(const struct rect *a, const struct rect *b) {
+    return a->x1 <= b->x1 && a->y1 <= b->y1 && a->x2 >= b->x2 && a->y2 >= b->y2;
+}
+
+static struct rect rect_union(const struct rect *a, const struct rect *b) {
+    return (struct rect) {
+        .x1 = a->x1 < b->x1 ? a->x1 : b->x1,
+        .y1 = a->y1 < b->y1 ? a->y1 : b->y1,
+        .x2 = a->x2 > b->x2 ? a->x2 : b->x2,
+        .y2 = a->y2 > b->y2 ? a->y2 : b->y2,
+    };
+}
+
+/// Whether the union of @a a and @a b is exactly the pixels of both, i.e. they
+/// have the same columns and touching rows, or the other way around.
+static bool rect_can_merge(const struct rect *a, const struct rect *b) {
+    if (a->x1 == b->x1 && a->x2 == b->x2) {
+        return a->y1 <= b->y2 && b->y1 <= a->y2;
+    }
+    if (a->y1 == b->y1 && a->y2 == b->y2) {
+        return a->x1 <= b->x2 && b->x1 <= a->x2;
+    }
+    return false;
+}
+
+static uint64_t rect_get_area(const struct rect *rect) {
+    return rect_is_empty(rect) ? 0 : (uint64_t) (rect->x2 - rect->x1) * (rect->y2 - rect->y1);
+}
+
+static void damage_clear(struct damage *damage) {
+    damage->n_rects = 0;
+}
+
+static void damage_remove(struct damage *damage, int index) {
+    damage->rects[index] = damage->rects[--damage->n_rects];
+}
+
+static void damage_add_rect(struct damage *damage, struct rect rect) {
+    struct rect extents;
+
+    if (rect_is_empty(&rect)) {
+        return;
+    }
+
+    for (int i = 0; i < damage->n_rects;) {
+        if (rect_contains(damage->rects + i, &rect)) {
+            return;
+        }
+
+        if (rect_contains(&rect, damage->rects + i)) {
+            damage_remove(damage, i);
+        } else if (rect_can_merge(&rect, damage->rects + i)) {
+            // the merged rect might be mergeable with the ones we already looked at.
+            rect = rect_union(&rect, damage->rects + i);
+            damage_remove(damage, i);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (damage->n_rects == MAX_DAMAGE_RECTS) {
+        extents = rect;
+        for (int i = 0; i < damage->n_rects; i++) {
+            extents = rect_union(&extents, damage->rects + i);
+        }
+
+        damage->n_rects = 0;
+        rect = extents;
+    }
+
+    damage->rects[damage->n_rects++] = rect;
+}
+
+static void damage_add(struct damage *damage, const struct damage *other) {
+    for (int i = 0; i < other->n_rects; i++) {
+        damage_add_rect(damage, other->rects[i]);
+    }
+}
+
+/// Upper bound of the damaged pixels, rects may still overlap a bit.
+static uint64_t damage_get_area(const struct damage *damage) {
+    uint64_t area = 0;
+
+    for (int i = 0; i < damage->n_rects; i++) {
+        area += rect_get_area(damage->rects + i);
+    }
+
+    return area;
+}
+
+int shadowfb_new(struct shadowfb **shadow_out, unsigned int width, unsigned int height, int n_buffers) {
+    struct shadowfb *shadow;
+
+    shadow = malloc(sizeof *shadow);
+    if (shadow == NULL) {
+        return ENOMEM;
+    }
+
+    // cache line aligned rows, same as dumb buffers usually have.
+    shadow->pitch = ((size_t) width * 4 + 63) & ~(size_t) 63;
+    shadow->mem = malloc(shadow->pitch * height);
+    shadow->buffer_damage = calloc(n_buffers, sizeof *shadow->buffer_damage);
+    if (shadow->mem == NULL || shadow->buffer_damage == NULL) {
+        free(shadow->buffer_damage);
+        free(shadow->mem);
+        free(shadow);
+        return ENOMEM;
+    }
+
+    shadow->width = width;
+    shadow->height = height;
+    shadow->valid = false;
+    shadow->split_x = 0;
+    shadow->split_y = 0;
+    shadow->n_buffers = n_buffers;
+    damage_clear(&shadow->frame_damage);
+    damage_clear(&shadow->copy_damage);
+
+    // we don't know what the buffers contain yet.
+    for (int i = 0; i < n_buffers; i++) {
+        damage_add_rect(shadow->buffer_damage + i, (struct rect) { 0, 0, width, height });
+    }
+
+    *shadow_out = shadow;
+    return 0;
+}
+
+void shadowfb_destroy(struct shadowfb *shadow) {
+    free(shadow->buffer_damage);
+    free(shadow->mem);
+    free(shadow);
+}
+
+uint64_t shadowfb_begin_fill(struct shadowfb *shadow, int buffer_index, unsigned int split_x, unsigned int split_y) {
+    unsigned int x1, x2, y1, y2;
+
+    if (split_x > shadow->width) {
+        split_x = shadow->width;
+    }
+    if (split_y > shadow->height) {
+        split_y = shadow->height;
+    }
+
+    damage_clear(&shadow->frame_damage);
+
+    if (!shadow->valid) {
+        damage_add_rect(&shadow->frame_damage, (struct rect) { 0, 0, shadow->width, shadow->height });
+        shadow->valid = true;
+    } else {
+        x1 = split_x < shadow->split_x ? split_x : shadow->split_x;
+        x2 = split_x < shadow->split_x ? shadow->split_x : split_x;
+        y1 = split_y < shadow->split_y ? split_y : shadow->split_y;
+        y2 = split_y < shadow->split_y ? shadow->split_y : split_y;
+
+        // the red part changes in the columns between the old and new split,
+        // the blue part in the rows in between. Split the rows around the
+        // columns, so nothing is written twice.
+        damage_add_rect(&shadow->frame_damage, (struct rect) { x1, 0, x2, shadow->height });
+        damage_add_rect(&shadow->frame_damage, (struct rect) { 0, y1, x1, y2 });
+        damage_add_rect(&shadow->frame_damage, (struct rect) { x2, y1, shadow->width, y2 });
+    }
+
+    shadow->split_x = split_x;
+    shadow->split_y = split_y;
+
+    for (int i = 0; i < shadow->n_buffers; i++) {
+        damage_add(shadow->buffer_damage + i, &shadow->frame_damage);
+    }
+
+    shadow->copy_damage = shadow->buffer_damage[buffer_index];
+    damage_clear(shadow->buffer_damage + buffer_index);
+
+    return damage_get_area(&shadow->copy_damage) * 4;
+}
+
+/// Intersect @a rect with the rows [begin, end). Returns false if nothing is left.
+static bool clip_rows(const struct rect *rect, unsigned int begin, unsigned int end, struct rect *out) {
+    *out = (struct rect) {
+        .x1 = rect->x1,
+        .y1 = rect->y1 > begin ? rect->y1 : begin,
+        .x2 = rect->x2,
+        .y2 = rect->y2 < end ? rect->y2 : end,
+    };
+    return !rect_is_empty(out);
+}
+
+void shadowfb_fill_rows(
+    struct shadowfb *shadow,
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t dst_pitch,
+    unsigned int begin,
+    unsigned int end
+) {
+    const struct fill_kernels *store_kernels;
+    const uint8_t *src_row;
+    uint8_t *dst_row;
+    struct rect rect;
+
+    // non-temporal stores would evict the shadow from the cache right before we copy it.
+    store_kernels = fill_get_kernels(FILL_ISA_SCALAR);
+
+    for (int i = 0; i < shadow->frame_damage.n_rects; i++) {
+        if (clip_rows(shadow->frame_damage.rects + i, begin, end, &rect)) {
+            fill_checkerboard_rect(store_kernels, shadow->mem, shadow->pitch, rect.x1, rect.x2, rect.y1, rect.y2, shadow->split_x, shadow->split_y);
+        }
+    }
+
+    for (int i = 0; i < shadow->copy_damage.n_rects; i++) {
+        if (!clip_rows(shadow->copy_damage.rects + i, begin, end, &rect)) {
+            continue;
+        }
+
+        for (unsigned int y = rect.y1; y < rect.y2; y++) {
+            src_row = (const uint8_t *) shadow->mem + y * shadow->pitch;
+            dst_row = (uint8_t *) dst + y * dst_pitch;
+
+            kernels->copy((uint32_t *) dst_row + rect.x1, (const uint32_t *) src_row + rect.x1, rect.x2 - rect.x1);
+        }
+    }
+
+    kernels->finish();
+}
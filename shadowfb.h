@@ -0,0 +1,68 @@
+#ifndef _SHADOWFB_H
+#define _SHADOWFB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fill.h>
+
+/**
+ * @brief A cached copy of the checkerboard, for rendering into dumb buffers
+ * without rewriting all of their pixels every frame.
+ *
+ * The checkerboard is rendered into ordinary malloc'd memory, where writing
+ * (and reading) is cheap, and only the parts that changed since a dumb buffer
+ * was last filled are copied out to it.
+ *
+ * Since dumb buffers are used round-robin, what's damaged is tracked per
+ * buffer: the damage of every frame is added to all buffers of the ring, and
+ * a buffer's damage is cleared when it's filled.
+ *
+ * Not thread-safe, except for @ref shadowfb_fill_rows which can be called for
+ * disjoint rows from multiple threads.
+ */
+struct shadowfb;
+
+int shadowfb_new(
+    struct shadowfb **shadow_out,
+    unsigned int width,
+    unsigned int height,
+    int n_buffers
+);
+
+void shadowfb_destroy(
+    struct shadowfb *shadow
+);
+
+/**
+ * @brief Start filling buffer @a buffer_index of the ring with the checkerboard
+ * at the new split.
+ *
+ * The rows of the buffer then need to be filled using @ref shadowfb_fill_rows
+ * before the next call to this function.
+ *
+ * @returns the number of bytes that'll be written to the buffer.
+ */
+uint64_t shadowfb_begin_fill(
+    struct shadowfb *shadow,
+    int buffer_index,
+    unsigned int split_x,
+    unsigned int split_y
+);
+
+/**
+ * @brief Render what changed in rows [@a begin, @a end) into the shadow and copy
+ * what's damaged in the buffer from the shadow to @a dst, using the
+ * non-temporal stores of @a kernels.
+ */
+void shadowfb_fill_rows(
+    struct shadowfb *shadow,
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t dst_pitch,
+    unsigned int begin,
+    unsigned int end
+);
+
+#endif
@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <esUtil.h>
+#include <softcube.h>
+
+/*
+ * 4-wide float & int vectors. GCC and clang compile these to SSE on x86 and
+ * NEON on ARM, without us having to write the intrinsics for both.
+ */
+typedef float vec4f __attribute__((vector_size(16)));
+typedef int32_t vec4i __attribute__((vector_size(16)));
+typedef uint32_t vec4u __attribute__((vector_size(16)));
+
+#define N_VERTICES (4 * 6)
+#define N_TRIANGLES (2 * 6)
+#define GAMMA_LUT_SIZE 1024
+
+#define BLACK 0xff000000u
+
+/// Same as struct cube_vertex in vulkan2.c.
+struct softcube_vertex {
+    float position[3];
+    uint8_t color[4];
+    int8_t normal[4];
+};
+
+// clang-format off
+/// The same mesh as in vulkan2.c. Every face is a triangle strip of 4 vertices.
+static const struct softcube_vertex vertices[N_VERTICES] = {
+    // front
+    { { -1.0f, -1.0f, +1.0f }, {   0,   0, 255, 255 }, {    0,    0, +127, 0 } }, // blue
+    { { +1.0f, -1.0f, +1.0f }, { 255,   0, 255, 255 }, {    0,    0, +127, 0 } }, // magenta
+    { { -1.0f, +1.0f, +1.0f }, {   0, 255, 255, 255 }, {    0,    0, +127, 0 } }, // cyan
+    { { +1.0f, +1.0f, +1.0f }, { 255, 255, 255, 255 }, {    0,    0, +127, 0 } }, // white
+    // back
+    { { +1.0f, -1.0f, -1.0f }, { 255,   0,   0, 255 }, {    0,    0, -127, 0 } }, // red
+    { { -1.0f, -1.0f, -1.0f }, {   0,   0,   0, 255 }, {    0,    0, -127, 0 } }, // black
+    { { +1.0f, +1.0f, -1.0f }, { 255, 255,   0, 255 }, {    0,    0, -127, 0 } }, // yellow
+    { { -1.0f, +1.0f, -1.0f }, {   0, 255,   0, 255 }, {    0,    0, -127, 0 } }, // green
+    // right
+    { { +1.0f, -1.0f, +1.0f }, { 255,   0, 255, 255 }, { +127,    0,    0, 0 } }, // magenta
+    { { +1.0f, -1.0f, -1.0f }, { 255,   0,   0, 255 }, { +127,    0,    0, 0 } }, // red
+    { { +1.0f, +1.0f, +1.0f }, { 255, 255, 255, 255 }, { +127,    0,    0, 0 } }, // white
+    { { +1.0f, +1.0f, -1.0f }, { 255, 255,   0, 255 }, { +127,    0,    0, 0 } }, // yellow
+    // left
+    { { -1.0f, -1.0f, -1.0f }, {   0,   0,   0, 255 }, { -127,    0,    0, 0 } }, // black
+    { { -1.0f, -1.0f, +1.0f }, {   0,   0, 255, 255 }, { -127,    0,    0, 0 } }, // blue
+    { { -1.0f, +1.0f, -1.0f }, {   0, 255,   0, 255 }, { -127,    0,    0, 0 } }, // green
+    { { -1.0f, +1.0f, +1.0f }, {   0, 255, 255, 255 }, { -127,    0,    0, 0 } }, // cyan
+    // top
+    { { -1.0f, +1.0f, +1.0f }, {   0, 255, 255, 255 }, {    0, +127,    0, 0 } }, // cyan
+    { { +1.0f, +1.0f, +1.0f }, { 255, 255, 255, 255 }, {    0, +127,    0, 0 } }, // white
+    { { -1.0f, +1.0f, -1.0f }, {   0, 255,   0, 255 }, {    0, +127,    0, 0 } }, // green
+    { { +1.0f, +1.0f, -1.0f }, { 255, 255,   0, 255 }, {    0, +127,    0, 0 } }, // yellow
+    // bottom
+    { { -1.0f, -1.0f, -1.0f }, {   0,   0,   0, 255 }, {    0, -127,    0, 0 } }, // black
+    { { +1.0f, -1.0f, -1.0f }, { 255,   0,   0, 255 }, {    0, -127,    0, 0 } }, // red
+    { { -1.0f, -1.0f, +1.0f }, {   0,   0, 255, 255 }, {    0, -127,    0, 0 } }, // blue
+    { { +1.0f, -1.0f, +1.0f }, { 255,   0, 255, 255 }, {    0, -127,    0, 0 } }, // magenta
+};
+// clang-format on
+
+/// A vertex after the vertex shader, in framebuffer coordinates.
+struct screen_vertex {
+    float x, y;
+
+    /// 1/w, and the color divided by w, for perspective-correct interpolation.
+    float inv_w;
+    float color[3];
+};
+
+/**
+ * A triangle that passed culling, set up for rasterization. The barycentric
+ * coordinate of vertex k at pixel center (x, y) is edge_a[k] * x + edge_b[k] * y + edge_c[k],
+ * and the pixel is covered if all three are >= 0.
+ */
+struct triangle {
+    float edge_a[3], edge_b[3], edge_c[3];
+    float inv_w[3];
+    float color[3][3];
+
+    /// Bounding box in pixels, inclusive.
+    int min_x, min_y, max_x, max_y;
+};
+
+struct tile_bin {
+    int n_triangles;
+    uint8_t triangles[N_TRIANGLES];
+};
+
+struct softcube {
+    unsigned int width, height;
+    unsigned int n_tiles_x, n_tiles_y;
+
+    struct softcube_shading shading;
+    uint8_t gamma_lut[GAMMA_LUT_SIZE];
+
+    bool has_start_time;
+    uint64_t start_time_ms;
+
+    int n_triangles;
+    struct triangle triangles[N_TRIANGLES];
+    struct tile_bin *bins;
+};
+
+int softcube_new(struct softcube **cube_out, unsigned int width, unsigned int height, const struct softcube_shading *shading) {
+    struct softcube *cube;
+
+    if (width == 0 || height == 0) {
+        return EINVAL;
+    }
+
+    cube = malloc(sizeof *cube);
+    if (cube == NULL) {
+        return ENOMEM;
+    }
+
+    cube->width = width;
+    cube->height = height;
+    cube->n_tiles_x = (width + SOFTCUBE_TILE_SIZE - 1) / SOFTCUBE_TILE_SIZE;
+    cube->n_tiles_y = (height + SOFTCUBE_TILE_SIZE - 1) / SOFTCUBE_TILE_SIZE;
+    cube->shading = *shading;
+    cube->has_start_time = false;
+    cube->n_triangles = 0;
+
+    cube->bins = calloc(cube->n_tiles_x * cube->n_tiles_y, sizeof *cube->bins);
+    if (cube->bins == NULL) {
+        free(cube);
+        return ENOMEM;
+    }
+
+    for (int i = 0; i < GAMMA_LUT_SIZE; i++) {
+        cube->gamma_lut[i] = (uint8_t) (powf(i / (float) (GAMMA_LUT_SIZE - 1), shading->gamma) * 255.0f + 0.5f);
+    }
+
+    *cube_out = cube;
+    return 0;
+}
+
+void softcube_destroy(struct softcube *cube) {
+    free(cube->bins);
+    free(cube);
+}
+
+unsigned int softcube_get_n_tiles(struct softcube *cube) {
+    return cube->n_tiles_x * cube->n_tiles_y;
+}
+
+/// GLSL-style `matrix * vector`, ESMatrix is column-major.
+static void transform(const ESMatrix *matrix, const float in[4], float out[4]) {
+    for (int row = 0; row < 4; row++) {
+        out[row] = matrix->m[0][row] * in[0] + matrix->m[1][row] * in[1] + matrix->m[2][row] * in[2] + matrix->m[3][row] * in[3];
+    }
+}
+
+/// What vkcube.vert does, plus the perspective divide and viewport transform.
+static bool shade_vertex(
+    struct softcube *cube,
+    const ESMatrix *modelview,
+    const ESMatrix *modelviewprojection,
+    const struct softcube_vertex *vertex,
+    struct screen_vertex *out
+) {
+    float position[4], clip[4], eye[4], normal[3], light_dir[3];
+    float length, diffuse;
+
+    position[0] = vertex->position[0];
+    position[1] = vertex->position[1];
+    position[2] = vertex->position[2];
+    position[3] = 1.0f;
+
+    transform(modelviewprojection, position, clip);
+    if (clip[3] <= 1e-6f) {
+        return false;
+    }
+
+    diffuse = 1.0f;
+    if (cube->shading.lighting) {
+        // the normal matrix is the upper 3x3 of the modelview matrix.
+        for (int row = 0; row < 3; row++) {
+            normal[row] = (modelview->m[0][row] * vertex->normal[0] + modelview->m[1][row] * vertex->normal[1] + modelview->m[2][row] * vertex->normal[2]) / 127.0f;
+        }
+
+        transform(modelview, position, eye);
+
+        length = 0.0f;
+        for (int i = 0; i < 3; i++) {
+            light_dir[i] = cube->shading.light[i] - eye[i] / eye[3];
+            length += light_dir[i] * light_dir[i];
+        }
+        length = sqrtf(length);
+
+        diffuse = (normal[0] * light_dir[0] + normal[1] * light_dir[1] + normal[2] * light_dir[2]) / length;
+        if (diffuse < 0.0f) {
+            diffuse = 0.0f;
+        }
+    }
+
+    out->inv_w = 1.0f / clip[3];
+    out->x = (clip[0] * out->inv_w + 1.0f) * 0.5f * cube->width;
+    out->y = (clip[1] * out->inv_w + 1.0f) * 0.5f * cube->height;
+
+    for (int i = 0; i < 3; i++) {
+        out->color[i] = diffuse * vertex->color[i] / 255.0f * out->inv_w;
+    }
+
+    return true;
+}
+
+/// Cull & set up a triangle. Returns false if it's not visible.
+static bool setup_triangle(struct softcube *cube, const struct screen_vertex *v[3], struct triangle *tri) {
+    float area, a, b, c, at_k;
+    int i, j;
+
+    // the signed area as defined by the vulkan spec. The pipeline uses
+    // VK_FRONT_FACE_CLOCKWISE and VK_CULL_MODE_BACK_BIT, so only triangles
+    // with a negative area are drawn.
+    area = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        i = k;
+        j = (k + 1) % 3;
+        area += v[i]->x * v[j]->y - v[j]->x * v[i]->y;
+    }
+    area *= -0.5f;
+
+    if (!(area < 0.0f)) {
+        return false;
+    }
+
+    // edge function opposite of vertex k, normalized so it's 1 at vertex k.
+    for (int k = 0; k < 3; k++) {
+        i = (k + 1) % 3;
+        j = (k + 2) % 3;
+
+        a = v[i]->y - v[j]->y;
+        b = v[j]->x - v[i]->x;
+        c = -(a * v[i]->x + b * v[i]->y);
+        at_k = a * v[k]->x + b * v[k]->y + c;
+
+        tri->edge_a[k] = a / at_k;
+        tri->edge_b[k] = b / at_k;
+        tri->edge_c[k] = c / at_k;
+
+        tri->inv_w[k] = v[k]->inv_w;
+        memcpy(tri->color[k], v[k]->color, sizeof tri->color[k]);
+    }
+
+    tri->min_x = (int) floorf(fminf(v[0]->x, fminf(v[1]->x, v[2]->x)));
+    tri->min_y = (int) floorf(fminf(v[0]->y, fminf(v[1]->y, v[2]->y)));
+    tri->max_x = (int) ceilf(fmaxf(v[0]->x, fmaxf(v[1]->x, v[2]->x)));
+    tri->max_y = (int) ceilf(fmaxf(v[0]->y, fmaxf(v[1]->y, v[2]->y)));
+
+    if (tri->min_x < 0) tri->min_x = 0;
+    if (tri->min_y < 0) tri->min_y = 0;
+    if (tri->max_x > (int) cube->width - 1) tri->max_x = cube->width - 1;
+    if (tri->max_y > (int) cube->height - 1) tri->max_y = cube->height - 1;
+
+    return tri->min_x <= tri->max_x && tri->min_y <= tri->max_y;
+}
+
+void softcube_begin_frame(struct softcube *cube, uint64_t time_ms) {
+    struct screen_vertex screen[N_VERTICES];
+    bool visible[N_VERTICES];
+    const struct screen_vertex *tri_vertices[3];
+    ESMatrix modelview, projection, modelviewprojection;
+    struct triangle *tri;
+    float aspect_ratio;
+    uint64_t t;
+    int first;
+
+    if (!cube->has_start_time) {
+        cube->start_time_ms = time_ms;
+        cube->has_start_time = true;
+    }
+
+    // same as cube_gpu_buffer_update_transforms in vulkan2.c
+    t = (time_ms - cube->start_time_ms) / 5;
+    aspect_ratio = cube->height / (float) cube->width;
+
+    esMatrixLoadIdentity(&modelview);
+    esTranslate(&modelview, 0.0f, 0.0f, -8.0f);
+    esRotate(&modelview, 45.0f + (0.25f * t), 1.0f, 0.0f, 0.0f);
+    esRotate(&modelview, 45.0f - (0.5f * t), 0.0f, 1.0f, 0.0f);
+    esRotate(&modelview, 10.0f + (0.15f * t), 0.0f, 0.0f, 1.0f);
+
+    esMatrixLoadIdentity(&projection);
+    esFrustum(&projection, -2.8f, +2.8f, -2.8f * aspect_ratio, +2.8f * aspect_ratio, 6.0f, 10.0f);
+
+    esMatrixLoadIdentity(&modelviewprojection);
+    esMatrixMultiply(&modelviewprojection, &modelview, &projection);
+
+    for (int i = 0; i < N_VERTICES; i++) {
+        visible[i] = shade_vertex(cube, &modelview, &modelviewprojection, vertices + i, screen + i);
+    }
+
+    // two triangles per strip; the second one has its first two vertices
+    // swapped, so both have the same winding.
+    cube->n_triangles = 0;
+    for (int face = 0; face < 6; face++) {
+        first = face * 4;
+
+        for (int k = 0; k < 2; k++) {
+            if (k == 0) {
+                tri_vertices[0] = screen + first + 0;
+                tri_vertices[1] = screen + first + 1;
+                tri_vertices[2] = screen + first + 2;
+            } else {
+                tri_vertices[0] = screen + first + 2;
+                tri_vertices[1] = screen + first + 1;
+                tri_vertices[2] = screen + first + 3;
+            }
+
+            if (!visible[first + k] || !visible[first + k + 1] || !visible[first + k + 2]) {
+                continue;
+            }
+
+            tri = cube->triangles + cube->n_triangles;
+            if (setup_triangle(cube, tri_vertices, tri)) {
+                cube->n_triangles++;
+            }
+        }
+    }
+
+    // bin the triangles into all tiles their bounding box touches.
+    memset(cube->bins, 0, cube->n_tiles_x * cube->n_tiles_y * sizeof *cube->bins);
+    for (int i = 0; i < cube->n_triangles; i++) {
+        tri = cube->triangles + i;
+
+        for (int ty = tri->min_y / SOFTCUBE_TILE_SIZE; ty <= tri->max_y / SOFTCUBE_TILE_SIZE; ty++) {
+            for (int tx = tri->min_x / SOFTCUBE_TILE_SIZE; tx <= tri->max_x / SOFTCUBE_TILE_SIZE; tx++) {
+                struct tile_bin *bin = cube->bins + ty * cube->n_tiles_x + tx;
+                bin->triangles[bin->n_triangles++] = i;
+            }
+        }
+    }
+}
+
+static vec4i to_int(vec4f v) {
+    return __builtin_convertvector(v, vec4i);
+}
+
+/// Clamp to [0, 1]. NaNs (from lanes outside the triangle) become 0.
+static vec4f clamp_unorm(vec4f v) {
+    const vec4f one = { 1.0f, 1.0f, 1.0f, 1.0f };
+    vec4i mask;
+
+    mask = v > 0.0f;
+    v = (vec4f) ((vec4i) v & mask);
+
+    mask = v < 1.0f;
+    return (vec4f) (((vec4i) v & mask) | ((vec4i) one & ~mask));
+}
+
+/// Rasterize the part of @a tri inside the tile at @a tile_x, @a tile_y into @a pixels.
+static void rasterize(
+    struct softcube *cube,
+    const struct triangle *tri,
+    int tile_x,
+    int tile_y,
+    int tile_width,
+    int tile_height,
+    uint32_t *pixels
+) {
+    const vec4f lane_offsets = { 0.5f, 1.5f, 2.5f, 3.5f };
+    vec4f l0, l1, l2, inv_w, w, px, py, channel[3];
+    vec4i inside, quantized[3];
+    vec4u color, *dst;
+    int x_begin, x_end, y_begin, y_end;
+    bool gamma;
+
+    // the tile-relative part of the bounding box, in groups of 4 pixels.
+    x_begin = (tri->min_x > tile_x ? tri->min_x - tile_x : 0) & ~3;
+    x_end = tri->max_x - tile_x + 1 < tile_width ? tri->max_x - tile_x + 1 : tile_width;
+    y_begin = tri->min_y > tile_y ? tri->min_y - tile_y : 0;
+    y_end = tri->max_y - tile_y + 1 < tile_height ? tri->max_y - tile_y + 1 : tile_height;
+
+    gamma = cube->shading.gamma != 1.0f;
+
+    for (int y = y_begin; y < y_end; y++) {
+        py = (vec4f) { 0.5f, 0.5f, 0.5f, 0.5f } + (float) (tile_y + y);
+
+        for (int x = x_begin; x < x_end; x += 4) {
+            px = lane_offsets + (float) (tile_x + x);
+
+            l0 = tri->edge_a[0] * px + tri->edge_b[0] * py + tri->edge_c[0];
+            l1 = tri->edge_a[1] * px + tri->edge_b[1] * py + tri->edge_c[1];
+            l2 = tri->edge_a[2] * px + tri->edge_b[2] * py + tri->edge_c[2];
+
+            inside = (l0 >= 0.0f) & (l1 >= 0.0f) & (l2 >= 0.0f);
+            if (!(inside[0] | inside[1] | inside[2] | inside[3])) {
+                continue;
+            }
+
+            inv_w = l0 * tri->inv_w[0] + l1 * tri->inv_w[1] + l2 * tri->inv_w[2];
+            w = 1.0f / inv_w;
+
+            for (int c = 0; c < 3; c++) {
+                channel[c] = clamp_unorm((l0 * tri->color[0][c] + l1 * tri->color[1][c] + l2 * tri->color[2][c]) * w);
+
+                if (gamma) {
+                    quantized[c] = to_int(channel[c] * (float) (GAMMA_LUT_SIZE - 1) + 0.5f);
+                    for (int lane = 0; lane < 4; lane++) {
+                        quantized[c][lane] = cube->gamma_lut[quantized[c][lane]];
+                    }
+                } else {
+                    quantized[c] = to_int(channel[c] * 255.0f + 0.5f);
+                }
+            }
+
+            color = BLACK | (vec4u) (quantized[0] << 16) | (vec4u) (quantized[1] << 8) | (vec4u) quantized[2];
+
+            dst = (vec4u *) (pixels + y * SOFTCUBE_TILE_SIZE + x);
+            *dst = (color & (vec4u) inside) | (*dst & ~(vec4u) inside);
+        }
+    }
+}
+
+void softcube_render_tiles(
+    struct softcube *cube,
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t dst_pitch,
+    unsigned int begin,
+    unsigned int end
+) {
+    uint32_t pixels[SOFTCUBE_TILE_SIZE * SOFTCUBE_TILE_SIZE] __attribute__((aligned(64)));
+    const struct tile_bin *bin;
+    unsigned int tile_x, tile_y, tile_width, tile_height;
+    uint32_t *row;
+
+    for (unsigned int tile = begin; tile < end; tile++) {
+        bin = cube->bins + tile;
+
+        tile_x = (tile % cube->n_tiles_x) * SOFTCUBE_TILE_SIZE;
+        tile_y = (tile / cube->n_tiles_x) * SOFTCUBE_TILE_SIZE;
+        tile_width = cube->width - tile_x < SOFTCUBE_TILE_SIZE ? cube->width - tile_x : SOFTCUBE_TILE_SIZE;
+        tile_height = cube->height - tile_y < SOFTCUBE_TILE_SIZE ? cube->height - tile_y : SOFTCUBE_TILE_SIZE;
+
+        if (bin->n_triangles == 0) {
+            for (unsigned int y = 0; y < tile_height; y++) {
+                row = (uint32_t *) ((uint8_t *) dst + (tile_y + y) * dst_pitch);
+                kernels->fill(row + tile_x, BLACK, tile_width);
+            }
+            continue;
+        }
+
+        for (unsigned int i = 0; i < SOFTCUBE_TILE_SIZE * SOFTCUBE_TILE_SIZE; i++) {
+            pixels[i] = BLACK;
+        }
+
+        // there's no depth test (same as the vulkan pipeline), back-face
+        // culling is enough for a convex mesh.
+        for (int i = 0; i < bin->n_triangles; i++) {
+            rasterize(cube, cube->triangles + bin->triangles[i], tile_x, tile_y, tile_width, tile_height, pixels);
+        }
+
+        for (unsigned int y = 0; y < tile_height; y++) {
+            row = (uint32_t *) ((uint8_t *) dst + (tile_y + y) * dst_pitch);
+            kernels->copy(row + tile_x, pixels + y * SOFTCUBE_TILE_SIZE, tile_width);
+        }
+    }
+
+    kernels->finish();
+}
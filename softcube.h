@@ -0,0 +1,86 @@
+#ifndef _SOFTCUBE_H
+#define _SOFTCUBE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fill.h>
+
+/**
+ * @brief A CPU rasterizer for the cube scene of vulkan2.c, for machines
+ * without a usable vulkan driver.
+ *
+ * Draws the same mesh with the same esTransform.c matrices and the same
+ * shading as vkcube.vert / vkcube.frag (per-vertex diffuse lighting,
+ * perspective-correct color interpolation, back-face culling, optional gamma),
+ * into an XRGB8888 buffer.
+ *
+ * The buffer is split into tiles of SOFTCUBE_TILE_SIZE x SOFTCUBE_TILE_SIZE
+ * pixels. @ref softcube_begin_frame transforms the vertices and bins the
+ * triangles into the tiles they touch, then the tiles can be rendered by
+ * multiple threads with @ref softcube_render_tiles. Tiles are rasterized into
+ * a cached tile buffer, evaluating the edge functions for 4 pixels at once,
+ * and then copied out a row at a time with the non-temporal stores of the
+ * fill kernels, so it works well for write-combined dumb buffers too.
+ *
+ * There's no near-plane clipping; triangles with a vertex behind the camera
+ * are skipped. The cube never gets close to the near plane.
+ */
+struct softcube;
+
+#define SOFTCUBE_TILE_SIZE 64
+
+struct softcube_shading {
+    /// Light position in eye space.
+    float light[3];
+
+    /// Whether to apply diffuse lighting at all.
+    bool lighting;
+
+    /// Output colors are raised to this power.
+    float gamma;
+};
+
+#define SOFTCUBE_SHADING_DEFAULT ((struct softcube_shading) { .light = { 2.0f, 2.0f, 20.0f }, .lighting = true, .gamma = 1.0f })
+
+int softcube_new(
+    struct softcube **cube_out,
+    unsigned int width,
+    unsigned int height,
+    const struct softcube_shading *shading
+);
+
+void softcube_destroy(
+    struct softcube *cube
+);
+
+unsigned int softcube_get_n_tiles(
+    struct softcube *cube
+);
+
+/**
+ * @brief Transform, cull and bin the cube for time @a time_ms. The cube
+ * rotates at the same speed as the vulkan one.
+ */
+void softcube_begin_frame(
+    struct softcube *cube,
+    uint64_t time_ms
+);
+
+/**
+ * @brief Render the tiles [@a begin, @a end) into @a dst, clearing
+ * everything the cube doesn't cover to black.
+ *
+ * Can be called from multiple threads for disjoint ranges of tiles.
+ */
+void softcube_render_tiles(
+    struct softcube *cube,
+    const struct fill_kernels *kernels,
+    void *dst,
+    size_t dst_pitch,
+    unsigned int begin,
+    unsigned int end
+);
+
+#endif
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <fill.h>
+#include <workpool.h>
+#include <softcube.h>
+#include <benchmark.h>
+
+/// One frame every 16ms, like a 60Hz display.
+#define FRAME_INTERVAL_MS 16
+
+/// Tiles handed out to a worker at once.
+#define TILES_PER_CHUNK 4
+
+struct softcube_bench {
+    size_t pitch;
+    unsigned int width, height;
+    void *mem;
+
+    struct softcube *cube;
+    const struct fill_kernels *kernels;
+};
+
+static uint64_t get_monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t get_process_cpu_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void render_tiles(void *userdata, unsigned int begin, unsigned int end) {
+    struct softcube_bench *bench = userdata;
+
+    softcube_render_tiles(bench->cube, bench->kernels, bench->mem, bench->pitch, begin, end);
+}
+
+static void render_frame(struct softcube_bench *bench, struct workpool *pool, uint64_t time_ms) {
+    softcube_begin_frame(bench->cube, time_ms);
+
+    if (pool != NULL) {
+        workpool_submit(pool, render_tiles, bench, softcube_get_n_tiles(bench->cube), TILES_PER_CHUNK);
+        workpool_wait(pool);
+    } else {
+        render_tiles(bench, 0, softcube_get_n_tiles(bench->cube));
+    }
+}
+
+/// Render @a n_frames frames of the animation and return the frames per second.
+/// The CPU time (of all threads) per frame is written to @a cpu_ms_out.
+static double run(struct softcube_bench *bench, struct workpool *pool, int n_frames, double *cpu_ms_out) {
+    uint64_t start, duration, cpu_start;
+
+    start = get_monotonic_ns();
+    cpu_start = get_process_cpu_ns();
+
+    for (int frame = 0; frame < n_frames; frame++) {
+        render_frame(bench, pool, (uint64_t) frame * FRAME_INTERVAL_MS);
+    }
+
+    duration = get_monotonic_ns() - start;
+
+    *cpu_ms_out = (get_process_cpu_ns() - cpu_start) / 1e6 / n_frames;
+    return n_frames / (duration / 1e9);
+}
+
+/**
+ * Check the tiled & threaded rendering gives the same pixels as rendering the
+ * whole buffer at once on a single thread with the scalar kernels, and that
+ * the cube is actually there.
+ */
+static bool verify(struct softcube_bench *bench, struct workpool *pool, void *expected) {
+    const struct fill_kernels *kernels = bench->kernels;
+    uint32_t center;
+    bool ok = true;
+
+    for (int frame = 0; frame < 2 * 240 && ok; frame += 37) {
+        bench->kernels = fill_get_kernels(FILL_ISA_SCALAR);
+        render_frame(bench, NULL, (uint64_t) frame * FRAME_INTERVAL_MS);
+        memcpy(expected, bench->mem, bench->pitch * bench->height);
+
+        bench->kernels = kernels;
+        render_frame(bench, pool, (uint64_t) frame * FRAME_INTERVAL_MS);
+
+        center = ((uint32_t *) ((uint8_t *) bench->mem + bench->height / 2 * bench->pitch))[bench->width / 2];
+        ok = memcmp(expected, bench->mem, bench->pitch * bench->height) == 0 && center != 0xff000000;
+    }
+
+    return ok;
+}
+
+static int dump_ppm(const struct softcube_bench *bench, const char *path) {
+    const uint32_t *row;
+    FILE *file;
+
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "[softcube-bench] Couldn't open \"%s\".\n", path);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", bench->width, bench->height);
+    for (unsigned int y = 0; y < bench->height; y++) {
+        row = (const uint32_t *) ((const uint8_t *) bench->mem + y * bench->pitch);
+        for (unsigned int x = 0; x < bench->width; x++) {
+            fputc((row[x] >> 16) & 0xff, file);
+            fputc((row[x] >> 8) & 0xff, file);
+            fputc(row[x] & 0xff, file);
+        }
+    }
+
+    fclose(file);
+    return EXIT_SUCCESS;
+}
+
+static void print_usage(const char *argv0) {
+    printf(
+        "usage: %s [options]\n"
+        "\n"
+        "Measures how fast the cube scene can be rendered on the CPU, into a buffer\n"
+        "the size of a dumb buffer, on a single thread and with the tiles spread over\n"
+        "worker threads.\n"
+        "\n"
+        "  --size=WIDTHxHEIGHT        Buffer size. (default: 1920x1080)\n"
+        "  --threads=N                Number of worker threads for the threaded run,\n"
+        "                             0 for one per CPU. (default: 0)\n"
+        "  --frames=N                 Number of frames to render per run. (default: 240)\n"
+        "  --no-lighting              Don't apply the diffuse lighting.\n"
+        "  --gamma=GAMMA              Raise the output colors to this power. (default: 1)\n"
+        "  --dump=FILE                Write the last frame as a PPM image to FILE.\n"
+        "  --benchmark=FILE           Write the results as JSON to FILE\n"
+        "                             (or stdout if FILE is \"-\").\n"
+        "  --baseline=FILE            Compare against the JSON written by an earlier\n"
+        "                             --benchmark run and fail if anything regressed.\n"
+        "  --tolerance=PERCENT        How much worse than the baseline is still ok. (default: 10)\n"
+        "  --help                     Show this help.\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    struct softcube_shading shading;
+    struct benchmark_report report;
+    struct softcube_bench bench;
+    struct workpool *pool;
+    const char *benchmark_path, *baseline_path, *dump_path;
+    double tolerance, fps, threaded_fps, cpu_ms;
+    void *expected;
+    int opt, n_frames, n_threads, n_regressions, ok;
+
+    static const struct option long_options[] = {
+        { "size", required_argument, NULL, 's' },
+        { "threads", required_argument, NULL, 'j' },
+        { "frames", required_argument, NULL, 'n' },
+        { "no-lighting", no_argument, NULL, 'L' },
+        { "gamma", required_argument, NULL, 'g' },
+        { "dump", required_argument, NULL, 'd' },
+        { "benchmark", required_argument, NULL, 'b' },
+        { "baseline", required_argument, NULL, 'B' },
+        { "tolerance", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    bench.width = 1920;
+    bench.height = 1080;
+    shading = SOFTCUBE_SHADING_DEFAULT;
+    n_threads = 0;
+    n_frames = 240;
+    benchmark_path = NULL;
+    baseline_path = NULL;
+    dump_path = NULL;
+    tolerance = 10.0;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%ux%u", &bench.width, &bench.height) != 2 || bench.width == 0 || bench.height == 0) {
+                    fprintf(stderr, "[softcube-bench] Invalid size \"%s\", expected WIDTHxHEIGHT.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                n_threads = atoi(optarg);
+                if (n_threads < 0) {
+                    fprintf(stderr, "[softcube-bench] Invalid number of threads \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                n_frames = atoi(optarg);
+                if (n_frames <= 0) {
+                    fprintf(stderr, "[softcube-bench] Invalid number of frames \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'L':
+                shading.lighting = false;
+                break;
+            case 'g':
+                shading.gamma = atof(optarg);
+                if (!(shading.gamma > 0.0f)) {
+                    fprintf(stderr, "[softcube-bench] Invalid gamma \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'd':
+                dump_path = optarg;
+                break;
+            case 'b':
+                benchmark_path = optarg;
+                break;
+            case 'B':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    // dumb buffers usually have a pitch aligned to 64 bytes.
+    bench.pitch = ((size_t) bench.width * 4 + 63) & ~(size_t) 63;
+
+    bench.mem = malloc(bench.pitch * bench.height);
+    expected = malloc(bench.pitch * bench.height);
+    if (bench.mem == NULL || expected == NULL) {
+        fprintf(stderr, "[softcube-bench] Couldn't allocate the buffers.\n");
+        return EXIT_FAILURE;
+    }
+
+    // the padding at the end of the rows is never written, but compared.
+    memset(bench.mem, 0, bench.pitch * bench.height);
+    memset(expected, 0, bench.pitch * bench.height);
+
+    ok = softcube_new(&bench.cube, bench.width, bench.height, &shading);
+    if (ok != 0) {
+        fprintf(stderr, "[softcube-bench] Couldn't create the rasterizer: %s\n", strerror(ok));
+        return EXIT_FAILURE;
+    }
+
+    ok = workpool_new(&pool, n_threads, true);
+    if (ok != 0) {
+        fprintf(stderr, "[softcube-bench] Couldn't create the worker threads: %s\n", strerror(ok));
+        return EXIT_FAILURE;
+    }
+
+    bench.kernels = fill_get_best_kernels();
+
+    benchmark_report_init(&report, "softcube");
+
+    ok = EXIT_SUCCESS;
+    if (!verify(&bench, pool, expected)) {
+        fprintf(stderr, "[softcube-bench] Rendering in tiles on multiple threads gives different pixels than on a single thread.\n");
+        ok = EXIT_FAILURE;
+    }
+
+    fps = run(&bench, NULL, n_frames, &cpu_ms);
+    printf("%-16s %8.1f fps, %.2f ms CPU time per frame\n", "single-threaded", fps, cpu_ms);
+    benchmark_report_add(&report, "frames_per_second", "fps", fps, true);
+    benchmark_report_add(&report, "cpu_time_per_frame", "ms", cpu_ms, false);
+
+    threaded_fps = run(&bench, pool, n_frames, &cpu_ms);
+    printf(
+        "%d threads        %8.1f fps, %.2f ms CPU time per frame (%.2fx single-threaded)\n",
+        workpool_get_concurrency(pool),
+        threaded_fps,
+        cpu_ms,
+        threaded_fps / fps
+    );
+    benchmark_report_add(&report, "threaded_frames_per_second", "fps", threaded_fps, true);
+
+    if (dump_path != NULL && dump_ppm(&bench, dump_path) != EXIT_SUCCESS) {
+        ok = EXIT_FAILURE;
+    }
+
+    workpool_destroy(pool);
+    softcube_destroy(bench.cube);
+    free(expected);
+    free(bench.mem);
+
+    if (benchmark_path != NULL && benchmark_report_save(&report, benchmark_path) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (baseline_path != NULL) {
+        if (benchmark_report_compare(&report, baseline_path, tolerance / 100.0, stdout, &n_regressions) != 0 || n_regressions > 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return ok;
+}
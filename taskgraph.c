@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <taskgraph.h>
+
+struct taskgraph_task {
+    struct taskgraph *graph;
+    int id;
+
+    const char *name;
+    uint32_t dependencies;
+    taskgraph_task_cb cb;
+    void *userdata;
+
+    pthread_t thread;
+    bool thread_started;
+
+    int result;
+    uint64_t start_ns, end_ns;
+};
+
+struct taskgraph {
+    pthread_mutex_t mutex;
+    pthread_cond_t task_finished;
+
+    int n_tasks;
+    struct taskgraph_task tasks[TASKGRAPH_MAX_TASKS];
+
+    /// Tasks that have finished (successfully or not) and tasks that failed.
+    uint32_t finished_mask, failed_mask;
+
+    uint64_t start_ns, end_ns;
+};
+
+static uint64_t get_monotonic_time_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+int taskgraph_new(struct taskgraph **graph_out) {
+    struct taskgraph *graph;
+    int ok;
+
+    graph = malloc(sizeof *graph);
+    if (graph == NULL) {
+        return ENOMEM;
+    }
+
+    ok = pthread_mutex_init(&graph->mutex, NULL);
+    if (ok != 0) {
+        goto fail_free_graph;
+    }
+
+    ok = pthread_cond_init(&graph->task_finished, NULL);
+    if (ok != 0) {
+        goto fail_destroy_mutex;
+    }
+
+    graph->n_tasks = 0;
+    graph->finished_mask = 0;
+    graph->failed_mask = 0;
+    graph->start_ns = 0;
+    graph->end_ns = 0;
+
+    *graph_out = graph;
+    return 0;
+
+
+    fail_destroy_mutex:
+    pthread_mutex_destroy(&graph->mutex);
+
+    fail_free_graph:
+    free(graph);
+    return ok;
+}
+
+void taskgraph_destroy(struct taskgraph *graph) {
+    pthread_cond_destroy(&graph->task_finished);
+    pthread_mutex_destroy(&graph->mutex);
+    free(graph);
+}
+
+int taskgraph_add_task(
+    struct taskgraph *graph,
+    const char *name,
+    uint32_t dependencies,
+    taskgraph_task_cb cb,
+    void *userdata,
+    int *task_id_out
+) {
+    struct taskgraph_task *task;
+    int id;
+
+    id = graph->n_tasks;
+    if (id >= TASKGRAPH_MAX_TASKS) {
+        return ENOSPC;
+    }
+
+    // only tasks that were already added can be dependencies
+    if (dependencies & ~(TASKGRAPH_DEP(id) - 1)) {
+        fprintf(stderr, "[taskgraph] Task \"%s\" depends on a task that was not added yet.\n", name);
+        return EINVAL;
+    }
+
+    task = graph->tasks + id;
+    task->graph = graph;
+    task->id = id;
+    task->name = name;
+    task->dependencies = dependencies;
+    task->cb = cb;
+    task->userdata = userdata;
+    task->thread_started = false;
+    task->result = 0;
+    task->start_ns = 0;
+    task->end_ns = 0;
+
+    graph->n_tasks++;
+
+    if (task_id_out != NULL) {
+        *task_id_out = id;
+    }
+
+    return 0;
+}
+
+static void finish_task_locked(struct taskgraph_task *task, int result) {
+    struct taskgraph *graph = task->graph;
+
+    task->result = result;
+    task->end_ns = get_monotonic_time_ns();
+
+    graph->finished_mask |= TASKGRAPH_DEP(task->id);
+    if (result != 0) {
+        graph->failed_mask |= TASKGRAPH_DEP(task->id);
+    }
+
+    pthread_cond_broadcast(&graph->task_finished);
+}
+
+static void *run_task(void *arg) {
+    struct taskgraph_task *task = arg;
+    struct taskgraph *graph = task->graph;
+    int result;
+
+    pthread_mutex_lock(&graph->mutex);
+
+    while ((task->dependencies & ~graph->finished_mask) && !(task->dependencies & graph->failed_mask)) {
+        pthread_cond_wait(&graph->task_finished, &graph->mutex);
+    }
+
+    task->start_ns = get_monotonic_time_ns();
+
+    if (task->dependencies & graph->failed_mask) {
+        finish_task_locked(task, ECANCELED);
+        pthread_mutex_unlock(&graph->mutex);
+        return NULL;
+    }
+
+    pthread_mutex_unlock(&graph->mutex);
+
+    result = task->cb(task->userdata);
+
+    pthread_mutex_lock(&graph->mutex);
+    finish_task_locked(task, result);
+    pthread_mutex_unlock(&graph->mutex);
+
+    return NULL;
+}
+
+int taskgraph_run(struct taskgraph *graph) {
+    struct taskgraph_task *task;
+    int ok;
+
+    graph->finished_mask = 0;
+    graph->failed_mask = 0;
+    graph->start_ns = get_monotonic_time_ns();
+
+    for (int i = 0; i < graph->n_tasks; i++) {
+        task = graph->tasks + i;
+
+        ok = pthread_create(&task->thread, NULL, run_task, task);
+        if (ok != 0) {
+            fprintf(stderr, "[taskgraph] Couldn't start thread for task \"%s\". pthread_create: %s\n", task->name, strerror(ok));
+
+            pthread_mutex_lock(&graph->mutex);
+            task->start_ns = get_monotonic_time_ns();
+            finish_task_locked(task, ok);
+            pthread_mutex_unlock(&graph->mutex);
+            continue;
+        }
+
+        task->thread_started = true;
+    }
+
+    for (int i = 0; i < graph->n_tasks; i++) {
+        task = graph->tasks + i;
+        if (task->thread_started) {
+            pthread_join(task->thread, NULL);
+            task->thread_started = false;
+        }
+    }
+
+    graph->end_ns = get_monotonic_time_ns();
+
+    for (int i = 0; i < graph->n_tasks; i++) {
+        if (graph->tasks[i].result != 0 && graph->tasks[i].result != ECANCELED) {
+            return graph->tasks[i].result;
+        }
+    }
+
+    return 0;
+}
+
+int taskgraph_get_result(struct taskgraph *graph, int task_id) {
+    if (task_id < 0 || task_id >= graph->n_tasks) {
+        return EINVAL;
+    }
+
+    return graph->tasks[task_id].result;
+}
+
+void taskgraph_print_timings(struct taskgraph *graph, FILE *file) {
+    struct taskgraph_task *task;
+    uint64_t sum_ns = 0;
+
+    fprintf(file, "startup timings:\n");
+    for (int i = 0; i < graph->n_tasks; i++) {
+        task = graph->tasks + i;
+
+        fprintf(
+            file,
+            "  %-16s %8.3f ms .. %8.3f ms  (%8.3f ms)%s\n",
+            task->name,
+            (task->start_ns - graph->start_ns) / 1000000.0,
+            (task->end_ns - graph->start_ns) / 1000000.0,
+            (task->end_ns - task->start_ns) / 1000000.0,
+            task->result == 0 ? "" : task->result == ECANCELED ? "  skipped" : "  failed"
+        );
+
+        sum_ns += task->end_ns - task->start_ns;
+    }
+
+    fprintf(
+        file,
+        "  total: %.3f ms wall time, %.3f ms if run sequentially\n",
+        (graph->end_ns - graph->start_ns) / 1000000.0,
+        sum_ns / 1000000.0
+    );
+}
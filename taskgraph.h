@@ -0,0 +1,86 @@
+#ifndef _TASKGRAPH_H
+#define _TASKGRAPH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief A small, run-once dependency graph of tasks.
+ *
+ * Every task gets its own thread and starts as soon as all of its dependencies
+ * have finished successfully. If a dependency fails, the task is skipped
+ * and marked as canceled, so everything downstream of a failed task is skipped too.
+ *
+ * This is meant for startup work like opening the KMS device and creating the
+ * vulkan device, where only a handful of slow, mostly independent steps exist.
+ */
+struct taskgraph;
+
+#define TASKGRAPH_MAX_TASKS 32
+
+/// Dependency mask for the task with id @a task_id.
+#define TASKGRAPH_DEP(task_id) ((uint32_t) 1 << (task_id))
+
+/**
+ * @brief A task. Returns 0 on success, or a positive errno value on failure.
+ */
+typedef int (*taskgraph_task_cb)(void *userdata);
+
+int taskgraph_new(
+    struct taskgraph **graph_out
+);
+
+void taskgraph_destroy(
+    struct taskgraph *graph
+);
+
+/**
+ * @brief Add a task that'll run once all tasks in @a dependencies
+ * (a mask built using @ref TASKGRAPH_DEP) have completed successfully.
+ *
+ * Dependencies need to be added before the tasks that depend on them,
+ * so the graph can't contain cycles.
+ */
+int taskgraph_add_task(
+    struct taskgraph *graph,
+    const char *name,
+    uint32_t dependencies,
+    taskgraph_task_cb cb,
+    void *userdata,
+    int *task_id_out
+);
+
+/**
+ * @brief Run all tasks and wait for them to finish.
+ *
+ * @returns 0 if all tasks completed successfully, otherwise the error
+ * of the first task that failed.
+ */
+int taskgraph_run(
+    struct taskgraph *graph
+);
+
+/**
+ * @brief Get the result of a task after @ref taskgraph_run.
+ * 0 on success, ECANCELED if the task was skipped because a dependency failed.
+ */
+int taskgraph_get_result(
+    struct taskgraph *graph,
+    int task_id
+);
+
+static inline bool taskgraph_succeeded(struct taskgraph *graph, int task_id) {
+    return taskgraph_get_result(graph, task_id) == 0;
+}
+
+/**
+ * @brief Print when each task started and finished (relative to the start of
+ * @ref taskgraph_run), how long it took, and the total wall time.
+ */
+void taskgraph_print_timings(
+    struct taskgraph *graph,
+    FILE *file
+);
+
+#endif
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE__)
+#define VECMATH_HAVE_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#define VECMATH_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#include <vecmath.h>
+
+#define PI 3.1415926535897932384626433832795f
+
+/*
+ * A column of a matrix. Everything below is written in terms of these few
+ * operations, so there's one implementation of each function for SSE, NEON
+ * and plain C. SSE is part of x86_64 and NEON of aarch64, so there's no need
+ * for runtime dispatch.
+ *
+ * Multiplies and adds are kept separate (no fused multiply-add), so the
+ * results match the scalar esTransform.c code.
+ */
+#if defined(VECMATH_HAVE_SSE)
+
+typedef __m128 vec4;
+
+static inline vec4 vec4_load(const float *p) {
+    return _mm_loadu_ps(p);
+}
+
+static inline void vec4_store(float *p, vec4 v) {
+    _mm_storeu_ps(p, v);
+}
+
+static inline vec4 vec4_set(float x, float y, float z, float w) {
+    return _mm_setr_ps(x, y, z, w);
+}
+
+static inline vec4 vec4_add(vec4 a, vec4 b) {
+    return _mm_add_ps(a, b);
+}
+
+static inline vec4 vec4_mul_scalar(vec4 a, float s) {
+    return _mm_mul_ps(a, _mm_set1_ps(s));
+}
+
+/// @a acc + @a a * @a s
+static inline vec4 vec4_madd_scalar(vec4 acc, vec4 a, float s) {
+    return _mm_add_ps(acc, _mm_mul_ps(a, _mm_set1_ps(s)));
+}
+
+#elif defined(VECMATH_HAVE_NEON)
+
+typedef float32x4_t vec4;
+
+static inline vec4 vec4_load(const float *p) {
+    return vld1q_f32(p);
+}
+
+static inline void vec4_store(float *p, vec4 v) {
+    vst1q_f32(p, v);
+}
+
+static inline vec4 vec4_set(float x, float y, float z, float w) {
+    const float v[4] = { x, y, z, w };
+    return vld1q_f32(v);
+}
+
+static inline vec4 vec4_add(vec4 a, vec4 b) {
+    return vaddq_f32(a, b);
+}
+
+static inline vec4 vec4_mul_scalar(vec4 a, float s) {
+    return vmulq_n_f32(a, s);
+}
+
+static inline vec4 vec4_madd_scalar(vec4 acc, vec4 a, float s) {
+    return vaddq_f32(acc, vmulq_n_f32(a, s));
+}
+
+#else
+
+typedef struct {
+    float v[4];
+} vec4;
+
+static inline vec4 vec4_load(const float *p) {
+    vec4 r;
+    memcpy(r.v, p, sizeof r.v);
+    return r;
+}
+
+static inline void vec4_store(float *p, vec4 v) {
+    memcpy(p, v.v, sizeof v.v);
+}
+
+static inline vec4 vec4_set(float x, float y, float z, float w) {
+    return (vec4) { { x, y, z, w } };
+}
+
+static inline vec4 vec4_add(vec4 a, vec4 b) {
+    for (int i = 0; i < 4; i++) {
+        a.v[i] += b.v[i];
+    }
+    return a;
+}
+
+static inline vec4 vec4_mul_scalar(vec4 a, float s) {
+    for (int i = 0; i < 4; i++) {
+        a.v[i] *= s;
+    }
+    return a;
+}
+
+static inline vec4 vec4_madd_scalar(vec4 acc, vec4 a, float s) {
+    for (int i = 0; i < 4; i++) {
+        acc.v[i] += a.v[i] * s;
+    }
+    return acc;
+}
+
+#endif
+
+static inline void load_columns(const ESMatrix *m, vec4 columns[4]) {
+    for (int i = 0; i < 4; i++) {
+        columns[i] = vec4_load(m->m[i]);
+    }
+}
+
+/// @a columns * (@a x, @a y, @a z, @a w)
+static inline vec4 combine4(const vec4 columns[4], float x, float y, float z, float w) {
+    vec4 r;
+
+    r = vec4_mul_scalar(columns[0], x);
+    r = vec4_madd_scalar(r, columns[1], y);
+    r = vec4_madd_scalar(r, columns[2], z);
+    return vec4_madd_scalar(r, columns[3], w);
+}
+
+/// @a columns * (@a x, @a y, @a z, 0)
+static inline vec4 combine3(const vec4 columns[4], float x, float y, float z) {
+    vec4 r;
+
+    r = vec4_mul_scalar(columns[0], x);
+    r = vec4_madd_scalar(r, columns[1], y);
+    return vec4_madd_scalar(r, columns[2], z);
+}
+
+/// @a out = @a a * @a b, with the columns of @a a already loaded.
+static inline void multiply_loaded(ESMatrix *out, const vec4 a[4], const ESMatrix *b) {
+    vec4 r[4];
+
+    for (int i = 0; i < 4; i++) {
+        r[i] = combine4(a, b->m[i][0], b->m[i][1], b->m[i][2], b->m[i][3]);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        vec4_store(out->m[i], r[i]);
+    }
+}
+
+void mat4_identity(ESMatrix *out) {
+    vec4_store(out->m[0], vec4_set(1.0f, 0.0f, 0.0f, 0.0f));
+    vec4_store(out->m[1], vec4_set(0.0f, 1.0f, 0.0f, 0.0f));
+    vec4_store(out->m[2], vec4_set(0.0f, 0.0f, 1.0f, 0.0f));
+    vec4_store(out->m[3], vec4_set(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+void mat4_multiply(ESMatrix *out, const ESMatrix *a, const ESMatrix *b) {
+    vec4 columns[4];
+
+    load_columns(a, columns);
+    multiply_loaded(out, columns, b);
+}
+
+void mat4_translate(ESMatrix *m, float x, float y, float z) {
+    vec4 columns[4];
+
+    load_columns(m, columns);
+    vec4_store(m->m[3], vec4_add(columns[3], combine3(columns, x, y, z)));
+}
+
+void mat4_scale(ESMatrix *m, float x, float y, float z) {
+    vec4_store(m->m[0], vec4_mul_scalar(vec4_load(m->m[0]), x));
+    vec4_store(m->m[1], vec4_mul_scalar(vec4_load(m->m[1]), y));
+    vec4_store(m->m[2], vec4_mul_scalar(vec4_load(m->m[2]), z));
+}
+
+/// @a m = @a m * the rotation with the (upper 3x3) columns @a r.
+static void rotate_by_columns(ESMatrix *m, const float r[3][3]) {
+    vec4 columns[4], out[3];
+
+    load_columns(m, columns);
+
+    for (int i = 0; i < 3; i++) {
+        out[i] = combine3(columns, r[i][0], r[i][1], r[i][2]);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        vec4_store(m->m[i], out[i]);
+    }
+}
+
+void mat4_rotate(ESMatrix *m, float angle, float x, float y, float z) {
+    float sin_angle, cos_angle, one_minus_cos, magnitude;
+    float xx, yy, zz, xy, yz, zx, xs, ys, zs;
+    float r[3][3];
+
+    magnitude = sqrtf(x * x + y * y + z * z);
+    if (!(magnitude > 0.0f)) {
+        return;
+    }
+
+    sin_angle = sinf(angle * PI / 180.0f);
+    cos_angle = cosf(angle * PI / 180.0f);
+    one_minus_cos = 1.0f - cos_angle;
+
+    x /= magnitude;
+    y /= magnitude;
+    z /= magnitude;
+
+    xx = x * x;
+    yy = y * y;
+    zz = z * z;
+    xy = x * y;
+    yz = y * z;
+    zx = z * x;
+    xs = x * sin_angle;
+    ys = y * sin_angle;
+    zs = z * sin_angle;
+
+    // exactly the matrix esRotate builds.
+    r[0][0] = (one_minus_cos * xx) + cos_angle;
+    r[0][1] = (one_minus_cos * xy) - zs;
+    r[0][2] = (one_minus_cos * zx) + ys;
+    r[1][0] = (one_minus_cos * xy) + zs;
+    r[1][1] = (one_minus_cos * yy) + cos_angle;
+    r[1][2] = (one_minus_cos * yz) - xs;
+    r[2][0] = (one_minus_cos * zx) - ys;
+    r[2][1] = (one_minus_cos * yz) + xs;
+    r[2][2] = (one_minus_cos * zz) + cos_angle;
+
+    rotate_by_columns(m, r);
+}
+
+/// The upper 3x3 of @ref mat4_from_quat.
+static void quat_to_columns(const struct quat *q, float r[3][3]) {
+    float xx, yy, zz, xy, xz, yz, wx, wy, wz;
+
+    xx = q->x * q->x;
+    yy = q->y * q->y;
+    zz = q->z * q->z;
+    xy = q->x * q->y;
+    xz = q->x * q->z;
+    yz = q->y * q->z;
+    wx = q->w * q->x;
+    wy = q->w * q->y;
+    wz = q->w * q->z;
+
+    r[0][0] = 1.0f - 2.0f * (yy + zz);
+    r[0][1] = 2.0f * (xy + wz);
+    r[0][2] = 2.0f * (xz - wy);
+    r[1][0] = 2.0f * (xy - wz);
+    r[1][1] = 1.0f - 2.0f * (xx + zz);
+    r[1][2] = 2.0f * (yz + wx);
+    r[2][0] = 2.0f * (xz + wy);
+    r[2][1] = 2.0f * (yz - wx);
+    r[2][2] = 1.0f - 2.0f * (xx + yy);
+}
+
+void mat4_rotate_quat(ESMatrix *m, const struct quat *q) {
+    float r[3][3];
+
+    quat_to_columns(q, r);
+    rotate_by_columns(m, r);
+}
+
+void mat4_from_quat(ESMatrix *out, const struct quat *q) {
+    float r[3][3];
+
+    quat_to_columns(q, r);
+
+    vec4_store(out->m[0], vec4_set(r[0][0], r[0][1], r[0][2], 0.0f));
+    vec4_store(out->m[1], vec4_set(r[1][0], r[1][1], r[1][2], 0.0f));
+    vec4_store(out->m[2], vec4_set(r[2][0], r[2][1], r[2][2], 0.0f));
+    vec4_store(out->m[3], vec4_set(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+void mat4_frustum(ESMatrix *m, float left, float right, float bottom, float top, float near_z, float far_z) {
+    float delta_x = right - left;
+    float delta_y = top - bottom;
+    float delta_z = far_z - near_z;
+    vec4 columns[4], column2;
+
+    if ((near_z <= 0.0f) || (far_z <= 0.0f) || (delta_x <= 0.0f) || (delta_y <= 0.0f) || (delta_z <= 0.0f)) {
+        return;
+    }
+
+    load_columns(m, columns);
+
+    // the frustum matrix is mostly zeroes, so only multiply what's not.
+    column2 = vec4_mul_scalar(columns[0], (right + left) / delta_x);
+    column2 = vec4_madd_scalar(column2, columns[1], (top + bottom) / delta_y);
+    column2 = vec4_madd_scalar(column2, columns[2], -far_z / delta_z);
+    column2 = vec4_madd_scalar(column2, columns[3], -1.0f);
+
+    vec4_store(m->m[0], vec4_mul_scalar(columns[0], 2.0f * near_z / delta_x));
+    vec4_store(m->m[1], vec4_mul_scalar(columns[1], 2.0f * near_z / delta_y));
+    vec4_store(m->m[2], column2);
+    vec4_store(m->m[3], vec4_mul_scalar(columns[2], -(near_z * far_z) / delta_z));
+}
+
+void mat4_perspective(ESMatrix *m, float fovy, float aspect, float near_z, float far_z) {
+    float frustum_w, frustum_h;
+
+    frustum_h = tanf(fovy / 360.0f * PI) * near_z;
+    frustum_w = frustum_h * aspect;
+
+    mat4_frustum(m, -frustum_w, frustum_w, -frustum_h, frustum_h, near_z, far_z);
+}
+
+void mat4_ortho(ESMatrix *m, float left, float right, float bottom, float top, float near_z, float far_z) {
+    float delta_x = right - left;
+    float delta_y = top - bottom;
+    float delta_z = far_z - near_z;
+    vec4 columns[4];
+
+    if ((delta_x == 0.0f) || (delta_y == 0.0f) || (delta_z == 0.0f)) {
+        return;
+    }
+
+    load_columns(m, columns);
+
+    vec4_store(m->m[0], vec4_mul_scalar(columns[0], 2.0f / delta_x));
+    vec4_store(m->m[1], vec4_mul_scalar(columns[1], 2.0f / delta_y));
+    vec4_store(m->m[2], vec4_mul_scalar(columns[2], -1.0f / delta_z));
+    vec4_store(m->m[3], combine4(columns, -(right + left) / delta_x, -(top + bottom) / delta_y, -near_z / delta_z, 1.0f));
+}
+
+void mat4_multiply_batch(ESMatrix *out, const ESMatrix *a, const ESMatrix *b, size_t n) {
+    vec4 columns[4];
+
+    load_columns(a, columns);
+
+    for (size_t i = 0; i < n; i++) {
+        multiply_loaded(out + i, columns, b + i);
+    }
+}
+
+void mat4_compose_batch(ESMatrix *out, const ESMatrix *parent, const struct transform *transforms, size_t n) {
+    const struct transform *t;
+    vec4 columns[4];
+    float r[3][3];
+
+    if (parent != NULL) {
+        load_columns(parent, columns);
+    } else {
+        columns[0] = vec4_set(1.0f, 0.0f, 0.0f, 0.0f);
+        columns[1] = vec4_set(0.0f, 1.0f, 0.0f, 0.0f);
+        columns[2] = vec4_set(0.0f, 0.0f, 1.0f, 0.0f);
+        columns[3] = vec4_set(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        t = transforms + i;
+
+        quat_to_columns(&t->rotation, r);
+
+        // parent * translate * rotate * scale, one column at a time.
+        for (int j = 0; j < 3; j++) {
+            vec4_store(out[i].m[j], vec4_mul_scalar(combine3(columns, r[j][0], r[j][1], r[j][2]), t->scale));
+        }
+        vec4_store(out[i].m[3], combine4(columns, t->translation[0], t->translation[1], t->translation[2], 1.0f));
+    }
+}
+
+struct quat quat_identity(void) {
+    return (struct quat) { 0.0f, 0.0f, 0.0f, 1.0f };
+}
+
+struct quat quat_from_axis_angle(float angle, float x, float y, float z) {
+    float magnitude, half, s;
+
+    magnitude = sqrtf(x * x + y * y + z * z);
+    if (!(magnitude > 0.0f)) {
+        return quat_identity();
+    }
+
+    half = angle * PI / 360.0f;
+    s = sinf(half) / magnitude;
+
+    return (struct quat) { x * s, y * s, z * s, cosf(half) };
+}
+
+struct quat quat_multiply(struct quat a, struct quat b) {
+    return (struct quat) {
+        .x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        .y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        .z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+        .w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+    };
+}
+
+struct quat quat_normalize(struct quat q) {
+    float length;
+
+    length = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    if (!(length > 0.0f)) {
+        return quat_identity();
+    }
+
+    return (struct quat) { q.x / length, q.y / length, q.z / length, q.w / length };
+}
+
+struct quat quat_slerp(struct quat a, struct quat b, float t) {
+    float dot, theta, sin_theta, wa, wb;
+
+    dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+
+    // q and -q are the same rotation, take the one that's closer.
+    if (dot < 0.0f) {
+        b = (struct quat) { -b.x, -b.y, -b.z, -b.w };
+        dot = -dot;
+    }
+
+    // almost the same rotation, sin(theta) would be about 0.
+    if (dot > 0.9995f) {
+        wa = 1.0f - t;
+        wb = t;
+        return quat_normalize((struct quat) {
+            wa * a.x + wb * b.x,
+            wa * a.y + wb * b.y,
+            wa * a.z + wb * b.z,
+            wa * a.w + wb * b.w,
+        });
+    }
+
+    theta = acosf(dot);
+    sin_theta = sinf(theta);
+    wa = sinf((1.0f - t) * theta) / sin_theta;
+    wb = sinf(t * theta) / sin_theta;
+
+    return (struct quat) {
+        wa * a.x + wb * b.x,
+        wa * a.y + wb * b.y,
+        wa * a.z + wb * b.z,
+        wa * a.w + wb * b.w,
+    };
+}
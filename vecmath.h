@@ -0,0 +1,97 @@
+#ifndef _VECMATH_H
+#define _VECMATH_H
+
+#include <stddef.h>
+
+#include <esUtil.h>
+
+/**
+ * @brief 4x4 matrix and quaternion math, using SSE on x86 and NEON on ARM.
+ *
+ * Matrices are ESMatrix, column-major (m[column][row]) like GLSL, so they can
+ * be passed to the existing esTransform.c callers and copied into uniform
+ * buffers as-is. They don't need to be aligned.
+ *
+ * mat4_multiply(out, a, b) computes a * b the way it's written in math (and
+ * GLSL), so transforming a vector with the result first applies b, then a.
+ * Note esMatrixMultiply takes its arguments the other way around.
+ *
+ * The functions that modify a matrix in place (translate, scale, rotate,
+ * frustum, ...) multiply the new transformation on the right, same as the
+ * esTransform.c functions, so they give the same results.
+ *
+ * esTransform.c is implemented on top of this, so existing callers get the
+ * vectorized versions without any changes.
+ */
+
+/// A rotation quaternion, x/y/z being the vector part.
+struct quat {
+    float x, y, z, w;
+};
+
+/**
+ * @brief A translation, rotation and uniform scale, composed into a model
+ * matrix by @ref mat4_compose_batch. Applied in the order scale, rotate, translate.
+ */
+struct transform {
+    struct quat rotation;
+    float translation[3];
+    float scale;
+};
+
+void mat4_identity(ESMatrix *out);
+
+/// @a out = @a a * @a b. @a out can be the same as @a a or @a b.
+void mat4_multiply(ESMatrix *out, const ESMatrix *a, const ESMatrix *b);
+
+void mat4_translate(ESMatrix *m, float x, float y, float z);
+
+void mat4_scale(ESMatrix *m, float x, float y, float z);
+
+/**
+ * @brief Rotate by @a angle degrees around the axis @a x, @a y, @a z, same as
+ * esRotate. Note that's clockwise when looking along the axis towards the
+ * origin, so it equals rotating by the quaternion for -@a angle.
+ */
+void mat4_rotate(ESMatrix *m, float angle, float x, float y, float z);
+
+/// Rotate by the unit quaternion @a q.
+void mat4_rotate_quat(ESMatrix *m, const struct quat *q);
+
+void mat4_frustum(ESMatrix *m, float left, float right, float bottom, float top, float near_z, float far_z);
+
+void mat4_perspective(ESMatrix *m, float fovy, float aspect, float near_z, float far_z);
+
+void mat4_ortho(ESMatrix *m, float left, float right, float bottom, float top, float near_z, float far_z);
+
+/// The rotation matrix of the unit quaternion @a q.
+void mat4_from_quat(ESMatrix *out, const struct quat *q);
+
+/**
+ * @brief @a out[i] = @a a * @a b[i] for @a n matrices, e.g. the view-projection
+ * matrix times the model matrices of a lot of objects.
+ *
+ * @a out can be the same array as @a b.
+ */
+void mat4_multiply_batch(ESMatrix *out, const ESMatrix *a, const ESMatrix *b, size_t n);
+
+/**
+ * @brief @a out[i] = @a parent * the model matrix of @a transforms[i], for @a n
+ * transforms. @a parent can be NULL for the identity.
+ */
+void mat4_compose_batch(ESMatrix *out, const ESMatrix *parent, const struct transform *transforms, size_t n);
+
+struct quat quat_identity(void);
+
+/// The counter-clockwise rotation by @a angle degrees around the axis @a x, @a y, @a z.
+struct quat quat_from_axis_angle(float angle, float x, float y, float z);
+
+/// The rotation @a b followed by @a a.
+struct quat quat_multiply(struct quat a, struct quat b);
+
+struct quat quat_normalize(struct quat q);
+
+/// Spherical interpolation from @a a (@a t = 0) to @a b (@a t = 1), along the shorter arc.
+struct quat quat_slerp(struct quat a, struct quat b, float t);
+
+#endif
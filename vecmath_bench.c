@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <esUtil.h>
+#include <vecmath.h>
+#include <benchmark.h>
+
+#define PI 3.1415926535897932384626433832795f
+
+/// Results are written here, so the compiler can't drop the loops.
+static volatile float sink;
+
+static uint64_t get_monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * The scalar functions esTransform.c had before it was ported to vecmath.c,
+ * to compare against.
+ */
+static void reference_multiply(ESMatrix *result, const ESMatrix *src_a, const ESMatrix *src_b) {
+    ESMatrix tmp;
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            tmp.m[i][j] = (src_a->m[i][0] * src_b->m[0][j]) + (src_a->m[i][1] * src_b->m[1][j]) + (src_a->m[i][2] * src_b->m[2][j]) +
+                          (src_a->m[i][3] * src_b->m[3][j]);
+        }
+    }
+
+    memcpy(result, &tmp, sizeof(ESMatrix));
+}
+
+static void reference_identity(ESMatrix *result) {
+    memset(result, 0, sizeof(ESMatrix));
+    result->m[0][0] = 1.0f;
+    result->m[1][1] = 1.0f;
+    result->m[2][2] = 1.0f;
+    result->m[3][3] = 1.0f;
+}
+
+static void reference_scale(ESMatrix *result, float sx, float sy, float sz) {
+    for (int i = 0; i < 4; i++) {
+        result->m[0][i] *= sx;
+        result->m[1][i] *= sy;
+        result->m[2][i] *= sz;
+    }
+}
+
+static void reference_translate(ESMatrix *result, float tx, float ty, float tz) {
+    for (int i = 0; i < 4; i++) {
+        result->m[3][i] += (result->m[0][i] * tx + result->m[1][i] * ty + result->m[2][i] * tz);
+    }
+}
+
+static void reference_rotate(ESMatrix *result, float angle, float x, float y, float z) {
+    float sin_angle, cos_angle, one_minus_cos, mag;
+    float xx, yy, zz, xy, yz, zx, xs, ys, zs;
+    ESMatrix rot;
+
+    mag = sqrtf(x * x + y * y + z * z);
+    sin_angle = sinf(angle * PI / 180.0f);
+    cos_angle = cosf(angle * PI / 180.0f);
+    if (mag <= 0.0f) {
+        return;
+    }
+
+    x /= mag;
+    y /= mag;
+    z /= mag;
+
+    xx = x * x;
+    yy = y * y;
+    zz = z * z;
+    xy = x * y;
+    yz = y * z;
+    zx = z * x;
+    xs = x * sin_angle;
+    ys = y * sin_angle;
+    zs = z * sin_angle;
+    one_minus_cos = 1.0f - cos_angle;
+
+    rot.m[0][0] = (one_minus_cos * xx) + cos_angle;
+    rot.m[0][1] = (one_minus_cos * xy) - zs;
+    rot.m[0][2] = (one_minus_cos * zx) + ys;
+    rot.m[0][3] = 0.0F;
+
+    rot.m[1][0] = (one_minus_cos * xy) + zs;
+    rot.m[1][1] = (one_minus_cos * yy) + cos_angle;
+    rot.m[1][2] = (one_minus_cos * yz) - xs;
+    rot.m[1][3] = 0.0F;
+
+    rot.m[2][0] = (one_minus_cos * zx) - ys;
+    rot.m[2][1] = (one_minus_cos * yz) + xs;
+    rot.m[2][2] = (one_minus_cos * zz) + cos_angle;
+    rot.m[2][3] = 0.0F;
+
+    rot.m[3][0] = 0.0F;
+    rot.m[3][1] = 0.0F;
+    rot.m[3][2] = 0.0F;
+    rot.m[3][3] = 1.0F;
+
+    reference_multiply(result, &rot, result);
+}
+
+static void reference_frustum(ESMatrix *result, float left, float right, float bottom, float top, float near_z, float far_z) {
+    float delta_x = right - left;
+    float delta_y = top - bottom;
+    float delta_z = far_z - near_z;
+    ESMatrix frust;
+
+    if ((near_z <= 0.0f) || (far_z <= 0.0f) || (delta_x <= 0.0f) || (delta_y <= 0.0f) || (delta_z <= 0.0f)) {
+        return;
+    }
+
+    frust.m[0][0] = 2.0f * near_z / delta_x;
+    frust.m[0][1] = frust.m[0][2] = frust.m[0][3] = 0.0f;
+
+    frust.m[1][1] = 2.0f * near_z / delta_y;
+    frust.m[1][0] = frust.m[1][2] = frust.m[1][3] = 0.0f;
+
+    frust.m[2][0] = (right + left) / delta_x;
+    frust.m[2][1] = (top + bottom) / delta_y;
+    frust.m[2][2] = -far_z / delta_z;
+    frust.m[2][3] = -1.0f;
+
+    frust.m[3][2] = -(near_z * far_z) / delta_z;
+    frust.m[3][0] = frust.m[3][1] = frust.m[3][3] = 0.0f;
+
+    reference_multiply(result, &frust, result);
+}
+
+/// A model transform, as angle & axis so it can be fed to both versions.
+struct model {
+    float translation[3];
+    float angle;
+    float axis[3];
+    float scale;
+};
+
+static bool matrix_equal(const ESMatrix *a, const ESMatrix *b) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            if (fabsf(a->m[i][j] - b->m[i][j]) > 1e-5f * fmaxf(1.0f, fabsf(b->m[i][j]))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/// The modelview & modelview-projection matrices of the cube scene at time @a t, like vulkan2.c.
+static void cube_transforms_reference(float t, ESMatrix *modelview, ESMatrix *mvp) {
+    ESMatrix projection;
+
+    reference_identity(modelview);
+    reference_translate(modelview, 0.0f, 0.0f, -8.0f);
+    reference_rotate(modelview, 45.0f + (0.25f * t), 1.0f, 0.0f, 0.0f);
+    reference_rotate(modelview, 45.0f - (0.5f * t), 0.0f, 1.0f, 0.0f);
+    reference_rotate(modelview, 10.0f + (0.15f * t), 0.0f, 0.0f, 1.0f);
+
+    reference_identity(&projection);
+    reference_frustum(&projection, -2.8f, +2.8f, -2.8f * 0.5625f, +2.8f * 0.5625f, 6.0f, 10.0f);
+
+    reference_identity(mvp);
+    reference_multiply(mvp, modelview, &projection);
+}
+
+static void cube_transforms(float t, ESMatrix *modelview, ESMatrix *mvp) {
+    ESMatrix projection;
+
+    esMatrixLoadIdentity(modelview);
+    esTranslate(modelview, 0.0f, 0.0f, -8.0f);
+    esRotate(modelview, 45.0f + (0.25f * t), 1.0f, 0.0f, 0.0f);
+    esRotate(modelview, 45.0f - (0.5f * t), 0.0f, 1.0f, 0.0f);
+    esRotate(modelview, 10.0f + (0.15f * t), 0.0f, 0.0f, 1.0f);
+
+    esMatrixLoadIdentity(&projection);
+    esFrustum(&projection, -2.8f, +2.8f, -2.8f * 0.5625f, +2.8f * 0.5625f, 6.0f, 10.0f);
+
+    esMatrixLoadIdentity(mvp);
+    esMatrixMultiply(mvp, modelview, &projection);
+}
+
+/// Model matrices the way a caller of esTransform.c would build them.
+static void compose_reference(ESMatrix *out, const ESMatrix *view_projection, const struct model *models, size_t n) {
+    const struct model *model;
+    ESMatrix m;
+
+    for (size_t i = 0; i < n; i++) {
+        model = models + i;
+
+        reference_identity(&m);
+        reference_translate(&m, model->translation[0], model->translation[1], model->translation[2]);
+        reference_rotate(&m, model->angle, model->axis[0], model->axis[1], model->axis[2]);
+        reference_scale(&m, model->scale, model->scale, model->scale);
+        reference_multiply(out + i, &m, view_projection);
+    }
+}
+
+/// The same as @ref compose_reference using quaternions. esRotate turns clockwise, quaternions counter-clockwise.
+static void models_to_transforms(const struct model *models, struct transform *transforms, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        transforms[i].rotation = quat_from_axis_angle(-models[i].angle, models[i].axis[0], models[i].axis[1], models[i].axis[2]);
+        memcpy(transforms[i].translation, models[i].translation, sizeof transforms[i].translation);
+        transforms[i].scale = models[i].scale;
+    }
+}
+
+static float random_float(float min, float max) {
+    return min + (max - min) * (rand() / (float) RAND_MAX);
+}
+
+static bool verify(const ESMatrix *view_projection, const struct model *models, const struct transform *transforms, ESMatrix *a, ESMatrix *b, size_t n) {
+    ESMatrix modelview_a, modelview_b, mvp_a, mvp_b, m;
+    struct quat q0, q1, q;
+    bool ok = true;
+
+    for (int frame = 0; frame < 240; frame += 7) {
+        cube_transforms_reference(frame, &modelview_a, &mvp_a);
+        cube_transforms(frame, &modelview_b, &mvp_b);
+        if (!matrix_equal(&modelview_b, &modelview_a) || !matrix_equal(&mvp_b, &mvp_a)) {
+            fprintf(stderr, "[vecmath-bench] The cube transforms differ from the scalar code.\n");
+            ok = false;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        reference_multiply(a + i, models[i].angle > 0.0f ? &modelview_a : &mvp_a, view_projection);
+    }
+    for (size_t i = 0; i < n; i++) {
+        b[i] = models[i].angle > 0.0f ? modelview_a : mvp_a;
+    }
+    mat4_multiply_batch(b, view_projection, b, n);
+    for (size_t i = 0; i < n && ok; i++) {
+        if (!matrix_equal(b + i, a + i)) {
+            fprintf(stderr, "[vecmath-bench] mat4_multiply_batch differs from the scalar code.\n");
+            ok = false;
+        }
+    }
+
+    compose_reference(a, view_projection, models, n);
+    mat4_compose_batch(b, view_projection, transforms, n);
+    for (size_t i = 0; i < n && ok; i++) {
+        if (!matrix_equal(b + i, a + i)) {
+            fprintf(stderr, "[vecmath-bench] mat4_compose_batch differs from the scalar code.\n");
+            ok = false;
+        }
+    }
+
+    // slerp half-way between two rotations around the same axis.
+    q0 = quat_from_axis_angle(10.0f, 1.0f, 2.0f, 3.0f);
+    q1 = quat_from_axis_angle(100.0f, 1.0f, 2.0f, 3.0f);
+    q = quat_slerp(q0, q1, 0.5f);
+    mat4_from_quat(&m, &q);
+    reference_identity(&mvp_a);
+    reference_rotate(&mvp_a, -55.0f, 1.0f, 2.0f, 3.0f);
+    if (!matrix_equal(&m, &mvp_a)) {
+        fprintf(stderr, "[vecmath-bench] quat_slerp gives the wrong rotation.\n");
+        ok = false;
+    }
+
+    // rotating twice is the same as rotating by the product.
+    q = quat_multiply(q1, q0);
+    mat4_identity(&m);
+    mat4_rotate_quat(&m, &q);
+    reference_identity(&mvp_a);
+    reference_rotate(&mvp_a, -100.0f, 1.0f, 2.0f, 3.0f);
+    reference_rotate(&mvp_a, -10.0f, 1.0f, 2.0f, 3.0f);
+    if (!matrix_equal(&m, &mvp_a)) {
+        fprintf(stderr, "[vecmath-bench] quat_multiply gives the wrong rotation.\n");
+        ok = false;
+    }
+
+    return ok;
+}
+
+static void print_usage(const char *argv0) {
+    printf(
+        "usage: %s [options]\n"
+        "\n"
+        "Compares the vectorized matrix functions of vecmath.c against the scalar\n"
+        "code esTransform.c used to have: the transforms the cube scene computes\n"
+        "every frame, and batches of model matrices.\n"
+        "\n"
+        "  --count=N                  Number of model matrices per batch. (default: 4096)\n"
+        "  --iterations=N             Number of frames / batches to time. (default: 1000)\n"
+        "  --benchmark=FILE           Write the results as JSON to FILE\n"
+        "                             (or stdout if FILE is \"-\").\n"
+        "  --baseline=FILE            Compare against the JSON written by an earlier\n"
+        "                             --benchmark run and fail if anything regressed.\n"
+        "  --tolerance=PERCENT        How much worse than the baseline is still ok. (default: 10)\n"
+        "  --help                     Show this help.\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    struct benchmark_report report;
+    struct transform *transforms;
+    struct model *models;
+    ESMatrix modelview, mvp, view_projection;
+    ESMatrix *a, *b;
+    const char *benchmark_path, *baseline_path;
+    double tolerance, reference_ns, vecmath_ns;
+    uint64_t start;
+    size_t n;
+    int opt, n_iterations, n_regressions, ok;
+
+    static const struct option long_options[] = {
+        { "count", required_argument, NULL, 'c' },
+        { "iterations", required_argument, NULL, 'n' },
+        { "benchmark", required_argument, NULL, 'b' },
+        { "baseline", required_argument, NULL, 'B' },
+        { "tolerance", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    n = 4096;
+    n_iterations = 1000;
+    benchmark_path = NULL;
+    baseline_path = NULL;
+    tolerance = 10.0;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                n = strtoul(optarg, NULL, 10);
+                if (n == 0) {
+                    fprintf(stderr, "[vecmath-bench] Invalid number of matrices \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                n_iterations = atoi(optarg);
+                if (n_iterations <= 0) {
+                    fprintf(stderr, "[vecmath-bench] Invalid number of iterations \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                benchmark_path = optarg;
+                break;
+            case 'B':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    models = malloc(n * sizeof *models);
+    transforms = malloc(n * sizeof *transforms);
+    a = malloc(n * sizeof *a);
+    b = malloc(n * sizeof *b);
+    if (models == NULL || transforms == NULL || a == NULL || b == NULL) {
+        fprintf(stderr, "[vecmath-bench] Couldn't allocate the matrices.\n");
+        return EXIT_FAILURE;
+    }
+
+    // always the same scene, so runs are comparable.
+    srand(1);
+    for (size_t i = 0; i < n; i++) {
+        models[i] = (struct model) {
+            .translation = { random_float(-10.0f, 10.0f), random_float(-10.0f, 10.0f), random_float(-30.0f, -10.0f) },
+            .angle = random_float(-180.0f, 180.0f),
+            .axis = { random_float(-1.0f, 1.0f), random_float(-1.0f, 1.0f), random_float(0.1f, 1.0f) },
+            .scale = random_float(0.25f, 2.0f),
+        };
+    }
+    models_to_transforms(models, transforms, n);
+
+    cube_transforms(0.0f, &modelview, &view_projection);
+
+    benchmark_report_init(&report, "vecmath");
+
+    ok = verify(&view_projection, models, transforms, a, b, n) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // the matrices the cube scene computes every frame.
+    start = get_monotonic_ns();
+    for (int i = 0; i < n_iterations; i++) {
+        cube_transforms_reference(i, &modelview, &mvp);
+        sink = mvp.m[3][3];
+    }
+    reference_ns = (double) (get_monotonic_ns() - start) / n_iterations;
+
+    start = get_monotonic_ns();
+    for (int i = 0; i < n_iterations; i++) {
+        cube_transforms(i, &modelview, &mvp);
+        sink = mvp.m[3][3];
+    }
+    vecmath_ns = (double) (get_monotonic_ns() - start) / n_iterations;
+
+    printf("cube transforms:   %8.1f ns scalar, %8.1f ns vectorized (%.2fx)\n", reference_ns, vecmath_ns, reference_ns / vecmath_ns);
+    benchmark_report_add(&report, "cube_transforms_ns", "ns", vecmath_ns, false);
+    benchmark_report_add(&report, "cube_transforms_speedup", "x", reference_ns / vecmath_ns, true);
+
+    // view-projection times a batch of model matrices.
+    start = get_monotonic_ns();
+    for (int i = 0; i < n_iterations; i++) {
+        for (size_t j = 0; j < n; j++) {
+            reference_multiply(b + j, a + j, &view_projection);
+        }
+        sink = b[i % n].m[3][3];
+    }
+    reference_ns = (double) (get_monotonic_ns() - start) / n_iterations / n;
+
+    start = get_monotonic_ns();
+    for (int i = 0; i < n_iterations; i++) {
+        mat4_multiply_batch(b, &view_projection, a, n);
+        sink = b[i % n].m[3][3];
+    }
+    vecmath_ns = (double) (get_monotonic_ns() - start) / n_iterations / n;
+
+    printf("batch multiply:    %8.2f ns scalar, %8.2f ns vectorized (%.2fx) per matrix\n", reference_ns, vecmath_ns, reference_ns / vecmath_ns);
+    benchmark_report_add(&report, "batch_multiply_ns", "ns", vecmath_ns, false);
+    benchmark_report_add(&report, "batch_multiply_speedup", "x", reference_ns / vecmath_ns, true);
+
+    // building model matrices from translation, rotation and scale.
+    start = get_monotonic_ns();
+    for (int i = 0; i < n_iterations; i++) {
+        compose_reference(b, &view_projection, models, n);
+        sink = b[i % n].m[3][3];
+    }
+    reference_ns = (double) (get_monotonic_ns() - start) / n_iterations / n;
+
+    start = get_monotonic_ns();
+    for (int i = 0; i < n_iterations; i++) {
+        mat4_compose_batch(b, &view_projection, transforms, n);
+        sink = b[i % n].m[3][3];
+    }
+    vecmath_ns = (double) (get_monotonic_ns() - start) / n_iterations / n;
+
+    printf("batch compose:     %8.2f ns scalar, %8.2f ns vectorized (%.2fx) per matrix\n", reference_ns, vecmath_ns, reference_ns / vecmath_ns);
+    benchmark_report_add(&report, "batch_compose_ns", "ns", vecmath_ns, false);
+    benchmark_report_add(&report, "batch_compose_speedup", "x", reference_ns / vecmath_ns, true);
+
+    free(b);
+    free(a);
+    free(transforms);
+    free(models);
+
+    if (benchmark_path != NULL && benchmark_report_save(&report, benchmark_path) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (baseline_path != NULL) {
+        if (benchmark_report_compare(&report, baseline_path, tolerance / 100.0, stdout, &n_regressions) != 0 || n_regressions > 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return ok;
+}
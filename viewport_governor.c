@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <viewport_governor.h>
+
+struct viewport_governor {
+    struct viewport_governor_config config;
+
+    float scale;
+
+    /// Rejected scales are raised to this.
+    float min_supported_scale;
+
+    int n_over_budget, n_under_grow_threshold;
+};
+
+int viewport_governor_new(struct viewport_governor **governor_out, const struct viewport_governor_config *config) {
+    struct viewport_governor *governor;
+
+    if (config->min_scale <= 0.0f || config->min_scale > 1.0f || config->step <= 0.0f) {
+        return EINVAL;
+    }
+
+    governor = malloc(sizeof *governor);
+    if (governor == NULL) {
+        return ENOMEM;
+    }
+
+    governor->config = *config;
+    governor->scale = 1.0f;
+    governor->min_supported_scale = config->min_scale;
+    governor->n_over_budget = 0;
+    governor->n_under_grow_threshold = 0;
+
+    *governor_out = governor;
+    return 0;
+}
+
+void viewport_governor_destroy(struct viewport_governor *governor) {
+    free(governor);
+}
+
+bool viewport_governor_update(struct viewport_governor *governor, uint64_t gpu_time_ns, float *scale_out) {
+    float bigger, estimate;
+
+    if (gpu_time_ns > governor->config.budget_ns) {
+        governor->n_over_budget++;
+        governor->n_under_grow_threshold = 0;
+
+        if (governor->n_over_budget >= governor->config.shrink_frames && governor->scale > governor->min_supported_scale) {
+            governor->n_over_budget = 0;
+
+            *scale_out = governor->scale - governor->config.step;
+            if (*scale_out < governor->min_supported_scale) {
+                *scale_out = governor->min_supported_scale;
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    governor->n_over_budget = 0;
+
+    if (governor->scale >= 1.0f) {
+        return false;
+    }
+
+    bigger = governor->scale + governor->config.step;
+    if (bigger > 1.0f) {
+        bigger = 1.0f;
+    }
+
+    // GPU time is mostly proportional to the number of pixels.
+    estimate = (float) gpu_time_ns * (bigger * bigger) / (governor->scale * governor->scale);
+
+    if (estimate < governor->config.grow_headroom * governor->config.budget_ns) {
+        governor->n_under_grow_threshold++;
+        if (governor->n_under_grow_threshold >= governor->config.grow_frames) {
+            governor->n_under_grow_threshold = 0;
+            *scale_out = bigger;
+            return true;
+        }
+    } else {
+        governor->n_under_grow_threshold = 0;
+    }
+
+    return false;
+}
+
+void viewport_governor_accept(struct viewport_governor *governor, float scale) {
+    governor->scale = scale;
+    governor->n_over_budget = 0;
+    governor->n_under_grow_threshold = 0;
+}
+
+void viewport_governor_reject(struct viewport_governor *governor, float scale) {
+    // if the display can't scale by this much, it can't scale by even more.
+    if (scale < governor->scale && scale + governor->config.step > governor->min_supported_scale) {
+        governor->min_supported_scale = scale + governor->config.step;
+        if (governor->min_supported_scale > governor->scale) {
+            governor->min_supported_scale = governor->scale;
+        }
+    }
+}
+
+float viewport_governor_get_scale(struct viewport_governor *governor) {
+    return governor->scale;
+}
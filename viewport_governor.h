@@ -0,0 +1,89 @@
+#ifndef _VIEWPORT_GOVERNOR_H
+#define _VIEWPORT_GOVERNOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Decides how big the rendered viewport should be, so the GPU time per
+ * frame stays within budget.
+ *
+ * The viewport is the full output size scaled by a factor between the configured
+ * minimum and 1. The display controller scales it back up to the full output size,
+ * so a smaller viewport costs no extra GPU work.
+ *
+ * To avoid oscillating, the viewport only shrinks after a few frames in a row were
+ * over budget, and only grows after a lot of frames in a row would've been well
+ * within budget at the bigger size.
+ *
+ * Every change the governor proposes needs to be checked against what the display
+ * controller can actually scale (using a TEST_ONLY commit), and then either
+ * accepted or rejected. Rejected scales are not proposed again.
+ *
+ * Not thread-safe, it's meant to be used from the render loop only.
+ */
+struct viewport_governor;
+
+struct viewport_governor_config {
+    /// The GPU time per frame we want to stay below.
+    uint64_t budget_ns;
+
+    /// Smallest scale factor, for example 0.5 for half the width & height.
+    float min_scale;
+
+    /// How much the scale changes at once.
+    float step;
+
+    /// Number of frames in a row that need to be over budget before shrinking.
+    int shrink_frames;
+
+    /// Number of frames in a row that need to fit into @ref grow_headroom before growing.
+    int grow_frames;
+
+    /// Only grow if the (estimated) GPU time at the bigger size is below this fraction of the budget.
+    float grow_headroom;
+};
+
+int viewport_governor_new(
+    struct viewport_governor **governor_out,
+    const struct viewport_governor_config *config
+);
+
+void viewport_governor_destroy(
+    struct viewport_governor *governor
+);
+
+/**
+ * @brief Feed the GPU time of a frame rendered at the current scale.
+ *
+ * @returns true if the governor wants to change the scale. The proposed scale
+ * is written to @a scale_out and needs to be accepted or rejected.
+ */
+bool viewport_governor_update(
+    struct viewport_governor *governor,
+    uint64_t gpu_time_ns,
+    float *scale_out
+);
+
+/**
+ * @brief The proposed @a scale is used from now on.
+ */
+void viewport_governor_accept(
+    struct viewport_governor *governor,
+    float scale
+);
+
+/**
+ * @brief The proposed @a scale can't be used, for example because the display
+ * controller can't upscale that much. Smaller scales won't be proposed anymore.
+ */
+void viewport_governor_reject(
+    struct viewport_governor *governor,
+    float scale
+);
+
+float viewport_governor_get_scale(
+    struct viewport_governor *governor
+);
+
+#endif
@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+#include <vkalloc.h>
+
+struct vkalloc_range {
+    struct vkalloc_range *next;
+    VkDeviceSize offset, size;
+};
+
+struct vkalloc_block {
+    struct vkalloc_block *next;
+
+    uint32_t memory_type;
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void *mapped;
+    bool dedicated;
+
+    /// Free ranges of this block, sorted by offset. Adjacent ranges are always merged.
+    struct vkalloc_range *free_ranges;
+
+    size_t n_allocations;
+};
+
+struct vkalloc {
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_props;
+    VkDeviceSize buffer_image_granularity;
+    uint32_t max_device_allocations;
+
+    pthread_mutex_t mutex;
+
+    VkDeviceSize block_size;
+    struct vkalloc_block *blocks;
+
+    uint64_t n_device_allocations;
+    size_t n_allocations;
+    VkDeviceSize n_bytes_used;
+};
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+int vkalloc_new(
+    struct vkalloc **alloc_out,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    VkDeviceSize block_size
+) {
+    VkPhysicalDeviceProperties props;
+    struct vkalloc *alloc;
+    int ok;
+
+    alloc = malloc(sizeof *alloc);
+    if (alloc == NULL) {
+        return ENOMEM;
+    }
+
+    ok = pthread_mutex_init(&alloc->mutex, NULL);
+    if (ok != 0) {
+        free(alloc);
+        return ok;
+    }
+
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &alloc->memory_props);
+
+    alloc->physical_device = physical_device;
+    alloc->device = device;
+    alloc->buffer_image_granularity = props.limits.bufferImageGranularity;
+    alloc->max_device_allocations = props.limits.maxMemoryAllocationCount;
+    alloc->block_size = block_size;
+    alloc->blocks = NULL;
+    alloc->n_device_allocations = 0;
+    alloc->n_allocations = 0;
+    alloc->n_bytes_used = 0;
+
+    *alloc_out = alloc;
+    return 0;
+}
+
+static void destroy_block(struct vkalloc *alloc, struct vkalloc_block *block) {
+    struct vkalloc_range *range, *next;
+
+    for (range = block->free_ranges; range != NULL; range = next) {
+        next = range->next;
+        free(range);
+    }
+
+    if (block->mapped != NULL) {
+        vkUnmapMemory(alloc->device, block->memory);
+    }
+
+    vkFreeMemory(alloc->device, block->memory, NULL);
+    free(block);
+}
+
+void vkalloc_destroy(struct vkalloc *alloc) {
+    struct vkalloc_block *block, *next;
+
+    if (alloc->n_allocations > 0) {
+        fprintf(stderr, "[vkalloc] %zu allocations were not freed before destroying the allocator.\n", alloc->n_allocations);
+    }
+
+    for (block = alloc->blocks; block != NULL; block = next) {
+        next = block->next;
+        destroy_block(alloc, block);
+    }
+
+    pthread_mutex_destroy(&alloc->mutex);
+    free(alloc);
+}
+
+static size_t count_blocks_locked(struct vkalloc *alloc) {
+    size_t n = 0;
+
+    for (struct vkalloc_block *block = alloc->blocks; block != NULL; block = block->next) {
+        n++;
+    }
+
+    return n;
+}
+
+static VkResult create_block_locked(
+    struct vkalloc *alloc,
+    uint32_t memory_type,
+    VkDeviceSize size,
+    bool dedicated,
+    struct vkalloc_block **block_out
+) {
+    struct vkalloc_block *block;
+    struct vkalloc_range *range;
+    VkDeviceMemory memory;
+    void *mapped;
+    VkResult ok;
+
+    if (count_blocks_locked(alloc) >= alloc->max_device_allocations) {
+        fprintf(stderr, "[vkalloc] Reached maxMemoryAllocationCount (%"PRIu32").\n", alloc->max_device_allocations);
+        return VK_ERROR_TOO_MANY_OBJECTS;
+    }
+
+    block = malloc(sizeof *block);
+    if (block == NULL) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    range = malloc(sizeof *range);
+    if (range == NULL) {
+        ok = VK_ERROR_OUT_OF_HOST_MEMORY;
+        goto fail_free_block;
+    }
+
+    ok = vkAllocateMemory(
+        alloc->device,
+        &(const VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = size,
+            .memoryTypeIndex = memory_type,
+            .pNext = NULL
+        },
+        NULL,
+        &memory
+    );
+    if (ok != VK_SUCCESS) {
+        fprintf(stderr, "[vkalloc] Could not allocate memory block. vkAllocateMemory: %d\n", ok);
+        goto fail_free_range;
+    }
+
+    mapped = NULL;
+    if (alloc->memory_props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        ok = vkMapMemory(alloc->device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        if (ok != VK_SUCCESS) {
+            fprintf(stderr, "[vkalloc] Could not map memory block. vkMapMemory: %d\n", ok);
+            goto fail_free_memory;
+        }
+    }
+
+    range->next = NULL;
+    range->offset = 0;
+    range->size = size;
+
+    block->memory_type = memory_type;
+    block->memory = memory;
+    block->size = size;
+    block->mapped = mapped;
+    block->dedicated = dedicated;
+    block->free_ranges = range;
+    block->n_allocations = 0;
+
+    block->next = alloc->blocks;
+    alloc->blocks = block;
+    alloc->n_device_allocations++;
+
+    *block_out = block;
+    return VK_SUCCESS;
+
+
+    fail_free_memory:
+    vkFreeMemory(alloc->device, memory, NULL);
+
+    fail_free_range:
+    free(range);
+
+    fail_free_block:
+    free(block);
+    return ok;
+}
+
+/**
+ * @brief Try to carve out @a size bytes aligned to @a alignment from the free ranges of @a block.
+ */
+static bool try_alloc_from_block(struct vkalloc_block *block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset_out) {
+    struct vkalloc_range **prev_next, *range, *tail;
+    VkDeviceSize offset, range_end;
+
+    for (prev_next = &block->free_ranges; *prev_next != NULL; prev_next = &(*prev_next)->next) {
+        range = *prev_next;
+        offset = align_up(range->offset, alignment);
+        range_end = range->offset + range->size;
+
+        if (offset + size > range_end) {
+            continue;
+        }
+
+        if (offset + size < range_end && offset > range->offset) {
+            // allocation is in the middle of the range, we need to split it in two.
+            tail = malloc(sizeof *tail);
+            if (tail == NULL) {
+                return false;
+            }
+
+            tail->offset = offset + size;
+            tail->size = range_end - tail->offset;
+            tail->next = range->next;
+
+            range->size = offset - range->offset;
+            range->next = tail;
+        } else if (offset + size < range_end) {
+            range->offset = offset + size;
+            range->size = range_end - range->offset;
+        } else if (offset > range->offset) {
+            range->size = offset - range->offset;
+        } else {
+            // the allocation takes up the whole range.
+            *prev_next = range->next;
+            free(range);
+        }
+
+        *offset_out = offset;
+        return true;
+    }
+
+    return false;
+}
+
+static int find_memory_type(struct vkalloc *alloc, VkMemoryPropertyFlags flags, uint32_t type_bits) {
+    for (uint32_t i = 0; i < alloc->memory_props.memoryTypeCount; i++) {
+        if ((type_bits & (1u << i)) && (alloc->memory_props.memoryTypes[i].propertyFlags & flags) == flags) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static VkResult alloc_memory(
+    struct vkalloc *alloc,
+    const VkMemoryRequirements *reqs,
+    VkMemoryPropertyFlags flags,
+    bool optimal_image,
+    struct vkalloc_allocation *allocation_out
+) {
+    struct vkalloc_block *block;
+    VkDeviceSize size, alignment, offset;
+    VkResult ok;
+    int memory_type;
+
+    memory_type = find_memory_type(alloc, flags, reqs->memoryTypeBits);
+    if (memory_type < 0) {
+        fprintf(stderr, "[vkalloc] Could not find a suitable memory type.\n");
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+
+    size = reqs->size;
+    alignment = reqs->alignment;
+    if (optimal_image) {
+        // make sure no linear resource ends up on the same "page" as this image.
+        size = align_up(size, alloc->buffer_image_granularity);
+        alignment = align_up(alignment, alloc->buffer_image_granularity);
+    }
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    block = NULL;
+    if (size <= alloc->block_size / 2) {
+        for (block = alloc->blocks; block != NULL; block = block->next) {
+            if (block->memory_type == (uint32_t) memory_type && !block->dedicated && try_alloc_from_block(block, size, alignment, &offset)) {
+                break;
+            }
+        }
+
+        if (block == NULL) {
+            ok = create_block_locked(alloc, memory_type, alloc->block_size, false, &block);
+            if (ok != VK_SUCCESS) {
+                goto fail_unlock;
+            }
+
+            if (!try_alloc_from_block(block, size, alignment, &offset)) {
+                // can only happen when we're out of host memory.
+                ok = VK_ERROR_OUT_OF_HOST_MEMORY;
+                goto fail_unlock;
+            }
+        }
+    } else {
+        ok = create_block_locked(alloc, memory_type, size, true, &block);
+        if (ok != VK_SUCCESS) {
+            goto fail_unlock;
+        }
+
+        try_alloc_from_block(block, size, 1, &offset);
+    }
+
+    block->n_allocations++;
+    alloc->n_allocations++;
+    alloc->n_bytes_used += size;
+
+    pthread_mutex_unlock(&alloc->mutex);
+
+    allocation_out->memory = block->memory;
+    allocation_out->offset = offset;
+    allocation_out->size = size;
+    allocation_out->memory_type = memory_type;
+    allocation_out->mapped = block->mapped != NULL ? (char*) block->mapped + offset : NULL;
+    allocation_out->block = block;
+    return VK_SUCCESS;
+
+
+    fail_unlock:
+    pthread_mutex_unlock(&alloc->mutex);
+    return ok;
+}
+
+VkResult vkalloc_alloc_buffer_memory(
+    struct vkalloc *alloc,
+    VkBuffer buffer,
+    VkMemoryPropertyFlags flags,
+    struct vkalloc_allocation *allocation_out
+) {
+    struct vkalloc_allocation allocation;
+    VkMemoryRequirements reqs;
+    VkResult ok;
+
+    vkGetBufferMemoryRequirements(alloc->device, buffer, &reqs);
+
+    ok = alloc_memory(alloc, &reqs, flags, false, &allocation);
+    if (ok != VK_SUCCESS) {
+        return ok;
+    }
+
+    ok = vkBindBufferMemory(alloc->device, buffer, allocation.memory, allocation.offset);
+    if (ok != VK_SUCCESS) {
+        fprintf(stderr, "[vkalloc] Could not bind buffer memory. vkBindBufferMemory: %d\n", ok);
+        vkalloc_free(alloc, &allocation);
+        return ok;
+    }
+
+    *allocation_out = allocation;
+    return VK_SUCCESS;
+}
+
+VkResult vkalloc_alloc_image_memory(
+    struct vkalloc *alloc,
+    VkImage image,
+    VkMemoryPropertyFlags flags,
+    struct vkalloc_allocation *allocation_out
+) {
+    struct vkalloc_allocation allocation;
+    VkMemoryRequirements reqs;
+    VkResult ok;
+
+    vkGetImageMemoryRequirements(alloc->device, image, &reqs);
+
+    ok = alloc_memory(alloc, &reqs, flags, true, &allocation);
+    if (ok != VK_SUCCESS) {
+        return ok;
+    }
+
+    ok = vkBindImageMemory(alloc->device, image, allocation.memory, allocation.offset);
+    if (ok != VK_SUCCESS) {
+        fprintf(stderr, "[vkalloc] Could not bind image memory. vkBindImageMemory: %d\n", ok);
+        vkalloc_free(alloc, &allocation);
+        return ok;
+    }
+
+    *allocation_out = allocation;
+    return VK_SUCCESS;
+}
+
+void vkalloc_free(struct vkalloc *alloc, struct vkalloc_allocation *allocation) {
+    struct vkalloc_range **prev_next, *prev, *range, *next;
+    struct vkalloc_block *block = allocation->block, **block_prev_next;
+    VkDeviceSize start, end;
+
+    start = allocation->offset;
+    end = allocation->offset + allocation->size;
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    alloc->n_allocations--;
+    alloc->n_bytes_used -= allocation->size;
+
+    if (--block->n_allocations == 0) {
+        for (block_prev_next = &alloc->blocks; *block_prev_next != block; block_prev_next = &(*block_prev_next)->next);
+        *block_prev_next = block->next;
+
+        destroy_block(alloc, block);
+        goto out_unlock;
+    }
+
+    // find the free ranges before and after the allocation
+    prev = NULL;
+    for (prev_next = &block->free_ranges; *prev_next != NULL && (*prev_next)->offset < start; prev_next = &(*prev_next)->next) {
+        prev = *prev_next;
+    }
+    next = *prev_next;
+
+    if (prev != NULL && prev->offset + prev->size == start) {
+        prev->size += allocation->size;
+
+        if (next != NULL && next->offset == end) {
+            prev->size += next->size;
+            prev->next = next->next;
+            free(next);
+        }
+    } else if (next != NULL && next->offset == end) {
+        next->offset = start;
+        next->size += allocation->size;
+    } else {
+        range = malloc(sizeof *range);
+        if (range == NULL) {
+            // we just leak the range in this case, it'll be reclaimed when the block is freed.
+            goto out_unlock;
+        }
+
+        range->offset = start;
+        range->size = allocation->size;
+        range->next = next;
+        *prev_next = range;
+    }
+
+    out_unlock:
+    pthread_mutex_unlock(&alloc->mutex);
+
+    allocation->block = NULL;
+    allocation->memory = VK_NULL_HANDLE;
+    allocation->mapped = NULL;
+}
+
+void vkalloc_get_stats(struct vkalloc *alloc, struct vkalloc_stats *stats_out) {
+    struct vkalloc_stats stats = { 0 };
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    stats.n_device_allocations = alloc->n_device_allocations;
+    stats.n_allocations = alloc->n_allocations;
+    stats.n_bytes_used = alloc->n_bytes_used;
+
+    for (struct vkalloc_block *block = alloc->blocks; block != NULL; block = block->next) {
+        stats.n_blocks++;
+        if (block->dedicated) {
+            stats.n_dedicated_blocks++;
+        }
+
+        stats.n_bytes_allocated += block->size;
+
+        for (struct vkalloc_range *range = block->free_ranges; range != NULL; range = range->next) {
+            stats.n_free_ranges++;
+            if (range->size > stats.largest_free_range) {
+                stats.largest_free_range = range->size;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&alloc->mutex);
+
+    *stats_out = stats;
+}
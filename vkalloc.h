@@ -0,0 +1,104 @@
+#ifndef _VKALLOC_H
+#define _VKALLOC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief A device memory sub-allocator.
+ *
+ * Instead of doing one vkAllocateMemory per buffer / image (which counts against
+ * maxMemoryAllocationCount, and is slow on some drivers), memory is allocated
+ * in large blocks per memory type and handed out in pieces, first-fit.
+ * Host-visible blocks are mapped once and stay mapped for their whole lifetime.
+ *
+ * Allocations bigger than half the block size get a block of their own.
+ * Blocks are freed as soon as their last allocation is freed.
+ *
+ * All functions are thread-safe.
+ */
+struct vkalloc;
+
+struct vkalloc_block;
+
+struct vkalloc_allocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint32_t memory_type;
+
+    /// Pointer to the start of the allocation if the memory is host visible, NULL otherwise.
+    void *mapped;
+
+    struct vkalloc_block *block;
+};
+
+struct vkalloc_stats {
+    /// Number of vkAllocateMemory calls so far, including blocks that were already freed again.
+    uint64_t n_device_allocations;
+
+    size_t n_blocks;
+    size_t n_dedicated_blocks;
+    size_t n_allocations;
+
+    /// Total size of all blocks.
+    VkDeviceSize n_bytes_allocated;
+    /// Total size of all sub-allocations, not counting the gaps left by alignment.
+    VkDeviceSize n_bytes_used;
+
+    size_t n_free_ranges;
+    VkDeviceSize largest_free_range;
+};
+
+int vkalloc_new(
+    struct vkalloc **alloc_out,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    VkDeviceSize block_size
+);
+
+/**
+ * @brief Free all blocks. All allocations need to be freed before this is called.
+ */
+void vkalloc_destroy(
+    struct vkalloc *alloc
+);
+
+/**
+ * @brief Allocate memory for @a buffer from a memory type that has at least the
+ * properties in @a flags, and bind it.
+ */
+VkResult vkalloc_alloc_buffer_memory(
+    struct vkalloc *alloc,
+    VkBuffer buffer,
+    VkMemoryPropertyFlags flags,
+    struct vkalloc_allocation *allocation_out
+);
+
+/**
+ * @brief Allocate memory for an optimal-tiling @a image from a memory type that has at
+ * least the properties in @a flags, and bind it.
+ *
+ * The allocation is padded to bufferImageGranularity, so it can share blocks with buffers.
+ */
+VkResult vkalloc_alloc_image_memory(
+    struct vkalloc *alloc,
+    VkImage image,
+    VkMemoryPropertyFlags flags,
+    struct vkalloc_allocation *allocation_out
+);
+
+void vkalloc_free(
+    struct vkalloc *alloc,
+    struct vkalloc_allocation *allocation
+);
+
+void vkalloc_get_stats(
+    struct vkalloc *alloc,
+    struct vkalloc_stats *stats_out
+);
+
+#endif
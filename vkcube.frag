@@ -3,7 +3,15 @@
 layout(location = 0) in vec4 vVaryingColor;
 layout(location = 0) out vec4 f_color;
 
+// Specialization constant, see enum cube_constant in vulkan2.c.
+// With the default, the pow is folded away.
+layout(constant_id = 4) const float gamma = 1.0;
+
 void main()
 {
-    f_color = vVaryingColor;
+    if (gamma == 1.0) {
+        f_color = vVaryingColor;
+    } else {
+        f_color = vec4(pow(vVaryingColor.rgb, vec3(gamma)), vVaryingColor.a);
+    }
 }
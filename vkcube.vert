@@ -10,17 +10,27 @@ layout(location = 0) in vec4 in_position;
 layout(location = 1) in vec4 in_color;
 layout(location = 2) in vec3 in_normal;
 
-vec4 lightSource = vec4(2.0, 2.0, 20.0, 0.0);
+// Specialization constants, see enum cube_constant in vulkan2.c.
+layout(constant_id = 0) const float light_x = 2.0;
+layout(constant_id = 1) const float light_y = 2.0;
+layout(constant_id = 2) const float light_z = 20.0;
+layout(constant_id = 3) const bool lighting = true;
+
+vec4 lightSource = vec4(light_x, light_y, light_z, 0.0);
 
 layout(location = 0) out vec4 vVaryingColor;
 
 void main()
 {
     gl_Position = modelviewprojectionMatrix * in_position;
-    vec3 vEyeNormal = normalMatrix * in_normal;
-    vec4 vPosition4 = modelviewMatrix * in_position;
-    vec3 vPosition3 = vPosition4.xyz / vPosition4.w;
-    vec3 vLightDir = normalize(lightSource.xyz - vPosition3);
-    float diff = max(0.0, dot(vEyeNormal, vLightDir));
-    vVaryingColor = vec4(diff * in_color.rgb, 1.0);
+    if (lighting) {
+        vec3 vEyeNormal = normalMatrix * in_normal;
+        vec4 vPosition4 = modelviewMatrix * in_position;
+        vec3 vPosition3 = vPosition4.xyz / vPosition4.w;
+        vec3 vLightDir = normalize(lightSource.xyz - vPosition3);
+        float diff = max(0.0, dot(vEyeNormal, vLightDir));
+        vVaryingColor = vec4(diff * in_color.rgb, 1.0);
+    } else {
+        vVaryingColor = vec4(in_color.rgb, 1.0);
+    }
 }
@@ -51,6 +51,11 @@ struct vk_device {
     // whether the required extensions for explicit fencing are supported
     bool explicit_fencing;
 
+    // whether semaphores can be imported from / exported as sync_files
+    // directly. If not, they go through the DRM syncobjs of the images.
+    bool sync_fd_import;
+    bool sync_fd_export;
+
     struct {
         PFN_vkCreateDebugUtilsMessengerEXT createDebugUtilsMessengerEXT;
         PFN_vkDestroyDebugUtilsMessengerEXT destroyDebugUtilsMessengerEXT;
@@ -99,6 +104,12 @@ struct vk_image {
     // difference (the exporting semantics are the same for both).
     VkSemaphore render_semaphore; // signaled by vulkan when rendering finishes
 
+    // Only used if vulkan can't import / export sync_files directly: the
+    // syncobjs we convert the sync_files from / to. They're created once
+    // with the image, not every frame. 0 if unused.
+    uint32_t buffer_syncobj;
+    uint32_t render_syncobj;
+
     // We don't need this theoretically. But the validation layers
     // are happy if we signal them via this fence that execution
     // has finished.
@@ -183,6 +194,28 @@ int find_mem_type(VkPhysicalDevice phdev, VkMemoryPropertyFlags flags, uint32_t
     return -1;
 }
 
+static VkExternalSemaphoreFeatureFlags get_semaphore_features(VkPhysicalDevice phdev, VkExternalSemaphoreHandleTypeFlagBits type) {
+    VkExternalSemaphoreProperties props = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES,
+        .pNext = NULL,
+        .exportFromImportedHandleTypes = 0,
+        .compatibleHandleTypes = 0,
+        .externalSemaphoreFeatures = 0
+    };
+
+    vkGetPhysicalDeviceExternalSemaphoreProperties(
+        phdev,
+        &(VkPhysicalDeviceExternalSemaphoreInfo) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO,
+            .pNext = NULL,
+            .handleType = type,
+        },
+        &props
+    );
+
+    return props.externalSemaphoreFeatures;
+}
+
 static bool has_extension(const VkExtensionProperties *avail, uint32_t availc, const char *req) {
     // check if all required extensions are supported
     for (size_t j = 0; j < availc; ++j) {
@@ -808,14 +841,6 @@ struct vk_device *vk_device_create(struct device *device) {
         goto error;
     }
 
-    VkExternalSemaphoreProperties props = {
-        .sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES,
-        .pNext = NULL,
-        .exportFromImportedHandleTypes = 0,
-        .compatibleHandleTypes = 0,
-        .externalSemaphoreFeatures = 0
-    };
-
     // semaphore import/export support
     // we import kms_fence_fd as semaphore and add that as wait semaphore
     // to a render submission so that we only render a buffer when
@@ -824,25 +849,32 @@ struct vk_device *vk_device_create(struct device *device) {
     // and pass that as render_fence_fd to the kernel, signaling
     // that the buffer can only be used when that semaphore is signaled,
     // i.e. we are finished with rendering and all barriers.
-    vkGetPhysicalDeviceExternalSemaphoreProperties(
-        phdev,
-        &(VkPhysicalDeviceExternalSemaphoreInfo) {
-            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO,
-            .pNext = NULL,
-            .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
-        },
-        &props
-    );
+    //
+    // KMS gives and takes sync_files, so if the driver can import and
+    // export them directly, that's what we use. Otherwise we fall back to
+    // opaque fds, which are DRM syncobjs, and convert between the two
+    // using the syncobj ioctls.
+    VkExternalSemaphoreFeatureFlags sync_fd_features = get_semaphore_features(phdev, VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT);
+    vk_dev->sync_fd_import = sync_fd_features & VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT;
+    vk_dev->sync_fd_export = sync_fd_features & VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT;
+
+    if (!vk_dev->sync_fd_import || !vk_dev->sync_fd_export) {
+        VkExternalSemaphoreFeatureFlags opaque_features = get_semaphore_features(phdev, VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT);
+
+        if (!vk_dev->sync_fd_import && (opaque_features & VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT) == 0) {
+            error("Vulkan can't import sync_fd or drm syncobj fd semaphores");
+            abort();
+        }
 
-    if ((props.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT) == 0) {
-        error("Vulkan can't import drm syncobj fd semaphores");
-        abort();
+        if (!vk_dev->sync_fd_export && (opaque_features & VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT) == 0) {
+            error("Vulkan can't export sync_fd or drm syncobj fd semaphores");
+            abort();
+        }
     }
 
-    if ((props.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT) == 0) {
-        error("Vulkan can't export drm syncobj fd semaphores");
-        abort();
-    }
+    debug("importing KMS fences %s, exporting render fences %s\n",
+          vk_dev->sync_fd_import ? "as sync_fd" : "through a drm syncobj",
+          vk_dev->sync_fd_export ? "as sync_fd" : "through a drm syncobj");
 
     vk_dev->api.getSemaphoreFdKHR = (PFN_vkGetSemaphoreFdKHR) vkGetDeviceProcAddr(vk_dev->dev, "vkGetSemaphoreFdKHR");
     if (!vk_dev->api.getSemaphoreFdKHR) {
@@ -1028,6 +1060,7 @@ struct buffer *buffer_vk_create(struct device *device, struct output *output) {
     struct gbm_bo *bo;
     VkFramebuffer framebuffer;
     VkSemaphore buffer_semaphore, render_semaphore;
+    uint32_t buffer_syncobj, render_syncobj;
     VkFence render_fence;
     VkImageView img_view;
     VkBuffer ubo;
@@ -1547,7 +1580,9 @@ struct buffer *buffer_vk_create(struct device *device, struct output *output) {
             .flags = 0,
             .pNext = &(VkExportSemaphoreCreateInfo) {
                 .sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO,
-                .handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
+                .handleTypes = vk_dev->sync_fd_export ?
+                    VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT :
+                    VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
                 .pNext = NULL
             },
         },
@@ -1559,6 +1594,45 @@ struct buffer *buffer_vk_create(struct device *device, struct output *output) {
         abort();
     }
 
+    // Fallback for drivers that can't import sync_files: KMS fences are
+    // imported into this syncobj, which is then imported into
+    // buffer_semaphore every frame.
+    buffer_syncobj = 0;
+    if (!vk_dev->sync_fd_import) {
+        if (drmSyncobjCreate(device->kms_fd, 0, &buffer_syncobj) < 0) {
+            fprintf(stderr, "Couldn't create syncobj for importing KMS out_fence into vulkan. drmSyncobjCreate: %s\n", strerror(errno));
+            abort();
+        }
+    }
+
+    // Fallback for drivers that can't export sync_files: opaque fds have
+    // reference transference, so the syncobj we get from it here shares
+    // the payload of render_semaphore for as long as both exist, and we
+    // can export the sync_file from it every frame.
+    render_syncobj = 0;
+    if (!vk_dev->sync_fd_export) {
+        ok = vk_dev->api.getSemaphoreFdKHR(
+            vk_dev->dev,
+            &(VkSemaphoreGetFdInfoKHR) {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
+                .semaphore = render_semaphore,
+                .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
+                .pNext = NULL
+            },
+            &fd
+        );
+        if (ok != VK_SUCCESS) {
+            vk_error(ok, "vkGetSemaphoreFdKHR");
+            abort();
+        }
+
+        if (drmSyncobjFDToHandle(device->kms_fd, fd, &render_syncobj) < 0) {
+            fprintf(stderr, "Couldn't convert syncobj fd to syncobj handle. drmSyncobjFDToHandle: %s\n", strerror(errno));
+            abort();
+        }
+        close(fd);
+    }
+
     img->memories[0] = img_device_memory;
     img->image = vk_img;
     img->image_view = img_view;
@@ -1570,6 +1644,8 @@ struct buffer *buffer_vk_create(struct device *device, struct output *output) {
     img->ds = decriptor_set;
     img->buffer_semaphore = buffer_semaphore;
     img->render_semaphore = render_semaphore;
+    img->buffer_syncobj = buffer_syncobj;
+    img->render_syncobj = render_syncobj;
     img->render_fence = render_fence;
     img->buffer.output = output;
     img->buffer.in_use = false;
@@ -1631,6 +1707,12 @@ void buffer_vk_destroy(struct device *device, struct buffer *buffer) {
     if (img->render_semaphore) {
         vkDestroySemaphore(vk_dev->dev, img->render_semaphore, NULL);
     }
+    if (img->buffer_syncobj) {
+        drmSyncobjDestroy(device->kms_fd, img->buffer_syncobj);
+    }
+    if (img->render_syncobj) {
+        drmSyncobjDestroy(device->kms_fd, img->render_syncobj);
+    }
     if (img->fb) {
         vkDestroyFramebuffer(vk_dev->dev, img->fb, NULL);
     }
@@ -1707,55 +1789,39 @@ bool buffer_vk_fill(struct buffer *buffer, int frame_num) {
     submission.commandBufferCount = 1;
     submission.pCommandBuffers = &img->cb;
 
-    // we don't have to recreate it every frame but there
-    // are currently validation layer errors for sync_fd handles
-    // (don't reset payload on export) so we recreate the
-    // semaphore in every frame. Shouldn't hurt performance.
-    if (img->buffer_semaphore) {
-        vkDestroySemaphore(vk_dev->dev, img->render_semaphore, NULL);
-    }
-
-    res = vkCreateSemaphore(
-        vk_dev->dev,
-        &(VkSemaphoreCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-            .flags = 0,
-            .pNext = &(VkExportSemaphoreCreateInfo) {
-                .sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO,
-                .handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
-                .pNext = NULL
-            },
-        },
-        NULL,
-        &img->render_semaphore
-    );
-    if (res != VK_SUCCESS) {
-        vk_error(res, "vkCreateSemaphore");
-        return false;
+    // The render semaphore is created once with the image. Exporting a
+    // sync_file resets it to unsignaled, so it can be signaled again next
+    // frame; with the syncobj fallback, we reset the syncobj ourselves.
+    if (img->render_syncobj) {
+        ok = drmSyncobjReset(buffer->output->device->kms_fd, &img->render_syncobj, 1);
+        if (ok < 0) {
+            fprintf(stderr, "Couldn't reset render syncobj. drmSyncobjReset: %s\n", strerror(errno));
+            abort();
+        }
     }
 
-    uint32_t syncobj_handle;
-    int syncobj_fd;
-
     bool has_in_fence;
     if (buffer->kms_fence_fd != -1) {
-        ok = drmSyncobjCreate(buffer->output->device->kms_fd, 0, &syncobj_handle);
-        if (ok < 0) {
-            fprintf(stderr, "Couldn't create syncobj for importing KMS out_fence into vulkan. drmSyncobjCreate: %s\n", strerror(errno));
-            abort();
-        }
+        int in_fence_fd;
 
-        ok = drmSyncobjImportSyncFile(buffer->output->device->kms_fd, syncobj_handle, buffer->kms_fence_fd);
-        if (ok < 0) {
-            fprintf(stderr, "Couldn't create import KMS out_fence into syncobj. drmSyncobjImportSyncFile: %s\n", strerror(errno));
-            abort();
-        }
+        if (vk_dev->sync_fd_import) {
+            // importing transfers ownership of the sync_file to vulkan.
+            in_fence_fd = buffer->kms_fence_fd;
+            buffer->kms_fence_fd = -1;
+        } else {
+            ok = drmSyncobjImportSyncFile(buffer->output->device->kms_fd, img->buffer_syncobj, buffer->kms_fence_fd);
+            if (ok < 0) {
+                fprintf(stderr, "Couldn't create import KMS out_fence into syncobj. drmSyncobjImportSyncFile: %s\n", strerror(errno));
+                abort();
+            }
 
-        
-        ok = drmSyncobjHandleToFD(buffer->output->device->kms_fd, syncobj_handle, &syncobj_fd);
-        if (ok < 0) {
-            fprintf(stderr, "Couldn't export syncobj as fd. drmSyncobjHandleToFD: %s\n", strerror(errno));
-            abort();
+            fd_replace(&buffer->kms_fence_fd, -1);
+
+            ok = drmSyncobjHandleToFD(buffer->output->device->kms_fd, img->buffer_syncobj, &in_fence_fd);
+            if (ok < 0) {
+                fprintf(stderr, "Couldn't export syncobj as fd. drmSyncobjHandleToFD: %s\n", strerror(errno));
+                abort();
+            }
         }
 
         // importing semaphore transfers ownership to vulkan
@@ -1773,8 +1839,10 @@ bool buffer_vk_fill(struct buffer *buffer, int frame_num) {
                 .sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR,
                 .semaphore = img->buffer_semaphore,
                 .flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT,
-                .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
-                .fd = syncobj_fd
+                .handleType = vk_dev->sync_fd_import ?
+                    VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT :
+                    VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
+                .fd = in_fence_fd
             }
         );
         if (res != VK_SUCCESS) {
@@ -1814,51 +1882,52 @@ bool buffer_vk_fill(struct buffer *buffer, int frame_num) {
         return false;
     }
 
-    if (img->buffer.render_fence_fd) {
-        close(img->buffer.render_fence_fd);
-    }
-
-    img->buffer.render_fence_fd = -1;
-    // We have to export the fence/semaphore *every frame* since
-    // we pass ownership to the kernel when passing the sync_fd.
-    // additionally, to export a fence as sync_fd, it
-    // "must be signaled, or have an associated fence signal operation
-    // pending execution", since sync_fd has copy transference semantics
-    // (see the vulkan spec for more details or importing/exporting
-    // fences/semaphores). So it's important that we do this *after* we sumit
-    // our command buffer using this fence/semaphore
-    res = vk_dev->api.getSemaphoreFdKHR(
-        vk_dev->dev,
-        &(VkSemaphoreGetFdInfoKHR) {
-            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
-            .semaphore = img->render_semaphore,
-            .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
-            .pNext = NULL
-        },
-        &syncobj_fd
-    );
-    if (res != VK_SUCCESS) {
-        vk_error(res, "vkGetSemaphoreFdKHR");
-        abort();
-    }
-
-    ok = drmSyncobjFDToHandle(buffer->output->device->kms_fd, syncobj_fd, &syncobj_handle);
-    if (ok < 0) {
-        fprintf(stderr, "Couldn't convert syncobj fd to syncobj handle. drmSyncobjFDToHandle: %s\n", strerror(errno));
-        abort();
-    }
-
-    ok = drmSyncobjWait(buffer->output->device->kms_fd, &syncobj_handle, 1, INT64_MAX, DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT, NULL);
-    if (ok < 0) {
-        fprintf(stderr, "Couldn't wait for syncobj submit. drmSyncobjWait: %s\n", strerror(errno));
-        abort();
-    }
+    // KMS is done with the previous frame's fence by now.
+    fd_replace(&img->buffer.render_fence_fd, -1);
 
     int syncfile_fd;
-    ok = drmSyncobjExportSyncFile(buffer->output->device->kms_fd, syncobj_handle, &syncfile_fd);
-    if (ok < 0) {
-        fprintf(stderr, "Couldn't export syncfile of syncobj handle. drmSyncobjExportSyncFile: %s\n", strerror(errno));
-        abort();
+    if (vk_dev->sync_fd_export) {
+        // We have to export the semaphore *every frame* since
+        // we pass ownership to the kernel when passing the sync_fd.
+        // additionally, to export a semaphore as sync_fd, it
+        // "must be signaled, or have an associated fence signal operation
+        // pending execution", since sync_fd has copy transference semantics
+        // (see the vulkan spec for more details or importing/exporting
+        // fences/semaphores). So it's important that we do this *after* we sumit
+        // our command buffer using this semaphore.
+        //
+        // This doesn't block, the sync_file is created right away even if
+        // the driver hasn't handed the work to the kernel yet.
+        res = vk_dev->api.getSemaphoreFdKHR(
+            vk_dev->dev,
+            &(VkSemaphoreGetFdInfoKHR) {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
+                .semaphore = img->render_semaphore,
+                .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+                .pNext = NULL
+            },
+            &syncfile_fd
+        );
+        if (res != VK_SUCCESS) {
+            vk_error(res, "vkGetSemaphoreFdKHR");
+            abort();
+        }
+    } else {
+        // The driver may not have submitted the work to the kernel yet, in
+        // which case the syncobj doesn't have a fence we could export.
+        // This is the only place we block, and only on drivers without
+        // sync_fd export.
+        ok = drmSyncobjWait(buffer->output->device->kms_fd, &img->render_syncobj, 1, INT64_MAX, DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT, NULL);
+        if (ok < 0) {
+            fprintf(stderr, "Couldn't wait for syncobj submit. drmSyncobjWait: %s\n", strerror(errno));
+            abort();
+        }
+
+        ok = drmSyncobjExportSyncFile(buffer->output->device->kms_fd, img->render_syncobj, &syncfile_fd);
+        if (ok < 0) {
+            fprintf(stderr, "Couldn't export syncfile of syncobj handle. drmSyncobjExportSyncFile: %s\n", strerror(errno));
+            abort();
+        }
     }
 
     img->buffer.render_fence_fd = syncfile_fd;
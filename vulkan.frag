@@ -9,6 +9,9 @@ layout(set = 0, binding = 0) uniform UBO {
 
 const float pi = 3.1415926535897932;
 
+// can be overridden when creating the pipeline.
+layout(constant_id = 0) const float gamma = 2.2;
+
 void main() {
 	// rotating color wheel
 	float t = 2 * pi * ubo.t;
@@ -20,7 +23,7 @@ void main() {
 	// aren't trying to achieve anything physcially). So we need to bring the
 	// color into linear color space afterwards since that's what shaders
 	// should output (e.g. for blending). That's what the pow is for
-	fragColor = vec4(pow(col, vec3(2.2)), 1);
+	fragColor = vec4(pow(col, vec3(gamma)), 1);
 
 	// simple white-black color ramp for testing
 	// float gray = pow(uv.x, 2.2 * 2.2);
@@ -7,7 +7,14 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <math.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <pthread.h>
 
 #include <gbm.h>
 #include <xf86drm.h>
@@ -20,7 +27,17 @@
 #include <simple.vert.h>
 #include <vkcube.frag.h>
 #include <vkcube.vert.h>
+#include <instanced.vert.h>
 #include <modesetting.h>
+#include <fbcache.h>
+#include <pipeline_cache.h>
+#include <taskgraph.h>
+#include <vkalloc.h>
+#include <memtrack.h>
+#include <viewport_governor.h>
+#include <gpu_queries.h>
+#include <benchmark.h>
+#include <pipeline_variants.h>
 #include <esUtil.h>
 
 const char *vk_strerror(VkResult result) {
@@ -72,6 +89,12 @@ const char *vk_strerror(VkResult result) {
 #define LOG_DEBUG(...) printf(__VA_ARGS__);
 
 
+enum vkdev_queue {
+    VKDEV_QUEUE_GRAPHICS,
+    VKDEV_QUEUE_TRANSFER,
+    VKDEV_QUEUE_COMPUTE
+};
+
 struct vkdev {
     VkInstance instance;
     VkPhysicalDevice physical_device;
@@ -80,6 +103,34 @@ struct vkdev {
     VkDebugUtilsMessengerEXT debug_utils_messenger;
     VkCommandPool graphics_cmd_pool;
 
+    /// Queues of dedicated transfer / compute queue families, if the device has them.
+    /// Otherwise these are the same as the graphics queue & command pool.
+    VkQueue transfer_queue, compute_queue;
+    VkCommandPool transfer_cmd_pool, compute_cmd_pool;
+    uint32_t graphics_queue_family_index, transfer_queue_family_index, compute_queue_family_index;
+
+    /// Whether the pipelineStatisticsQuery feature is enabled.
+    bool pipeline_statistics_supported;
+
+    /// Whether VK_KHR_external_memory_fd is enabled, so memory can be exported as an fd.
+    bool memory_export_supported;
+
+    /// Whether VK_EXT_memory_budget is enabled, see @ref memtrack.
+    bool memory_budget_supported;
+
+    /// One timeline semaphore per queue (indexed by enum vkdev_queue).
+    /// Every submission signals the next value, so the value tells us exactly
+    /// which submissions have completed.
+    VkSemaphore timelines[3];
+    uint64_t timeline_values[3];
+
+    PFN_vkWaitSemaphoresKHR wait_semaphores;
+    PFN_vkGetSemaphoreCounterValueKHR get_semaphore_counter_value;
+
+    struct pipeline_cache *pipeline_cache;
+    struct vkalloc *allocator;
+    struct memtrack *memtrack;
+
     PFN_vkCreateDebugUtilsMessengerEXT create_debug_utils_messenger;
     PFN_vkDestroyDebugUtilsMessengerEXT destroy_debug_utils_messenger;
 };
@@ -109,12 +160,73 @@ static int get_graphics_queue_family_index(VkPhysicalDevice device) {
     return -1;
 }
 
-static int score_physical_device(VkPhysicalDevice device, const char **required_device_extensions) {
+/**
+ * @brief Find a queue family that supports all of @a flags, but none of @a excluded_flags.
+ */
+static int get_dedicated_queue_family_index(VkPhysicalDevice device, VkQueueFlags flags, VkQueueFlags excluded_flags) {
+    uint32_t n_queue_families;
+
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &n_queue_families, NULL);
+
+    VkQueueFamilyProperties queue_families[n_queue_families];
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &n_queue_families, queue_families);
+
+    for (unsigned i = 0; i < n_queue_families; i++) {
+        if ((queue_families[i].queueFlags & flags) == flags && !(queue_families[i].queueFlags & excluded_flags)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static const char *physical_device_type_name(VkPhysicalDeviceType type) {
+    switch (type) {
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated GPU";
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete GPU";
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual GPU";
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: return "CPU";
+        default: return "other";
+    }
+}
+
+/// Way more than the device type is worth, see @ref score_physical_device.
+#define DRM_DEVICE_MATCH_SCORE 100
+
+static bool is_same_drm_device(VkPhysicalDevice device, dev_t drm_device) {
+    VkPhysicalDeviceDrmPropertiesEXT drm_props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DRM_PROPERTIES_EXT,
+        .pNext = NULL,
+    };
+
+    vkGetPhysicalDeviceProperties2(
+        device,
+        &(VkPhysicalDeviceProperties2) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &drm_props,
+        }
+    );
+
+    // The KMS device is a primary node, but there's no harm in checking the render node too.
+    return (drm_props.hasPrimary && makedev(drm_props.primaryMajor, drm_props.primaryMinor) == drm_device)
+        || (drm_props.hasRender && makedev(drm_props.renderMajor, drm_props.renderMinor) == drm_device);
+}
+
+/**
+ * @brief Score how well @a device suits us, 0 if it's not usable at all.
+ *
+ * If @a drm_device is given, a GPU that is the same device as that DRM node is
+ * preferred over everything else, since a different GPU's buffers would have to
+ * be copied by the display engine (if it can import them at all). That's only
+ * known if the device supports VK_EXT_physical_device_drm.
+ */
+static int score_physical_device(VkPhysicalDevice device, const char **required_device_extensions, const dev_t *drm_device) {
     VkPhysicalDeviceProperties props;
     VkPhysicalDeviceFeatures features;
     VkResult ok;
     uint32_t n_available_extensions;
     int graphics_queue_fam_index;
+    const char *drm_match;
     int score = 1;
 
     vkGetPhysicalDeviceProperties(device, &props);
@@ -128,7 +240,7 @@ static int score_physical_device(VkPhysicalDevice device, const char **required_
 
     graphics_queue_fam_index = get_graphics_queue_family_index(device);
     if (graphics_queue_fam_index == -1) {
-        LOG_ERROR("Physical device does not support a graphics queue.\n");
+        LOG_ERROR("Physical device \"%s\" does not support a graphics queue.\n", props.deviceName);
         return 0;
     }
 
@@ -151,13 +263,31 @@ static int score_physical_device(VkPhysicalDevice device, const char **required_
                 goto found;
             }
         }
-        LOG_ERROR("Required extension %s is not supported by vulkan device.\n", *cursor);
+        LOG_ERROR("Required extension %s is not supported by vulkan device \"%s\".\n", *cursor, props.deviceName);
         return 0;
 
         found:
         continue;
     }
 
+    drm_match = "";
+    if (drm_device != NULL) {
+        drm_match = ", can't tell if it's the KMS device (no VK_EXT_physical_device_drm)";
+        for (unsigned i = 0; i < n_available_extensions; i++) {
+            if (strcmp(available_extensions[i].extensionName, VK_EXT_PHYSICAL_DEVICE_DRM_EXTENSION_NAME) == 0) {
+                if (is_same_drm_device(device, *drm_device)) {
+                    drm_match = ", same device as the KMS device";
+                    score += DRM_DEVICE_MATCH_SCORE;
+                } else {
+                    drm_match = ", not the KMS device";
+                }
+                break;
+            }
+        }
+    }
+
+    LOG_DEBUG("vulkan device \"%s\": score %d (%s%s)\n", props.deviceName, score, physical_device_type_name(props.deviceType), drm_match);
+
     return score;
 }
 
@@ -171,20 +301,33 @@ struct vkdev *vkdev_new(
     const char **optional_instance_extensions,
     const char **required_device_extensions,
     const char **optional_device_extensions,
-    const struct debug_messenger *messenger
+    const struct debug_messenger *messenger,
+    int drm_fd
 ) {
     PFN_vkCreateDebugUtilsMessengerEXT create_debug_utils_messenger;
     PFN_vkDestroyDebugUtilsMessengerEXT destroy_debug_utils_messenger;
     VkDebugUtilsMessengerEXT debug_utils_messenger;
-    VkCommandPool graphics_cmd_pool;
+    VkDeviceQueueCreateInfo queue_create_infos[3];
+    VkPhysicalDeviceFeatures available_features;
+    PFN_vkWaitSemaphoresKHR wait_semaphores;
+    PFN_vkGetSemaphoreCounterValueKHR get_semaphore_counter_value;
+    VkSemaphore timelines[3];
+    VkCommandPool graphics_cmd_pool, transfer_cmd_pool, compute_cmd_pool;
+    struct pipeline_cache *pipeline_cache;
+    struct vkalloc *allocator;
+    struct memtrack *memtrack;
     struct vkdev *dev;
     VkInstance instance;
     VkDevice device;
     VkResult ok;
-    VkQueue graphics_queue;
+    VkQueue graphics_queue, transfer_queue, compute_queue;
+    uint32_t n_queue_create_infos;
     uint32_t n_available_layers, n_available_instance_extensions, n_available_device_extensions, n_physical_devices;
     int n_layers, n_instance_extensions, n_device_extensions;
-    int graphics_queue_family_index;
+    int graphics_queue_family_index, transfer_queue_family_index, compute_queue_family_index, err;
+    bool memory_export_supported, memory_budget_supported, has_drm_device;
+    VkPhysicalDeviceProperties best_device_props;
+    struct stat drm_stat;
 
     ok = vkEnumerateInstanceLayerProperties(&n_available_layers, NULL);
     if (ok != VK_SUCCESS) {
@@ -357,11 +500,20 @@ struct vkdev *vkdev_new(
         goto fail_maybe_destroy_messenger;
     }
 
+    has_drm_device = false;
+    if (drm_fd >= 0) {
+        if (fstat(drm_fd, &drm_stat) == 0 && S_ISCHR(drm_stat.st_mode)) {
+            has_drm_device = true;
+        } else {
+            LOG_ERROR("Couldn't stat the DRM device, can't match it to a vulkan device.\n");
+        }
+    }
+
     VkPhysicalDevice best_device = VK_NULL_HANDLE;
     int score = 0;
     for (unsigned i = 0; i < n_physical_devices; i++) {
         VkPhysicalDevice this = physical_devices[i];
-        int this_score = score_physical_device(this, required_device_extensions);
+        int this_score = score_physical_device(this, required_device_extensions, has_drm_device ? &drm_stat.st_rdev : NULL);
         
         if (this_score > score) {
             best_device = this;
@@ -374,6 +526,21 @@ struct vkdev *vkdev_new(
         goto fail_maybe_destroy_messenger;
     }
 
+    vkGetPhysicalDeviceProperties(best_device, &best_device_props);
+    if (has_drm_device && score < DRM_DEVICE_MATCH_SCORE) {
+        LOG_DEBUG(
+            "Using vulkan device \"%s\", but it's not known to be the KMS device. "
+            "Scanout buffers may need to be copied by the display engine.\n",
+            best_device_props.deviceName
+        );
+    } else {
+        LOG_DEBUG(
+            "Using vulkan device \"%s\"%s.\n",
+            best_device_props.deviceName,
+            has_drm_device ? ", since it's the KMS device" : ", since it has the highest score"
+        );
+    }
+
     ok = vkEnumerateDeviceExtensionProperties(best_device, NULL, &n_available_device_extensions, NULL);
     if (ok != VK_SUCCESS) {
         LOG_VK_ERROR(ok, "Could not query device extensions. vkEnumerateDeviceExtensionProperties");
@@ -408,30 +575,86 @@ struct vkdev *vkdev_new(
         continue;
     }
 
+    memory_export_supported = false;
+    memory_budget_supported = false;
+    for (int i = 0; i < n_device_extensions; i++) {
+        if (strcmp(device_extensions[i], VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME) == 0) {
+            memory_export_supported = true;
+        } else if (strcmp(device_extensions[i], VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+            memory_budget_supported = true;
+        }
+    }
+
     graphics_queue_family_index = get_graphics_queue_family_index(best_device);
 
+    // Queues that can do graphics or compute can implicitly do transfers too,
+    // so a dedicated transfer queue is one that can do neither. (That's usually a DMA engine.)
+    transfer_queue_family_index = get_dedicated_queue_family_index(best_device, VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+    compute_queue_family_index = get_dedicated_queue_family_index(best_device, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
+
+    LOG_DEBUG(
+        "queue families: graphics %d, transfer %d%s, compute %d%s\n",
+        graphics_queue_family_index,
+        transfer_queue_family_index >= 0 ? transfer_queue_family_index : graphics_queue_family_index,
+        transfer_queue_family_index >= 0 ? " (dedicated)" : "",
+        compute_queue_family_index >= 0 ? compute_queue_family_index : graphics_queue_family_index,
+        compute_queue_family_index >= 0 ? " (dedicated)" : ""
+    );
+
+    // only used for profiling, so we enable it if it's there but don't require it.
+    vkGetPhysicalDeviceFeatures(best_device, &available_features);
+
+    n_queue_create_infos = 0;
+    queue_create_infos[n_queue_create_infos++] = (VkDeviceQueueCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        .flags = 0,
+        .queueFamilyIndex = graphics_queue_family_index,
+        .queueCount = 1,
+        .pQueuePriorities = (float[1]) { 1.0f },
+        .pNext = NULL,
+    };
+
+    if (transfer_queue_family_index >= 0) {
+        queue_create_infos[n_queue_create_infos++] = (VkDeviceQueueCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .flags = 0,
+            .queueFamilyIndex = transfer_queue_family_index,
+            .queueCount = 1,
+            .pQueuePriorities = (float[1]) { 1.0f },
+            .pNext = NULL,
+        };
+    }
+
+    if (compute_queue_family_index >= 0) {
+        queue_create_infos[n_queue_create_infos++] = (VkDeviceQueueCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .flags = 0,
+            .queueFamilyIndex = compute_queue_family_index,
+            .queueCount = 1,
+            .pQueuePriorities = (float[1]) { 1.0f },
+            .pNext = NULL,
+        };
+    }
+
     ok = vkCreateDevice(
         best_device,
         &(const VkDeviceCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
             .flags = 0,
-            .queueCreateInfoCount = 1,
-            .pQueueCreateInfos = (const VkDeviceQueueCreateInfo[1]) {
-                {
-                    .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-                    .flags = 0,
-                    .queueFamilyIndex = graphics_queue_family_index,
-                    .queueCount = 1,
-                    .pQueuePriorities = (float[1]) { 1.0f },
-                    .pNext = NULL,
-                },
-            },
+            .queueCreateInfoCount = n_queue_create_infos,
+            .pQueueCreateInfos = queue_create_infos,
             .enabledLayerCount = n_layers,
             .ppEnabledLayerNames = layers,
             .enabledExtensionCount = n_device_extensions,
             .ppEnabledExtensionNames = device_extensions,
-            .pEnabledFeatures = &(const VkPhysicalDeviceFeatures) { 0 },
-            .pNext = NULL,
+            .pEnabledFeatures = &(const VkPhysicalDeviceFeatures) {
+                .pipelineStatisticsQuery = available_features.pipelineStatisticsQuery
+            },
+            .pNext = &(const VkPhysicalDeviceTimelineSemaphoreFeatures) {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+                .timelineSemaphore = VK_TRUE,
+                .pNext = NULL,
+            },
         },
         NULL,
         &device
@@ -459,9 +682,109 @@ struct vkdev *vkdev_new(
         goto fail_destroy_device;
     }
 
+    transfer_queue = graphics_queue;
+    transfer_cmd_pool = graphics_cmd_pool;
+    if (transfer_queue_family_index >= 0) {
+        vkGetDeviceQueue(device, transfer_queue_family_index, 0, &transfer_queue);
+
+        ok = vkCreateCommandPool(
+            device,
+            &(const VkCommandPoolCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                .queueFamilyIndex = transfer_queue_family_index,
+                .pNext = NULL,
+            },
+            NULL,
+            &transfer_cmd_pool
+        );
+        if (ok != VK_SUCCESS) {
+            LOG_VK_ERROR(ok, "Could not create command pool for allocating transfer command buffers. vkCreateCommandPool");
+            goto fail_destroy_graphics_cmd_pool;
+        }
+    } else {
+        transfer_queue_family_index = graphics_queue_family_index;
+    }
+
+    compute_queue = graphics_queue;
+    compute_cmd_pool = graphics_cmd_pool;
+    if (compute_queue_family_index >= 0) {
+        vkGetDeviceQueue(device, compute_queue_family_index, 0, &compute_queue);
+
+        ok = vkCreateCommandPool(
+            device,
+            &(const VkCommandPoolCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                .queueFamilyIndex = compute_queue_family_index,
+                .pNext = NULL,
+            },
+            NULL,
+            &compute_cmd_pool
+        );
+        if (ok != VK_SUCCESS) {
+            LOG_VK_ERROR(ok, "Could not create command pool for allocating compute command buffers. vkCreateCommandPool");
+            goto fail_maybe_destroy_transfer_cmd_pool;
+        }
+    } else {
+        compute_queue_family_index = graphics_queue_family_index;
+    }
+
+    // vkdev needs VK_KHR_timeline_semaphore to be in the required device extensions.
+    wait_semaphores = (PFN_vkWaitSemaphoresKHR) vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+    get_semaphore_counter_value = (PFN_vkGetSemaphoreCounterValueKHR) vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+    if (wait_semaphores == NULL || get_semaphore_counter_value == NULL) {
+        LOG_ERROR("Could not resolve timeline semaphore functions. Is VK_KHR_timeline_semaphore enabled?\n");
+        goto fail_maybe_destroy_compute_cmd_pool;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        ok = vkCreateSemaphore(
+            device,
+            &(const VkSemaphoreCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                .flags = 0,
+                .pNext = &(const VkSemaphoreTypeCreateInfo) {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                    .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+                    .initialValue = 0,
+                    .pNext = NULL,
+                },
+            },
+            NULL,
+            timelines + i
+        );
+        if (ok != VK_SUCCESS) {
+            LOG_VK_ERROR(ok, "Could not create timeline semaphore. vkCreateSemaphore");
+            for (int j = 0; j < i; j++) {
+                vkDestroySemaphore(device, timelines[j], NULL);
+            }
+            goto fail_maybe_destroy_compute_cmd_pool;
+        }
+    }
+
+    // shared by all pipelines created on this device.
+    err = pipeline_cache_new(&pipeline_cache, best_device, device, application_name);
+    if (err != 0) {
+        LOG_ERROR("Could not create pipeline cache. pipeline_cache_new: %s\n", strerror(err));
+        goto fail_destroy_timelines;
+    }
+
+    err = vkalloc_new(&allocator, best_device, device, 4 << 20);
+    if (err != 0) {
+        LOG_ERROR("Could not create device memory allocator. vkalloc_new: %s\n", strerror(err));
+        goto fail_destroy_pipeline_cache;
+    }
+
+    err = memtrack_new(&memtrack, best_device, memory_budget_supported);
+    if (err != 0) {
+        LOG_ERROR("Could not create memory accounting. memtrack_new: %s\n", strerror(err));
+        goto fail_destroy_allocator;
+    }
+
     dev = malloc(sizeof *dev);
     if (dev == NULL) {
-        goto fail_destroy_graphics_cmd_pool;
+        goto fail_destroy_memtrack;
     }
 
     dev->device = device;
@@ -470,11 +793,54 @@ struct vkdev *vkdev_new(
     dev->graphics_queue = graphics_queue;
     dev->debug_utils_messenger = debug_utils_messenger;
     dev->graphics_cmd_pool = graphics_cmd_pool;
+    dev->transfer_queue = transfer_queue;
+    dev->compute_queue = compute_queue;
+    dev->transfer_cmd_pool = transfer_cmd_pool;
+    dev->compute_cmd_pool = compute_cmd_pool;
+    dev->graphics_queue_family_index = graphics_queue_family_index;
+    dev->transfer_queue_family_index = transfer_queue_family_index;
+    dev->compute_queue_family_index = compute_queue_family_index;
+    dev->pipeline_statistics_supported = available_features.pipelineStatisticsQuery;
+    dev->memory_export_supported = memory_export_supported;
+    dev->memory_budget_supported = memory_budget_supported;
+    for (int i = 0; i < 3; i++) {
+        dev->timelines[i] = timelines[i];
+        dev->timeline_values[i] = 0;
+    }
+    dev->wait_semaphores = wait_semaphores;
+    dev->get_semaphore_counter_value = get_semaphore_counter_value;
+    dev->pipeline_cache = pipeline_cache;
+    dev->allocator = allocator;
+    dev->memtrack = memtrack;
     dev->create_debug_utils_messenger = create_debug_utils_messenger;
     dev->destroy_debug_utils_messenger = destroy_debug_utils_messenger;
     return dev;
 
 
+    fail_destroy_memtrack:
+    memtrack_destroy(memtrack);
+
+    fail_destroy_allocator:
+    vkalloc_destroy(allocator);
+
+    fail_destroy_pipeline_cache:
+    pipeline_cache_destroy(pipeline_cache);
+
+    fail_destroy_timelines:
+    for (int i = 0; i < 3; i++) {
+        vkDestroySemaphore(device, timelines[i], NULL);
+    }
+
+    fail_maybe_destroy_compute_cmd_pool:
+    if (compute_cmd_pool != graphics_cmd_pool) {
+        vkDestroyCommandPool(device, compute_cmd_pool, NULL);
+    }
+
+    fail_maybe_destroy_transfer_cmd_pool:
+    if (transfer_cmd_pool != graphics_cmd_pool) {
+        vkDestroyCommandPool(device, transfer_cmd_pool, NULL);
+    }
+
     fail_destroy_graphics_cmd_pool:
     vkDestroyCommandPool(device, graphics_cmd_pool, NULL);
 
@@ -492,6 +858,19 @@ struct vkdev *vkdev_new(
 }
 
 void vkdev_destroy(struct vkdev *dev) {
+    pipeline_cache_save(dev->pipeline_cache);
+    pipeline_cache_destroy(dev->pipeline_cache);
+    vkalloc_destroy(dev->allocator);
+    memtrack_destroy(dev->memtrack);
+    for (int i = 0; i < 3; i++) {
+        vkDestroySemaphore(dev->device, dev->timelines[i], NULL);
+    }
+    if (dev->compute_cmd_pool != dev->graphics_cmd_pool) {
+        vkDestroyCommandPool(dev->device, dev->compute_cmd_pool, NULL);
+    }
+    if (dev->transfer_cmd_pool != dev->graphics_cmd_pool) {
+        vkDestroyCommandPool(dev->device, dev->transfer_cmd_pool, NULL);
+    }
     vkDestroyCommandPool(dev->device, dev->graphics_cmd_pool, NULL);
     vkDestroyDevice(dev->device, NULL);
     if (dev->debug_utils_messenger != VK_NULL_HANDLE) {
@@ -501,1641 +880,3598 @@ void vkdev_destroy(struct vkdev *dev) {
     free(dev);
 }
 
+static VkQueue vkdev_get_queue(struct vkdev *dev, enum vkdev_queue queue) {
+    switch (queue) {
+        case VKDEV_QUEUE_TRANSFER: return dev->transfer_queue;
+        case VKDEV_QUEUE_COMPUTE: return dev->compute_queue;
+        case VKDEV_QUEUE_GRAPHICS:
+        default: return dev->graphics_queue;
+    }
+}
 
-
-struct vk_kms_image {
-    struct gbm_bo *bo;
-    int width, height;
-    uint32_t drm_format, gbm_format;
-    uint64_t drm_modifier;
-    VkFormat vk_format;
-    VkImage image;
-    VkDeviceMemory memory;
-};
-
-static int find_mem_type(VkPhysicalDevice phdev, VkMemoryPropertyFlags flags, uint32_t req_bits) {
-    VkPhysicalDeviceMemoryProperties props;
-    vkGetPhysicalDeviceMemoryProperties(phdev, &props);
-
-    for (unsigned i = 0u; i < props.memoryTypeCount; ++i) {
-        if (req_bits & (1 << i)) {
-            if ((props.memoryTypes[i].propertyFlags & flags) == flags) {
-                return i;
-            }
-        }
+static uint32_t vkdev_get_queue_family_index(struct vkdev *dev, enum vkdev_queue queue) {
+    switch (queue) {
+        case VKDEV_QUEUE_TRANSFER: return dev->transfer_queue_family_index;
+        case VKDEV_QUEUE_COMPUTE: return dev->compute_queue_family_index;
+        case VKDEV_QUEUE_GRAPHICS:
+        default: return dev->graphics_queue_family_index;
     }
+}
 
-    return -1;
+static VkCommandPool vkdev_get_cmd_pool(struct vkdev *dev, enum vkdev_queue queue) {
+    switch (queue) {
+        case VKDEV_QUEUE_TRANSFER: return dev->transfer_cmd_pool;
+        case VKDEV_QUEUE_COMPUTE: return dev->compute_cmd_pool;
+        case VKDEV_QUEUE_GRAPHICS:
+        default: return dev->graphics_cmd_pool;
+    }
 }
 
-static struct vk_kms_image *vk_kms_image_new(
+/**
+ * @brief Submit a single command buffer to @a queue.
+ *
+ * The submission waits for @a wait_semaphores before the given stages. Entries of
+ * @a wait_values are the values to wait for on timeline semaphores (like the
+ * timelines of other queues) and are ignored for binary semaphores.
+ * @a signal_semaphores are signalled once the command buffer completes, and so
+ * is the queue's timeline, with the value returned in @a timeline_value_out.
+ *
+ * If the device has no dedicated transfer / compute queue, this submits to the graphics queue.
+ * Queues are externally synchronized, so callers need to make sure they don't submit
+ * to the same queue from multiple threads.
+ */
+static VkResult vkdev_submit(
     struct vkdev *dev,
-    struct gbm_device *gbm_device,
-    int width, int height,
-    VkFormat vk_format,
-    uint32_t gbm_format,
-    uint32_t drm_format, uint64_t drm_modifier
+    enum vkdev_queue queue,
+    VkCommandBuffer cmdbuf,
+    uint32_t n_wait_semaphores,
+    const VkSemaphore *wait_semaphores,
+    const uint64_t *wait_values,
+    const VkPipelineStageFlags *wait_stages,
+    uint32_t n_signal_semaphores,
+    const VkSemaphore *signal_semaphores,
+    uint64_t *timeline_value_out
 ) {
-    PFN_vkGetMemoryFdPropertiesKHR get_memory_fd_props;
-    VkSubresourceLayout layout;
-    struct vk_kms_image *img;
-    VkDeviceMemory img_device_memory;
-    struct gbm_bo *bo;
+    VkSemaphore signal_semaphores_with_timeline[n_signal_semaphores + 1];
+    uint64_t signal_values[n_signal_semaphores + 1];
+    uint64_t timeline_value;
     VkResult ok;
-    VkImage vkimg;
-    int fd;
 
-    ok = vkCreateImage(
-        dev->device,
-        &(VkImageCreateInfo){
-            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-            .flags = 0,
-            .imageType = VK_IMAGE_TYPE_2D,
-            .format = vk_format,
-            .extent = { .width = width, .height = height, .depth = 1 },
-            .mipLevels = 1,
-            .arrayLayers = 1,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT,
-            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-            .queueFamilyIndexCount = 0,
-            .pQueueFamilyIndices = 0,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .pNext =
-                &(VkExternalMemoryImageCreateInfo){
-                    .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
-                    .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
-                    .pNext =
-                        &(VkImageDrmFormatModifierExplicitCreateInfoEXT){
-                            .sType = VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT,
-                            .drmFormatModifierPlaneCount = 1,
-                            .drmFormatModifier = drm_modifier,
-                            .pPlaneLayouts =
-                                (VkSubresourceLayout[1]){
-                                    {
-                                        .offset = 0,
-                                        .size = 0,
-                                        .rowPitch = 0,
-                                        .arrayPitch = 0,
-                                        .depthPitch = 0,
-                                    },
-                                },
-                        },
-                },
+    timeline_value = dev->timeline_values[queue] + 1;
+
+    for (uint32_t i = 0; i < n_signal_semaphores; i++) {
+        signal_semaphores_with_timeline[i] = signal_semaphores[i];
+        signal_values[i] = 0;
+    }
+    signal_semaphores_with_timeline[n_signal_semaphores] = dev->timelines[queue];
+    signal_values[n_signal_semaphores] = timeline_value;
+
+    ok = vkQueueSubmit(
+        vkdev_get_queue(dev, queue),
+        1,
+        &(const VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .waitSemaphoreCount = n_wait_semaphores,
+            .pWaitSemaphores = wait_semaphores,
+            .pWaitDstStageMask = wait_stages,
+            .commandBufferCount = cmdbuf != VK_NULL_HANDLE ? 1 : 0,
+            .pCommandBuffers = &cmdbuf,
+            .signalSemaphoreCount = n_signal_semaphores + 1,
+            .pSignalSemaphores = signal_semaphores_with_timeline,
+            .pNext = &(const VkTimelineSemaphoreSubmitInfo) {
+                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                .waitSemaphoreValueCount = wait_values != NULL ? n_wait_semaphores : 0,
+                .pWaitSemaphoreValues = wait_values,
+                .signalSemaphoreValueCount = n_signal_semaphores + 1,
+                .pSignalSemaphoreValues = signal_values,
+                .pNext = NULL,
+            },
         },
-        NULL,
-        &vkimg
+        VK_NULL_HANDLE
     );
     if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Could not create Vulkan image. vkCreateImage");
-        return NULL;
+        LOG_VK_ERROR(ok, "Couldn't submit command buffer. vkQueueSubmit");
+        return ok;
     }
 
-    vkGetImageSubresourceLayout(
+    dev->timeline_values[queue] = timeline_value;
+    if (timeline_value_out != NULL) {
+        *timeline_value_out = timeline_value;
+    }
+
+    return VK_SUCCESS;
+}
+
+/**
+ * @brief Wait until the submission to @a queue that signalled @a value has completed.
+ */
+static VkResult vkdev_wait(struct vkdev *dev, enum vkdev_queue queue, uint64_t value, uint64_t timeout_ns) {
+    return dev->wait_semaphores(
         dev->device,
-        vkimg,
-        &(VkImageSubresource){
-            .aspectMask = VK_IMAGE_ASPECT_MEMORY_PLANE_0_BIT_EXT,  // For v3dv, this doesn't really matter
-            .mipLevel = 0,
-            .arrayLayer = 0,
+        &(const VkSemaphoreWaitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .flags = 0,
+            .semaphoreCount = 1,
+            .pSemaphores = &dev->timelines[queue],
+            .pValues = &value,
+            .pNext = NULL,
         },
-        &layout
+        timeout_ns
     );
+}
 
-    bo = gbm_bo_create_with_modifiers(
-        gbm_device,
-        width,
-        height,
-        gbm_format,
-        &drm_modifier,
-        1
-    );
-    if (bo == NULL) {
-        LOG_ERROR("Could not create GBM BO. gbm_bo_create_with_modifiers: %s\n", strerror(errno));
-        goto fail_destroy_image;
-    }
+/**
+ * @brief Get the value of the last completed submission to @a queue.
+ * Every submission with a value less or equal to that has completed too.
+ */
+static uint64_t vkdev_get_completed_value(struct vkdev *dev, enum vkdev_queue queue) {
+    uint64_t value;
+    VkResult ok;
 
-    if (gbm_bo_get_offset(bo, 0) != layout.offset) {
-        LOG_ERROR("GBM BO layout doesn't match image layout. This is probably a driver / kernel bug.\n");
-        goto fail_destroy_bo;
+    ok = dev->get_semaphore_counter_value(dev->device, dev->timelines[queue], &value);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't query timeline semaphore value. vkGetSemaphoreCounterValueKHR");
+        return 0;
     }
 
-    if (gbm_bo_get_stride_for_plane(bo, 0) != layout.rowPitch) {
-        LOG_ERROR("GBM BO layout doesn't match image layout. This is probably a driver / kernel bug.\n");
-        goto fail_destroy_bo;
-    }
-
-    fd = gbm_bo_get_fd(bo);
-    if (fd < 0) {
-        LOG_ERROR("Couldn't get dmabuf fd for GBM buffer. gbm_bo_get_fd: %s\n", strerror(errno));
-        goto fail_destroy_bo;
-    }
-
-    // find out as which memory types we can import our dmabuf fd
-    VkMemoryFdPropertiesKHR fd_memory_props = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR,
-        .pNext = NULL,
-        .memoryTypeBits = 0,
-    };
+    return value;
+}
 
-    get_memory_fd_props = (PFN_vkGetMemoryFdPropertiesKHR) vkGetDeviceProcAddr(dev->device, "vkGetMemoryFdPropertiesKHR");
-    if (get_memory_fd_props == NULL) {
-        LOG_ERROR("Couldn't resolve vkGetMemoryFdPropertiesKHR.\n");
-        goto fail_destroy_bo;
-    }
+/**
+ * @brief Record the release half of a queue family ownership transfer of @a buffer
+ * from @a src_queue to @a dst_queue. Needs to be recorded in a command buffer
+ * submitted to @a src_queue, and followed by @ref vkdev_cmd_acquire_buffer on
+ * @a dst_queue, with a semaphore in between.
+ *
+ * If both queues are of the same family, no ownership transfer is necessary and
+ * the semaphore alone is enough, so nothing is recorded.
+ */
+static void vkdev_cmd_release_buffer(
+    struct vkdev *dev,
+    VkCommandBuffer cmdbuf,
+    VkBuffer buffer,
+    enum vkdev_queue src_queue,
+    enum vkdev_queue dst_queue,
+    VkPipelineStageFlags src_stages,
+    VkAccessFlags src_access
+) {
+    uint32_t src_family = vkdev_get_queue_family_index(dev, src_queue);
+    uint32_t dst_family = vkdev_get_queue_family_index(dev, dst_queue);
 
-    ok = get_memory_fd_props(
-        dev->device,
-        VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
-        fd,
-        &fd_memory_props
-    );
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't get dmabuf memory properties. vkGetMemoryFdPropertiesKHR");
-        goto fail_destroy_bo;
+    if (src_family == dst_family) {
+        return;
     }
 
-    // Find out the memory requirements for our image (the supported memory types for import)
-    VkMemoryRequirements2 image_memory_reqs = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
-        .memoryRequirements = { 0 },
-        .pNext = NULL
-    };
-
-    vkGetImageMemoryRequirements2(
-        dev->device,
-        &(VkImageMemoryRequirementsInfo2) {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
-            .image = vkimg,
+    vkCmdPipelineBarrier(
+        cmdbuf,
+        src_stages,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0, NULL,
+        1,
+        &(const VkBufferMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = src_access,
+            .dstAccessMask = 0,
+            .srcQueueFamilyIndex = src_family,
+            .dstQueueFamilyIndex = dst_family,
+            .buffer = buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
             .pNext = NULL,
         },
-        &image_memory_reqs
+        0, NULL
     );
+}
 
-    // Find a memory type that fits both to the dmabuf and the image
-    int mem = find_mem_type(dev->physical_device, 0, image_memory_reqs.memoryRequirements.memoryTypeBits & fd_memory_props.memoryTypeBits);
-    if (mem < 0) {
-        LOG_ERROR("Couldn't find a memory type that's both supported by the image and the dmabuffer.\n");
-        goto fail_destroy_bo;
+/**
+ * @brief Record the acquire half of a queue family ownership transfer of @a buffer.
+ * See @ref vkdev_cmd_release_buffer.
+ */
+static void vkdev_cmd_acquire_buffer(
+    struct vkdev *dev,
+    VkCommandBuffer cmdbuf,
+    VkBuffer buffer,
+    enum vkdev_queue src_queue,
+    enum vkdev_queue dst_queue,
+    VkPipelineStageFlags dst_stages,
+    VkAccessFlags dst_access
+) {
+    uint32_t src_family = vkdev_get_queue_family_index(dev, src_queue);
+    uint32_t dst_family = vkdev_get_queue_family_index(dev, dst_queue);
+
+    if (src_family == dst_family) {
+        return;
     }
 
-    // now, create a VkDeviceMemory instance from our dmabuf.
-    ok = vkAllocateMemory(
-        dev->device,
-        &(VkMemoryAllocateInfo) {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .allocationSize = layout.size,
-            .memoryTypeIndex = mem,
-            .pNext = &(VkImportMemoryFdInfoKHR) {
-                .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
-                .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
-                .fd = fd,
-                .pNext = &(VkMemoryDedicatedAllocateInfo) {
-                    .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
-                    .image = vkimg,
-                    .buffer = VK_NULL_HANDLE,
-                    .pNext = NULL,
-                },
-            },
+    vkCmdPipelineBarrier(
+        cmdbuf,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        dst_stages,
+        0,
+        0, NULL,
+        1,
+        &(const VkBufferMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = dst_access,
+            .srcQueueFamilyIndex = src_family,
+            .dstQueueFamilyIndex = dst_family,
+            .buffer = buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+            .pNext = NULL,
         },
-        NULL,
-        &img_device_memory
+        0, NULL
     );
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't import dmabuf as vulkan device memory. vkAllocateMemory");
-        goto fail_destroy_bo;
+}
+
+/**
+ * @brief Like @ref vkdev_cmd_release_buffer, but for images. The layout transition from
+ * @a old_layout to @a new_layout happens as part of the ownership transfer, so the same
+ * layouts need to be passed to @ref vkdev_cmd_acquire_image.
+ *
+ * If both queues are of the same family, only the layout transition is recorded here.
+ */
+static void vkdev_cmd_release_image(
+    struct vkdev *dev,
+    VkCommandBuffer cmdbuf,
+    VkImage image,
+    VkImageAspectFlags aspect,
+    VkImageLayout old_layout,
+    VkImageLayout new_layout,
+    enum vkdev_queue src_queue,
+    enum vkdev_queue dst_queue,
+    VkPipelineStageFlags src_stages,
+    VkAccessFlags src_access
+) {
+    uint32_t src_family = vkdev_get_queue_family_index(dev, src_queue);
+    uint32_t dst_family = vkdev_get_queue_family_index(dev, dst_queue);
+
+    if (src_family == dst_family && old_layout == new_layout) {
+        return;
     }
 
-    ok = vkBindImageMemory2(
-        dev->device,
+    vkCmdPipelineBarrier(
+        cmdbuf,
+        src_stages,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0, NULL,
+        0, NULL,
         1,
-        &(VkBindImageMemoryInfo){
-            .sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
-            .image = vkimg,
-            .memory = img_device_memory,
-            .memoryOffset = 0,
+        &(const VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = src_access,
+            .dstAccessMask = 0,
+            .oldLayout = old_layout,
+            .newLayout = new_layout,
+            .srcQueueFamilyIndex = src_family == dst_family ? VK_QUEUE_FAMILY_IGNORED : src_family,
+            .dstQueueFamilyIndex = src_family == dst_family ? VK_QUEUE_FAMILY_IGNORED : dst_family,
+            .image = image,
+            .subresourceRange = {
+                .aspectMask = aspect,
+                .baseMipLevel = 0,
+                .levelCount = VK_REMAINING_MIP_LEVELS,
+                .baseArrayLayer = 0,
+                .layerCount = VK_REMAINING_ARRAY_LAYERS,
+            },
             .pNext = NULL,
         }
     );
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't bind dmabuf-backed vulkan device memory to vulkan image. vkBindImageMemory2");
-        goto fail_free_device_memory;
-    }
+}
 
-    img = malloc(sizeof *img);
-    if (img == NULL) {
-        goto fail_free_device_memory;
+/**
+ * @brief Record the acquire half of a queue family ownership transfer of @a image.
+ * See @ref vkdev_cmd_release_image.
+ */
+static void vkdev_cmd_acquire_image(
+    struct vkdev *dev,
+    VkCommandBuffer cmdbuf,
+    VkImage image,
+    VkImageAspectFlags aspect,
+    VkImageLayout old_layout,
+    VkImageLayout new_layout,
+    enum vkdev_queue src_queue,
+    enum vkdev_queue dst_queue,
+    VkPipelineStageFlags dst_stages,
+    VkAccessFlags dst_access
+) {
+    uint32_t src_family = vkdev_get_queue_family_index(dev, src_queue);
+    uint32_t dst_family = vkdev_get_queue_family_index(dev, dst_queue);
+
+    if (src_family == dst_family) {
+        return;
     }
 
-    img->bo = bo;
-    img->memory = img_device_memory;
-    img->image = vkimg;
-    img->width = width;
-    img->height = height;
-    img->drm_format = drm_format;
-    img->gbm_format = gbm_format;
-    img->drm_modifier = drm_modifier;
-    img->vk_format = vk_format;
-    return img;
+    vkCmdPipelineBarrier(
+        cmdbuf,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        dst_stages,
+        0,
+        0, NULL,
+        0, NULL,
+        1,
+        &(const VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = dst_access,
+            .oldLayout = old_layout,
+            .newLayout = new_layout,
+            .srcQueueFamilyIndex = src_family,
+            .dstQueueFamilyIndex = dst_family,
+            .image = image,
+            .subresourceRange = {
+                .aspectMask = aspect,
+                .baseMipLevel = 0,
+                .levelCount = VK_REMAINING_MIP_LEVELS,
+                .baseArrayLayer = 0,
+                .layerCount = VK_REMAINING_ARRAY_LAYERS,
+            },
+            .pNext = NULL,
+        }
+    );
+}
 
 
-    fail_free_device_memory:
-    vkFreeMemory(dev->device, img_device_memory, NULL);
+/**
+ * @brief Allocate & bind memory for a buffer that's not specific to any output,
+ * and account for it in @ref memtrack.
+ */
+static VkResult vkdev_alloc_buffer_memory(struct vkdev *dev, VkBuffer buffer, VkMemoryPropertyFlags flags, struct vkalloc_allocation *allocation_out) {
+    VkResult ok;
 
-    fail_destroy_bo:
-    gbm_bo_destroy(bo);
+    ok = vkalloc_alloc_buffer_memory(dev->allocator, buffer, flags, allocation_out);
+    if (ok != VK_SUCCESS) {
+        return ok;
+    }
 
-    fail_destroy_image:
-    vkDestroyImage(dev->device, vkimg, NULL);
-    return NULL;
+    memtrack_add(dev->memtrack, MEMTRACK_NO_OUTPUT, MEMTRACK_KIND_BUFFER, allocation_out->memory_type, allocation_out->size);
+    return VK_SUCCESS;
 }
 
-static void vk_kms_image_destroy(struct vk_kms_image *img, VkDevice device) {
-    vkFreeMemory(device, img->memory, NULL);
-    gbm_bo_destroy(img->bo);
-    vkDestroyImage(device, img->image, NULL);
-    free(img);
+static void vkdev_free_buffer_memory(struct vkdev *dev, struct vkalloc_allocation *allocation) {
+    memtrack_remove(dev->memtrack, MEMTRACK_NO_OUTPUT, MEMTRACK_KIND_BUFFER, allocation->memory_type, allocation->size);
+    vkalloc_free(dev->allocator, allocation);
 }
 
-
-struct pipeline_fb {
-    int width, height;
-    VkImageView view;
-    VkFramebuffer fb;
-};
-
-static struct pipeline_fb *pipeline_fb_new(struct vkdev *dev, struct vk_kms_image *image, VkRenderPass renderpass) {
-    struct pipeline_fb *fb;
-    VkFramebuffer vkfb;
-    VkImageView view;
+static VkCommandBuffer vkdev_begin_one_time_cmdbuf(struct vkdev *dev, enum vkdev_queue queue) {
+    VkCommandBuffer cmdbuf;
     VkResult ok;
 
-    ok = vkCreateImageView(
+    ok = vkAllocateCommandBuffers(
         dev->device,
-        &(const VkImageViewCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            .flags = 0,
-            .image = image->image,
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = image->vk_format,
-            .components = {
-                .r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                .a = VK_COMPONENT_SWIZZLE_IDENTITY,
-            },
-            .subresourceRange = {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .baseMipLevel = 0,
-                .levelCount = 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            },
+        &(const VkCommandBufferAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = vkdev_get_cmd_pool(dev, queue),
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
             .pNext = NULL,
         },
-        NULL,
-        &view
+        &cmdbuf
     );
     if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Could not create image view. vkCreateImageView");
-        return NULL;
+        LOG_VK_ERROR(ok, "Couldn't allocate command buffer. vkAllocateCommandBuffers");
+        return VK_NULL_HANDLE;
     }
 
-    ok = vkCreateFramebuffer(
-        dev->device,
-        &(const VkFramebufferCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .flags = 0,
-            .renderPass = renderpass,
-            .attachmentCount = 1,
-            .pAttachments = (VkImageView[]) { view },
-            .width = image->width,
-            .height = image->height,
-            .layers = 1,
+    ok = vkBeginCommandBuffer(
+        cmdbuf,
+        &(const VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+            .pInheritanceInfo = NULL,
             .pNext = NULL,
-        },
-        NULL,
-        &vkfb
+        }
     );
     if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Could not create framebuffer. vkCreateFramebuffer");
-        return NULL;
-    }
-
-    fb = malloc(sizeof *fb);
-    if (fb == NULL) {
-        goto fail_destroy_vkfb;
+        LOG_VK_ERROR(ok, "Couldn't begin command buffer. vkBeginCommandBuffer");
+        vkFreeCommandBuffers(dev->device, vkdev_get_cmd_pool(dev, queue), 1, &cmdbuf);
+        return VK_NULL_HANDLE;
     }
 
-    fb->fb = vkfb;
-    fb->view = view;
-    fb->width = image->width;
-    fb->height = image->height;
-    return fb;
-
-
-    fail_destroy_vkfb:
-    vkDestroyFramebuffer(dev->device, vkfb, NULL);
-
-    fail_destroy_image_view:
-    vkDestroyImageView(dev->device, view, NULL);
-    return NULL;
-}
-
-static void pipeline_fb_destroy(struct pipeline_fb *fb, VkDevice device) {
-    vkDestroyFramebuffer(device, fb->fb, NULL);
-    vkDestroyImageView(device, fb->view, NULL);
-    free(fb);
+    return cmdbuf;
 }
 
-
-struct cube_ubo_data {
-    ESMatrix modelview;
-    ESMatrix modelviewprojection;
-    float normal[12];
-};
-
-struct cube_gpu_data {
-    struct cube_ubo_data ubo;
-    float vertices[3*4*6];
-    float colors[3*4*6];
-    float normals[3*4*6];
-};
-
-struct cube_gpu_buffer {
-    VkBuffer buffer;
-    VkDeviceMemory memory;
-    VkDescriptorSet descriptor_set;
-    VkDescriptorPool descriptor_pool;
-    struct cube_gpu_data *mapped;
-};
-
-static struct cube_gpu_buffer *cube_gpu_buffer_new(struct vkdev *dev, VkDescriptorSetLayout ubo_layout) {
-    struct cube_gpu_data *mapped;
-    VkDescriptorPool descriptor_pool;
-    struct cube_gpu_buffer *ubo;
-    VkDescriptorSet descriptor_set;
-    VkDeviceMemory mem;
-    VkBuffer buffer;
+/**
+ * @brief Copy @a size bytes of @a data into the (usually device-local, not host visible)
+ * @a buffer using a staging buffer and the transfer queue, and hand the buffer over to the
+ * graphics queue for access with @a dst_access in @a dst_stages.
+ *
+ * Blocks until the copy is done, so this is meant for static data uploaded on startup.
+ * Uses the transfer and graphics command pools, so nothing else may use them concurrently.
+ */
+static VkResult vkdev_upload_buffer(
+    struct vkdev *dev,
+    VkBuffer buffer,
+    const void *data,
+    VkDeviceSize size,
+    VkPipelineStageFlags dst_stages,
+    VkAccessFlags dst_access
+) {
+    struct vkalloc_allocation staging_memory;
+    VkCommandBuffer transfer_cmdbuf, graphics_cmdbuf;
+    VkBuffer staging_buffer;
+    uint64_t transfer_value, graphics_value;
     VkResult ok;
+    bool same_family;
+
+    same_family = vkdev_get_queue_family_index(dev, VKDEV_QUEUE_TRANSFER) == vkdev_get_queue_family_index(dev, VKDEV_QUEUE_GRAPHICS);
 
     ok = vkCreateBuffer(
         dev->device,
         &(VkBufferCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = sizeof(struct cube_gpu_data),
-            .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
-                     VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            .size = size,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
             .flags = 0
         },
         NULL,
-        &buffer
+        &staging_buffer
     );
     if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't create uniform / vertex buffer. vkCreateBuffer");
-        return NULL;
+        LOG_VK_ERROR(ok, "Couldn't create staging buffer. vkCreateBuffer");
+        return ok;
     }
 
-    VkMemoryRequirements reqs;
-    vkGetBufferMemoryRequirements(dev->device, buffer, &reqs);
-
-    VkDeviceSize mem_size = reqs.size < sizeof(struct cube_gpu_data) ? sizeof(struct cube_gpu_data) : reqs.size;
+    ok = vkdev_alloc_buffer_memory(dev, staging_buffer, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &staging_memory);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't allocate memory for staging buffer. vkdev_alloc_buffer_memory");
+        goto fail_destroy_staging_buffer;
+    }
 
-    int memory_type = find_mem_type(dev->physical_device, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, reqs.memoryTypeBits);
-    if (memory_type < 0) {
-        LOG_ERROR("Couldn't find a memory type that is accessible from host and coherent.\n");
-        goto fail_destroy_buffer;
+    memcpy(staging_memory.mapped, data, size);
+
+    transfer_cmdbuf = vkdev_begin_one_time_cmdbuf(dev, VKDEV_QUEUE_TRANSFER);
+    if (transfer_cmdbuf == VK_NULL_HANDLE) {
+        ok = VK_ERROR_OUT_OF_HOST_MEMORY;
+        goto fail_free_staging_memory;
     }
 
-    ok = vkAllocateMemory(
-        dev->device,
-        &(const VkMemoryAllocateInfo) {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .allocationSize = mem_size,
-            .memoryTypeIndex = memory_type,
-            .pNext = NULL
-        },
-        NULL,
-        &mem
-    );
+    vkCmdCopyBuffer(transfer_cmdbuf, staging_buffer, buffer, 1, &(const VkBufferCopy) { .srcOffset = 0, .dstOffset = 0, .size = size });
+
+    if (same_family) {
+        // the transfer queue is the graphics queue, so a plain barrier is enough.
+        vkCmdPipelineBarrier(
+            transfer_cmdbuf,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            dst_stages,
+            0,
+            0, NULL,
+            1,
+            &(const VkBufferMemoryBarrier) {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = dst_access,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = buffer,
+                .offset = 0,
+                .size = VK_WHOLE_SIZE,
+                .pNext = NULL,
+            },
+            0, NULL
+        );
+    } else {
+        vkdev_cmd_release_buffer(dev, transfer_cmdbuf, buffer, VKDEV_QUEUE_TRANSFER, VKDEV_QUEUE_GRAPHICS, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+    }
+
+    ok = vkEndCommandBuffer(transfer_cmdbuf);
     if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't allocate memory for uniform / vertex buffer. vkAllocateMemory");
-        goto fail_destroy_buffer;
+        LOG_VK_ERROR(ok, "Couldn't finish recording upload commands. vkEndCommandBuffer");
+        goto fail_free_transfer_cmdbuf;
     }
 
-    ok = vkMapMemory(dev->device, mem, 0, mem_size, 0, (void**) &mapped);
+    ok = vkdev_submit(dev, VKDEV_QUEUE_TRANSFER, transfer_cmdbuf, 0, NULL, NULL, NULL, 0, NULL, &transfer_value);
     if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't map uniform / vertex buffer. vkMapMemory");
-        goto fail_free_device_mem;
+        goto fail_free_transfer_cmdbuf;
     }
 
-    // clang-format off
-    static const float vertices[] = {
-        // front
-        -1.0f, -1.0f, +1.0f, // point blue
-        +1.0f, -1.0f, +1.0f, // point magenta
-        -1.0f, +1.0f, +1.0f, // point cyan
-        +1.0f, +1.0f, +1.0f, // point white
-        // back
-        +1.0f, -1.0f, -1.0f, // point red
-        -1.0f, -1.0f, -1.0f, // point black
-        +1.0f, +1.0f, -1.0f, // point yellow
-        -1.0f, +1.0f, -1.0f, // point green
-        // right
-        +1.0f, -1.0f, +1.0f, // point magenta
-        +1.0f, -1.0f, -1.0f, // point red
-        +1.0f, +1.0f, +1.0f, // point white
-        +1.0f, +1.0f, -1.0f, // point yellow
-        // left
-        -1.0f, -1.0f, -1.0f, // point black
-        -1.0f, -1.0f, +1.0f, // point blue
-        -1.0f, +1.0f, -1.0f, // point green
-        -1.0f, +1.0f, +1.0f, // point cyan
-        // top
-        -1.0f, +1.0f, +1.0f, // point cyan
-        +1.0f, +1.0f, +1.0f, // point white
-        -1.0f, +1.0f, -1.0f, // point green
-        +1.0f, +1.0f, -1.0f, // point yellow
-        // bottom
-        -1.0f, -1.0f, -1.0f, // point black
-        +1.0f, -1.0f, -1.0f, // point red
-        -1.0f, -1.0f, +1.0f, // point blue
-        +1.0f, -1.0f, +1.0f  // point magenta
-    };
+    graphics_cmdbuf = VK_NULL_HANDLE;
+    if (!same_family) {
+        graphics_cmdbuf = vkdev_begin_one_time_cmdbuf(dev, VKDEV_QUEUE_GRAPHICS);
+        if (graphics_cmdbuf == VK_NULL_HANDLE) {
+            ok = VK_ERROR_OUT_OF_HOST_MEMORY;
+            goto fail_wait_transfer;
+        }
 
-    static const float colors[] = {
-        // front
-        0.0f,  0.0f,  1.0f, // blue
-        1.0f,  0.0f,  1.0f, // magenta
-        0.0f,  1.0f,  1.0f, // cyan
-        1.0f,  1.0f,  1.0f, // white
-        // back
-        1.0f,  0.0f,  0.0f, // red
-        0.0f,  0.0f,  0.0f, // black
-        1.0f,  1.0f,  0.0f, // yellow
-        0.0f,  1.0f,  0.0f, // green
-        // right
-        1.0f,  0.0f,  1.0f, // magenta
-        1.0f,  0.0f,  0.0f, // red
-        1.0f,  1.0f,  1.0f, // white
-        1.0f,  1.0f,  0.0f, // yellow
-        // left
-        0.0f,  0.0f,  0.0f, // black
-        0.0f,  0.0f,  1.0f, // blue
-        0.0f,  1.0f,  0.0f, // green
-        0.0f,  1.0f,  1.0f, // cyan
-        // top
-        0.0f,  1.0f,  1.0f, // cyan
-        1.0f,  1.0f,  1.0f, // white
-        0.0f,  1.0f,  0.0f, // green
-        1.0f,  1.0f,  0.0f, // yellow
-        // bottom
-        0.0f,  0.0f,  0.0f, // black
-        1.0f,  0.0f,  0.0f, // red
-        0.0f,  0.0f,  1.0f, // blue
-        1.0f,  0.0f,  1.0f  // magenta
-    };
+        vkdev_cmd_acquire_buffer(dev, graphics_cmdbuf, buffer, VKDEV_QUEUE_TRANSFER, VKDEV_QUEUE_GRAPHICS, dst_stages, dst_access);
 
-    static const float normals[] = {
-        // front
-        +0.0f, +0.0f, +1.0f, // forward
-        +0.0f, +0.0f, +1.0f, // forward
-        +0.0f, +0.0f, +1.0f, // forward
-        +0.0f, +0.0f, +1.0f, // forward
-        // back
-        +0.0f, +0.0f, -1.0f, // backbard
-        +0.0f, +0.0f, -1.0f, // backbard
-        +0.0f, +0.0f, -1.0f, // backbard
-        +0.0f, +0.0f, -1.0f, // backbard
-        // right
-        +1.0f, +0.0f, +0.0f, // right
-        +1.0f, +0.0f, +0.0f, // right
-        +1.0f, +0.0f, +0.0f, // right
-        +1.0f, +0.0f, +0.0f, // right
-        // left
-        -1.0f, +0.0f, +0.0f, // left
-        -1.0f, +0.0f, +0.0f, // left
-        -1.0f, +0.0f, +0.0f, // left
-        -1.0f, +0.0f, +0.0f, // left
-        // top
-        +0.0f, +1.0f, +0.0f, // up
-        +0.0f, +1.0f, +0.0f, // up
-        +0.0f, +1.0f, +0.0f, // up
-        +0.0f, +1.0f, +0.0f, // up
-        // bottom
-        +0.0f, -1.0f, +0.0f, // down
-        +0.0f, -1.0f, +0.0f, // down
-        +0.0f, -1.0f, +0.0f, // down
-        +0.0f, -1.0f, +0.0f  // down
-    };
-    // clang-format on
+        ok = vkEndCommandBuffer(graphics_cmdbuf);
+        if (ok != VK_SUCCESS) {
+            LOG_VK_ERROR(ok, "Couldn't finish recording upload commands. vkEndCommandBuffer");
+            goto fail_free_graphics_cmdbuf;
+        }
 
-    memcpy(mapped->vertices, vertices, sizeof(vertices));
-    memcpy(mapped->colors, colors, sizeof(colors));
-    memcpy(mapped->normals, normals, sizeof(normals));
+        ok = vkdev_submit(
+            dev, VKDEV_QUEUE_GRAPHICS, graphics_cmdbuf,
+            1, &dev->timelines[VKDEV_QUEUE_TRANSFER], &transfer_value, &dst_stages,
+            0, NULL,
+            &graphics_value
+        );
+        if (ok != VK_SUCCESS) {
+            goto fail_free_graphics_cmdbuf;
+        }
 
-    ok = vkBindBufferMemory(dev->device, buffer, mem, 0);
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't bind device memory to vertex / uniform buffer. vkBindBufferMemory");
-        goto fail_unmap_mem;
-    }
+        ok = vkdev_wait(dev, VKDEV_QUEUE_GRAPHICS, graphics_value, UINT64_MAX);
+        if (ok != VK_SUCCESS) {
+            LOG_VK_ERROR(ok, "Couldn't wait for buffer upload. vkWaitSemaphoresKHR");
+            goto fail_free_graphics_cmdbuf;
+        }
 
-    ok = vkCreateDescriptorPool(
-        dev->device,
-        &(const VkDescriptorPoolCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-            .flags = 0,
-            .maxSets = 1,
-            .poolSizeCount = 1,
-            .pPoolSizes = &(const VkDescriptorPoolSize) {
-                .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .descriptorCount = 1
-            },
-            .pNext = NULL,
-        },
-        NULL,
-        &descriptor_pool
-    );
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't create a descriptor pool for allocating the uniform / vertex buffer descriptor set. vkCreateDescriptorPool");
-        goto fail_unmap_mem;
+        vkFreeCommandBuffers(dev->device, vkdev_get_cmd_pool(dev, VKDEV_QUEUE_GRAPHICS), 1, &graphics_cmdbuf);
     }
 
-    ok = vkAllocateDescriptorSets(
-        dev->device,
-        &(const VkDescriptorSetAllocateInfo) {
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-            .descriptorPool = descriptor_pool,
-            .descriptorSetCount = 1,
-            .pSetLayouts = &ubo_layout,
-        },
-        &descriptor_set
-    );
+    ok = vkdev_wait(dev, VKDEV_QUEUE_TRANSFER, transfer_value, UINT64_MAX);
     if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't allocate a descriptor set for uniform / vertex buffer. vkAllocateDescriptorSets");
-        goto fail_destroy_descriptor_pool;
-    }
-
-    vkUpdateDescriptorSets(
-        dev->device,
-        1,
-        (const VkWriteDescriptorSet []) {
-            {
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = descriptor_set,
-                .dstBinding = 0,
-                .dstArrayElement = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .pImageInfo = NULL,
-                .pBufferInfo = &(VkDescriptorBufferInfo) {
-                    .buffer = buffer,
-                    .offset = 0,
-                    .range = sizeof(struct cube_ubo_data),
-                },
-                .pTexelBufferView = NULL,
-                .pNext = NULL,
-            }
-        },
-        0,
-        NULL
-    );
-
-    ubo = malloc(sizeof *ubo);
-    if (ubo == NULL) {
-        goto fail_free_descriptor_set;
+        LOG_VK_ERROR(ok, "Couldn't wait for buffer upload. vkWaitSemaphoresKHR");
+        goto fail_wait_transfer;
     }
 
-    ubo->buffer = buffer;
-    ubo->memory = mem;
-    ubo->descriptor_pool = descriptor_pool;
-    ubo->descriptor_set = descriptor_set;
-    ubo->mapped = mapped;
-    return ubo;
+    vkFreeCommandBuffers(dev->device, vkdev_get_cmd_pool(dev, VKDEV_QUEUE_TRANSFER), 1, &transfer_cmdbuf);
+    vkdev_free_buffer_memory(dev, &staging_memory);
+    vkDestroyBuffer(dev->device, staging_buffer, NULL);
+    return VK_SUCCESS;
 
 
-    fail_free_descriptor_set:
-    vkFreeDescriptorSets(dev->device, descriptor_pool, 1, &descriptor_set);
-
-    fail_destroy_descriptor_pool:
-    vkDestroyDescriptorPool(dev->device, descriptor_pool, NULL);
+    fail_free_graphics_cmdbuf:
+    vkQueueWaitIdle(dev->graphics_queue);
+    vkFreeCommandBuffers(dev->device, vkdev_get_cmd_pool(dev, VKDEV_QUEUE_GRAPHICS), 1, &graphics_cmdbuf);
 
-    fail_unmap_mem:
-    vkUnmapMemory(dev->device, mem);
+    fail_wait_transfer:
+    // the copy might still be reading from the staging buffer.
+    vkQueueWaitIdle(dev->transfer_queue);
 
-    fail_free_device_mem:
-    vkFreeMemory(dev->device, mem, NULL);
+    fail_free_transfer_cmdbuf:
+    vkFreeCommandBuffers(dev->device, vkdev_get_cmd_pool(dev, VKDEV_QUEUE_TRANSFER), 1, &transfer_cmdbuf);
 
-    fail_destroy_buffer:
-    vkDestroyBuffer(dev->device, buffer, NULL);
-    return NULL;
-}
+    fail_free_staging_memory:
+    vkdev_free_buffer_memory(dev, &staging_memory);
 
-static void cube_gpu_buffer_destroy(struct cube_gpu_buffer *ubo, VkDevice device) {
-    vkFreeDescriptorSets(device, ubo->descriptor_pool, 1, &ubo->descriptor_set);
-    vkDestroyDescriptorPool(device, ubo->descriptor_pool, NULL);
-    vkUnmapMemory(device, ubo->memory);
-    vkFreeMemory(device, ubo->memory, NULL);
-    vkDestroyBuffer(device, ubo->buffer, NULL);
-    free(ubo);
+    fail_destroy_staging_buffer:
+    vkDestroyBuffer(dev->device, staging_buffer, NULL);
+    return ok;
 }
 
-static void cube_gpu_buffer_update_transforms(struct cube_gpu_buffer *buf, struct timeval start_time, float aspect_ratio) {
-    struct cube_ubo_data ubo;
-    struct timeval tv;
-    uint64_t t;
-
-    gettimeofday(&tv, NULL);
-
-    t = ((tv.tv_sec * 1000 + tv.tv_usec / 1000) -
-            (start_time.tv_sec * 1000 + start_time.tv_usec / 1000)) / 5;
 
-    esMatrixLoadIdentity(&ubo.modelview);
-    esTranslate(&ubo.modelview, 0.0f, 0.0f, -8.0f);
-    esRotate(&ubo.modelview, 45.0f + (0.25f * t), 1.0f, 0.0f, 0.0f);
-    esRotate(&ubo.modelview, 45.0f - (0.5f * t), 0.0f, 1.0f, 0.0f);
-    esRotate(&ubo.modelview, 10.0f + (0.15f * t), 0.0f, 0.0f, 1.0f);
+struct vk_kms_image {
+    /// NULL for offscreen images, see @ref vk_offscreen_image_new.
+    struct gbm_bo *bo;
+    int width, height;
+    uint32_t drm_format, gbm_format;
+    uint64_t drm_modifier;
+    VkFormat vk_format;
+    VkImage image;
+    VkDeviceMemory memory;
 
-    ESMatrix projection;
-    esMatrixLoadIdentity(&projection);
-    esFrustum(&projection, -2.8f, +2.8f, -2.8f * aspect_ratio, +2.8f * aspect_ratio, 6.0f, 10.0f);
+    /// What's reported to @ref memtrack for this image.
+    int output;
+    uint32_t memory_type;
+    VkDeviceSize memory_size;
+};
 
-    esMatrixLoadIdentity(&ubo.modelviewprojection);
-    esMatrixMultiply(&ubo.modelviewprojection, &ubo.modelview, &projection);
+static int find_mem_type(VkPhysicalDevice phdev, VkMemoryPropertyFlags flags, uint32_t req_bits) {
+    VkPhysicalDeviceMemoryProperties props;
+    vkGetPhysicalDeviceMemoryProperties(phdev, &props);
 
-    /* The mat3 normalMatrix is laid out as 3 vec4s. */
-    memcpy(&ubo.normal, &ubo.modelview, sizeof(ubo.normal));
+    for (unsigned i = 0u; i < props.memoryTypeCount; ++i) {
+        if (req_bits & (1 << i)) {
+            if ((props.memoryTypes[i].propertyFlags & flags) == flags) {
+                return i;
+            }
+        }
+    }
 
-    memcpy(&(buf->mapped->ubo), &ubo, sizeof(ubo));
+    return -1;
 }
 
+static pthread_mutex_t gbm_lock = PTHREAD_MUTEX_INITIALIZER;
 
-struct cube_pipeline {
-    VkShaderModule vert_shader, frag_shader;
-    VkDescriptorSetLayout set_layout;
-    VkPipelineLayout pipeline_layout;
-    VkRenderPass renderpass;
-    VkPipeline pipeline;
-};
-
-static struct cube_pipeline *cube_pipeline_new(struct vkdev *dev, int width, int height, VkFormat format) {
-    VkPipelineLayout pipeline_layout;
-    struct cube_pipeline *pipeline;
-    VkDescriptorSetLayout set_layout;
-    VkShaderModule vert_shader, frag_shader;
-    VkRenderPass renderpass;
-    VkPipeline vkpipeline;
+static struct vk_kms_image *vk_kms_image_new(
+    struct vkdev *dev,
+    struct gbm_device *gbm_device,
+    int output,
+    int width, int height,
+    VkFormat vk_format,
+    uint32_t gbm_format,
+    uint32_t drm_format, uint64_t drm_modifier
+) {
+    PFN_vkGetMemoryFdPropertiesKHR get_memory_fd_props;
+    VkSubresourceLayout layout;
+    struct vk_kms_image *img;
+    VkDeviceMemory img_device_memory;
+    struct gbm_bo *bo;
     VkResult ok;
+    VkImage vkimg;
+    int fd;
 
-    ok = vkCreateShaderModule(
+    ok = vkCreateImage(
         dev->device,
-        &(const VkShaderModuleCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        &(VkImageCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
             .flags = 0,
-            .codeSize = sizeof(vkcube_vert_data),
-            .pCode = vkcube_vert_data,
-            .pNext = NULL
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = vk_format,
+            .extent = { .width = width, .height = height, .depth = 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = 0,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .pNext =
+                &(VkExternalMemoryImageCreateInfo){
+                    .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+                    .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+                    .pNext =
+                        &(VkImageDrmFormatModifierExplicitCreateInfoEXT){
+                            .sType = VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT,
+                            .drmFormatModifierPlaneCount = 1,
+                            .drmFormatModifier = drm_modifier,
+                            .pPlaneLayouts =
+                                (VkSubresourceLayout[1]){
+                                    {
+                                        .offset = 0,
+                                        .size = 0,
+                                        .rowPitch = 0,
+                                        .arrayPitch = 0,
+                                        .depthPitch = 0,
+                                    },
+                                },
+                        },
+                },
         },
         NULL,
-        &vert_shader
+        &vkimg
     );
     if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Could not load vertex shader. vkCreateShaderModule");
+        LOG_VK_ERROR(ok, "Could not create Vulkan image. vkCreateImage");
         return NULL;
     }
 
-    ok = vkCreateShaderModule(
+    vkGetImageSubresourceLayout(
         dev->device,
-        &(const VkShaderModuleCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .flags = 0,
-            .codeSize = sizeof(vkcube_frag_data),
-            .pCode = vkcube_frag_data,
-            .pNext = NULL
+        vkimg,
+        &(VkImageSubresource){
+            .aspectMask = VK_IMAGE_ASPECT_MEMORY_PLANE_0_BIT_EXT,  // For v3dv, this doesn't really matter
+            .mipLevel = 0,
+            .arrayLayer = 0,
         },
-        NULL,
-        &frag_shader
+        &layout
     );
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Could not load vertex shader. vkCreateShaderModule");
-        goto fail_destroy_vert_shader;
-    }
 
-    const VkPipelineShaderStageCreateInfo vert_shader_stage_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .flags = 0,
-        .stage = VK_SHADER_STAGE_VERTEX_BIT,
-        .module = vert_shader,
-        .pName = "main",
-        .pSpecializationInfo = NULL,
-        .pNext = NULL,
-    };
+    // images are allocated concurrently on startup, and GBM doesn't
+    // guarantee that's safe.
+    pthread_mutex_lock(&gbm_lock);
+    bo = gbm_bo_create_with_modifiers(
+        gbm_device,
+        width,
+        height,
+        gbm_format,
+        &drm_modifier,
+        1
+    );
+    pthread_mutex_unlock(&gbm_lock);
+    if (bo == NULL) {
+        LOG_ERROR("Could not create GBM BO. gbm_bo_create_with_modifiers: %s\n", strerror(errno));
+        goto fail_destroy_image;
+    }
 
-    const VkPipelineShaderStageCreateInfo frag_shader_stage_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .flags = 0,
-        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-        .module = frag_shader,
-        .pName = "main",
-        .pSpecializationInfo = NULL,
-        .pNext = NULL,
-    };
+    if (gbm_bo_get_offset(bo, 0) != layout.offset) {
+        LOG_ERROR("GBM BO layout doesn't match image layout. This is probably a driver / kernel bug.\n");
+        goto fail_destroy_bo;
+    }
 
-    const VkPipelineShaderStageCreateInfo shader_stages[] = {
-        vert_shader_stage_info,
-        frag_shader_stage_info
-    };
+    if (gbm_bo_get_stride_for_plane(bo, 0) != layout.rowPitch) {
+        LOG_ERROR("GBM BO layout doesn't match image layout. This is probably a driver / kernel bug.\n");
+        goto fail_destroy_bo;
+    }
 
-    // TODO: Make this static instead
-    const VkPipelineDynamicStateCreateInfo dynamic_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-        .flags = 0,
-        .dynamicStateCount = 2,
-        .pDynamicStates = (VkDynamicState[2]) {
-            VK_DYNAMIC_STATE_VIEWPORT,
-            VK_DYNAMIC_STATE_SCISSOR,
-        },
+    fd = gbm_bo_get_fd(bo);
+    if (fd < 0) {
+        LOG_ERROR("Couldn't get dmabuf fd for GBM buffer. gbm_bo_get_fd: %s\n", strerror(errno));
+        goto fail_destroy_bo;
+    }
+
+    // find out as which memory types we can import our dmabuf fd
+    VkMemoryFdPropertiesKHR fd_memory_props = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR,
         .pNext = NULL,
+        .memoryTypeBits = 0,
     };
 
-    const VkPipelineVertexInputStateCreateInfo vertex_input_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .flags = 0,
-        .vertexBindingDescriptionCount = 3,
-        .pVertexBindingDescriptions = (VkVertexInputBindingDescription[]) {
-            {
-                .binding = 0,
-                .stride = 3 * sizeof(float),
-                .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-            },
-            {
-                .binding = 1,
-                .stride = 3 * sizeof(float),
-                .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-            },
-            {
-                .binding = 2,
-                .stride = 3 * sizeof(float),
-                .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-            },
+    get_memory_fd_props = (PFN_vkGetMemoryFdPropertiesKHR) vkGetDeviceProcAddr(dev->device, "vkGetMemoryFdPropertiesKHR");
+    if (get_memory_fd_props == NULL) {
+        LOG_ERROR("Couldn't resolve vkGetMemoryFdPropertiesKHR.\n");
+        goto fail_destroy_bo;
+    }
+
+    ok = get_memory_fd_props(
+        dev->device,
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+        fd,
+        &fd_memory_props
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't get dmabuf memory properties. vkGetMemoryFdPropertiesKHR");
+        goto fail_destroy_bo;
+    }
+
+    // Find out the memory requirements for our image (the supported memory types for import)
+    VkMemoryRequirements2 image_memory_reqs = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+        .memoryRequirements = { 0 },
+        .pNext = NULL
+    };
+
+    vkGetImageMemoryRequirements2(
+        dev->device,
+        &(VkImageMemoryRequirementsInfo2) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+            .image = vkimg,
+            .pNext = NULL,
         },
-        .vertexAttributeDescriptionCount = 3,
-        .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[]) {
-            {
-                .location = 0,
-                .binding = 0,
-                .format = VK_FORMAT_R32G32B32_SFLOAT,
-                .offset = 0,
+        &image_memory_reqs
+    );
+
+    // Find a memory type that fits both to the dmabuf and the image
+    int mem = find_mem_type(dev->physical_device, 0, image_memory_reqs.memoryRequirements.memoryTypeBits & fd_memory_props.memoryTypeBits);
+    if (mem < 0) {
+        LOG_ERROR("Couldn't find a memory type that's both supported by the image and the dmabuffer.\n");
+        goto fail_destroy_bo;
+    }
+
+    // now, create a VkDeviceMemory instance from our dmabuf.
+    ok = vkAllocateMemory(
+        dev->device,
+        &(VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = layout.size,
+            .memoryTypeIndex = mem,
+            .pNext = &(VkImportMemoryFdInfoKHR) {
+                .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+                .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+                .fd = fd,
+                .pNext = &(VkMemoryDedicatedAllocateInfo) {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+                    .image = vkimg,
+                    .buffer = VK_NULL_HANDLE,
+                    .pNext = NULL,
+                },
             },
-            {
-                .location = 1,
-                .binding = 1,
-                .format = VK_FORMAT_R32G32B32_SFLOAT,
-                .offset = 0,
+        },
+        NULL,
+        &img_device_memory
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't import dmabuf as vulkan device memory. vkAllocateMemory");
+        goto fail_destroy_bo;
+    }
+
+    ok = vkBindImageMemory2(
+        dev->device,
+        1,
+        &(VkBindImageMemoryInfo){
+            .sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
+            .image = vkimg,
+            .memory = img_device_memory,
+            .memoryOffset = 0,
+            .pNext = NULL,
+        }
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't bind dmabuf-backed vulkan device memory to vulkan image. vkBindImageMemory2");
+        goto fail_free_device_memory;
+    }
+
+    img = malloc(sizeof *img);
+    if (img == NULL) {
+        goto fail_free_device_memory;
+    }
+
+    img->bo = bo;
+    img->memory = img_device_memory;
+    img->image = vkimg;
+    img->width = width;
+    img->height = height;
+    img->drm_format = drm_format;
+    img->gbm_format = gbm_format;
+    img->drm_modifier = drm_modifier;
+    img->vk_format = vk_format;
+    img->output = output;
+    img->memory_type = mem;
+    img->memory_size = layout.size;
+
+    // the memory is allocated by GBM, vulkan only imports it. So this is the
+    // one place where it's accounted for.
+    memtrack_add(dev->memtrack, output, MEMTRACK_KIND_SCANOUT, mem, layout.size);
+    return img;
+
+
+    fail_free_device_memory:
+    vkFreeMemory(dev->device, img_device_memory, NULL);
+
+    fail_destroy_bo:
+    pthread_mutex_lock(&gbm_lock);
+    gbm_bo_destroy(bo);
+    pthread_mutex_unlock(&gbm_lock);
+
+    fail_destroy_image:
+    vkDestroyImage(dev->device, vkimg, NULL);
+    return NULL;
+}
+
+/**
+ * @brief Create an image that's not backed by a GBM BO, for rendering without KMS.
+ *
+ * If the device can export it, the memory is allocated as exportable (opaque fd),
+ * so the image could still be handed to another process or API. Otherwise it's
+ * just plain device memory.
+ */
+static struct vk_kms_image *vk_offscreen_image_new(
+    struct vkdev *dev,
+    int output,
+    int width, int height,
+    VkFormat vk_format
+) {
+    VkExternalImageFormatProperties external_format_props;
+    VkImageFormatProperties2 format_props;
+    VkMemoryRequirements reqs;
+    struct vk_kms_image *img;
+    VkDeviceMemory img_device_memory;
+    VkResult ok;
+    VkImage vkimg;
+    bool exportable;
+    int mem;
+
+    exportable = false;
+    if (dev->memory_export_supported) {
+        external_format_props = (VkExternalImageFormatProperties) {
+            .sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES,
+            .pNext = NULL,
+        };
+
+        format_props = (VkImageFormatProperties2) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2,
+            .pNext = &external_format_props,
+        };
+
+        ok = vkGetPhysicalDeviceImageFormatProperties2(
+            dev->physical_device,
+            &(const VkPhysicalDeviceImageFormatInfo2) {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2,
+                .format = vk_format,
+                .type = VK_IMAGE_TYPE_2D,
+                .tiling = VK_IMAGE_TILING_OPTIMAL,
+                .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                .flags = 0,
+                .pNext = &(const VkPhysicalDeviceExternalImageFormatInfo) {
+                    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO,
+                    .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+                    .pNext = NULL,
+                },
             },
-            {
-                .location = 2,
-                .binding = 2,
-                .format = VK_FORMAT_R32G32B32_SFLOAT,
-                .offset = 0,
+            &format_props
+        );
+
+        exportable = ok == VK_SUCCESS && (external_format_props.externalMemoryProperties.externalMemoryFeatures & VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT);
+    }
+
+    ok = vkCreateImage(
+        dev->device,
+        &(VkImageCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .flags = 0,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = vk_format,
+            .extent = { .width = width, .height = height, .depth = 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = 0,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .pNext = exportable ? &(VkExternalMemoryImageCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+                .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+                .pNext = NULL,
+            } : NULL,
+        },
+        NULL,
+        &vkimg
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Could not create offscreen Vulkan image. vkCreateImage");
+        return NULL;
+    }
+
+    vkGetImageMemoryRequirements(dev->device, vkimg, &reqs);
+
+    mem = find_mem_type(dev->physical_device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, reqs.memoryTypeBits);
+    if (mem < 0) {
+        LOG_ERROR("Couldn't find a device local memory type for the offscreen image.\n");
+        goto fail_destroy_image;
+    }
+
+    // exportable memory should be dedicated anyway, so we don't
+    // use the sub-allocator for any offscreen image.
+    ok = vkAllocateMemory(
+        dev->device,
+        &(VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = reqs.size,
+            .memoryTypeIndex = mem,
+            .pNext = &(VkMemoryDedicatedAllocateInfo) {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+                .image = vkimg,
+                .buffer = VK_NULL_HANDLE,
+                .pNext = exportable ? &(VkExportMemoryAllocateInfo) {
+                    .sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO,
+                    .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+                    .pNext = NULL,
+                } : NULL,
             },
         },
-        .pNext = NULL,
-    };
+        NULL,
+        &img_device_memory
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't allocate memory for offscreen image. vkAllocateMemory");
+        goto fail_destroy_image;
+    }
+
+    ok = vkBindImageMemory(dev->device, vkimg, img_device_memory, 0);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't bind memory to offscreen image. vkBindImageMemory");
+        goto fail_free_device_memory;
+    }
+
+    img = malloc(sizeof *img);
+    if (img == NULL) {
+        goto fail_free_device_memory;
+    }
+
+    img->bo = NULL;
+    img->memory = img_device_memory;
+    img->image = vkimg;
+    img->width = width;
+    img->height = height;
+    img->drm_format = DRM_FORMAT_INVALID;
+    img->gbm_format = 0;
+    img->drm_modifier = DRM_FORMAT_MOD_INVALID;
+    img->vk_format = vk_format;
+    img->output = output;
+    img->memory_type = mem;
+    img->memory_size = reqs.size;
+
+    memtrack_add(dev->memtrack, output, MEMTRACK_KIND_OFFSCREEN, mem, reqs.size);
+    return img;
+
+
+    fail_free_device_memory:
+    vkFreeMemory(dev->device, img_device_memory, NULL);
+
+    fail_destroy_image:
+    vkDestroyImage(dev->device, vkimg, NULL);
+    return NULL;
+}
+
+static void vk_kms_image_destroy(struct vk_kms_image *img, struct vkdev *dev) {
+    memtrack_remove(
+        dev->memtrack,
+        img->output,
+        img->bo != NULL ? MEMTRACK_KIND_SCANOUT : MEMTRACK_KIND_OFFSCREEN,
+        img->memory_type,
+        img->memory_size
+    );
+
+    vkFreeMemory(dev->device, img->memory, NULL);
+    if (img->bo != NULL) {
+        pthread_mutex_lock(&gbm_lock);
+        gbm_bo_destroy(img->bo);
+        pthread_mutex_unlock(&gbm_lock);
+    }
+    vkDestroyImage(dev->device, img->image, NULL);
+    free(img);
+}
+
+
+struct pipeline_fb {
+    int width, height;
+
+    /// The part of the image that is rendered into (from the top left corner).
+    /// Smaller than the image with dynamic resolution, see @ref viewport_governor.
+    int viewport_width, viewport_height;
+
+    VkImageView view;
+    VkFramebuffer fb;
+};
+
+static struct pipeline_fb *pipeline_fb_new(struct vkdev *dev, struct vk_kms_image *image, VkRenderPass renderpass) {
+    struct pipeline_fb *fb;
+    VkFramebuffer vkfb;
+    VkImageView view;
+    VkResult ok;
+
+    ok = vkCreateImageView(
+        dev->device,
+        &(const VkImageViewCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .flags = 0,
+            .image = image->image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = image->vk_format,
+            .components = {
+                .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .a = VK_COMPONENT_SWIZZLE_IDENTITY,
+            },
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .pNext = NULL,
+        },
+        NULL,
+        &view
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Could not create image view. vkCreateImageView");
+        return NULL;
+    }
+
+    ok = vkCreateFramebuffer(
+        dev->device,
+        &(const VkFramebufferCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .flags = 0,
+            .renderPass = renderpass,
+            .attachmentCount = 1,
+            .pAttachments = (VkImageView[]) { view },
+            .width = image->width,
+            .height = image->height,
+            .layers = 1,
+            .pNext = NULL,
+        },
+        NULL,
+        &vkfb
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Could not create framebuffer. vkCreateFramebuffer");
+        return NULL;
+    }
+
+    fb = malloc(sizeof *fb);
+    if (fb == NULL) {
+        goto fail_destroy_vkfb;
+    }
+
+    fb->fb = vkfb;
+    fb->view = view;
+    fb->width = image->width;
+    fb->height = image->height;
+    fb->viewport_width = image->width;
+    fb->viewport_height = image->height;
+    return fb;
+
+
+    fail_destroy_vkfb:
+    vkDestroyFramebuffer(dev->device, vkfb, NULL);
+
+    fail_destroy_image_view:
+    vkDestroyImageView(dev->device, view, NULL);
+    return NULL;
+}
+
+static void pipeline_fb_destroy(struct pipeline_fb *fb, VkDevice device) {
+    vkDestroyFramebuffer(device, fb->fb, NULL);
+    vkDestroyImageView(device, fb->view, NULL);
+    free(fb);
+}
+
+
+struct cube_ubo_data {
+    ESMatrix modelview;
+    ESMatrix modelviewprojection;
+    float normal[12];
+};
+
+/**
+ * @brief One interleaved vertex. Colors and normals are packed into 8 bits per component,
+ * which is plenty for them and makes a vertex 20 bytes instead of 36.
+ */
+struct cube_vertex {
+    float position[3];
+    uint8_t color[4];
+    int8_t normal[4];
+};
+
+#define CUBE_PRIMITIVE_RESTART_INDEX 0xFFFF
+#define CUBE_N_INDICES (5*6 - 1)
+
+/**
+ * @brief Vertices and indices of the cube, in one buffer. The 6 faces are triangle
+ * strips of 4 vertices each, separated by the primitive restart index, so the whole
+ * cube is a single indexed draw.
+ */
+struct cube_mesh {
+    struct cube_vertex vertices[4*6];
+    uint16_t indices[CUBE_N_INDICES];
+};
+
+/**
+ * @brief The device-local mesh shared by all frames, and a ring of per-frame uniform
+ * buffer slots. All slots are accessed through the same descriptor set, using a
+ * dynamic offset to select the slot.
+ */
+struct cube_gpu_buffer {
+    /// Holds the whole struct cube_mesh, so it's the index buffer too.
+    VkBuffer vertex_buffer;
+    struct vkalloc_allocation vertex_memory;
+
+    VkBuffer ubo_buffer;
+    struct vkalloc_allocation ubo_memory;
+    VkDeviceSize ubo_stride;
+    int n_ubo_slots;
+
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSet descriptor_set;
+};
+
+static struct cube_gpu_buffer *cube_gpu_buffer_new(struct vkdev *dev, VkDescriptorSetLayout ubo_layout, int n_ubo_slots) {
+    struct vkalloc_allocation vertex_memory, ubo_memory;
+    VkPhysicalDeviceProperties props;
+    VkBuffer vertex_buffer, ubo_buffer;
+    VkDescriptorPool descriptor_pool;
+    struct cube_gpu_buffer *gpubuf;
+    VkDescriptorSet descriptor_set;
+    VkDeviceSize ubo_stride;
+    VkResult ok;
+
+    // clang-format off
+    static const struct cube_mesh mesh = {
+        .vertices = {
+            // front
+            { { -1.0f, -1.0f, +1.0f }, {   0,   0, 255, 255 }, {    0,    0, +127, 0 } }, // blue
+            { { +1.0f, -1.0f, +1.0f }, { 255,   0, 255, 255 }, {    0,    0, +127, 0 } }, // magenta
+            { { -1.0f, +1.0f, +1.0f }, {   0, 255, 255, 255 }, {    0,    0, +127, 0 } }, // cyan
+            { { +1.0f, +1.0f, +1.0f }, { 255, 255, 255, 255 }, {    0,    0, +127, 0 } }, // white
+            // back
+            { { +1.0f, -1.0f, -1.0f }, { 255,   0,   0, 255 }, {    0,    0, -127, 0 } }, // red
+            { { -1.0f, -1.0f, -1.0f }, {   0,   0,   0, 255 }, {    0,    0, -127, 0 } }, // black
+            { { +1.0f, +1.0f, -1.0f }, { 255, 255,   0, 255 }, {    0,    0, -127, 0 } }, // yellow
+            { { -1.0f, +1.0f, -1.0f }, {   0, 255,   0, 255 }, {    0,    0, -127, 0 } }, // green
+            // right
+            { { +1.0f, -1.0f, +1.0f }, { 255,   0, 255, 255 }, { +127,    0,    0, 0 } }, // magenta
+            { { +1.0f, -1.0f, -1.0f }, { 255,   0,   0, 255 }, { +127,    0,    0, 0 } }, // red
+            { { +1.0f, +1.0f, +1.0f }, { 255, 255, 255, 255 }, { +127,    0,    0, 0 } }, // white
+            { { +1.0f, +1.0f, -1.0f }, { 255, 255,   0, 255 }, { +127,    0,    0, 0 } }, // yellow
+            // left
+            { { -1.0f, -1.0f, -1.0f }, {   0,   0,   0, 255 }, { -127,    0,    0, 0 } }, // black
+            { { -1.0f, -1.0f, +1.0f }, {   0,   0, 255, 255 }, { -127,    0,    0, 0 } }, // blue
+            { { -1.0f, +1.0f, -1.0f }, {   0, 255,   0, 255 }, { -127,    0,    0, 0 } }, // green
+            { { -1.0f, +1.0f, +1.0f }, {   0, 255, 255, 255 }, { -127,    0,    0, 0 } }, // cyan
+            // top
+            { { -1.0f, +1.0f, +1.0f }, {   0, 255, 255, 255 }, {    0, +127,    0, 0 } }, // cyan
+            { { +1.0f, +1.0f, +1.0f }, { 255, 255, 255, 255 }, {    0, +127,    0, 0 } }, // white
+            { { -1.0f, +1.0f, -1.0f }, {   0, 255,   0, 255 }, {    0, +127,    0, 0 } }, // green
+            { { +1.0f, +1.0f, -1.0f }, { 255, 255,   0, 255 }, {    0, +127,    0, 0 } }, // yellow
+            // bottom
+            { { -1.0f, -1.0f, -1.0f }, {   0,   0,   0, 255 }, {    0, -127,    0, 0 } }, // black
+            { { +1.0f, -1.0f, -1.0f }, { 255,   0,   0, 255 }, {    0, -127,    0, 0 } }, // red
+            { { -1.0f, -1.0f, +1.0f }, {   0,   0, 255, 255 }, {    0, -127,    0, 0 } }, // blue
+            { { +1.0f, -1.0f, +1.0f }, { 255,   0, 255, 255 }, {    0, -127,    0, 0 } }, // magenta
+        },
+        .indices = {
+             0,  1,  2,  3, CUBE_PRIMITIVE_RESTART_INDEX,
+             4,  5,  6,  7, CUBE_PRIMITIVE_RESTART_INDEX,
+             8,  9, 10, 11, CUBE_PRIMITIVE_RESTART_INDEX,
+            12, 13, 14, 15, CUBE_PRIMITIVE_RESTART_INDEX,
+            16, 17, 18, 19, CUBE_PRIMITIVE_RESTART_INDEX,
+            20, 21, 22, 23
+        },
+    };
+    // clang-format on
+
+    ok = vkCreateBuffer(
+        dev->device,
+        &(VkBufferCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = sizeof(struct cube_mesh),
+            .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .flags = 0
+        },
+        NULL,
+        &vertex_buffer
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't create vertex buffer. vkCreateBuffer");
+        return NULL;
+    }
+
+    ok = vkdev_alloc_buffer_memory(dev, vertex_buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertex_memory);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't allocate memory for vertex buffer. vkdev_alloc_buffer_memory");
+        goto fail_destroy_vertex_buffer;
+    }
+
+    ok = vkdev_upload_buffer(
+        dev,
+        vertex_buffer,
+        &mesh, sizeof(mesh),
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT
+    );
+    if (ok != VK_SUCCESS) {
+        goto fail_free_vertex_memory;
+    }
+
+    // dynamic offsets need to be aligned to minUniformBufferOffsetAlignment
+    vkGetPhysicalDeviceProperties(dev->physical_device, &props);
+    ubo_stride = sizeof(struct cube_ubo_data);
+    if (props.limits.minUniformBufferOffsetAlignment > 1) {
+        ubo_stride = (ubo_stride + props.limits.minUniformBufferOffsetAlignment - 1) / props.limits.minUniformBufferOffsetAlignment * props.limits.minUniformBufferOffsetAlignment;
+    }
+
+    ok = vkCreateBuffer(
+        dev->device,
+        &(VkBufferCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = ubo_stride * n_ubo_slots,
+            .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            .flags = 0
+        },
+        NULL,
+        &ubo_buffer
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't create uniform buffer. vkCreateBuffer");
+        goto fail_free_vertex_memory;
+    }
+
+    ok = vkdev_alloc_buffer_memory(dev, ubo_buffer, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &ubo_memory);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't allocate memory for uniform buffer. vkdev_alloc_buffer_memory");
+        goto fail_destroy_ubo_buffer;
+    }
+
+    ok = vkCreateDescriptorPool(
+        dev->device,
+        &(const VkDescriptorPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .flags = 0,
+            .maxSets = 1,
+            .poolSizeCount = 1,
+            .pPoolSizes = &(const VkDescriptorPoolSize) {
+                .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .descriptorCount = 1
+            },
+            .pNext = NULL,
+        },
+        NULL,
+        &descriptor_pool
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't create a descriptor pool for allocating the uniform buffer descriptor set. vkCreateDescriptorPool");
+        goto fail_free_ubo_memory;
+    }
+
+    ok = vkAllocateDescriptorSets(
+        dev->device,
+        &(const VkDescriptorSetAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = descriptor_pool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &ubo_layout,
+        },
+        &descriptor_set
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't allocate a descriptor set for uniform buffer. vkAllocateDescriptorSets");
+        goto fail_destroy_descriptor_pool;
+    }
+
+    vkUpdateDescriptorSets(
+        dev->device,
+        1,
+        (const VkWriteDescriptorSet []) {
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = descriptor_set,
+                .dstBinding = 0,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .pImageInfo = NULL,
+                .pBufferInfo = &(VkDescriptorBufferInfo) {
+                    .buffer = ubo_buffer,
+                    .offset = 0,
+                    .range = sizeof(struct cube_ubo_data),
+                },
+                .pTexelBufferView = NULL,
+                .pNext = NULL,
+            }
+        },
+        0,
+        NULL
+    );
+
+    gpubuf = malloc(sizeof *gpubuf);
+    if (gpubuf == NULL) {
+        goto fail_destroy_descriptor_pool;
+    }
+
+    gpubuf->vertex_buffer = vertex_buffer;
+    gpubuf->vertex_memory = vertex_memory;
+    gpubuf->ubo_buffer = ubo_buffer;
+    gpubuf->ubo_memory = ubo_memory;
+    gpubuf->ubo_stride = ubo_stride;
+    gpubuf->n_ubo_slots = n_ubo_slots;
+    gpubuf->descriptor_pool = descriptor_pool;
+    gpubuf->descriptor_set = descriptor_set;
+    return gpubuf;
+
+
+    fail_destroy_descriptor_pool:
+    vkDestroyDescriptorPool(dev->device, descriptor_pool, NULL);
+
+    fail_free_ubo_memory:
+    vkdev_free_buffer_memory(dev, &ubo_memory);
+
+    fail_destroy_ubo_buffer:
+    vkDestroyBuffer(dev->device, ubo_buffer, NULL);
+
+    fail_free_vertex_memory:
+    vkdev_free_buffer_memory(dev, &vertex_memory);
+
+    fail_destroy_vertex_buffer:
+    vkDestroyBuffer(dev->device, vertex_buffer, NULL);
+    return NULL;
+}
+
+static void cube_gpu_buffer_destroy(struct cube_gpu_buffer *gpubuf, struct vkdev *dev) {
+    vkDestroyDescriptorPool(dev->device, gpubuf->descriptor_pool, NULL);
+    vkDestroyBuffer(dev->device, gpubuf->ubo_buffer, NULL);
+    vkdev_free_buffer_memory(dev, &gpubuf->ubo_memory);
+    vkDestroyBuffer(dev->device, gpubuf->vertex_buffer, NULL);
+    vkdev_free_buffer_memory(dev, &gpubuf->vertex_memory);
+    free(gpubuf);
+}
+
+static uint32_t cube_gpu_buffer_get_ubo_offset(struct cube_gpu_buffer *gpubuf, int slot) {
+    return slot * gpubuf->ubo_stride;
+}
+
+static void cube_gpu_buffer_update_transforms(struct cube_gpu_buffer *buf, int slot, struct timeval start_time, float aspect_ratio) {
+    struct cube_ubo_data ubo;
+    struct timeval tv;
+    uint64_t t;
+
+    gettimeofday(&tv, NULL);
+
+    t = ((tv.tv_sec * 1000 + tv.tv_usec / 1000) -
+            (start_time.tv_sec * 1000 + start_time.tv_usec / 1000)) / 5;
+
+    esMatrixLoadIdentity(&ubo.modelview);
+    esTranslate(&ubo.modelview, 0.0f, 0.0f, -8.0f);
+    esRotate(&ubo.modelview, 45.0f + (0.25f * t), 1.0f, 0.0f, 0.0f);
+    esRotate(&ubo.modelview, 45.0f - (0.5f * t), 0.0f, 1.0f, 0.0f);
+    esRotate(&ubo.modelview, 10.0f + (0.15f * t), 0.0f, 0.0f, 1.0f);
+
+    ESMatrix projection;
+    esMatrixLoadIdentity(&projection);
+    esFrustum(&projection, -2.8f, +2.8f, -2.8f * aspect_ratio, +2.8f * aspect_ratio, 6.0f, 10.0f);
+
+    esMatrixLoadIdentity(&ubo.modelviewprojection);
+    esMatrixMultiply(&ubo.modelviewprojection, &ubo.modelview, &projection);
+
+    /* The mat3 normalMatrix is laid out as 3 vec4s. */
+    memcpy(&ubo.normal, &ubo.modelview, sizeof(ubo.normal));
+
+    memcpy((char*) buf->ubo_memory.mapped + cube_gpu_buffer_get_ubo_offset(buf, slot), &ubo, sizeof(ubo));
+}
+
+
+enum cube_scene {
+    /// One cube, transformed on the CPU, drawn from a vertex buffer.
+    CUBE_SCENE_SINGLE,
+
+    /// Lots of cubes in one instanced draw, animated entirely in the vertex shader.
+    CUBE_SCENE_INSTANCED
+};
+
+/**
+ * @brief Push constants of the instanced scene, see instanced.vert.
+ */
+struct instanced_push_constants {
+    ESMatrix projection;
+    float time;
+    float extent;
+    float distance;
+    float scale;
+};
+
+/**
+ * @brief IDs of the specialization constants in vkcube.vert, vkcube.frag and instanced.vert.
+ */
+enum cube_constant {
+    CUBE_CONSTANT_LIGHT_X = 0,
+    CUBE_CONSTANT_LIGHT_Y = 1,
+    CUBE_CONSTANT_LIGHT_Z = 2,
+    CUBE_CONSTANT_LIGHTING = 3,
+    CUBE_CONSTANT_GAMMA = 4,
+};
+
+/**
+ * @brief Shading options that are baked into the pipeline as specialization constants.
+ */
+struct cube_shading {
+    /// Position of the light source, in eye space.
+    float light[3];
+
+    /// If false, the diffuse lighting is compiled out and the cubes have their plain colors.
+    bool lighting;
+
+    /// Exponent applied to the output color. 1.0 is a no-op (and compiled out).
+    float gamma;
+};
+
+#define CUBE_SHADING_DEFAULT ((struct cube_shading) { .light = {2.0f, 2.0f, 20.0f}, .lighting = true, .gamma = 1.0f })
+
+struct cube_pipeline {
+    VkShaderModule vert_shader, frag_shader;
+    VkDescriptorSetLayout set_layout;
+    VkPipelineLayout pipeline_layout;
+    VkRenderPass renderpass;
+
+    /// The variant for the current shading options, owned by @ref variants.
+    VkPipeline pipeline;
+    struct pipeline_variants *variants;
+
+    struct vkdev *dev;
+    int width, height;
+
+    enum cube_scene scene;
+    /// Number of cubes drawn by the instanced scene, 1 for the single cube scene.
+    int n_instances;
+};
+
+/**
+ * @brief Create the graphics pipeline for one variant, see @ref pipeline_variants.
+ * Everything but the specialization constants is the same for all variants.
+ */
+static VkResult cube_pipeline_create_variant(void *userdata, const VkSpecializationInfo *specialization, VkPipeline *pipeline_out) {
+    struct cube_pipeline *pipeline;
+    VkResult ok;
+
+    pipeline = userdata;
+
+    const VkPipelineShaderStageCreateInfo vert_shader_stage_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .flags = 0,
+        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+        .module = pipeline->vert_shader,
+        .pName = "main",
+        .pSpecializationInfo = specialization,
+        .pNext = NULL,
+    };
+
+    const VkPipelineShaderStageCreateInfo frag_shader_stage_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .flags = 0,
+        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .module = pipeline->frag_shader,
+        .pName = "main",
+        .pSpecializationInfo = specialization,
+        .pNext = NULL,
+    };
+
+    const VkPipelineShaderStageCreateInfo shader_stages[] = {
+        vert_shader_stage_info,
+        frag_shader_stage_info
+    };
+
+    // TODO: Make this static instead
+    const VkPipelineDynamicStateCreateInfo dynamic_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .flags = 0,
+        .dynamicStateCount = 2,
+        .pDynamicStates = (VkDynamicState[2]) {
+            VK_DYNAMIC_STATE_VIEWPORT,
+            VK_DYNAMIC_STATE_SCISSOR,
+        },
+        .pNext = NULL,
+    };
+
+    // the instanced scene generates its vertices in the shader.
+    const VkPipelineVertexInputStateCreateInfo instanced_vertex_input_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .flags = 0,
+        .vertexBindingDescriptionCount = 0,
+        .pVertexBindingDescriptions = NULL,
+        .vertexAttributeDescriptionCount = 0,
+        .pVertexAttributeDescriptions = NULL,
+        .pNext = NULL,
+    };
+
+    const VkPipelineVertexInputStateCreateInfo vertex_input_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .flags = 0,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = (VkVertexInputBindingDescription[]) {
+            {
+                .binding = 0,
+                .stride = sizeof(struct cube_vertex),
+                .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+            },
+        },
+        .vertexAttributeDescriptionCount = 3,
+        .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[]) {
+            {
+                .location = 0,
+                .binding = 0,
+                .format = VK_FORMAT_R32G32B32_SFLOAT,
+                .offset = offsetof(struct cube_vertex, position),
+            },
+            {
+                .location = 1,
+                .binding = 0,
+                .format = VK_FORMAT_R8G8B8A8_UNORM,
+                .offset = offsetof(struct cube_vertex, color),
+            },
+            {
+                .location = 2,
+                .binding = 0,
+                .format = VK_FORMAT_R8G8B8A8_SNORM,
+                .offset = offsetof(struct cube_vertex, normal),
+            },
+        },
+        .pNext = NULL,
+    };
+
+    const VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .pNext = 0,
+        .flags = 0,
+        .topology = pipeline->scene == CUBE_SCENE_INSTANCED ? VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST : VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+        // the faces of the single cube are separate strips in one indexed draw
+        .primitiveRestartEnable = pipeline->scene == CUBE_SCENE_INSTANCED ? VK_FALSE : VK_TRUE,
+    };
+
+    const VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = pipeline->width,
+        .height = pipeline->height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+
+    const VkRect2D scissor = {
+        .offset = {0, 0},
+        .extent = {pipeline->width, pipeline->height}
+    };
+
+    const VkPipelineViewportStateCreateInfo viewport_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .flags = 0,
+        .viewportCount = 1,
+        .pViewports = &viewport,
+        .scissorCount = 1,
+        .pScissors = &scissor,
+        .pNext = NULL,
+    };
+    
+    const VkPipelineRasterizationStateCreateInfo rasterizer = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .flags = 0,
+        .depthClampEnable = VK_FALSE,
+        .rasterizerDiscardEnable = VK_FALSE,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .cullMode = VK_CULL_MODE_BACK_BIT,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .depthBiasEnable = VK_FALSE,
+        .depthBiasConstantFactor = 0.0f,
+        .depthBiasClamp = 0.0f,
+        .depthBiasSlopeFactor = 0.0f,
+        .lineWidth = 1.0f,
+        .pNext = NULL,
+    };
+
+    const VkPipelineMultisampleStateCreateInfo multisampling = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .flags = 0,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+        .sampleShadingEnable = VK_FALSE,
+        .minSampleShading = 1.0f,
+        .pSampleMask = NULL,
+        .alphaToCoverageEnable = VK_FALSE,
+        .alphaToOneEnable = VK_FALSE,
+        .pNext = NULL,
+    };
+
+    const VkPipelineColorBlendAttachmentState color_blend_attachment = {
+        .blendEnable = VK_FALSE,
+        .srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .colorBlendOp = VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .alphaBlendOp = VK_BLEND_OP_ADD,
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+    };
+
+    const VkPipelineColorBlendStateCreateInfo color_blending = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .flags = 0,
+        .logicOpEnable = VK_FALSE,
+        .logicOp = VK_LOGIC_OP_COPY,
+        .attachmentCount = 1,
+        .pAttachments = &color_blend_attachment,
+        .blendConstants = { 0.0f, 0.0f, 0.0f, 0.0f },
+        .pNext = NULL,
+    };
+
+    const VkGraphicsPipelineCreateInfo pipeline_create_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .flags = 0,
+        .stageCount = 2,
+        .pStages = shader_stages,
+        .pVertexInputState = pipeline->scene == CUBE_SCENE_INSTANCED ? &instanced_vertex_input_info : &vertex_input_info,
+        .pInputAssemblyState = &input_assembly,
+        .pTessellationState = NULL,
+        .pViewportState = &viewport_state,
+        .pRasterizationState = &rasterizer,
+        .pMultisampleState = &multisampling,
+        .pDepthStencilState = NULL,
+        .pColorBlendState = &color_blending,
+        .pDynamicState = &dynamic_state,
+        .layout = pipeline->pipeline_layout,
+        .renderPass = pipeline->renderpass,
+        .subpass = 0,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1,
+        .pNext = NULL,
+    };
+
+    ok = pipeline_cache_create_graphics_pipelines(pipeline->dev->pipeline_cache, 1, &pipeline_create_info, pipeline_out);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't create graphics pipeline. vkCreateGraphicsPipeline");
+        return ok;
+    }
+
+    return VK_SUCCESS;
+}
+
+
+/**
+ * @brief Switch to the pipeline variant for @a shading, creating it if this
+ * combination wasn't used before. Command buffers need to be re-recorded afterwards.
+ */
+static VkResult cube_pipeline_use_shading(struct cube_pipeline *pipeline, const struct cube_shading *shading) {
+    struct pipeline_variant_key key;
+    VkPipeline vkpipeline;
+    VkResult ok;
+
+    pipeline_variant_key_init(&key);
+    pipeline_variant_key_set_float(&key, CUBE_CONSTANT_LIGHT_X, shading->light[0]);
+    pipeline_variant_key_set_float(&key, CUBE_CONSTANT_LIGHT_Y, shading->light[1]);
+    pipeline_variant_key_set_float(&key, CUBE_CONSTANT_LIGHT_Z, shading->light[2]);
+    pipeline_variant_key_set_bool(&key, CUBE_CONSTANT_LIGHTING, shading->lighting);
+    pipeline_variant_key_set_float(&key, CUBE_CONSTANT_GAMMA, shading->gamma);
+
+    ok = pipeline_variants_get(pipeline->variants, &key, &vkpipeline);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't get pipeline variant. pipeline_variants_get");
+        return ok;
+    }
+
+    pipeline->pipeline = vkpipeline;
+    return VK_SUCCESS;
+}
+
+static struct cube_pipeline *cube_pipeline_new(struct vkdev *dev, int width, int height, VkFormat format, enum cube_scene scene, int n_instances, const struct cube_shading *shading) {
+    VkPipelineLayout pipeline_layout;
+    struct cube_pipeline *pipeline;
+    VkDescriptorSetLayout set_layout;
+    VkShaderModule vert_shader, frag_shader;
+    VkRenderPass renderpass;
+    VkResult ok;
+
+    ok = vkCreateShaderModule(
+        dev->device,
+        &(const VkShaderModuleCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .flags = 0,
+            .codeSize = scene == CUBE_SCENE_INSTANCED ? sizeof(instanced_vert_data) : sizeof(vkcube_vert_data),
+            .pCode = scene == CUBE_SCENE_INSTANCED ? instanced_vert_data : vkcube_vert_data,
+            .pNext = NULL
+        },
+        NULL,
+        &vert_shader
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Could not load vertex shader. vkCreateShaderModule");
+        return NULL;
+    }
+
+    ok = vkCreateShaderModule(
+        dev->device,
+        &(const VkShaderModuleCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .flags = 0,
+            .codeSize = sizeof(vkcube_frag_data),
+            .pCode = vkcube_frag_data,
+            .pNext = NULL
+        },
+        NULL,
+        &frag_shader
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Could not load vertex shader. vkCreateShaderModule");
+        goto fail_destroy_vert_shader;
+    }
+
+    ok = vkCreateDescriptorSetLayout(
+        dev->device,
+        &(const VkDescriptorSetLayoutCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .flags = 0,
+            .bindingCount = 1,
+            .pBindings = (VkDescriptorSetLayoutBinding[]) {
+                {
+                    .binding = 0,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                    .descriptorCount = 1,
+                    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+                    .pImmutableSamplers = NULL
+                }
+            },
+            .pNext = NULL,
+        },
+        NULL,
+        &set_layout
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't create descriptor set layout. vkCreateDescriptorSetLayout");
+        goto fail_destroy_frag_shader;
+    }
+
+    const VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .flags = 0,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = scene == CUBE_SCENE_INSTANCED ? 1 : 0,
+        .pPushConstantRanges = &(const VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+            .offset = 0,
+            .size = sizeof(struct instanced_push_constants),
+        },
+        .pNext = NULL,
+    };
+
+    ok = vkCreatePipelineLayout(dev->device, &pipeline_layout_info, NULL, &pipeline_layout);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't create pipeline layout. vkCreatePipelineLayout");
+        goto fail_destroy_descriptor_set_layout;
+    }
+
+    const VkAttachmentDescription color_attachment = {
+        .flags = 0,
+        .format = format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_GENERAL, // can be anything since we manually transition the image layout
+    };
+
+    const VkAttachmentReference color_attachment_reference = {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    };
+
+    const VkSubpassDescription subpass = {
+        .flags = 0,
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .inputAttachmentCount = 0,
+        .pInputAttachments = 0,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_attachment_reference,
+        .pResolveAttachments = NULL,
+        .pDepthStencilAttachment = NULL,
+        .preserveAttachmentCount = 0,
+        .pPreserveAttachments = NULL,
+    };
+
+    const VkRenderPassCreateInfo render_pass_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .flags = 0,
+        .attachmentCount = 1,
+        .pAttachments = &color_attachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = 0,
+        .pDependencies = NULL,
+        .pNext = NULL,
+    };
+
+    ok = vkCreateRenderPass(dev->device, &render_pass_info, NULL, &renderpass);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Could not create render pass. vkCreateRenderPass");
+        goto fail_destroy_layout;
+    }
+
+    pipeline = malloc(sizeof *pipeline);
+    if (pipeline == NULL) {
+        goto fail_destroy_renderpass;
+    }
+
+    pipeline->vert_shader = vert_shader;
+    pipeline->frag_shader = frag_shader;
+    pipeline->set_layout = set_layout;
+    pipeline->pipeline_layout = pipeline_layout;
+    pipeline->renderpass = renderpass;
+    pipeline->pipeline = VK_NULL_HANDLE;
+    pipeline->dev = dev;
+    pipeline->width = width;
+    pipeline->height = height;
+    pipeline->scene = scene;
+    pipeline->n_instances = scene == CUBE_SCENE_INSTANCED ? n_instances : 1;
+
+    if (pipeline_variants_new(&pipeline->variants, dev->device, cube_pipeline_create_variant, pipeline) != 0) {
+        LOG_ERROR("Couldn't create pipeline variants.\n");
+        goto fail_free_pipeline;
+    }
+
+    ok = cube_pipeline_use_shading(pipeline, shading);
+    if (ok != VK_SUCCESS) {
+        goto fail_destroy_variants;
+    }
+
+    return pipeline;
+
+    
+    fail_destroy_variants:
+    pipeline_variants_destroy(pipeline->variants);
+
+    fail_free_pipeline:
+    free(pipeline);
+
+    fail_destroy_renderpass:
+    vkDestroyRenderPass(dev->device, renderpass, NULL);
+
+    fail_destroy_layout:
+    vkDestroyPipelineLayout(dev->device, pipeline_layout, NULL);
+
+    fail_destroy_descriptor_set_layout:
+    vkDestroyDescriptorSetLayout(dev->device, set_layout, NULL);
+
+    fail_destroy_frag_shader:
+    vkDestroyShaderModule(dev->device, frag_shader, NULL);
+
+    fail_destroy_vert_shader:
+    vkDestroyShaderModule(dev->device, vert_shader, NULL);
+    return NULL;
+}
+
+void cube_pipeline_destroy(struct cube_pipeline *pipeline, VkDevice device) {
+    pipeline_variants_destroy(pipeline->variants);
+    vkDestroyRenderPass(device, pipeline->renderpass, NULL);
+    vkDestroyPipelineLayout(device, pipeline->pipeline_layout, NULL);
+    vkDestroyShaderModule(device, pipeline->frag_shader, NULL);
+    vkDestroyShaderModule(device, pipeline->vert_shader, NULL);
+}
+
+/**
+ * @brief Record the rendering commands into @a buffer, which needs to be in the initial state.
+ *
+ * @a push is only used by the instanced scene. Push constants are part of the
+ * command buffer, so the instanced scene is re-recorded every frame. That's cheap,
+ * since it's just one draw no matter how many cubes there are.
+ */
+static VkResult cube_pipeline_record_commands(
+    struct cube_pipeline *pipeline,
+    VkCommandBuffer buffer,
+    struct pipeline_fb *dest,
+    struct cube_gpu_buffer *gpubuf,
+    struct gpu_queries *queries,
+    int slot,
+    const struct instanced_push_constants *push
+) {
+    VkResult ok;
+
+    ok = vkBeginCommandBuffer(
+        buffer,
+        &(const VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = 0,
+            .pInheritanceInfo = NULL,
+            .pNext = NULL
+        }
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Could not begin recording rendering commands to command buffer. vkBeginCommandBuffer");
+        return ok;
+    }
+
+    if (queries != NULL) {
+        gpu_queries_cmd_begin(queries, buffer, slot);
+    }
+
+    vkCmdBeginRenderPass(
+        buffer,
+        &(const VkRenderPassBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = pipeline->renderpass,
+            .framebuffer = dest->fb,
+            .renderArea = {
+                .offset = { 0.0f, 0.0f },
+                .extent = {
+                    dest->viewport_width,
+                    dest->viewport_height,
+                },
+            },
+            .clearValueCount = 1,
+            .pClearValues = (const VkClearValue[1]) {
+                {
+                    .color = {{0.0f, 0.0f, 0.0f, 1.0f}},
+                },
+            },
+            .pNext = NULL,
+        },
+        VK_SUBPASS_CONTENTS_INLINE
+    );
+
+    if (queries != NULL) {
+        gpu_queries_cmd_begin_pass(queries, buffer, slot);
+    }
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+
+    if (pipeline->scene == CUBE_SCENE_INSTANCED) {
+        vkCmdPushConstants(buffer, pipeline->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof *push, push);
+    } else {
+        vkCmdBindVertexBuffers(
+            buffer, 0, 1,
+            &gpubuf->vertex_buffer,
+            (const VkDeviceSize[1]) { offsetof(struct cube_mesh, vertices) }
+        );
+
+        vkCmdBindIndexBuffer(buffer, gpubuf->vertex_buffer, offsetof(struct cube_mesh, indices), VK_INDEX_TYPE_UINT16);
+
+        vkCmdBindDescriptorSets(
+            buffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            pipeline->pipeline_layout,
+            0, 1,
+            &gpubuf->descriptor_set,
+            1,
+            (const uint32_t[1]) { cube_gpu_buffer_get_ubo_offset(gpubuf, slot) }
+        );
+    }
+
+    vkCmdSetViewport(
+        buffer,
+        0,
+        1,
+        &(const VkViewport) {
+            .x = 0.0f,
+            .y = 0.0f,
+            .width = dest->viewport_width,
+            .height = dest->viewport_height,
+            .minDepth = 0.0f,
+            .maxDepth = 1.0f,
+        }
+    );
+
+    vkCmdSetScissor(
+        buffer,
+        0,
+        1,
+        &(const VkRect2D) {
+            .offset = {0, 0},
+            .extent = {
+                dest->viewport_width,
+                dest->viewport_height
+            }
+        }
+    );
+
+    if (pipeline->scene == CUBE_SCENE_INSTANCED) {
+        // 6 faces, 2 triangles each
+        vkCmdDraw(buffer, 36, pipeline->n_instances, 0, 0);
+    } else {
+        vkCmdDrawIndexed(buffer, CUBE_N_INDICES, 1, 0, 0, 0);
+    }
+
+    if (queries != NULL) {
+        gpu_queries_cmd_end_pass(queries, buffer, slot);
+    }
+
+    vkCmdEndRenderPass(buffer);
+
+    if (queries != NULL) {
+        gpu_queries_cmd_end(queries, buffer, slot);
+    }
+
+    ok = vkEndCommandBuffer(buffer);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't finish recording rendering commands. vkEndCommandBuffer");
+        return ok;
+    }
+
+    return VK_SUCCESS;
+}
+
+VkCommandBuffer cube_pipeline_record(struct vkdev *dev, struct cube_pipeline *pipeline, struct pipeline_fb *dest, struct cube_gpu_buffer *gpubuf, struct gpu_queries *queries, int slot, const struct instanced_push_constants *push) {
+    VkCommandBuffer buffer;
+    VkResult ok;
+
+    ok = vkAllocateCommandBuffers(
+        dev->device,
+        &(const VkCommandBufferAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = dev->graphics_cmd_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+            .pNext = NULL,
+        },
+        &buffer
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Could not allocate command buffer for recording rendering commands. vkAllocateCommandBuffers");
+        return VK_NULL_HANDLE;
+    }
+
+    ok = cube_pipeline_record_commands(pipeline, buffer, dest, gpubuf, queries, slot, push);
+    if (ok != VK_SUCCESS) {
+        goto fail_free_buffer;
+    }
+
+    return buffer;
+
+
+    fail_free_buffer:
+    vkFreeCommandBuffers(dev->device, dev->graphics_cmd_pool, 1, &buffer);
+    return VK_NULL_HANDLE;
+}
+
+
+/// Maximum number of render targets. Fewer are used if memory is tight.
+#define CUBE_MAX_IMAGES 4
+#define CUBE_MIN_IMAGES 2
+
+/// We only drive one output for now. It's still passed around so the memory
+/// accounting is per output.
+#define CUBE_OUTPUT 0
+
+struct vkkmscube {
+    struct vkdev *vkdev;
+    struct cube_pipeline *pipeline;
+
+    int width, height;
+    
+    int drm_fd;
+    struct drmdev *drmdev;
+    struct gbm_device *gbm_device;
+    struct fbcache *fbcache;
+
+    /// Vertex data and one uniform buffer slot per image.
+    struct cube_gpu_buffer *gpubuf;
+
+    /// GPU timestamp / pipeline statistics queries, one slot per image.
+    /// NULL if the device doesn't support timestamps.
+    struct gpu_queries *queries;
+
+    /// Only used by the instanced scene. Everything but the time stays the same.
+    struct instanced_push_constants push;
+
+    /// Number of render targets actually used, see @ref init_memory_task.
+    int n_images;
+
+    /// Only with dynamic resolution, NULL otherwise. Frames are then rendered at
+    /// viewport_width x viewport_height and upscaled by the primary plane, which
+    /// is updated using atomic commits.
+    struct viewport_governor *governor;
+    int viewport_width, viewport_height;
+    uint32_t primary_plane_id;
+    bool needs_modeset;
+
+    struct {
+        struct vk_kms_image *image;
+        struct pipeline_fb *fb;
+        VkCommandBuffer cmdbuf;
+        uint32_t fb_id;
+    } images[CUBE_MAX_IMAGES];
+};
+
+static VkBool32 on_debug_utils_message(
+    VkDebugUtilsMessageSeverityFlagBitsEXT           severity,
+    VkDebugUtilsMessageTypeFlagsEXT                  types,
+    const VkDebugUtilsMessengerCallbackDataEXT*      data,
+    void*                                            userdata
+) {
+    LOG_DEBUG(
+        "[%s] (%"PRIi32", %s) %s (queues: %d, cmdbufs: %d, objects: %d)\n",
+        severity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT ? "VERBOSE" :
+            severity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT ? "INFO" :
+            severity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT ? "WARNING" :
+            severity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT ? "ERROR" : "unknown severity",
+        data->messageIdNumber,
+        data->pMessageIdName,
+        data->pMessage,
+        data->queueLabelCount,
+        data->cmdBufLabelCount,
+        data->objectCount
+    );
+    return VK_TRUE;
+}
+
+static struct drmdev *open_drmdev() {
+    struct drmdev *drmdev;
+    drmDevicePtr devices[64];
+    int n_devices;
+    int ok;
+
+    n_devices = drmGetDevices2(0, devices, sizeof(devices)/sizeof(*devices));
+    if (n_devices < 0) {
+        LOG_ERROR("Could not query DRM device list: %s\n", strerror(-n_devices));
+        return NULL;
+    }
+
+    // find a GPU that has a primary node
+    drmdev = NULL;
+    for (int i = 0; i < n_devices; i++) {
+        drmDevicePtr device;
+
+        device = devices[i];
+
+        if (!(device->available_nodes & (1 << DRM_NODE_PRIMARY))) {
+            // We need a primary node.
+            continue;
+        }
+
+        ok = drmdev_new_from_path(&drmdev, device->nodes[DRM_NODE_PRIMARY]);
+        if (ok != 0) {
+            LOG_ERROR("Could not create drmdev from device at \"%s\". Continuing.\n", device->nodes[DRM_NODE_PRIMARY]);
+            continue;
+        }
+
+        break;
+    }
+
+    if (drmdev == NULL) {
+        LOG_ERROR("Couldn't find a usable DRM device.\n"
+                  "Please make sure you've enabled the Fake-KMS driver in raspi-config.\n"
+                  "If you're not using a Raspberry Pi, please make sure there's KMS support for your graphics chip.\n");
+        return NULL;
+    }
+
+    return drmdev;
+}
+
+static int configure_drmdev(struct drmdev *drmdev) {
+    const struct drm_connector *connector;
+    const struct drm_encoder *encoder;
+    const struct drm_crtc *crtc;
+    const drmModeModeInfo *mode, *mode_iter;
+    int ok;
+
+    // find a connected connector
+    for_each_connector_in_drmdev(drmdev, connector) {
+        if (connector->connector->connection == DRM_MODE_CONNECTED) {
+            break;
+        }
+    }
+
+    if (connector == NULL) {
+        LOG_ERROR("Could not find a connected connector!\n");
+        return ENODEV;
+    }
+
+    // Find the preferred mode (GPU drivers _should_ always supply a preferred mode, but of course, they don't)
+    // Alternatively, find the mode with the highest width*height. If there are multiple modes with the same w*h,
+    // prefer higher refresh rates. After that, prefer progressive scanout modes.
+    mode = NULL;
+    for_each_mode_in_connector(connector, mode_iter) {
+        if (mode_iter->type & DRM_MODE_TYPE_PREFERRED) {
+            mode = mode_iter;
+            break;
+        } else if (mode == NULL) {
+            mode = mode_iter;
+        } else {
+            int area = mode_iter->hdisplay * mode_iter->vdisplay;
+            int old_area = mode->hdisplay * mode->vdisplay;
+
+            if ((area > old_area) ||
+                ((area == old_area) && (mode_iter->vrefresh > mode->vrefresh)) ||
+                ((area == old_area) && (mode_iter->vrefresh == mode->vrefresh) && ((mode->flags & DRM_MODE_FLAG_INTERLACE) == 0))) {
+                mode = mode_iter;
+            }
+        }
+    }
+
+    if (mode == NULL) {
+        LOG_ERROR("Could not find a preferred output mode!\n");
+        return ENODEV;
+    }
+
+    for_each_encoder_in_drmdev(drmdev, encoder) {
+        if (encoder->encoder->encoder_id == connector->connector->encoder_id) {
+            break;
+        }
+    }
+
+    if (encoder == NULL) {
+        for (int i = 0; i < connector->connector->count_encoders; i++, encoder = NULL) {
+            for_each_encoder_in_drmdev(drmdev, encoder) {
+                if (encoder->encoder->encoder_id == connector->connector->encoders[i]) {
+                    break;
+                }
+            }
+
+            if (encoder->encoder->possible_crtcs) {
+                // only use this encoder if there's a crtc we can use with it
+                break;
+            }
+        }
+    }
+
+    if (encoder == NULL) {
+        LOG_ERROR("Could not find a suitable DRM encoder.\n");
+        return ENODEV;
+    }
+
+    for_each_crtc_in_drmdev(drmdev, crtc) {
+        if (crtc->crtc->crtc_id == encoder->encoder->crtc_id) {
+            break;
+        }
+    }
+
+    if (crtc == NULL) {
+        for_each_crtc_in_drmdev(drmdev, crtc) {
+            if (encoder->encoder->possible_crtcs & crtc->bitmask) {
+                // find a CRTC that is possible to use with this encoder
+                break;
+            }
+        }
+    }
+
+    if (crtc == NULL) {
+        LOG_ERROR("Could not find a suitable DRM CRTC.\n");
+        return ENODEV;
+    }
+
+    ok = drmdev_configure(drmdev, connector->connector->connector_id, encoder->encoder->encoder_id, crtc->crtc->crtc_id, mode);
+    if (ok != 0) return ok;
+
+    return 0;
+}
+
+/**
+ * @brief Create the vulkan device. With KMS, @a drm_fd is the opened DRM device,
+ * and the GPU that belongs to it is preferred. -1 if there's no DRM device.
+ */
+static struct vkdev *create_vkdev(bool headless, int drm_fd) {
+    // clang-format off
+    if (headless) {
+        // Without KMS we don't need dmabuf import or DRM format modifiers, so this
+        // also works on software rasterizers like lavapipe. The validation layer
+        // would dominate the measured CPU times, so it's not enabled either.
+        return vkdev_new(
+            "vk-kmscube", VK_MAKE_VERSION(0, 0, 1),
+            "vk-kmscube", VK_MAKE_VERSION(0, 0, 1),
+            VK_MAKE_VERSION(1, 1, 0),
+            NULL, NULL,
+            NULL, NULL,
+            (const char*[]) {
+                VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+                NULL
+            },
+            (const char*[]) {
+                VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+                VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+                NULL
+            },
+            NULL,
+            drm_fd
+        );
+    }
+
+    return vkdev_new(
+        "vk-kmscube", VK_MAKE_VERSION(0, 0, 1),
+        "vk-kmscube", VK_MAKE_VERSION(0, 0, 1),
+        VK_MAKE_VERSION(1, 1, 0),
+        (const char*[]) { "VK_LAYER_KHRONOS_validation", NULL }, NULL,
+        (const char*[]) { "VK_EXT_debug_utils", NULL }, NULL,
+        (const char*[]) {
+            VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
+            VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+            VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME,
+            VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
+            VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME,
+            VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME,
+            VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME,
+            VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+            NULL
+        },
+        (const char*[]) {
+            VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+            NULL
+        },
+        &(const struct debug_messenger) {
+            .flags = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
+                | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
+                | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
+            .severities = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT
+                | VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT
+                | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
+                | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,
+            .types = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
+                | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
+                | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
+            .cb = on_debug_utils_message,
+            .userdata = NULL
+        },
+        drm_fd
+    );
+    // clang-format on
+}
 
-    const VkPipelineInputAssemblyStateCreateInfo input_assembly = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-        .pNext = 0,
-        .flags = 0,
-        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
-        .primitiveRestartEnable = VK_FALSE,
-    };
+/**
+ * @brief A render target format, as vulkan, DRM and GBM call it.
+ */
+struct cube_format {
+    VkFormat vk_format;
+    uint32_t drm_format;
+    uint32_t gbm_format;
+    int bytes_per_pixel;
+};
 
-    const VkViewport viewport = {
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = width,
-        .height = height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f,
-    };
+static const struct cube_format cube_format_xrgb8888 = {
+    .vk_format = VK_FORMAT_B8G8R8A8_SRGB,
+    .drm_format = DRM_FORMAT_XRGB8888,
+    .gbm_format = GBM_FORMAT_XRGB8888,
+    .bytes_per_pixel = 4,
+};
 
-    const VkRect2D scissor = {
-        .offset = {0, 0},
-        .extent = {width, height}
-    };
+/// Used instead of XRGB8888 when memory is tight, see @ref init_memory_task.
+/// There's no sRGB variant of this, so the colors are a bit darker.
+static const struct cube_format cube_format_rgb565 = {
+    .vk_format = VK_FORMAT_R5G6B5_UNORM_PACK16,
+    .drm_format = DRM_FORMAT_RGB565,
+    .gbm_format = GBM_FORMAT_RGB565,
+    .bytes_per_pixel = 2,
+};
 
-    const VkPipelineViewportStateCreateInfo viewport_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-        .flags = 0,
-        .viewportCount = 1,
-        .pViewports = &viewport,
-        .scissorCount = 1,
-        .pScissors = &scissor,
-        .pNext = NULL,
-    };
-    
-    const VkPipelineRasterizationStateCreateInfo rasterizer = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-        .flags = 0,
-        .depthClampEnable = VK_FALSE,
-        .rasterizerDiscardEnable = VK_FALSE,
-        .polygonMode = VK_POLYGON_MODE_FILL,
-        .cullMode = VK_CULL_MODE_BACK_BIT,
-        .frontFace = VK_FRONT_FACE_CLOCKWISE,
-        .depthBiasEnable = VK_FALSE,
-        .depthBiasConstantFactor = 0.0f,
-        .depthBiasClamp = 0.0f,
-        .depthBiasSlopeFactor = 0.0f,
-        .lineWidth = 1.0f,
-        .pNext = NULL,
-    };
+/**
+ * @brief State shared by the startup tasks of @ref vkkmscube_new.
+ *
+ * Each task only writes the fields it creates, and only reads fields
+ * written by the tasks it depends on.
+ */
+struct cube_init {
+    struct vkkmscube *cube;
 
-    const VkPipelineMultisampleStateCreateInfo multisampling = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-        .flags = 0,
-        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-        .sampleShadingEnable = VK_FALSE,
-        .minSampleShading = 1.0f,
-        .pSampleMask = NULL,
-        .alphaToCoverageEnable = VK_FALSE,
-        .alphaToOneEnable = VK_FALSE,
-        .pNext = NULL,
-    };
+    /// Render into offscreen images instead of KMS framebuffers.
+    /// The kms & gbm tasks don't do anything in that case.
+    bool headless;
 
-    const VkPipelineColorBlendAttachmentState color_blend_attachment = {
-        .blendEnable = VK_FALSE,
-        .srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
-        .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
-        .colorBlendOp = VK_BLEND_OP_ADD,
-        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-        .alphaBlendOp = VK_BLEND_OP_ADD,
-        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-    };
+    struct vkdev *dev;
+    struct drmdev *drmdev;
+    struct gbm_device *gbm_device;
+    struct fbcache *fbcache;
+    struct cube_pipeline *pipeline;
+    int width, height;
 
-    const VkPipelineColorBlendStateCreateInfo color_blending = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-        .flags = 0,
-        .logicOpEnable = VK_FALSE,
-        .logicOp = VK_LOGIC_OP_COPY,
-        .attachmentCount = 1,
-        .pAttachments = &color_blend_attachment,
-        .blendConstants = { 0.0f, 0.0f, 0.0f, 0.0f },
-        .pNext = NULL,
-    };
+    enum cube_scene scene;
+    int n_instances;
+    struct cube_shading shading;
 
-    ok = vkCreateDescriptorSetLayout(
-        dev->device,
-        &(const VkDescriptorSetLayoutCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-            .flags = 0,
-            .bindingCount = 1,
-            .pBindings = (VkDescriptorSetLayoutBinding[]) {
-                {
-                    .binding = 0,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                    .descriptorCount = 1,
-                    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-                    .pImmutableSamplers = NULL
-                }
-            },
-            .pNext = NULL,
-        },
-        NULL,
-        &set_layout
-    );
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't create descriptor set layout. vkCreateDescriptorSetLayout");
-        goto fail_destroy_frag_shader;
+    /// Chosen by the memory task, depending on the memory budget.
+    int n_images;
+    const struct cube_format *format;
+
+    struct cube_init_image {
+        struct cube_init *init;
+        int index;
+    } images[CUBE_MAX_IMAGES];
+};
+
+static int init_vulkan_task(void *userdata) {
+    struct cube_init *init = userdata;
+
+    init->dev = create_vkdev(init->headless, init->drmdev != NULL ? init->drmdev->fd : -1);
+    if (init->dev == NULL) {
+        LOG_ERROR("Could not setup vulkan device.\n");
+        return EIO;
     }
 
-    const VkPipelineLayoutCreateInfo pipeline_layout_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .flags = 0,
-        .setLayoutCount = 1,
-        .pSetLayouts = &set_layout,
-        .pushConstantRangeCount = 0,
-        .pPushConstantRanges = NULL,
-        .pNext = NULL,
-    };
+    return 0;
+}
 
-    ok = vkCreatePipelineLayout(dev->device, &pipeline_layout_info, NULL, &pipeline_layout);
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't create pipeline layout. vkCreatePipelineLayout");
-        goto fail_destroy_descriptor_set_layout;
+static int init_drm_task(void *userdata) {
+    struct cube_init *init = userdata;
+
+    if (init->headless) {
+        return 0;
     }
 
-    const VkAttachmentDescription color_attachment = {
-        .flags = 0,
-        .format = format,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_GENERAL, // can be anything since we manually transition the image layout
-    };
+    init->drmdev = open_drmdev();
+    if (init->drmdev == NULL) {
+        LOG_ERROR("Couldn't open a KMS device\n");
+        return EIO;
+    }
 
-    const VkAttachmentReference color_attachment_reference = {
-        .attachment = 0,
-        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-    };
+    return 0;
+}
 
-    const VkSubpassDescription subpass = {
-        .flags = 0,
-        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-        .inputAttachmentCount = 0,
-        .pInputAttachments = 0,
-        .colorAttachmentCount = 1,
-        .pColorAttachments = &color_attachment_reference,
-        .pResolveAttachments = NULL,
-        .pDepthStencilAttachment = NULL,
-        .preserveAttachmentCount = 0,
-        .pPreserveAttachments = NULL,
-    };
+static int init_kms_task(void *userdata) {
+    struct cube_init *init = userdata;
+    int ok;
 
-    const VkRenderPassCreateInfo render_pass_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-        .flags = 0,
-        .attachmentCount = 1,
-        .pAttachments = &color_attachment,
-        .subpassCount = 1,
-        .pSubpasses = &subpass,
-        .dependencyCount = 0,
-        .pDependencies = NULL,
-        .pNext = NULL,
-    };
+    if (init->headless) {
+        // width & height were already set from the options.
+        return 0;
+    }
 
-    ok = vkCreateRenderPass(dev->device, &render_pass_info, NULL, &renderpass);
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Could not create render pass. vkCreateRenderPass");
-        goto fail_destroy_layout;
+    ok = configure_drmdev(init->drmdev);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't configure the KMS device.\n");
+        return ok;
     }
 
-    const VkGraphicsPipelineCreateInfo pipeline_create_info = {
-        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .flags = 0,
-        .stageCount = 2,
-        .pStages = shader_stages,
-        .pVertexInputState = &vertex_input_info,
-        .pInputAssemblyState = &input_assembly,
-        .pTessellationState = NULL,
-        .pViewportState = &viewport_state,
-        .pRasterizationState = &rasterizer,
-        .pMultisampleState = &multisampling,
-        .pDepthStencilState = NULL,
-        .pColorBlendState = &color_blending,
-        .pDynamicState = &dynamic_state,
-        .layout = pipeline_layout,
-        .renderPass = renderpass,
-        .subpass = 0,
-        .basePipelineHandle = VK_NULL_HANDLE,
-        .basePipelineIndex = -1,
-        .pNext = NULL,
-    };
+    init->width = init->drmdev->selected_mode->hdisplay;
+    init->height = init->drmdev->selected_mode->vdisplay;
+    return 0;
+}
 
-    ok = vkCreateGraphicsPipelines(dev->device, VK_NULL_HANDLE, 1, &pipeline_create_info, NULL, &vkpipeline);
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't create graphics pipeline. vkCreateGraphicsPipeline");
-        goto fail_destroy_layout;
+static int init_gbm_task(void *userdata) {
+    struct cube_init *init = userdata;
+    int ok;
+
+    if (init->headless) {
+        return 0;
     }
 
-    pipeline = malloc(sizeof *pipeline);
-    if (pipeline == NULL) {
-        goto fail_destroy_pipeline;
+    init->gbm_device = gbm_create_device(init->drmdev->fd);
+    if (init->gbm_device == NULL) {
+        LOG_ERROR("Couldn't create GBM device from KMS fd. gbm_create_device: %s\n", strerror(errno));
+        return EIO;
     }
 
-    pipeline->vert_shader = vert_shader;
-    pipeline->frag_shader = frag_shader;
-    pipeline->set_layout = set_layout;
-    pipeline->pipeline_layout = pipeline_layout;
-    pipeline->renderpass = renderpass;
-    pipeline->pipeline = vkpipeline;
-    return pipeline;
+    // 4 scanout buffers will always stay referenced, this leaves some room
+    // for foreign buffers that get recycled.
+    ok = fbcache_new(&init->fbcache, init->drmdev->fd, (size_t) 8 * init->width * init->height * 4);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't create framebuffer cache. fbcache_new: %s\n", strerror(ok));
+        gbm_device_destroy(init->gbm_device);
+        return ok;
+    }
 
-    
-    fail_destroy_pipeline:
-    vkDestroyPipeline(dev->device, vkpipeline, NULL);
+    return 0;
+}
 
-    fail_destroy_renderpass:
-    vkDestroyRenderPass(dev->device, renderpass, NULL);
+/**
+ * @brief Decide how many render targets we can afford, and at which depth.
+ *
+ * On boards with little (shared) memory, 4 full-size scanout buffers can be
+ * too much, so we first go down to double buffering and then to 16 bit.
+ */
+static int init_memory_task(void *userdata) {
+    struct cube_init *init = userdata;
+    struct memtrack_plan plan;
+    VkDeviceSize n_pixels;
+
+    n_pixels = (VkDeviceSize) init->width * init->height;
+
+    memtrack_plan_render_targets(
+        init->dev->memtrack,
+        n_pixels * cube_format_xrgb8888.bytes_per_pixel,
+        n_pixels * cube_format_rgb565.bytes_per_pixel,
+        CUBE_MIN_IMAGES,
+        CUBE_MAX_IMAGES,
+        &plan
+    );
 
-    fail_destroy_layout:
-    vkDestroyPipelineLayout(dev->device, pipeline_layout, NULL);
+    init->n_images = plan.n_buffers;
+    init->format = plan.low_depth ? &cube_format_rgb565 : &cube_format_xrgb8888;
 
-    fail_destroy_descriptor_set_layout:
-    vkDestroyDescriptorSetLayout(dev->device, set_layout, NULL);
+    if (plan.n_buffers < CUBE_MAX_IMAGES || plan.low_depth) {
+        LOG_DEBUG(
+            "Memory is tight, using %d instead of %d render targets%s.\n",
+            plan.n_buffers,
+            CUBE_MAX_IMAGES,
+            plan.low_depth ? " with 16 bits per pixel" : ""
+        );
+    }
 
-    fail_destroy_frag_shader:
-    vkDestroyShaderModule(dev->device, frag_shader, NULL);
+    return 0;
+}
 
-    fail_destroy_vert_shader:
-    vkDestroyShaderModule(dev->device, vert_shader, NULL);
-    return NULL;
+static int init_pipeline_task(void *userdata) {
+    struct cube_init *init = userdata;
+
+    init->pipeline = cube_pipeline_new(init->dev, init->width, init->height, init->format->vk_format, init->scene, init->n_instances, &init->shading);
+    if (init->pipeline == NULL) {
+        LOG_ERROR("Couldn't setup graphics pipeline.\n");
+        return EIO;
+    }
+
+    pipeline_cache_report(init->dev->pipeline_cache);
+    return 0;
+}
+
+static int init_image_task(void *userdata) {
+    struct cube_init_image *init_image = userdata;
+    struct cube_init *init = init_image->init;
+    struct vk_kms_image *img;
+    uint32_t fb_id;
+    int ok;
+
+    if (init_image->index >= init->n_images) {
+        init->cube->images[init_image->index].image = NULL;
+        return 0;
+    }
+
+    if (init->headless) {
+        img = vk_offscreen_image_new(init->dev, CUBE_OUTPUT, init->width, init->height, init->format->vk_format);
+        if (img == NULL) {
+            LOG_ERROR("Couldn't create offscreen image.\n");
+            return EIO;
+        }
+
+        init->cube->images[init_image->index].image = img;
+        init->cube->images[init_image->index].fb_id = 0;
+        return 0;
+    }
+
+    img = vk_kms_image_new(init->dev, init->gbm_device, CUBE_OUTPUT, init->width, init->height, init->format->vk_format, init->format->gbm_format, init->format->drm_format, DRM_FORMAT_MOD_LINEAR);
+    if (img == NULL) {
+        LOG_ERROR("Couldn't create KMS image.\n");
+        return EIO;
+    }
+
+    ok = fbcache_get_for_gem(
+        init->fbcache,
+        init->width, init->height,
+        init->format->drm_format,
+        gbm_bo_get_modifier(img->bo),
+        (uint32_t[4]) { gbm_bo_get_handle_for_plane(img->bo, 0).u32, 0 },
+        (uint32_t[4]) { gbm_bo_get_stride_for_plane(img->bo, 0), 0 },
+        (uint32_t[4]) { gbm_bo_get_offset(img->bo, 0), 0 },
+        &fb_id
+    );
+    if (ok != 0) {
+        LOG_ERROR("Couldn't add GBM BO as kms image.\n");
+        fbcache_forget_gem_handle(init->fbcache, gbm_bo_get_handle_for_plane(img->bo, 0).u32);
+        vk_kms_image_destroy(img, init->dev);
+        return ok;
+    }
+
+    init->cube->images[init_image->index].image = img;
+    init->cube->images[init_image->index].fb_id = fb_id;
+    return 0;
 }
 
-void cube_pipeline_destroy(struct cube_pipeline *pipeline, VkDevice device) {
-    vkDestroyPipeline(device, pipeline->pipeline, NULL);
-    vkDestroyRenderPass(device, pipeline->renderpass, NULL);
-    vkDestroyPipelineLayout(device, pipeline->pipeline_layout, NULL);
-    vkDestroyShaderModule(device, pipeline->frag_shader, NULL);
-    vkDestroyShaderModule(device, pipeline->vert_shader, NULL);
+static int init_buffers_task(void *userdata) {
+    struct cube_init *init = userdata;
+
+    // This uploads the mesh using the transfer & graphics queues and command pools.
+    // That's fine as long as no other task running concurrently uses them, the
+    // command buffers are only recorded in the record task, which runs after this.
+    init->cube->gpubuf = cube_gpu_buffer_new(init->dev, init->pipeline->set_layout, CUBE_MAX_IMAGES);
+    if (init->cube->gpubuf == NULL) {
+        LOG_ERROR("Couldn't create a UBO/vertex buffer.\n");
+        return EIO;
+    }
+
+    return 0;
 }
 
-VkCommandBuffer cube_pipeline_record(struct vkdev *dev, struct cube_pipeline *pipeline, struct pipeline_fb *dest, struct cube_gpu_buffer *gpubuf) {
-    VkCommandBuffer buffer;
-    VkResult ok;
+static int init_queries_task(void *userdata) {
+    struct cube_init *init = userdata;
+    int ok;
 
-    ok = vkAllocateCommandBuffers(
-        dev->device,
-        &(const VkCommandBufferAllocateInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .commandPool = dev->graphics_cmd_pool,
-            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = 1,
-            .pNext = NULL,
-        },
-        &buffer
+    ok = gpu_queries_new(
+        &init->cube->queries,
+        init->dev->physical_device,
+        init->dev->device,
+        init->dev->graphics_queue_family_index,
+        CUBE_MAX_IMAGES,
+        init->dev->pipeline_statistics_supported
     );
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Could not allocate command buffer for recording rendering commands. vkAllocateCommandBuffers");
-        return VK_NULL_HANDLE;
+    if (ok == ENOTSUP) {
+        LOG_DEBUG("GPU timestamps are not supported, GPU times won't be reported.\n");
+        init->cube->queries = NULL;
+    } else if (ok != 0) {
+        LOG_ERROR("Couldn't create GPU query pools. gpu_queries_new: %s\n", strerror(ok));
+        return ok;
     }
 
-    ok = vkBeginCommandBuffer(
-        buffer,
-        &(const VkCommandBufferBeginInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-            .flags = 0,
-            .pInheritanceInfo = NULL,
-            .pNext = NULL
-        }
-    );
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Could not begin recording rendering commands to command buffer. vkBeginCommandBuffer");
-        return VK_NULL_HANDLE;
+    return 0;
+}
+
+static int init_image_target_task(void *userdata) {
+    struct cube_init_image *init_image = userdata;
+    struct cube_init *init = init_image->init;
+    struct pipeline_fb *fb;
+
+    if (init_image->index >= init->n_images) {
+        init->cube->images[init_image->index].fb = NULL;
+        return 0;
     }
 
-    vkCmdBeginRenderPass(
-        buffer,
-        &(const VkRenderPassBeginInfo) {
-            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-            .renderPass = pipeline->renderpass,
-            .framebuffer = dest->fb,
-            .renderArea = {
-                .offset = { 0.0f, 0.0f },
-                .extent = {
-                    dest->width,
-                    dest->height,
-                },
-            },
-            .clearValueCount = 1,
-            .pClearValues = (const VkClearValue[1]) {
-                {
-                    .color = {{0.0f, 0.0f, 0.0f, 1.0f}},
-                },
-            },
-            .pNext = NULL,
-        },
-        VK_SUBPASS_CONTENTS_INLINE
-    );
+    fb = pipeline_fb_new(init->dev, init->cube->images[init_image->index].image, init->pipeline->renderpass);
+    if (fb == NULL) {
+        LOG_ERROR("Couldn't import KMS FB into pipeline.\n");
+        return EIO;
+    }
 
-    vkCmdBindVertexBuffers(
-        buffer, 0, 3,
-        (VkBuffer[]) {
-            gpubuf->buffer,
-            gpubuf->buffer,
-            gpubuf->buffer
-        },
-        (VkDeviceSize[]) {
-            offsetof(struct cube_gpu_data, vertices),
-            offsetof(struct cube_gpu_data, colors),
-            offsetof(struct cube_gpu_data, normals)
-        }
-    );
+    init->cube->images[init_image->index].fb = fb;
+    return 0;
+}
 
-    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+/**
+ * @brief Spread the cubes of the instanced scene over a volume that grows with the
+ * number of cubes, so they stay about equally dense, and move the camera back far
+ * enough to see all of them.
+ */
+static void instanced_push_constants_init(struct instanced_push_constants *push, int n_instances, float aspect_ratio) {
+    float extent, distance;
 
-    vkCmdBindDescriptorSets(
-        buffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        pipeline->pipeline_layout,
-        0, 1,
-        &gpubuf->descriptor_set,
-        0,
-        NULL
-    );
+    extent = cbrtf(n_instances);
+    distance = 3.0f * extent + 2.0f;
 
-    vkCmdSetViewport(
-        buffer,
-        0,
-        1,
-        &(const VkViewport) {
-            .x = 0.0f,
-            .y = 0.0f,
-            .width = dest->width,
-            .height = dest->height,
-            .minDepth = 0.0f,
-            .maxDepth = 1.0f,
-        }
-    );
+    esMatrixLoadIdentity(&push->projection);
+    esFrustum(&push->projection, -0.5f, +0.5f, -0.5f * aspect_ratio, +0.5f * aspect_ratio, 1.0f, distance + 2.0f * extent + 2.0f);
 
-    vkCmdSetScissor(
-        buffer,
-        0,
-        1,
-        &(const VkRect2D) {
-            .offset = {0, 0},
-            .extent = {
-                dest->width,
-                dest->height
-            }
-        }
-    );
+    push->time = 0.0f;
+    push->extent = extent;
+    push->distance = distance;
+    push->scale = 0.5f;
+}
 
-    vkCmdDraw(buffer, 4, 1,  0, 0);
-    vkCmdDraw(buffer, 4, 1,  4, 0);
-    vkCmdDraw(buffer, 4, 1,  8, 0);
-    vkCmdDraw(buffer, 4, 1, 12, 0);
-    vkCmdDraw(buffer, 4, 1, 16, 0);
-    vkCmdDraw(buffer, 4, 1, 20, 0);
+static int init_record_task(void *userdata) {
+    struct cube_init *init = userdata;
+    struct vkkmscube *cube = init->cube;
 
-    vkCmdEndRenderPass(buffer);
+    instanced_push_constants_init(&cube->push, init->pipeline->n_instances, init->height / (float) init->width);
 
-    ok = vkEndCommandBuffer(buffer);
-    if (ok != VK_SUCCESS) {
-        LOG_VK_ERROR(ok, "Couldn't finish recording rendering commands. vkEndCommandBuffer");
-        goto fail_free_buffer;
+    // The command pool is externally synchronized, so we record all
+    // command buffers in one task instead of one per image.
+    for (int i = 0; i < init->n_images; i++) {
+        cube->images[i].cmdbuf = cube_pipeline_record(init->dev, init->pipeline, cube->images[i].fb, cube->gpubuf, cube->queries, i, &cube->push);
+        if (cube->images[i].cmdbuf == VK_NULL_HANDLE) {
+            LOG_ERROR("Couldn't record rendering commands.\n");
+
+            for (int j = 0; j < i; j++) {
+                vkFreeCommandBuffers(init->dev->device, init->dev->graphics_cmd_pool, 1, &(cube->images[j].cmdbuf));
+            }
+            return EIO;
+        }
     }
 
-    return buffer;
+    return 0;
+}
 
+static void log_allocator_stats(struct vkalloc *allocator) {
+    struct vkalloc_stats stats;
+    VkDeviceSize n_bytes_free;
 
-    fail_free_buffer:
-    vkFreeCommandBuffers(dev->device, dev->graphics_cmd_pool, 1, &buffer);
-    return VK_NULL_HANDLE;
-}
+    vkalloc_get_stats(allocator, &stats);
 
+    n_bytes_free = stats.n_bytes_allocated - stats.n_bytes_used;
 
-struct vkkmscube {
-    struct vkdev *vkdev;
-    struct cube_pipeline *pipeline;
+    LOG_DEBUG(
+        "device memory: %zu allocations in %zu blocks (%zu dedicated, %"PRIu64" vkAllocateMemory calls total), "
+        "%"PRIu64" of %"PRIu64" bytes used, %zu free ranges, fragmentation %.1f%%\n",
+        stats.n_allocations,
+        stats.n_blocks,
+        stats.n_dedicated_blocks,
+        stats.n_device_allocations,
+        (uint64_t) stats.n_bytes_used,
+        (uint64_t) stats.n_bytes_allocated,
+        stats.n_free_ranges,
+        n_bytes_free > 0 ? 100.0 * (1.0 - (double) stats.largest_free_range / n_bytes_free) : 0.0
+    );
+}
 
-    int width, height;
-    
-    int drm_fd;
-    struct drmdev *drmdev;
-    struct gbm_device *gbm_device;
+static void log_pipeline_variant_stats(struct pipeline_variants *variants) {
+    struct pipeline_variants_stats stats;
 
-    struct {
-        struct vk_kms_image *image;
-        struct pipeline_fb *fb;
-        VkCommandBuffer cmdbuf;
-        uint32_t fb_id;
-        struct cube_gpu_buffer *gpubuf;
-    } images[4];
-};
+    pipeline_variants_get_stats(variants, &stats);
 
-static VkBool32 on_debug_utils_message(
-    VkDebugUtilsMessageSeverityFlagBitsEXT           severity,
-    VkDebugUtilsMessageTypeFlagsEXT                  types,
-    const VkDebugUtilsMessengerCallbackDataEXT*      data,
-    void*                                            userdata
-) {
     LOG_DEBUG(
-        "[%s] (%"PRIi32", %s) %s (queues: %d, cmdbufs: %d, objects: %d)\n",
-        severity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT ? "VERBOSE" :
-            severity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT ? "INFO" :
-            severity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT ? "WARNING" :
-            severity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT ? "ERROR" : "unknown severity",
-        data->messageIdNumber,
-        data->pMessageIdName,
-        data->pMessage,
-        data->queueLabelCount,
-        data->cmdBufLabelCount,
-        data->objectCount
+        "pipeline variants: %u created, %"PRIu64" cache hits, %"PRIu64" misses\n",
+        stats.n_variants,
+        stats.n_hits,
+        stats.n_misses
     );
-    return VK_TRUE;
 }
 
-static struct drmdev *create_and_configure_drmdev() {
-    const struct drm_connector *connector;
-    const struct drm_encoder *encoder;
-    const struct drm_crtc *crtc;
-    const drmModeModeInfo *mode, *mode_iter;
-    struct drmdev *drmdev;
-    drmDevicePtr devices[64];
-    int n_devices;
+struct vkkmscube_options {
+    /// Render into offscreen images instead of showing them on a KMS device.
+    /// Works without DRM master, a display or even a GPU.
+    bool headless;
+
+    /// Size of the offscreen images. With KMS, the size of the selected mode is used.
+    int width, height;
+
+    enum cube_scene scene;
+
+    /// Number of cubes drawn by the instanced scene.
+    int n_instances;
+
+    struct cube_shading shading;
+
+    /// Render at a lower resolution when the GPU can't keep up, and let the
+    /// display controller upscale. Only with KMS. 0 to disable, otherwise the
+    /// smallest allowed scale factor.
+    float dynamic_resolution_min_scale;
+};
+
+/**
+ * @brief Set up the viewport governor, if the KMS device and the GPU support
+ * everything we need for it. Otherwise we just render at full resolution.
+ */
+static void cube_init_dynamic_resolution(struct vkkmscube *cube, float min_scale) {
+    uint64_t frame_ns;
     int ok;
 
-    n_devices = drmGetDevices2(0, devices, sizeof(devices)/sizeof(*devices));
-    if (n_devices < 0) {
-        LOG_ERROR("Could not query DRM device list: %s\n", strerror(-n_devices));
-        return NULL;
+    cube->governor = NULL;
+    cube->viewport_width = cube->width;
+    cube->viewport_height = cube->height;
+    cube->primary_plane_id = 0;
+    cube->needs_modeset = true;
+
+    if (min_scale <= 0.0f) {
+        return;
     }
 
-    // find a GPU that has a primary node
-    drmdev = NULL;
-    for (int i = 0; i < n_devices; i++) {
-        drmDevicePtr device;
+    if (cube->drmdev == NULL) {
+        LOG_ERROR("Dynamic resolution needs the plane scaler of a KMS device, it's not used in headless mode.\n");
+        return;
+    }
 
-        device = devices[i];
+    if (!cube->drmdev->supports_atomic_modesetting) {
+        LOG_ERROR("Dynamic resolution needs atomic modesetting, which the KMS device doesn't support.\n");
+        return;
+    }
 
-        if (!(device->available_nodes & (1 << DRM_NODE_PRIMARY))) {
-            // We need a primary node.
-            continue;
-        }
+    if (cube->queries == NULL) {
+        LOG_ERROR("Dynamic resolution needs GPU timestamps, which the GPU doesn't support.\n");
+        return;
+    }
 
-        ok = drmdev_new_from_path(&drmdev, device->nodes[DRM_NODE_PRIMARY]);
-        if (ok != 0) {
-            LOG_ERROR("Could not create drmdev from device at \"%s\". Continuing.\n", device->nodes[DRM_NODE_PRIMARY]);
-            continue;
-        }
+    ok = drmdev_get_primary_plane_id(cube->drmdev, &cube->primary_plane_id);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't find a primary plane for dynamic resolution. drmdev_get_primary_plane_id: %s\n", strerror(ok));
+        return;
+    }
 
-        break;
+    frame_ns = (uint64_t) (1000000000.0 / mode_get_vrefresh(cube->drmdev->selected_mode));
+
+    ok = viewport_governor_new(
+        &cube->governor,
+        &(const struct viewport_governor_config) {
+            // leave some room for the CPU work and the commit.
+            .budget_ns = frame_ns * 8 / 10,
+            .min_scale = min_scale,
+            .step = 0.1f,
+            .shrink_frames = 3,
+            .grow_frames = 60,
+            .grow_headroom = 0.8f,
+        }
+    );
+    if (ok != 0) {
+        LOG_ERROR("Couldn't create viewport governor. viewport_governor_new: %s\n", strerror(ok));
+        cube->governor = NULL;
+        return;
     }
 
-    if (drmdev == NULL) {
-        LOG_ERROR("Couldn't find a usable DRM device.\n"
-                  "Please make sure you've enabled the Fake-KMS driver in raspi-config.\n"
-                  "If you're not using a Raspberry Pi, please make sure there's KMS support for your graphics chip.\n");
+    LOG_DEBUG(
+        "Dynamic resolution enabled, GPU time budget is %.2f ms, smallest viewport is %.0f%%.\n",
+        frame_ns * 0.8 / 1000000.0,
+        min_scale * 100.0f
+    );
+}
+
+struct vkkmscube *vkkmscube_new(const struct vkkmscube_options *options) {
+    struct cube_init init = { 0 };
+    struct vkkmscube *cube;
+    struct taskgraph *graph;
+    int ok, drm_task, vulkan_task, kms_task, gbm_task, memory_task, pipeline_task, buffers_task, queries_task, image_tasks[CUBE_MAX_IMAGES], target_tasks[CUBE_MAX_IMAGES], record_task;
+    uint32_t all_targets;
+
+    cube = malloc(sizeof *cube);
+    if (cube == NULL) {
         return NULL;
     }
 
-    // find a connected connector
-    for_each_connector_in_drmdev(drmdev, connector) {
-        if (connector->connector->connection == DRM_MODE_CONNECTED) {
-            break;
-        }
+    ok = taskgraph_new(&graph);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't create startup task graph. taskgraph_new: %s\n", strerror(ok));
+        goto fail_free_cube;
     }
 
-    if (connector == NULL) {
-        LOG_ERROR("Could not find a connected connector!\n");
-        return NULL;
+    init.cube = cube;
+    init.headless = options->headless;
+    if (options->headless) {
+        init.width = options->width;
+        init.height = options->height;
     }
+    init.scene = options->scene;
+    init.n_instances = options->n_instances;
+    init.shading = options->shading;
 
-    // Find the preferred mode (GPU drivers _should_ always supply a preferred mode, but of course, they don't)
-    // Alternatively, find the mode with the highest width*height. If there are multiple modes with the same w*h,
-    // prefer higher refresh rates. After that, prefer progressive scanout modes.
-    mode = NULL;
-    for_each_mode_in_connector(connector, mode_iter) {
-        if (mode_iter->type & DRM_MODE_TYPE_PREFERRED) {
-            mode = mode_iter;
-            break;
-        } else if (mode == NULL) {
-            mode = mode_iter;
-        } else {
-            int area = mode_iter->hdisplay * mode_iter->vdisplay;
-            int old_area = mode->hdisplay * mode->vdisplay;
+    // The vulkan and KMS branches are independent of each other, the images only
+    // need the pipeline (for its renderpass & descriptor set layout) once they're
+    // allocated and imported. The memory task picks the number of images and
+    // their format, so it needs the device and the mode size. Vulkan only needs
+    // the opened DRM device, to pick the GPU that belongs to it.
+    //
+    //          +--> vulkan ---+--> memory --+-----> pipeline ---+---> buffers -----+
+    //          |      |       |             |                   |                  |
+    //          |      +-------|-------------|-------------------|---> queries -----+
+    //          |              |             |                   |                  |
+    //   drm ---+--> kms ------+--> gbm -----+-----> image[i] ---+---> target[i] ---+---> record
+    //
+    ok = taskgraph_add_task(graph, "drm", 0, init_drm_task, &init, &drm_task);
+    if (ok != 0) goto fail_destroy_graph;
 
-            if ((area > old_area) ||
-                ((area == old_area) && (mode_iter->vrefresh > mode->vrefresh)) ||
-                ((area == old_area) && (mode_iter->vrefresh == mode->vrefresh) && ((mode->flags & DRM_MODE_FLAG_INTERLACE) == 0))) {
-                mode = mode_iter;
-            }
-        }
+    ok = taskgraph_add_task(graph, "vulkan", TASKGRAPH_DEP(drm_task), init_vulkan_task, &init, &vulkan_task);
+    if (ok != 0) goto fail_destroy_graph;
+
+    ok = taskgraph_add_task(graph, "kms", TASKGRAPH_DEP(drm_task), init_kms_task, &init, &kms_task);
+    if (ok != 0) goto fail_destroy_graph;
+
+    ok = taskgraph_add_task(graph, "gbm", TASKGRAPH_DEP(kms_task), init_gbm_task, &init, &gbm_task);
+    if (ok != 0) goto fail_destroy_graph;
+
+    ok = taskgraph_add_task(graph, "memory", TASKGRAPH_DEP(vulkan_task) | TASKGRAPH_DEP(kms_task), init_memory_task, &init, &memory_task);
+    if (ok != 0) goto fail_destroy_graph;
+
+    ok = taskgraph_add_task(graph, "pipeline", TASKGRAPH_DEP(memory_task), init_pipeline_task, &init, &pipeline_task);
+    if (ok != 0) goto fail_destroy_graph;
+
+    ok = taskgraph_add_task(graph, "buffers", TASKGRAPH_DEP(pipeline_task), init_buffers_task, &init, &buffers_task);
+    if (ok != 0) goto fail_destroy_graph;
+
+    ok = taskgraph_add_task(graph, "queries", TASKGRAPH_DEP(vulkan_task), init_queries_task, &init, &queries_task);
+    if (ok != 0) goto fail_destroy_graph;
+
+    all_targets = 0;
+    for (int i = 0; i < CUBE_MAX_IMAGES; i++) {
+        static const char *image_task_names[CUBE_MAX_IMAGES] = { "image 0", "image 1", "image 2", "image 3" };
+        static const char *target_task_names[CUBE_MAX_IMAGES] = { "image 0 target", "image 1 target", "image 2 target", "image 3 target" };
+
+        init.images[i].init = &init;
+        init.images[i].index = i;
+
+        ok = taskgraph_add_task(graph, image_task_names[i], TASKGRAPH_DEP(memory_task) | TASKGRAPH_DEP(gbm_task), init_image_task, init.images + i, image_tasks + i);
+        if (ok != 0) goto fail_destroy_graph;
+
+        ok = taskgraph_add_task(graph, target_task_names[i], TASKGRAPH_DEP(image_tasks[i]) | TASKGRAPH_DEP(pipeline_task), init_image_target_task, init.images + i, target_tasks + i);
+        if (ok != 0) goto fail_destroy_graph;
+
+        all_targets |= TASKGRAPH_DEP(target_tasks[i]);
     }
 
-    if (mode == NULL) {
-        LOG_ERROR("Could not find a preferred output mode!\n");
-        return NULL;
+    ok = taskgraph_add_task(graph, "record", all_targets | TASKGRAPH_DEP(buffers_task) | TASKGRAPH_DEP(queries_task), init_record_task, &init, &record_task);
+    if (ok != 0) goto fail_destroy_graph;
+
+    ok = taskgraph_run(graph);
+
+    taskgraph_print_timings(graph, stdout);
+
+    if (ok != 0) {
+        goto fail_undo_tasks;
     }
 
-    for_each_encoder_in_drmdev(drmdev, encoder) {
-        if (encoder->encoder->encoder_id == connector->connector->encoder_id) {
-            break;
-        }
+    taskgraph_destroy(graph);
+
+    log_allocator_stats(init.dev->allocator);
+    memtrack_print(init.dev->memtrack, stdout);
+
+    cube->vkdev = init.dev;
+    cube->pipeline = init.pipeline;
+    cube->drm_fd = init.drmdev != NULL ? init.drmdev->fd : -1;
+    cube->gbm_device = init.gbm_device;
+    cube->fbcache = init.fbcache;
+    cube->drmdev = init.drmdev;
+    cube->width = init.width;
+    cube->height = init.height;
+    cube->n_images = init.n_images;
+    cube_init_dynamic_resolution(cube, options->dynamic_resolution_min_scale);
+    return cube;
+
+
+    fail_undo_tasks:
+    // every task either succeeds completely or cleans up after itself,
+    // so we only need to undo the tasks that succeeded.
+    if (taskgraph_succeeded(graph, queries_task) && cube->queries != NULL) {
+        gpu_queries_destroy(cube->queries);
     }
 
-    if (encoder == NULL) {
-        for (int i = 0; i < connector->connector->count_encoders; i++, encoder = NULL) {
-            for_each_encoder_in_drmdev(drmdev, encoder) {
-                if (encoder->encoder->encoder_id == connector->connector->encoders[i]) {
-                    break;
-                }
-            }
+    if (taskgraph_succeeded(graph, buffers_task)) {
+        cube_gpu_buffer_destroy(cube->gpubuf, init.dev);
+    }
 
-            if (encoder->encoder->possible_crtcs) {
-                // only use this encoder if there's a crtc we can use with it
-                break;
+    for (int i = 0; i < CUBE_MAX_IMAGES; i++) {
+        if (taskgraph_succeeded(graph, target_tasks[i]) && cube->images[i].fb != NULL) {
+            pipeline_fb_destroy(cube->images[i].fb, init.dev->device);
+        }
+
+        if (taskgraph_succeeded(graph, image_tasks[i]) && cube->images[i].image != NULL) {
+            if (cube->images[i].image->bo != NULL) {
+                fbcache_release(init.fbcache, cube->images[i].fb_id);
+                fbcache_forget_gem_handle(init.fbcache, gbm_bo_get_handle_for_plane(cube->images[i].image->bo, 0).u32);
             }
+            vk_kms_image_destroy(cube->images[i].image, init.dev);
         }
     }
 
-    if (encoder == NULL) {
-        LOG_ERROR("Could not find a suitable DRM encoder.\n");
-        return NULL;
+    if (taskgraph_succeeded(graph, pipeline_task)) {
+        cube_pipeline_destroy(init.pipeline, init.dev->device);
     }
 
-    for_each_crtc_in_drmdev(drmdev, crtc) {
-        if (crtc->crtc->crtc_id == encoder->encoder->crtc_id) {
-            break;
-        }
+    if (taskgraph_succeeded(graph, gbm_task) && init.gbm_device != NULL) {
+        fbcache_destroy(init.fbcache);
+        gbm_device_destroy(init.gbm_device);
     }
 
-    if (crtc == NULL) {
-        for_each_crtc_in_drmdev(drmdev, crtc) {
-            if (encoder->encoder->possible_crtcs & crtc->bitmask) {
-                // find a CRTC that is possible to use with this encoder
-                break;
-            }
-        }
+    if (taskgraph_succeeded(graph, drm_task) && init.drmdev != NULL) {
+        close(init.drmdev->fd);
     }
 
-    if (crtc == NULL) {
-        LOG_ERROR("Could not find a suitable DRM CRTC.\n");
-        return NULL;
+    if (taskgraph_succeeded(graph, vulkan_task)) {
+        vkdev_destroy(init.dev);
     }
 
-    ok = drmdev_configure(drmdev, connector->connector->connector_id, encoder->encoder->encoder_id, crtc->crtc->crtc_id, mode);
-    if (ok != 0) return NULL;
+    fail_destroy_graph:
+    taskgraph_destroy(graph);
 
-    return drmdev;
+    fail_free_cube:
+    free(cube);
+    return NULL;
 }
 
-struct vkkmscube *vkkmscube_new() {
-    struct cube_pipeline *cube_pipeline;
-    struct gbm_device *gbm_device;
-    struct vkkmscube *cube;
-    struct drmdev *drmdev;
-    struct vkdev *dev;
-    int ok, drm_fd, width, height;
+static volatile sig_atomic_t shall_exit = 0;
 
-    static const VkFormat vk_format = VK_FORMAT_B8G8R8A8_SRGB;
-    static const uint32_t drm_format = DRM_FORMAT_XRGB8888;
-    static const uint32_t gbm_format = GBM_FORMAT_XRGB8888;
+/// Set by SIGUSR1, to print the memory accounting while running.
+static volatile sig_atomic_t shall_print_memory = 0;
 
-    cube = malloc(sizeof *cube);
-    if (cube == NULL) {
-        return NULL;
-    }
+static uint64_t get_monotonic_time_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
 
-    // clang-format off
-    dev = vkdev_new(
-        "vk-kmscube", VK_MAKE_VERSION(0, 0, 1),
-        "vk-kmscube", VK_MAKE_VERSION(0, 0, 1),
-        VK_MAKE_VERSION(1, 1, 0),
-        (const char*[]) { "VK_LAYER_KHRONOS_validation", NULL }, NULL,
-        (const char*[]) { "VK_EXT_debug_utils", NULL }, NULL,
-        (const char*[]) {
-            VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
-            VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
-            VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME,
-            VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
-            VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME,
-            VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME,
-            VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME,
-            NULL
-        },
-        NULL,
-        &(const struct debug_messenger) {
-            .flags = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
-                | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
-                | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
-            .severities = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT
-                | VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT
-                | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
-                | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,
-            .types = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
-                | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
-                | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
-            .cb = on_debug_utils_message,
-            .userdata = NULL
-        }
+/**
+ * @brief Frame timings, accumulated over a few seconds and then printed.
+ *
+ * CPU time is the time it takes to update the UBO & submit, gpu wait is how long
+ * we block waiting for the GPU, scanout is how long the KMS commit takes.
+ * GPU time is measured using timestamp queries and arrives one frame late.
+ */
+struct frame_telemetry {
+    int n_frames;
+    uint64_t cpu_ns, gpu_wait_ns, scanout_ns;
+
+    int n_gpu_frames;
+    uint64_t gpu_ns;
+    struct gpu_query_results last_gpu_results;
+};
+
+#define FRAME_TELEMETRY_INTERVAL 240
+
+static void frame_telemetry_print_and_reset(struct frame_telemetry *telemetry, int n_instances) {
+    LOG_DEBUG(
+        "frame times over %d frames: cpu %.3f ms, gpu wait %.3f ms, scanout %.3f ms",
+        telemetry->n_frames,
+        telemetry->cpu_ns / 1000000.0 / telemetry->n_frames,
+        telemetry->gpu_wait_ns / 1000000.0 / telemetry->n_frames,
+        telemetry->scanout_ns / 1000000.0 / telemetry->n_frames
     );
-    // clang-format on
-    if (dev == NULL) {
-        LOG_ERROR("Could not setup vulkan device.\n");
-        return NULL;
+
+    if (telemetry->n_gpu_frames > 0) {
+        LOG_DEBUG(", gpu %.3f ms", telemetry->gpu_ns / 1000000.0 / telemetry->n_gpu_frames);
+
+        // how many cubes the GPU could draw per second, if it did nothing else
+        if (n_instances > 1 && telemetry->gpu_ns > 0) {
+            LOG_DEBUG(
+                ", %.2f M cubes/s (%.2f M triangles/s)",
+                (double) n_instances * telemetry->n_gpu_frames / (telemetry->gpu_ns / 1000.0),
+                12.0 * n_instances * telemetry->n_gpu_frames / (telemetry->gpu_ns / 1000.0)
+            );
+        }
     }
 
-    drmdev = create_and_configure_drmdev();
-    if (drmdev == NULL) {
-        LOG_ERROR("Couldn't open a KMS device\n");
-        goto fail_destroy_vkdev;
+    if (telemetry->last_gpu_results.has_pipeline_statistics) {
+        LOG_DEBUG(
+            " (%"PRIu64" vertices, %"PRIu64" vertex shader invocations, %"PRIu64" primitives, %"PRIu64" fragment shader invocations)",
+            telemetry->last_gpu_results.n_input_vertices,
+            telemetry->last_gpu_results.n_vertex_shader_invocations,
+            telemetry->last_gpu_results.n_clipping_primitives,
+            telemetry->last_gpu_results.n_fragment_shader_invocations
+        );
     }
 
-    drm_fd = drmdev->fd;
-    width = drmdev->selected_mode->hdisplay;
-    height = drmdev->selected_mode->vdisplay;
+    LOG_DEBUG("\n");
 
-    cube_pipeline = cube_pipeline_new(dev, width, height, vk_format);
-    if (cube_pipeline == NULL) {
-        LOG_ERROR("Couldn't setup graphics pipeline.\n");
-        goto fail_destroy_drmdev;
-    }
+    memset(telemetry, 0, sizeof *telemetry);
+}
 
-    gbm_device = gbm_create_device(drm_fd);
-    if (gbm_device == NULL) {
-        LOG_ERROR("Couldn't create GBM device from KMS fd. gbm_create_device: %s\n", strerror(errno));
-        goto fail_destroy_pipeline;
-    }
+static void on_exit_signal(int signal) {
+    shall_exit = 1;
+}
 
-    for (int i = 0; i < 4; i++) {
-        struct vk_kms_image *img = vk_kms_image_new(dev, gbm_device, width, height, vk_format, gbm_format, drm_format, DRM_FORMAT_MOD_LINEAR);
-        if (img == NULL) {
-            LOG_ERROR("Couldn't create KMS image.\n");
-            goto fail_destroy_previous;
-        }
+static void on_print_memory_signal(int signal) {
+    shall_print_memory = 1;
+}
 
-        uint32_t fb_id;
-        ok = drmModeAddFB2WithModifiers(
-            drm_fd,
-            width, height,
-            drm_format,
-            (uint32_t[4]) { gbm_bo_get_handle_for_plane(img->bo, 0).u32, 0 },
-            (uint32_t[4]) { gbm_bo_get_stride_for_plane(img->bo, 0), 0 },
-            (uint32_t[4]) { gbm_bo_get_offset(img->bo, 0), 0 },
-            (uint64_t[4]) { gbm_bo_get_modifier(img->bo), 0},
-            &fb_id,
-            0
-        );
-        if (ok < 0) {
-            LOG_ERROR("Couldn't add GBM BO as kms image.\n");
-            goto fail_destroy_pipeline_fb;
-        }
+/**
+ * @brief Totals over the whole run of the render loop, without the warmup frames.
+ * Used for the benchmark report.
+ */
+struct loop_totals {
+    int n_frames;
+    uint64_t elapsed_ns;
+    uint64_t cpu_ns;
+
+    int n_gpu_frames;
+    uint64_t gpu_ns;
+};
 
-        struct pipeline_fb *fb = pipeline_fb_new(dev, img, cube_pipeline->renderpass);
-        if (fb == NULL) {
-            LOG_ERROR("Couldn't import KMS FB into pipeline.\n");
-            goto fail_destroy_kms_img;
-        }
+/// The first frames include lazy driver work (shader compiles, page faults), so they're not counted in the totals.
+#define LOOP_WARMUP_FRAMES 16
 
-        struct cube_gpu_buffer *gpubuf = cube_gpu_buffer_new(dev, cube_pipeline->set_layout);
-        if (gpubuf == NULL) {
-            LOG_ERROR("Couldn't create a UBO/vertex buffer.\n");
-            goto fail_destroy_pipeline_fb;
-        }
+/**
+ * @returns true if there were new GPU times for @a slot. They're in @a telemetry's last_gpu_results then.
+ */
+static bool read_gpu_times(struct vkkmscube *cube, int slot, struct frame_telemetry *telemetry, struct loop_totals *totals) {
+    struct gpu_query_results gpu_results;
 
-        VkCommandBuffer cmdbuf = cube_pipeline_record(dev, cube_pipeline, fb, gpubuf);
-        if (cmdbuf == VK_NULL_HANDLE) {
-            LOG_ERROR("Couldn't record rendering commands.\n");
-            goto fail_destroy_gpubuf;
-        }
-        
-        cube->images[i].image = img;
-        cube->images[i].fb = fb;
-        cube->images[i].cmdbuf = cmdbuf;
-        cube->images[i].fb_id = fb_id;
-        cube->images[i].gpubuf = gpubuf;
-        continue;
+    if (cube->queries == NULL || !gpu_queries_read(cube->queries, slot, &gpu_results)) {
+        return false;
+    }
+
+    telemetry->n_gpu_frames++;
+    telemetry->gpu_ns += gpu_results.gpu_time_ns;
+    telemetry->last_gpu_results = gpu_results;
+
+    if (totals != NULL) {
+        totals->n_gpu_frames++;
+        totals->gpu_ns += gpu_results.gpu_time_ns;
+    }
 
+    return true;
+}
 
-        fail_destroy_cmdbuf:
-        vkFreeCommandBuffers(dev->device, dev->graphics_cmd_pool, 1, &cmdbuf);
+/**
+ * @brief Show @a fb_id on the primary plane, with its top left @a src_width x @a src_height
+ * pixels scaled to the whole mode. The first commit also sets the mode.
+ */
+static int cube_commit_plane(struct vkkmscube *cube, uint32_t fb_id, int src_width, int src_height, uint32_t flags) {
+    struct drmdev_atomic_req *req;
+    uint32_t plane_id;
+    int ok;
 
-        fail_destroy_gpubuf:
-        cube_gpu_buffer_destroy(gpubuf, dev->device);
+    ok = drmdev_new_atomic_req(cube->drmdev, &req);
+    if (ok != 0) {
+        return ok;
+    }
 
-        fail_destroy_pipeline_fb:
-        pipeline_fb_destroy(fb, dev->device);
+    plane_id = cube->primary_plane_id;
+
+    ok = drmdev_atomic_req_put_plane_property(req, plane_id, "FB_ID", fb_id);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_ID", cube->drmdev->selected_crtc->crtc->crtc_id);
+    // source coordinates are 16.16 fixed point
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "SRC_X", 0);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "SRC_Y", 0);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "SRC_W", (uint64_t) src_width << 16);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "SRC_H", (uint64_t) src_height << 16);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_X", 0);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_Y", 0);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_W", cube->width);
+    if (ok == 0) ok = drmdev_atomic_req_put_plane_property(req, plane_id, "CRTC_H", cube->height);
+    if (ok == 0 && cube->needs_modeset) {
+        ok = drmdev_atomic_req_put_modeset_props(req, &flags);
+    }
+    if (ok != 0) {
+        LOG_ERROR("Couldn't build atomic request for the primary plane.\n");
+        drmdev_destroy_atomic_req(req);
+        return ok;
+    }
 
-        fail_rm_kms_fb:
-        drmModeRmFB(drm_fd, fb_id);
+    ok = drmdev_atomic_req_commit(req, flags, NULL);
 
-        fail_destroy_kms_img:
-        vk_kms_image_destroy(img, dev->device);
+    drmdev_destroy_atomic_req(req);
 
-        fail_destroy_previous:
-        for (int j = 0; j < i; j++) {
-            cube_gpu_buffer_destroy(gpubuf, dev->device);
-            vkFreeCommandBuffers(dev->device, dev->graphics_cmd_pool, 1, &(cube->images[j].cmdbuf));
-            pipeline_fb_destroy(cube->images[j].fb, dev->device);
-            drmModeRmFB(drm_fd, cube->images[j].fb_id);
-            vk_kms_image_destroy(cube->images[j].image, dev->device);
-        }
-        goto fail_destroy_gbm_device;
+    if (ok == 0 && !(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+        cube->needs_modeset = false;
     }
 
-    cube->vkdev = dev;
-    cube->pipeline = cube_pipeline;
-    cube->drm_fd = drm_fd;
-    cube->gbm_device = gbm_device;
-    cube->drmdev = drmdev;
-    cube->width = width;
-    cube->height = height;
-    return cube;
+    return ok;
+}
 
+/**
+ * @brief Let the viewport governor know about the GPU time of a frame, and apply
+ * the new viewport size if it wants one and the display controller can scale it.
+ */
+static void cube_update_viewport(struct vkkmscube *cube, uint64_t gpu_time_ns) {
+    float scale;
+    int width, height, ok;
 
-    fail_destroy_gbm_device:
-    gbm_device_destroy(gbm_device);
+    if (!viewport_governor_update(cube->governor, gpu_time_ns, &scale)) {
+        return;
+    }
 
-    fail_destroy_pipeline:
-    cube_pipeline_destroy(cube_pipeline, dev->device);
+    // keep it even, some scalers don't like odd sizes.
+    width = ((int) (cube->width * scale + 0.5f)) & ~1;
+    height = ((int) (cube->height * scale + 0.5f)) & ~1;
+    if (width < 2) width = 2;
+    if (height < 2) height = 2;
 
-    fail_destroy_drmdev:
-    close(drmdev->fd);
+    ok = cube_commit_plane(cube, cube->images[0].fb_id, width, height, DRM_MODE_ATOMIC_TEST_ONLY);
+    if (ok != 0) {
+        LOG_DEBUG("Display can't scale %dx%d to %dx%d, staying at %dx%d.\n", width, height, cube->width, cube->height, cube->viewport_width, cube->viewport_height);
+        viewport_governor_reject(cube->governor, scale);
+        return;
+    }
 
-    fail_destroy_vkdev:
-    vkdev_destroy(dev);
+    viewport_governor_accept(cube->governor, scale);
 
-    fail_free_cube:
-    free(cube);
-    return NULL;
+    LOG_DEBUG("Rendering at %dx%d (%.0f%%), GPU time was %.2f ms.\n", width, height, scale * 100.0f, gpu_time_ns / 1000000.0);
+
+    cube->viewport_width = width;
+    cube->viewport_height = height;
 }
 
-void vkkmscube_loop(struct vkkmscube *cube) {
+/**
+ * @brief Render frames until we're told to exit, or until @a n_frames frames were
+ * rendered if that's non-zero.
+ *
+ * Without KMS (headless), frames aren't waited for after submission, so up to
+ * one frame per image is in flight and the loop measures the throughput of the renderer.
+ */
+void vkkmscube_loop(struct vkkmscube *cube, int n_frames, struct loop_totals *totals_out) {
+    struct frame_telemetry telemetry = { 0 };
+    struct loop_totals totals = { 0 };
+    uint64_t loop_start_ns, frame_start_ns, ready_ns, submitted_ns, rendered_ns, scanned_out_ns, measure_start_ns;
     struct timeval start_time;
+    uint64_t frame_values[CUBE_MAX_IMAGES] = { 0 };
+    uint64_t last_value;
     VkResult vk_res;
-    VkFence fence;
-    int i, ok;
-
-    vk_res = vkCreateFence(
-        cube->vkdev->device,
-        &(const VkFenceCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .flags = 0,
-            .pNext = NULL
-        },
-        NULL,
-        &fence
-    );
-    if (vk_res != VK_SUCCESS) {
-        LOG_VK_ERROR(vk_res, "Couldn't create fence to wait for rendering to complete. vkCreateFence");
-        return;
-    }
+    int i, frame, ok;
 
     gettimeofday(&start_time, NULL);
+    loop_start_ns = get_monotonic_time_ns();
 
     LOG_DEBUG("looping\n");
 
     i = 0;
-    while (1) {
-        cube_gpu_buffer_update_transforms(cube->images[i].gpubuf, start_time, cube->height / (float) cube->width);
+    last_value = 0;
+    measure_start_ns = 0;
+    for (frame = 0; !shall_exit && (n_frames == 0 || frame < n_frames); frame++) {
+        frame_start_ns = get_monotonic_time_ns();
+        if (frame == LOOP_WARMUP_FRAMES) {
+            measure_start_ns = frame_start_ns;
+        }
 
-        vk_res = vkQueueSubmit(
-            cube->vkdev->graphics_queue,
-            1,
-            &(const VkSubmitInfo) {
-                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                .waitSemaphoreCount = 0,
-                .pWaitSemaphores = NULL,
-                .pWaitDstStageMask = NULL,
-                .commandBufferCount = 1,
-                .pCommandBuffers = &(cube->images[i].cmdbuf),
-                .signalSemaphoreCount = 0,
-                .pSignalSemaphores = NULL,
-                .pNext = NULL,
-            },
-            fence
-        );
-        if (vk_res != VK_SUCCESS) {
-            LOG_VK_ERROR(vk_res, "Couldn't submit command buffer. vkQueueSubmit");
-            break;
+        // The UBO slot and command buffer of this image are still in use by the
+        // frame that last rendered into it, so wait for exactly that one.
+        if (frame_values[i] > vkdev_get_completed_value(cube->vkdev, VKDEV_QUEUE_GRAPHICS)) {
+            vk_res = vkdev_wait(cube->vkdev, VKDEV_QUEUE_GRAPHICS, frame_values[i], UINT64_MAX);
+            if (vk_res != VK_SUCCESS) {
+                LOG_VK_ERROR(vk_res, "Couldn't wait for previous frame to complete. vkWaitSemaphoresKHR");
+                break;
+            }
         }
 
-        vk_res = vkWaitForFences(cube->vkdev->device, 1, &fence, VK_TRUE, UINT64_MAX);
-        if (vk_res != VK_SUCCESS) {
-            LOG_VK_ERROR(vk_res, "Couldn't wait for rendering to complete. vkWaitForFences");
-            break;
+        // That frame is done now, so if its GPU times weren't picked up
+        // yet (see below), they're definitely available here.
+        if (read_gpu_times(cube, i, &telemetry, frame - cube->n_images >= LOOP_WARMUP_FRAMES ? &totals : NULL) && cube->governor != NULL) {
+            cube_update_viewport(cube, telemetry.last_gpu_results.gpu_time_ns);
+        }
+
+        ready_ns = get_monotonic_time_ns();
+
+        // The viewport only changes with dynamic resolution. It's baked into the
+        // command buffer, so that needs to be recorded again. (The instanced scene
+        // does that every frame anyway.)
+        if (cube->images[i].fb->viewport_width != cube->viewport_width || cube->images[i].fb->viewport_height != cube->viewport_height) {
+            cube->images[i].fb->viewport_width = cube->viewport_width;
+            cube->images[i].fb->viewport_height = cube->viewport_height;
+
+            if (cube->pipeline->scene != CUBE_SCENE_INSTANCED) {
+                vkResetCommandBuffer(cube->images[i].cmdbuf, 0);
+                vk_res = cube_pipeline_record_commands(cube->pipeline, cube->images[i].cmdbuf, cube->images[i].fb, cube->gpubuf, cube->queries, i, &cube->push);
+                if (vk_res != VK_SUCCESS) {
+                    break;
+                }
+            }
+        }
+
+        if (cube->pipeline->scene == CUBE_SCENE_INSTANCED) {
+            // the command buffer of this image isn't used by the GPU anymore (see above),
+            // so we can just record it again with the new time.
+            cube->push.time = (frame_start_ns - loop_start_ns) / 1000000000.0f;
+
+            vkResetCommandBuffer(cube->images[i].cmdbuf, 0);
+            vk_res = cube_pipeline_record_commands(cube->pipeline, cube->images[i].cmdbuf, cube->images[i].fb, cube->gpubuf, cube->queries, i, &cube->push);
+            if (vk_res != VK_SUCCESS) {
+                break;
+            }
+        } else {
+            cube_gpu_buffer_update_transforms(cube->gpubuf, i, start_time, cube->height / (float) cube->width);
         }
 
-        vk_res = vkResetFences(cube->vkdev->device, 1, &fence);
+        vk_res = vkdev_submit(cube->vkdev, VKDEV_QUEUE_GRAPHICS, cube->images[i].cmdbuf, 0, NULL, NULL, NULL, 0, NULL, frame_values + i);
         if (vk_res != VK_SUCCESS) {
-            LOG_VK_ERROR(vk_res, "Couldn't reset rendering fence. vkResetFences");
             break;
         }
 
-        ok = drmModeSetCrtc(
-            cube->drm_fd,
-            cube->drmdev->selected_crtc->crtc->crtc_id,
-            cube->images[i].fb_id,
-            0, 0,
-            &(cube->drmdev->selected_connector->connector->connector_id), 1,
-            (drmModeModeInfoPtr) cube->drmdev->selected_mode
-        );
-        if (ok < 0) {
-            LOG_ERROR("Couldn't set display mode. drmModeSetCrtc: %s\n", strerror(errno));
-            return;
+        last_value = frame_values[i];
+
+        if (cube->queries != NULL) {
+            gpu_queries_on_submit(cube->queries, i);
+        }
+
+        submitted_ns = get_monotonic_time_ns();
+        rendered_ns = submitted_ns;
+        scanned_out_ns = submitted_ns;
+
+        if (cube->drmdev != NULL) {
+            // we don't have explicit fencing for KMS yet, so the frame needs to be
+            // finished before we can show it.
+            vk_res = vkdev_wait(cube->vkdev, VKDEV_QUEUE_GRAPHICS, frame_values[i], UINT64_MAX);
+            if (vk_res != VK_SUCCESS) {
+                LOG_VK_ERROR(vk_res, "Couldn't wait for rendering to complete. vkWaitSemaphoresKHR");
+                break;
+            }
+
+            rendered_ns = get_monotonic_time_ns();
+
+            if (cube->governor != NULL) {
+                // scale whatever part of the image this frame was rendered into to the whole mode.
+                ok = cube_commit_plane(cube, cube->images[i].fb_id, cube->images[i].fb->viewport_width, cube->images[i].fb->viewport_height, 0);
+                if (ok != 0) {
+                    LOG_ERROR("Couldn't show frame. cube_commit_plane: %s\n", strerror(ok));
+                    break;
+                }
+            } else {
+                ok = drmModeSetCrtc(
+                    cube->drm_fd,
+                    cube->drmdev->selected_crtc->crtc->crtc_id,
+                    cube->images[i].fb_id,
+                    0, 0,
+                    &(cube->drmdev->selected_connector->connector->connector_id), 1,
+                    (drmModeModeInfoPtr) cube->drmdev->selected_mode
+                );
+                if (ok < 0) {
+                    LOG_ERROR("Couldn't set display mode. drmModeSetCrtc: %s\n", strerror(errno));
+                    break;
+                }
+            }
+
+            scanned_out_ns = get_monotonic_time_ns();
+        }
+
+        // read the GPU times of the previous frame. They're read one frame late
+        // and without waiting, so we never stall on the GPU here.
+        if (read_gpu_times(cube, (i + cube->n_images - 1) % cube->n_images, &telemetry, frame - 1 >= LOOP_WARMUP_FRAMES ? &totals : NULL) && cube->governor != NULL) {
+            cube_update_viewport(cube, telemetry.last_gpu_results.gpu_time_ns);
+        }
+
+        telemetry.n_frames++;
+        telemetry.cpu_ns += submitted_ns - ready_ns;
+        telemetry.gpu_wait_ns += (ready_ns - frame_start_ns) + (rendered_ns - submitted_ns);
+        telemetry.scanout_ns += scanned_out_ns - rendered_ns;
+        if (telemetry.n_frames == FRAME_TELEMETRY_INTERVAL) {
+            frame_telemetry_print_and_reset(&telemetry, cube->pipeline->n_instances);
+        }
+
+        if (frame >= LOOP_WARMUP_FRAMES) {
+            totals.n_frames++;
+            totals.cpu_ns += submitted_ns - ready_ns;
         }
 
-        i = (i + 1) % 4;
+        if (shall_print_memory) {
+            shall_print_memory = 0;
+            memtrack_print(cube->vkdev->memtrack, stdout);
+        }
+
+        i = (i + 1) % cube->n_images;
+    }
+
+    // frames that are still in flight count towards the elapsed time too.
+    if (last_value != 0) {
+        vkdev_wait(cube->vkdev, VKDEV_QUEUE_GRAPHICS, last_value, UINT64_MAX);
+
+        for (int j = 0; j < cube->n_images; j++) {
+            read_gpu_times(cube, j, &telemetry, totals.n_frames >= cube->n_images ? &totals : NULL);
+        }
+    }
+
+    if (totals.n_frames > 0) {
+        totals.elapsed_ns = get_monotonic_time_ns() - measure_start_ns;
+    }
+
+    if (totals_out != NULL) {
+        *totals_out = totals;
     }
 }
 
 void vkkmscube_destroy(struct vkkmscube *cube) {
+    struct fbcache_stats fbcache_stats;
+
     LOG_DEBUG("destroying\n");
+
+    if (cube->fbcache != NULL) {
+        fbcache_get_stats(cube->fbcache, &fbcache_stats);
+        LOG_DEBUG(
+            "framebuffer cache: %"PRIu64" hits, %"PRIu64" misses (%.1f%% hit rate), %"PRIu64" evictions, %zu entries using %zu of %zu bytes\n",
+            fbcache_stats.n_hits,
+            fbcache_stats.n_misses,
+            fbcache_stats.n_hits + fbcache_stats.n_misses > 0 ? 100.0 * fbcache_stats.n_hits / (fbcache_stats.n_hits + fbcache_stats.n_misses) : 0.0,
+            fbcache_stats.n_evictions,
+            fbcache_stats.n_entries,
+            fbcache_stats.n_bytes,
+            fbcache_stats.max_bytes
+        );
+    }
+
+    memtrack_print(cube->vkdev->memtrack, stdout);
+
+    vkDeviceWaitIdle(cube->vkdev->device);
+
+    for (int i = 0; i < cube->n_images; i++) {
+        vkFreeCommandBuffers(cube->vkdev->device, cube->vkdev->graphics_cmd_pool, 1, &(cube->images[i].cmdbuf));
+        pipeline_fb_destroy(cube->images[i].fb, cube->vkdev->device);
+        if (cube->images[i].image->bo != NULL) {
+            fbcache_release(cube->fbcache, cube->images[i].fb_id);
+            fbcache_forget_gem_handle(cube->fbcache, gbm_bo_get_handle_for_plane(cube->images[i].image->bo, 0).u32);
+        }
+        vk_kms_image_destroy(cube->images[i].image, cube->vkdev);
+    }
+
+    cube_gpu_buffer_destroy(cube->gpubuf, cube->vkdev);
+
+    if (cube->queries != NULL) {
+        gpu_queries_destroy(cube->queries);
+    }
+
+    if (cube->fbcache != NULL) {
+        fbcache_destroy(cube->fbcache);
+        gbm_device_destroy(cube->gbm_device);
+    }
+
+    log_allocator_stats(cube->vkdev->allocator);
+    log_pipeline_variant_stats(cube->pipeline->variants);
+
+    if (cube->governor != NULL) {
+        viewport_governor_destroy(cube->governor);
+    }
+
     cube_pipeline_destroy(cube->pipeline, cube->vkdev->device);
     vkdev_destroy(cube->vkdev);
     free(cube);
 }
 
+static void add_benchmark_metrics(struct benchmark_report *report, const struct loop_totals *totals, int n_instances) {
+    double fps;
+
+    fps = totals->n_frames / (totals->elapsed_ns / 1000000000.0);
+
+    benchmark_report_add(report, "frames_per_second", "1/s", fps, true);
+    benchmark_report_add(report, "cpu_time_per_frame", "ms", totals->cpu_ns / 1000000.0 / totals->n_frames, false);
+    if (totals->n_gpu_frames > 0) {
+        benchmark_report_add(report, "gpu_time_per_frame", "ms", totals->gpu_ns / 1000000.0 / totals->n_gpu_frames, false);
+    }
+
+    if (n_instances > 1) {
+        benchmark_report_add(report, "cubes_per_second", "1/s", fps * n_instances, true);
+        benchmark_report_add(report, "triangles_per_second", "1/s", fps * n_instances * 12, true);
+    }
+}
+
+static void print_usage(const char *argv0) {
+    printf(
+        "usage: %s [options]\n"
+        "\n"
+        "  --headless[=WIDTHxHEIGHT]  Render into offscreen images instead of showing the\n"
+        "                             cube on a display. Default size is 1920x1080.\n"
+        "  --scene=cube|instanced     Draw the single cube (default) or lots of cubes\n"
+        "                             in one instanced draw.\n"
+        "  --instances=N              Number of cubes in the instanced scene. (default: 10000)\n"
+        "  --light=X,Y,Z              Position of the light source. (default: 2,2,20)\n"
+        "  --no-lighting              Don't shade the cubes at all.\n"
+        "  --gamma=G                  Raise the output colors to the power of G. (default: 1)\n"
+        "  --dynamic-resolution[=MIN] Render at a lower resolution when the GPU can't keep up\n"
+        "                             and let the display upscale, down to MIN times the\n"
+        "                             mode size. (default: 0.5) Needs atomic modesetting.\n"
+        "  --frames=N                 Exit after rendering N frames.\n"
+        "  --benchmark=FILE           Write frames per second, CPU and GPU time per frame\n"
+        "                             as JSON to FILE (or stdout if FILE is \"-\").\n"
+        "  --baseline=FILE            Compare against the JSON written by an earlier\n"
+        "                             --benchmark run and fail if anything regressed.\n"
+        "  --tolerance=PERCENT        How much worse than the baseline is still ok. (default: 10)\n"
+        "  --help                     Show this help.\n",
+        argv0
+    );
+}
 
 int main(int argc, char **argv) {
+    struct vkkmscube_options options = {
+        .headless = false,
+        .width = 1920,
+        .height = 1080,
+        .scene = CUBE_SCENE_SINGLE,
+        .n_instances = 10000,
+        .shading = CUBE_SHADING_DEFAULT,
+        .dynamic_resolution_min_scale = 0.0f,
+    };
+    struct benchmark_report report;
+    struct loop_totals totals;
     struct vkkmscube *cube;
+    const char *benchmark_path, *baseline_path;
+    double tolerance;
+    int opt, n_frames, n_regressions, ok;
+
+    static const struct option long_options[] = {
+        { "headless", optional_argument, NULL, 'H' },
+        { "scene", required_argument, NULL, 's' },
+        { "instances", required_argument, NULL, 'i' },
+        { "light", required_argument, NULL, 'l' },
+        { "no-lighting", no_argument, NULL, 'L' },
+        { "gamma", required_argument, NULL, 'g' },
+        { "dynamic-resolution", optional_argument, NULL, 'd' },
+        { "frames", required_argument, NULL, 'n' },
+        { "benchmark", required_argument, NULL, 'b' },
+        { "baseline", required_argument, NULL, 'B' },
+        { "tolerance", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    n_frames = 0;
+    benchmark_path = NULL;
+    baseline_path = NULL;
+    tolerance = 10.0;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'H':
+                options.headless = true;
+                if (optarg != NULL && (sscanf(optarg, "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0)) {
+                    LOG_ERROR("Invalid offscreen size \"%s\", expected WIDTHxHEIGHT.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                if (strcmp(optarg, "cube") == 0) {
+                    options.scene = CUBE_SCENE_SINGLE;
+                } else if (strcmp(optarg, "instanced") == 0) {
+                    options.scene = CUBE_SCENE_INSTANCED;
+                } else {
+                    LOG_ERROR("Unknown scene \"%s\", expected \"cube\" or \"instanced\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i':
+                options.n_instances = atoi(optarg);
+                if (options.n_instances <= 0) {
+                    LOG_ERROR("Invalid number of instances \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                if (sscanf(optarg, "%f,%f,%f", options.shading.light + 0, options.shading.light + 1, options.shading.light + 2) != 3) {
+                    LOG_ERROR("Invalid light position \"%s\", expected X,Y,Z.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'L':
+                options.shading.lighting = false;
+                break;
+            case 'g':
+                options.shading.gamma = atof(optarg);
+                if (!(options.shading.gamma > 0.0f)) {
+                    LOG_ERROR("Invalid gamma \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'd':
+                options.dynamic_resolution_min_scale = optarg != NULL ? atof(optarg) : 0.5f;
+                if (!(options.dynamic_resolution_min_scale > 0.0f && options.dynamic_resolution_min_scale <= 1.0f)) {
+                    LOG_ERROR("Invalid smallest scale \"%s\", expected a number between 0 and 1.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                n_frames = atoi(optarg);
+                if (n_frames <= 0) {
+                    LOG_ERROR("Invalid number of frames \"%s\".\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                benchmark_path = optarg;
+                break;
+            case 'B':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
 
-    cube = vkkmscube_new();
+    cube = vkkmscube_new(&options);
     if (cube == NULL) {
         return EXIT_FAILURE;
     }
 
-    vkkmscube_loop(cube);
+    // exit the render loop cleanly on Ctrl+C, so we get to write the pipeline cache.
+    sigaction(SIGINT, &(const struct sigaction) { .sa_handler = on_exit_signal }, NULL);
+    sigaction(SIGTERM, &(const struct sigaction) { .sa_handler = on_exit_signal }, NULL);
+    sigaction(SIGUSR1, &(const struct sigaction) { .sa_handler = on_print_memory_signal }, NULL);
+
+    vkkmscube_loop(cube, n_frames, &totals);
 
     vkkmscube_destroy(cube);
 
+    if (benchmark_path != NULL || baseline_path != NULL) {
+        if (totals.n_frames == 0) {
+            LOG_ERROR("Not enough frames rendered for a benchmark report, need more than %d.\n", LOOP_WARMUP_FRAMES);
+            return EXIT_FAILURE;
+        }
+
+        benchmark_report_init(
+            &report,
+            options.scene == CUBE_SCENE_INSTANCED
+                ? (options.headless ? "headless-instanced" : "kms-instanced")
+                : (options.headless ? "headless-cube" : "kms-cube")
+        );
+        add_benchmark_metrics(&report, &totals, options.scene == CUBE_SCENE_INSTANCED ? options.n_instances : 1);
+
+        if (benchmark_path != NULL) {
+            ok = benchmark_report_save(&report, benchmark_path);
+            if (ok != 0) {
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (baseline_path != NULL) {
+            ok = benchmark_report_compare(&report, baseline_path, tolerance / 100.0, stdout, &n_regressions);
+            if (ok != 0 || n_regressions > 0) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
     LOG_DEBUG("Goodbye\n");
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,385 @@
+// for pthread_setaffinity_np & sched_getaffinity
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <workpool.h>
+
+struct workpool_chunk {
+    workpool_cb cb;
+    void *userdata;
+    unsigned int begin, end;
+};
+
+/**
+ * A ring of chunks. The owner pushes and pops at the back, thieves take from
+ * the front, so they get the chunks the owner would've gotten to last.
+ */
+struct workpool_queue {
+    pthread_mutex_t mutex;
+    struct workpool_chunk *chunks;
+    size_t front, size, capacity;
+};
+
+struct workpool_worker {
+    struct workpool *pool;
+    int index;
+    int cpu;
+    pthread_t thread;
+};
+
+struct workpool {
+    int n_workers;
+    struct workpool_worker *workers;
+
+    /// One queue per worker, plus one for the thread calling workpool_wait (the last one).
+    int n_queues;
+    struct workpool_queue *queues;
+    int next_queue;
+
+    /// Number of chunks that were submitted but didn't finish yet.
+    unsigned int n_pending;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+    uint64_t generation;
+    bool stop;
+};
+
+static int queue_init(struct workpool_queue *queue) {
+    queue->chunks = NULL;
+    queue->front = 0;
+    queue->size = 0;
+    queue->capacity = 0;
+    return pthread_mutex_init(&queue->mutex, NULL);
+}
+
+static void queue_deinit(struct workpool_queue *queue) {
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->chunks);
+}
+
+static int queue_push(struct workpool_queue *queue, const struct workpool_chunk *chunk) {
+    struct workpool_chunk *chunks;
+    size_t capacity;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    if (queue->size == queue->capacity) {
+        capacity = queue->capacity ? queue->capacity * 2 : 64;
+
+        chunks = malloc(capacity * sizeof *chunks);
+        if (chunks == NULL) {
+            pthread_mutex_unlock(&queue->mutex);
+            return ENOMEM;
+        }
+
+        for (size_t i = 0; i < queue->size; i++) {
+            chunks[i] = queue->chunks[(queue->front + i) % queue->capacity];
+        }
+
+        free(queue->chunks);
+        queue->chunks = chunks;
+        queue->front = 0;
+        queue->capacity = capacity;
+    }
+
+    queue->chunks[(queue->front + queue->size) % queue->capacity] = *chunk;
+    queue->size++;
+
+    pthread_mutex_unlock(&queue->mutex);
+    return 0;
+}
+
+static bool queue_pop_back(struct workpool_queue *queue, struct workpool_chunk *chunk_out) {
+    bool ok = false;
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->size > 0) {
+        queue->size--;
+        *chunk_out = queue->chunks[(queue->front + queue->size) % queue->capacity];
+        ok = true;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return ok;
+}
+
+static bool queue_steal_front(struct workpool_queue *queue, struct workpool_chunk *chunk_out) {
+    bool ok = false;
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->size > 0) {
+        *chunk_out = queue->chunks[queue->front];
+        queue->front = (queue->front + 1) % queue->capacity;
+        queue->size--;
+        ok = true;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return ok;
+}
+
+/// Take a chunk from our own queue, or steal one from another queue.
+static bool take_chunk(struct workpool *pool, int queue_index, struct workpool_chunk *chunk_out) {
+    if (queue_pop_back(pool->queues + queue_index, chunk_out)) {
+        return true;
+    }
+
+    for (int i = 1; i < pool->n_queues; i++) {
+        if (queue_steal_front(pool->queues + (queue_index + i) % pool->n_queues, chunk_out)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void run_chunk(struct workpool *pool, const struct workpool_chunk *chunk) {
+    chunk->cb(chunk->userdata, chunk->begin, chunk->end);
+
+    if (__atomic_sub_fetch(&pool->n_pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->all_done);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static void *run_worker(void *userdata) {
+    struct workpool_worker *worker = userdata;
+    struct workpool *pool = worker->pool;
+    struct workpool_chunk chunk;
+    uint64_t generation;
+    cpu_set_t cpus;
+    int ok;
+
+    if (worker->cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->cpu, &cpus);
+
+        ok = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+        if (ok != 0) {
+            fprintf(stderr, "[workpool] Couldn't pin worker %d to CPU %d. pthread_setaffinity_np: %s\n", worker->index, worker->cpu, strerror(ok));
+        }
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        generation = pool->generation;
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+
+        while (take_chunk(pool, worker->index, &chunk)) {
+            run_chunk(pool, &chunk);
+        }
+
+        // only sleep if nothing was submitted since we last looked at the queues.
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->stop && pool->generation == generation) {
+            pthread_cond_wait(&pool->work_available, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    return NULL;
+}
+
+/// Get the CPUs we're allowed to run on. Returns the number of CPUs written to @a cpus_out.
+static int get_allowed_cpus(int *cpus_out, int max_cpus) {
+    cpu_set_t cpus;
+    int n;
+
+    if (sched_getaffinity(0, sizeof cpus, &cpus) != 0) {
+        return 0;
+    }
+
+    n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < max_cpus; cpu++) {
+        if (CPU_ISSET(cpu, &cpus)) {
+            cpus_out[n++] = cpu;
+        }
+    }
+
+    return n;
+}
+
+static void stop_workers(struct workpool *pool, int n_started) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < n_started; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+}
+
+int workpool_new(struct workpool **pool_out, int n_threads, bool pin) {
+    struct workpool *pool;
+    int cpus[CPU_SETSIZE];
+    int n_cpus, n_queues_initialized, n_started, ok;
+
+    n_cpus = get_allowed_cpus(cpus, CPU_SETSIZE);
+
+    if (n_threads <= 0) {
+        n_threads = n_cpus > 1 ? n_cpus - 1 : 0;
+    }
+
+    pool = malloc(sizeof *pool);
+    if (pool == NULL) {
+        return ENOMEM;
+    }
+
+    pool->n_workers = n_threads;
+    pool->n_queues = n_threads + 1;
+    pool->next_queue = 0;
+    pool->n_pending = 0;
+    pool->generation = 0;
+    pool->stop = false;
+
+    pool->workers = calloc(pool->n_workers ? pool->n_workers : 1, sizeof *pool->workers);
+    pool->queues = calloc(pool->n_queues, sizeof *pool->queues);
+    if (pool->workers == NULL || pool->queues == NULL) {
+        ok = ENOMEM;
+        goto fail_free_arrays;
+    }
+
+    for (n_queues_initialized = 0; n_queues_initialized < pool->n_queues; n_queues_initialized++) {
+        ok = queue_init(pool->queues + n_queues_initialized);
+        if (ok != 0) {
+            goto fail_deinit_queues;
+        }
+    }
+
+    ok = pthread_mutex_init(&pool->mutex, NULL);
+    if (ok != 0) {
+        goto fail_deinit_queues;
+    }
+
+    ok = pthread_cond_init(&pool->work_available, NULL);
+    if (ok != 0) {
+        goto fail_destroy_mutex;
+    }
+
+    ok = pthread_cond_init(&pool->all_done, NULL);
+    if (ok != 0) {
+        goto fail_destroy_work_available;
+    }
+
+    for (n_started = 0; n_started < pool->n_workers; n_started++) {
+        struct workpool_worker *worker = pool->workers + n_started;
+
+        worker->pool = pool;
+        worker->index = n_started;
+        // leave the first CPU to the thread that submits the work.
+        worker->cpu = pin && n_cpus > 0 ? cpus[(n_started + 1) % n_cpus] : -1;
+
+        ok = pthread_create(&worker->thread, NULL, run_worker, worker);
+        if (ok != 0) {
+            fprintf(stderr, "[workpool] Couldn't start worker thread. pthread_create: %s\n", strerror(ok));
+            goto fail_stop_workers;
+        }
+    }
+
+    *pool_out = pool;
+    return 0;
+
+
+    fail_stop_workers:
+    stop_workers(pool, n_started);
+    pthread_cond_destroy(&pool->all_done);
+
+    fail_destroy_work_available:
+    pthread_cond_destroy(&pool->work_available);
+
+    fail_destroy_mutex:
+    pthread_mutex_destroy(&pool->mutex);
+
+    fail_deinit_queues:
+    for (int i = 0; i < n_queues_initialized; i++) {
+        queue_deinit(pool->queues + i);
+    }
+
+    fail_free_arrays:
+    free(pool->queues);
+    free(pool->workers);
+    free(pool);
+    return ok;
+}
+
+void workpool_destroy(struct workpool *pool) {
+    stop_workers(pool, pool->n_workers);
+
+    pthread_cond_destroy(&pool->all_done);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->mutex);
+
+    for (int i = 0; i < pool->n_queues; i++) {
+        queue_deinit(pool->queues + i);
+    }
+
+    free(pool->queues);
+    free(pool->workers);
+    free(pool);
+}
+
+int workpool_get_concurrency(struct workpool *pool) {
+    return pool->n_queues;
+}
+
+void workpool_submit(struct workpool *pool, workpool_cb cb, void *userdata, unsigned int n_items, unsigned int chunk_size) {
+    struct workpool_chunk chunk;
+
+    if (chunk_size == 0) {
+        chunk_size = 1;
+    }
+
+    for (unsigned int begin = 0; begin < n_items; begin += chunk_size) {
+        chunk = (struct workpool_chunk) {
+            .cb = cb,
+            .userdata = userdata,
+            .begin = begin,
+            .end = n_items - begin > chunk_size ? begin + chunk_size : n_items,
+        };
+
+        __atomic_add_fetch(&pool->n_pending, 1, __ATOMIC_ACQ_REL);
+
+        // round robin over all queues, so the chunks of consecutive
+        // submissions (outputs) are interleaved too.
+        if (queue_push(pool->queues + pool->next_queue, &chunk) != 0) {
+            // run it right here instead.
+            run_chunk(pool, &chunk);
+        }
+
+        pool->next_queue = (pool->next_queue + 1) % pool->n_queues;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void workpool_wait(struct workpool *pool) {
+    struct workpool_chunk chunk;
+
+    while (take_chunk(pool, pool->n_queues - 1, &chunk)) {
+        run_chunk(pool, &chunk);
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    while (__atomic_load_n(&pool->n_pending, __ATOMIC_ACQUIRE) > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
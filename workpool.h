@@ -0,0 +1,78 @@
+#ifndef _WORKPOOL_H
+#define _WORKPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief A pool of worker threads for splitting per-frame CPU work (like filling
+ * dumb buffers) into chunks.
+ *
+ * Every worker has its own queue. Submitted work is spread over the queues,
+ * and workers that run out of work steal chunks from the other queues, so
+ * uneven chunks (or a second output with a bigger mode) don't leave cores idle.
+ *
+ * Work of different submissions (for example one per output) is shared by the
+ * same workers. @ref workpool_wait is the barrier that waits for all of it,
+ * and the waiting thread works on chunks as well in the meantime.
+ *
+ * Submitting and waiting is meant to be done from a single thread.
+ */
+struct workpool;
+
+/**
+ * @brief Process the items [@a begin, @a end) of a submission.
+ */
+typedef void (*workpool_cb)(void *userdata, unsigned int begin, unsigned int end);
+
+/**
+ * @brief Create a pool.
+ *
+ * @param n_threads Number of worker threads, or 0 for one less than the
+ * number of CPUs we're allowed to run on (the thread calling @ref workpool_wait
+ * is the last one).
+ * @param pin Pin each worker to one of the CPUs we're allowed to run on.
+ */
+int workpool_new(
+    struct workpool **pool_out,
+    int n_threads,
+    bool pin
+);
+
+/**
+ * @brief Stop and join all workers. There must be no outstanding work.
+ */
+void workpool_destroy(
+    struct workpool *pool
+);
+
+/**
+ * @brief Number of threads working on submissions, including the one calling
+ * @ref workpool_wait.
+ */
+int workpool_get_concurrency(
+    struct workpool *pool
+);
+
+/**
+ * @brief Split the items [0, @a n_items) into chunks of @a chunk_size items
+ * and queue them. @a cb is called once for each chunk, from any thread.
+ *
+ * @a userdata needs to stay valid until @ref workpool_wait returns.
+ */
+void workpool_submit(
+    struct workpool *pool,
+    workpool_cb cb,
+    void *userdata,
+    unsigned int n_items,
+    unsigned int chunk_size
+);
+
+/**
+ * @brief Help working on the queued chunks until all of them are done.
+ */
+void workpool_wait(
+    struct workpool *pool
+);
+
+#endif